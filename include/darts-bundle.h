@@ -0,0 +1,461 @@
+#ifndef DARTS_BUNDLE_H_
+#define DARTS_BUNDLE_H_
+
+#include <cstring>
+
+#include "darts.h"
+
+// A bundle packs named dictionaries into one file. <Darts::BundleWriter>
+// writes a bundle, and <Darts::Bundle> maps it into memory and attaches its
+// dictionaries to <DoubleArrayImpl>s through set_array(), so opening a bundle
+// takes one mmap() and one pass over its index however many dictionaries it
+// has, and the units are neither read nor copied until they are used.
+// A bundle consists of the following parts.
+//   header   the magic "DARTSBND", the format version, the number of
+//            dictionaries, the size of the index and the checksums of the
+//            index and the header in <Details::BundleFormat::HEADER_SIZE>
+//            bytes
+//   index    an entry of <Details::BundleFormat::ENTRY_SIZE> bytes for each
+//            dictionary, sorted by name, followed by the zero-terminated
+//            names
+//   sections the dictionaries, each of which starts at a multiple of
+//            <Details::BundleFormat::SECTION_ALIGNMENT> bytes
+// A section is the same as a file written by save() with
+// <Darts::SAVE_HEADER>, so a dictionary in a bundle can also be opened alone
+// by open() or openMapped() with the offset of its section.
+
+namespace Darts {
+namespace Details {
+
+// <BundleFormat> has the constants of the format shared by <BundleWriter>
+// and <Bundle>. The entry of a dictionary keeps the
+// offset and the size of its section as 64-bit integers and the offset and
+// the length of its name in the names as 32-bit integers, and 8 bytes are
+// reserved. All the integers are little-endian.
+class BundleFormat {
+ public:
+  enum {
+    HEADER_SIZE = 64,
+    ENTRY_SIZE = 32,
+    SECTION_ALIGNMENT = 4096,
+    FORMAT_VERSION = 1
+  };
+
+  static const char *magic() {
+    return "DARTSBND";
+  }
+
+  static std::size_t align(std::size_t offset) {
+    return (offset + SECTION_ALIGNMENT - 1) &
+        ~static_cast<std::size_t>(SECTION_ALIGNMENT - 1);
+  }
+};
+
+}  // namespace Details
+
+// <BundleWriter> collects dictionaries and writes them into a bundle.
+class BundleWriter {
+ public:
+  BundleWriter() : entries_(), names_() {}
+
+  // add() appends a dictionary under `name'. Names must be distinct. The
+  // units are not copied, so `dic' must be kept until save(). Note that only
+  // the units, build_flags(), num_keys() and the remap table are written as
+  // well as save() with <Darts::SAVE_HEADER>. add() throws a
+  // <Darts::Exception> if `dic' is empty or `name' is already used.
+  template <typename Dictionary>
+  void add(const char *name, const Dictionary &dic) {
+    if (dic.array() == NULL || dic.size() == 0) {
+      DARTS_THROW("failed to add dictionary: empty dictionary");
+    }
+    Details::FileHeader header;
+    header.set_dictionary(dic);
+    add_units(name, dic.array(), header);
+  }
+
+  // size() returns the number of dictionaries.
+  std::size_t size() const {
+    return entries_.size();
+  }
+
+  // save() writes a bundle into the specified file. save() returns 0 iff the
+  // operation succeeds. Otherwise, it returns a non-zero value.
+  inline int save(const char *file_name) const;
+
+  // clear() forgets the dictionaries.
+  void clear() {
+    entries_.clear();
+    names_.clear();
+  }
+
+ private:
+  struct Entry {
+    Entry() : name_offset(0), name_length(0), units(NULL), header() {}
+
+    std::size_t name_offset;
+    std::size_t name_length;
+    const void *units;
+    Details::FileHeader header;
+  };
+
+  Details::AutoPool<Entry> entries_;
+  Details::AutoPool<char> names_;
+
+  // Disallows copy and assignment.
+  BundleWriter(const BundleWriter &);
+  BundleWriter &operator=(const BundleWriter &);
+
+  inline void add_units(const char *name, const void *units,
+      const Details::FileHeader &header);
+
+  const char *name(std::size_t id) const {
+    return &names_[entries_[id].name_offset];
+  }
+  std::size_t section_size(std::size_t id) const {
+    const Details::FileHeader &header = entries_[id].header;
+    return header.header_size() + header.unit_size() * header.num_units();
+  }
+  static inline bool write_zeros(std::size_t size, std::FILE *file);
+};
+
+inline void BundleWriter::add_units(const char *name, const void *units,
+    const Details::FileHeader &header) {
+  for (std::size_t i = 0; i < entries_.size(); ++i) {
+    if (std::strcmp(this->name(i), name) == 0) {
+      DARTS_THROW("failed to add dictionary: duplicate name");
+    }
+  }
+
+  Entry entry;
+  entry.name_offset = names_.size();
+  entry.name_length = std::strlen(name);
+  entry.units = units;
+  entry.header = header;
+  for (std::size_t i = 0; i <= entry.name_length; ++i) {
+    names_.append(name[i]);
+  }
+  entries_.append(entry);
+}
+
+inline int BundleWriter::save(const char *file_name) const {
+  // The entries are sorted by name so that <Bundle> finds a name by binary
+  // search. A bundle has dozens of dictionaries, so insertion sort is enough.
+  Details::AutoPool<std::size_t> order;
+  std::size_t names_size = 0;
+  for (std::size_t i = 0; i < entries_.size(); ++i) {
+    std::size_t j = order.size();
+    order.append(i);
+    for ( ; j > 0 && std::strcmp(name(order[j - 1]), name(i)) > 0; --j) {
+      order[j] = order[j - 1];
+    }
+    order[j] = i;
+    names_size += entries_[i].name_length + 1;
+  }
+
+  const std::size_t index_size =
+      Details::BundleFormat::ENTRY_SIZE * entries_.size() + names_size;
+  Details::AutoArray<Details::uchar_type> index;
+  try {
+    index.reset(new Details::uchar_type[index_size + 1]);
+  } catch (const std::bad_alloc &) {
+    DARTS_THROW("failed to save bundle: std::bad_alloc");
+  }
+
+  std::size_t section_offset = Details::BundleFormat::align(
+      Details::BundleFormat::HEADER_SIZE + index_size);
+  std::size_t name_offset = 0;
+  for (std::size_t i = 0; i < order.size(); ++i) {
+    const std::size_t id = order[i];
+    Details::uchar_type *bytes =
+        &index[0] + Details::BundleFormat::ENTRY_SIZE * i;
+    Details::write_int(section_offset, 8, bytes);
+    Details::write_int(section_size(id), 8, bytes + 8);
+    Details::write_int(name_offset, 4, bytes + 16);
+    Details::write_int(entries_[id].name_length, 4, bytes + 20);
+    Details::write_int(0, 8, bytes + 24);
+    std::memcpy(&index[0] + Details::BundleFormat::ENTRY_SIZE *
+        entries_.size() + name_offset, name(id), entries_[id].name_length + 1);
+    section_offset = Details::BundleFormat::align(
+        section_offset + section_size(id));
+    name_offset += entries_[id].name_length + 1;
+  }
+
+  Details::uchar_type header[Details::BundleFormat::HEADER_SIZE];
+  std::memcpy(header, Details::BundleFormat::magic(), 8);
+  Details::write_int(Details::BundleFormat::FORMAT_VERSION, 4, header + 8);
+  Details::write_int(entries_.size(), 4, header + 12);
+  Details::write_int(index_size, 8, header + 16);
+  Details::write_int(Details::crc32c(0, &index[0], index_size), 4,
+      header + 24);
+  Details::write_int(Details::crc32c(0, header, 28), 4, header + 28);
+  std::memset(header + 32, 0, Details::BundleFormat::HEADER_SIZE - 32);
+
+#ifdef _MSC_VER
+  std::FILE *file;
+  if (::fopen_s(&file, file_name, "wb") != 0) {
+    return -1;
+  }
+#else
+  std::FILE *file = std::fopen(file_name, "wb");
+  if (file == NULL) {
+    return -1;
+  }
+#endif
+
+  if (std::fwrite(header, 1, Details::BundleFormat::HEADER_SIZE, file) !=
+      Details::BundleFormat::HEADER_SIZE ||
+      std::fwrite(&index[0], 1, index_size, file) != index_size) {
+    std::fclose(file);
+    return -1;
+  }
+
+  std::size_t file_size = Details::BundleFormat::HEADER_SIZE + index_size;
+  for (std::size_t i = 0; i < order.size(); ++i) {
+    const Entry &entry = entries_[order[i]];
+    Details::uchar_type bytes[Details::FileHeader::MAX_SIZE];
+    entry.header.write(bytes);
+
+    const std::size_t padding_size =
+        Details::BundleFormat::align(file_size) - file_size;
+    if (!write_zeros(padding_size, file) ||
+        std::fwrite(bytes, 1, entry.header.header_size(), file) !=
+        entry.header.header_size() ||
+        std::fwrite(entry.units, entry.header.unit_size(),
+        entry.header.num_units(), file) != entry.header.num_units()) {
+      std::fclose(file);
+      return -1;
+    }
+    file_size += padding_size + section_size(order[i]);
+  }
+
+  if (std::fclose(file) != 0) {
+    return -1;
+  }
+  return 0;
+}
+
+inline bool BundleWriter::write_zeros(std::size_t size, std::FILE *file) {
+  static const Details::uchar_type zeros[256] = { 0 };
+  while (size > 0) {
+    const std::size_t write_size = (size < sizeof(zeros)) ?
+        size : sizeof(zeros);
+    if (std::fwrite(zeros, 1, write_size, file) != write_size) {
+      return false;
+    }
+    size -= write_size;
+  }
+  return true;
+}
+
+// <Bundle> opens a bundle and attaches its dictionaries. The dictionaries
+// refer to the memory of the <Bundle>, so it must outlive them, and they
+// must not be used after clear() or open() of the <Bundle>.
+class Bundle {
+ public:
+  Bundle() : file_(), num_dics_(0) {}
+  ~Bundle() {
+    clear();
+  }
+
+  // open() maps the specified file into memory read-only, or reads it if
+  // mmap() is not available, and then validates the header, the index and
+  // the header of each section. The units are not read, so use verify() to
+  // test their checksums. open() returns 0 iff the operation succeeds.
+  // Otherwise, it returns a non-zero value or throws a <Darts::Exception>.
+  // The exception is thrown when and only when a memory allocation fails.
+  inline int open(const char *file_name);
+
+  // size() returns the number of dictionaries, and name() returns the name of
+  // the `id'-th dictionary in order of name.
+  std::size_t size() const {
+    return num_dics_;
+  }
+  const char *name(std::size_t id) const {
+    std::size_t name_offset;
+    read_entry(id, 16, 4, &name_offset);
+    return reinterpret_cast<const char *>(names() + name_offset);
+  }
+  // find() returns the ID of the dictionary named `name', or size() if there
+  // is no such dictionary.
+  inline std::size_t find(const char *name) const;
+
+  // attach() gives the units of the dictionary named `name' to set_array() of
+  // `dic' and restores its remap table. It returns 0 iff the dictionary
+  // exists, its unit size matches `dic', its remap table is valid and its
+  // units pass is_valid_array() as well as in openMapped(). Otherwise, it
+  // returns a non-zero value and leaves `dic' as is.
+  // Note that set_array() does not restore build_flags() and num_keys().
+  template <typename Dictionary>
+  int attach(const char *name, Dictionary *dic) const {
+    const std::size_t id = find(name);
+    if (id == size()) {
+      return -1;
+    }
+    Details::FileHeader header;
+    header.read(section(id));
+    const Details::uchar_type *units = section(id) + header.header_size();
+    if (header.unit_size() != dic->unit_size() ||
+        (header.has_remap_table() && !header.read_remap_table(
+        section(id) + Details::FileHeader::SIZE)) ||
+        !Dictionary::is_valid_array(units, header.num_units())) {
+      return -1;
+    }
+    dic->set_array(units, header.num_units());
+    dic->set_remap_table(header.remap_table());
+    return 0;
+  }
+
+  // verify() tests the checksums of all the units, which reads the whole
+  // file. verify() returns 0 iff all the checksums match.
+  inline int verify() const;
+
+  // clear() unmaps or frees the bundle.
+  void clear() {
+    file_.clear();
+    num_dics_ = 0;
+  }
+
+ private:
+  Details::MappedFile file_;
+  std::size_t num_dics_;
+
+  // Disallows copy and assignment.
+  Bundle(const Bundle &);
+  Bundle &operator=(const Bundle &);
+
+  const Details::uchar_type *entry(std::size_t id) const {
+    return file_.data() + Details::BundleFormat::HEADER_SIZE +
+        Details::BundleFormat::ENTRY_SIZE * id;
+  }
+  const Details::uchar_type *names() const {
+    return entry(num_dics_);
+  }
+  void read_entry(std::size_t id, std::size_t pos, std::size_t num_bytes,
+      std::size_t *value) const {
+    Details::read_int(entry(id) + pos, num_bytes, value);
+  }
+  const Details::uchar_type *section(std::size_t id) const {
+    std::size_t section_offset;
+    read_entry(id, 0, 8, &section_offset);
+    return file_.data() + section_offset;
+  }
+
+  static inline bool is_valid(const Details::uchar_type *bytes,
+      std::size_t size, std::size_t *num_dics);
+};
+
+inline int Bundle::open(const char *file_name) {
+  Details::MappedFile file;
+  std::size_t num_dics;
+  if (!file.open(file_name, 0, 0) ||
+      !is_valid(file.data(), file.size(), &num_dics)) {
+    return -1;
+  }
+
+  clear();
+
+  file_.swap(&file);
+  num_dics_ = num_dics;
+  return 0;
+}
+
+inline std::size_t Bundle::find(const char *name) const {
+  std::size_t begin = 0;
+  std::size_t end = size();
+  while (begin < end) {
+    const std::size_t middle = begin + (end - begin) / 2;
+    const int result = std::strcmp(this->name(middle), name);
+    if (result == 0) {
+      return middle;
+    } else if (result < 0) {
+      begin = middle + 1;
+    } else {
+      end = middle;
+    }
+  }
+  return size();
+}
+
+inline int Bundle::verify() const {
+  for (std::size_t i = 0; i < size(); ++i) {
+    Details::FileHeader header;
+    header.read(section(i));
+    if ((header.has_remap_table() && !header.read_remap_table(
+        section(i) + Details::FileHeader::SIZE)) ||
+        header.compute_checksum(section(i) + header.header_size(),
+        header.unit_size() * header.num_units()) != header.checksum()) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+inline bool Bundle::is_valid(const Details::uchar_type *bytes,
+    std::size_t size, std::size_t *num_dics) {
+  std::size_t version, index_size, index_checksum, header_checksum;
+  if (size < Details::BundleFormat::HEADER_SIZE ||
+      std::memcmp(bytes, Details::BundleFormat::magic(), 8) != 0 ||
+      !Details::read_int(bytes + 8, 4, &version) ||
+      !Details::read_int(bytes + 12, 4, num_dics) ||
+      !Details::read_int(bytes + 16, 8, &index_size) ||
+      !Details::read_int(bytes + 24, 4, &index_checksum) ||
+      !Details::read_int(bytes + 28, 4, &header_checksum) ||
+      version != Details::BundleFormat::FORMAT_VERSION ||
+      header_checksum != Details::crc32c(0, bytes, 28) ||
+      index_size > size - Details::BundleFormat::HEADER_SIZE ||
+      *num_dics > index_size / Details::BundleFormat::ENTRY_SIZE) {
+    return false;
+  }
+  const Details::uchar_type *index =
+      bytes + Details::BundleFormat::HEADER_SIZE;
+  if (Details::crc32c(0, index, index_size) != index_checksum) {
+    return false;
+  }
+
+  // The index has passed its checksum, so the following tests reject a
+  // bundle which is broken on purpose or written by a broken writer.
+  const Details::uchar_type *names =
+      index + Details::BundleFormat::ENTRY_SIZE * *num_dics;
+  const std::size_t names_size =
+      index_size - Details::BundleFormat::ENTRY_SIZE * *num_dics;
+  const char *prev_name = NULL;
+  for (std::size_t i = 0; i < *num_dics; ++i) {
+    const Details::uchar_type *entry =
+        index + Details::BundleFormat::ENTRY_SIZE * i;
+    std::size_t section_offset, section_size, name_offset, name_length;
+    if (!Details::read_int(entry, 8, &section_offset) ||
+        !Details::read_int(entry + 8, 8, &section_size) ||
+        !Details::read_int(entry + 16, 4, &name_offset) ||
+        !Details::read_int(entry + 20, 4, &name_length) ||
+        name_offset >= names_size || name_length >= names_size - name_offset ||
+        names[name_offset + name_length] != '\0' ||
+        std::memchr(names + name_offset, '\0', name_length) != NULL) {
+      return false;
+    }
+    const char *name = reinterpret_cast<const char *>(names + name_offset);
+    if (prev_name != NULL && std::strcmp(prev_name, name) >= 0) {
+      return false;
+    }
+    prev_name = name;
+
+    if (section_offset % Details::BundleFormat::SECTION_ALIGNMENT != 0 ||
+        section_offset < Details::BundleFormat::HEADER_SIZE + index_size ||
+        section_offset > size || section_size > size - section_offset ||
+        section_size < Details::FileHeader::SIZE) {
+      return false;
+    }
+    Details::FileHeader header;
+    if (!header.read(bytes + section_offset) ||
+        header.header_size() > section_size || header.unit_size() == 0 ||
+        header.num_units() > (section_size - header.header_size()) /
+        header.unit_size() ||
+        header.num_units() < 256 || (header.num_units() & 0xFF) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace Darts
+
+#endif  // DARTS_BUNDLE_H_
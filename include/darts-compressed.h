@@ -0,0 +1,864 @@
+#ifndef DARTS_COMPRESSED_H_
+#define DARTS_COMPRESSED_H_
+
+#include "darts.h"
+
+// <Darts::CompressedDoubleArray> keeps the units of a dictionary in blocks of
+// <BLOCK_SIZE> units, and each block is encoded with a simple integer codec.
+// A block has a header, the flags of its units and 3 bit-packed streams,
+// whose widths are kept in the header.
+//   labels  the index of label() in the distinct labels of the block
+//   deltas  the zigzag encoded difference between the child base and the
+//           unit ID, that is, (ID ^ offset()) - ID
+//   values  value() - the minimum value in the block, for leaf units
+// A block is decoded into a small cache on its first access, and a block
+// which has not been used recently is evicted if the cache is full. The
+// cache uses the CLOCK algorithm, an approximation of LRU which only sets a
+// flag on a hit. So, a search pays for the decoding of each block which is
+// not in the cache, and otherwise a lookup of the block in the cache.
+// A trie is compressed to about a half, because the children of a unit are
+// usually placed near the unit. A DAWG is compressed much less, because the
+// merged units are referred to from random positions.
+// Note that searches update the cache, so a <CompressedDoubleArray> must not
+// be shared by threads. Open the file for each thread instead. Only 4-byte
+// units are supported, and dictionaries built with <Darts::BUILD_TAIL> are
+// not. A file written by save() has 1 section, which starts with a
+// <Details::FileHeader> whose unit size is 1, whose number of units is the
+// number of bytes of the offsets of the blocks and the encoded blocks and
+// whose number of keys is the number of units of the original dictionary.
+// The header keeps the remap table, and its checksum covers the remap table,
+// the offsets and the blocks. As the unit size is 1, open() of
+// <DoubleArrayImpl> rejects the file.
+
+namespace Darts {
+
+template <typename Dictionary = DoubleArray>
+class CompressedDoubleArray {
+ public:
+  typedef typename Dictionary::key_type key_type;
+  typedef typename Dictionary::value_type value_type;
+  typedef typename Dictionary::result_type result_type;
+  typedef typename Dictionary::result_pair_type result_pair_type;
+
+  enum { BLOCK_SIZE = 64 };
+  enum { DEFAULT_CACHE_SIZE = 1024 };
+
+  CompressedDoubleArray() : num_units_(0), num_blocks_(0), num_words_(0),
+      words_(), block_offsets_(), cache_size_(DEFAULT_CACHE_SIZE),
+      cache_units_(), slot_blocks_(), slot_flags_(), block_slots_(),
+      clock_hand_(0), num_used_slots_(0) {
+    for (std::size_t i = 0; i < 256; ++i) {
+      remap_[i] = static_cast<Details::uchar_type>(i);
+    }
+  }
+
+  // compress() encodes the units of `dic'. The remap table of `dic' is kept
+  // as well. compress() returns 0 or throws a <Darts::Exception>.
+  inline int compress(const Dictionary &dic);
+
+  // The search methods work as well as those of <DoubleArrayImpl>.
+  template <class U>
+  void exactMatchSearch(const key_type *key, U &result,
+      std::size_t length = 0, std::size_t node_pos = 0) const {
+    result = exactMatchSearch<U>(key, length, node_pos);
+  }
+  template <class U>
+  inline U exactMatchSearch(const key_type *key, std::size_t length = 0,
+      std::size_t node_pos = 0) const;
+
+  template <class U>
+  inline std::size_t commonPrefixSearch(const key_type *key, U *results,
+      std::size_t max_num_results, std::size_t length = 0,
+      std::size_t node_pos = 0) const;
+  template <class F>
+  inline std::size_t commonPrefixSearch(const key_type *key, F callback,
+      std::size_t length = 0, std::size_t node_pos = 0) const;
+
+  inline value_type traverse(const key_type *key, std::size_t &node_pos,
+      std::size_t &key_pos, std::size_t length = 0) const;
+
+  // set_cache_size() sets the maximum number of decoded blocks, which must
+  // not be 0. The cache is cleared.
+  inline void set_cache_size(std::size_t num_blocks);
+  std::size_t cache_size() const {
+    return cache_size_;
+  }
+
+  // size() returns the number of units of the original dictionary, and
+  // total_size() returns the number of bytes of the encoded blocks.
+  std::size_t size() const {
+    return num_units_;
+  }
+  std::size_t total_size() const {
+    return sizeof(Details::id_type) * (num_words_ + num_blocks_ + 1);
+  }
+
+  // open() and save() read and write a file which consists of a header, the
+  // offsets of the blocks and the encoded blocks. A file is rejected if the
+  // checksum does not match or if a block is broken. The arguments and the
+  // return values are the same as those of <DoubleArrayImpl> except that
+  // open() has no `size'.
+  inline int open(const char *file_name, const char *mode = "rb",
+      std::size_t offset = 0);
+  inline int save(const char *file_name, const char *mode = "wb",
+      std::size_t offset = 0) const;
+
+  // clear() frees memory allocated to the blocks and the cache.
+  void clear() {
+    num_units_ = 0;
+    num_blocks_ = 0;
+    num_words_ = 0;
+    words_.clear();
+    block_offsets_.clear();
+    cache_units_.clear();
+    slot_blocks_.clear();
+    slot_flags_.clear();
+    block_slots_.clear();
+    clock_hand_ = 0;
+    num_used_slots_ = 0;
+  }
+
+ private:
+  typedef Details::id_type id_type;
+  typedef Details::uchar_type uchar_type;
+  typedef Details::DoubleArrayUnit unit_type;
+
+  // <ResultCollector> stores matches into an array for the 1st
+  // commonPrefixSearch().
+  template <class U>
+  class ResultCollector {
+   public:
+    ResultCollector(U *results, std::size_t max_num_results)
+        : results_(results), max_num_results_(max_num_results),
+          num_results_(0) {}
+
+    bool operator()(value_type value, std::size_t length) {
+      if (num_results_ < max_num_results_) {
+        set_result(&results_[num_results_], value, length);
+      }
+      ++num_results_;
+      return true;
+    }
+
+   private:
+    U *results_;
+    std::size_t max_num_results_;
+    std::size_t num_results_;
+  };
+
+  std::size_t num_units_;
+  std::size_t num_blocks_;
+  std::size_t num_words_;
+  Details::AutoArray<id_type> words_;
+  Details::AutoArray<id_type> block_offsets_;
+  uchar_type remap_[256];
+
+  std::size_t cache_size_;
+  mutable Details::AutoArray<unit_type> cache_units_;
+  mutable Details::AutoArray<std::size_t> slot_blocks_;
+  mutable Details::AutoArray<uchar_type> slot_flags_;
+  mutable Details::AutoArray<std::size_t> block_slots_;
+  mutable std::size_t clock_hand_;
+  mutable std::size_t num_used_slots_;
+
+  // Disallows copy and assignment.
+  CompressedDoubleArray(const CompressedDoubleArray &);
+  CompressedDoubleArray &operator=(const CompressedDoubleArray &);
+
+  static void set_result(value_type *result, value_type value, std::size_t) {
+    *result = value;
+  }
+  static void set_result(result_pair_type *result, value_type value,
+      std::size_t length) {
+    result->value = value;
+    result->length = length;
+  }
+
+  uchar_type remap(key_type c) const {
+    return remap_[static_cast<uchar_type>(c)];
+  }
+  static bool has_char(const key_type *key, std::size_t length,
+      std::size_t i) {
+    return (length != 0) ? (i < length) : (key[i] != '\0');
+  }
+
+  // unit() returns a unit after loading its block into the cache.
+  const unit_type &unit(std::size_t id) const {
+    const std::size_t block_id = id / BLOCK_SIZE;
+    std::size_t slot = block_slots_[block_id];
+    if (slot == 0) {
+      slot = load_block(block_id);
+    } else {
+      slot_flags_[--slot] = 1;
+    }
+    return cache_units_[(slot * BLOCK_SIZE) + (id % BLOCK_SIZE)];
+  }
+
+  inline std::size_t load_block(std::size_t block_id) const;
+  // reset_cache() allocates an empty cache.
+  inline void reset_cache();
+
+  // encode_block() appends a block of units which starts at `begin' to
+  // `words', and decode_block() restores the units.
+  static inline void encode_block(const id_type *units, std::size_t begin,
+      Details::AutoPool<id_type> *words);
+  static inline void decode_block(const id_type *words, std::size_t begin,
+      id_type *units);
+  // is_valid_block() tests a block of `num_words' words which starts at unit
+  // `begin' before it is decoded. The header and the flags must give the
+  // number of words, every label ID must be less than the number of labels
+  // and every child must be in the first `num_units' units.
+  static inline bool is_valid_block(const id_type *words,
+      std::size_t num_words, std::size_t begin, std::size_t num_units);
+
+  // The labels of a block are packed into words in little-endian order.
+  static uchar_type label_byte(const uchar_type *labels, id_type label_id) {
+    return static_cast<uchar_type>(reinterpret_cast<const id_type *>(
+        labels)[label_id / 4] >> (8 * (label_id % 4)));
+  }
+
+  static std::size_t bit_width(std::size_t value) {
+    std::size_t width = 0;
+    for ( ; value != 0; value >>= 1) {
+      ++width;
+    }
+    return width;
+  }
+};
+
+//
+// <CompressedBitWriter> and extract_bits() pack and unpack fields of at most
+// 32 bits into and from an array of 32-bit words.
+//
+
+namespace Details {
+
+class CompressedBitWriter {
+ public:
+  explicit CompressedBitWriter(AutoPool<id_type> *words)
+      : words_(words), num_bits_(0) {}
+
+  void write(id_type value, std::size_t width) {
+    if (width == 0) {
+      return;
+    }
+    const std::size_t shift = num_bits_ % 32;
+    if (shift == 0) {
+      words_->append(0);
+    }
+    (*words_)[words_->size() - 1] |= value << shift;
+    if (shift + width > 32) {
+      words_->append(value >> (32 - shift));
+    }
+    num_bits_ += width;
+  }
+
+ private:
+  AutoPool<id_type> *words_;
+  std::size_t num_bits_;
+
+  // Disallows copy and assignment.
+  CompressedBitWriter(const CompressedBitWriter &);
+  CompressedBitWriter &operator=(const CompressedBitWriter &);
+};
+
+// extract_bits() reads a field of `width' bits at bit `pos'. It loads the
+// 2 words which contain the position, and the upper word is shifted in 2
+// steps so that a field which starts at a word does not shift it by 32.
+inline id_type extract_bits(const id_type *words, std::size_t pos,
+    std::size_t width) {
+  if (width == 0) {
+    return 0;
+  }
+  const std::size_t shift = pos % 32;
+  const id_type value = (words[pos / 32] >> shift) |
+      ((words[(pos / 32) + 1] << 1) << (31 - shift));
+  return value & (static_cast<id_type>(-1) >> (32 - width));
+}
+
+}  // namespace Details
+
+template <typename Dictionary>
+inline int CompressedDoubleArray<Dictionary>::compress(
+    const Dictionary &dic) {
+  if (dic.unit_size() != sizeof(id_type)) {
+    DARTS_THROW("failed to compress double-array: "
+        "unsupported unit size");
+  } else if (dic.size() == 0) {
+    DARTS_THROW("failed to compress double-array: unknown size");
+  }
+  const id_type *units = static_cast<const id_type *>(dic.array());
+  if (reinterpret_cast<const unit_type *>(units)[0].has_leaf()) {
+    DARTS_THROW("failed to compress double-array: "
+        "tails are not supported");
+  }
+
+  const std::size_t num_blocks = (dic.size() + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  Details::AutoPool<id_type> words;
+  Details::AutoArray<id_type> block_offsets;
+  try {
+    block_offsets.reset(new id_type[num_blocks + 1]);
+  } catch (const std::bad_alloc &) {
+    DARTS_THROW("failed to compress double-array: "
+        "std::bad_alloc");
+  }
+
+  // The last block is padded with copies of the last unit.
+  Details::AutoArray<id_type> block_units(new id_type[BLOCK_SIZE]);
+  for (std::size_t i = 0; i < num_blocks; ++i) {
+    for (std::size_t j = 0; j < BLOCK_SIZE; ++j) {
+      const std::size_t id = (i * BLOCK_SIZE) + j;
+      block_units[j] = units[(id < dic.size()) ? id : (dic.size() - 1)];
+    }
+    if (words.size() > static_cast<id_type>(-1)) {
+      DARTS_THROW("failed to compress double-array: "
+          "too many blocks");
+    }
+    block_offsets[i] = static_cast<id_type>(words.size());
+    encode_block(&block_units[0], i * BLOCK_SIZE, &words);
+
+    // Every unit must be restored as is.
+    words.append(0);
+    words.append(0);
+    id_type decoded[BLOCK_SIZE];
+    decode_block(&words[block_offsets[i]], i * BLOCK_SIZE, decoded);
+    words.resize(words.size() - 2);
+    for (std::size_t j = 0; j < BLOCK_SIZE; ++j) {
+      if (decoded[j] != block_units[j]) {
+        DARTS_THROW("failed to compress double-array: "
+            "unsupported unit");
+      }
+    }
+  }
+  block_offsets[num_blocks] = static_cast<id_type>(words.size());
+  // decode_block() may load 2 words after the last stream of a block.
+  words.append(0);
+  words.append(0);
+
+  Details::AutoArray<id_type> buf;
+  try {
+    buf.reset(new id_type[words.size()]);
+  } catch (const std::bad_alloc &) {
+    DARTS_THROW("failed to compress double-array: "
+        "std::bad_alloc");
+  }
+  for (std::size_t i = 0; i < words.size(); ++i) {
+    buf[i] = words[i];
+  }
+
+  clear();
+
+  num_units_ = dic.size();
+  num_blocks_ = num_blocks;
+  num_words_ = words.size();
+  words_.swap(&buf);
+  block_offsets_.swap(&block_offsets);
+  for (std::size_t i = 0; i < 256; ++i) {
+    remap_[i] = dic.remap_table()[i];
+  }
+  reset_cache();
+  return 0;
+}
+
+template <typename Dictionary>
+inline void CompressedDoubleArray<Dictionary>::encode_block(
+    const id_type *units, std::size_t begin,
+    Details::AutoPool<id_type> *words) {
+  const unit_type *block = reinterpret_cast<const unit_type *>(units);
+
+  // The 1st pass collects the labels and the widths of the fields.
+  bool has_label[256] = { false };
+  id_type min_value = static_cast<id_type>(-1);
+  id_type max_value = 0;
+  id_type max_delta = 0;
+  for (std::size_t i = 0; i < BLOCK_SIZE; ++i) {
+    if ((units[i] >> 31) != 0) {
+      const id_type value = static_cast<id_type>(block[i].value());
+      min_value = (value < min_value) ? value : min_value;
+      max_value = (value > max_value) ? value : max_value;
+    } else {
+      const std::size_t id = begin + i;
+      const std::size_t base = id ^ block[i].offset();
+      const id_type delta = static_cast<id_type>((base >= id) ?
+          ((base - id) << 1) : (((id - base) << 1) - 1));
+      max_delta = (delta > max_delta) ? delta : max_delta;
+      has_label[block[i].label()] = true;
+    }
+  }
+  if (min_value > max_value) {
+    min_value = max_value;
+  }
+
+  uchar_type labels[256];
+  uchar_type label_ids[256];
+  std::size_t num_labels = 0;
+  for (std::size_t i = 0; i < 256; ++i) {
+    if (has_label[i]) {
+      label_ids[i] = static_cast<uchar_type>(num_labels);
+      labels[num_labels++] = static_cast<uchar_type>(i);
+    }
+  }
+
+  const std::size_t label_width =
+      (num_labels > 1) ? bit_width(num_labels - 1) : 0;
+  const std::size_t delta_width = bit_width(max_delta);
+  const std::size_t value_width = bit_width(max_value - min_value);
+
+  // The header has the number of labels and the widths in the 1st word, the
+  // minimum value in the 2nd word and then the labels, 4 labels per word.
+  // The flags of leaf units and has_leaf() follow, 2 words per 32 units.
+  words->append(static_cast<id_type>(num_labels | (delta_width << 9) |
+      (value_width << 14)));
+  words->append(min_value);
+  for (std::size_t i = 0; i < num_labels; i += 4) {
+    id_type word = 0;
+    for (std::size_t j = i; j < num_labels && j < i + 4; ++j) {
+      word |= static_cast<id_type>(labels[j]) << (8 * (j - i));
+    }
+    words->append(word);
+  }
+
+  // The flags are followed by the streams of the labels, the deltas and the
+  // values, and each stream starts at a word.
+  for (std::size_t i = 0; i < BLOCK_SIZE; i += 32) {
+    id_type leaf_flags = 0;
+    id_type has_leaf_flags = 0;
+    for (std::size_t j = 0; j < 32; ++j) {
+      leaf_flags |= static_cast<id_type>(units[i + j] >> 31) << j;
+      has_leaf_flags |= static_cast<id_type>(
+          ((units[i + j] >> 31) == 0) && block[i + j].has_leaf()) << j;
+    }
+    words->append(leaf_flags);
+    words->append(has_leaf_flags);
+  }
+  {
+    Details::CompressedBitWriter writer(words);
+    for (std::size_t i = 0; i < BLOCK_SIZE; ++i) {
+      if ((units[i] >> 31) == 0) {
+        writer.write(label_ids[block[i].label()], label_width);
+      }
+    }
+  }
+  {
+    Details::CompressedBitWriter writer(words);
+    for (std::size_t i = 0; i < BLOCK_SIZE; ++i) {
+      if ((units[i] >> 31) == 0) {
+        const std::size_t id = begin + i;
+        const std::size_t base = id ^ block[i].offset();
+        writer.write(static_cast<id_type>((base >= id) ? ((base - id) << 1) :
+            (((id - base) << 1) - 1)), delta_width);
+      }
+    }
+  }
+  {
+    Details::CompressedBitWriter writer(words);
+    for (std::size_t i = 0; i < BLOCK_SIZE; ++i) {
+      if ((units[i] >> 31) != 0) {
+        writer.write(static_cast<id_type>(block[i].value()) - min_value,
+            value_width);
+      }
+    }
+  }
+}
+
+template <typename Dictionary>
+inline void CompressedDoubleArray<Dictionary>::decode_block(
+    const id_type *words, std::size_t begin, id_type *units) {
+  const std::size_t num_labels = words[0] & 0x1FF;
+  const std::size_t delta_width = (words[0] >> 9) & 0x1F;
+  const std::size_t value_width = (words[0] >> 14) & 0x1F;
+  const id_type min_value = words[1];
+  const uchar_type *labels = reinterpret_cast<const uchar_type *>(words + 2);
+  const std::size_t label_width =
+      (num_labels > 1) ? bit_width(num_labels - 1) : 0;
+
+  const id_type *flags = words + 2 + ((num_labels + 3) / 4);
+  std::size_t num_leaves = 0;
+  for (std::size_t i = 0; i < BLOCK_SIZE / 32; ++i) {
+    for (id_type leaf_flags = flags[i * 2]; leaf_flags != 0;
+        leaf_flags &= leaf_flags - 1) {
+      ++num_leaves;
+    }
+  }
+  const std::size_t num_nodes = BLOCK_SIZE - num_leaves;
+  const id_type *label_stream = flags + (BLOCK_SIZE / 16);
+  const id_type *delta_stream =
+      label_stream + ((num_nodes * label_width) + 31) / 32;
+  const id_type *value_stream =
+      delta_stream + ((num_nodes * delta_width) + 31) / 32;
+
+  std::size_t label_pos = 0;
+  std::size_t delta_pos = 0;
+  std::size_t value_pos = 0;
+  for (std::size_t i = 0; i < BLOCK_SIZE; ++i) {
+    if (((flags[(i / 32) * 2] >> (i % 32)) & 1) != 0) {
+      units[i] = (1U << 31) | (min_value +
+          Details::extract_bits(value_stream, value_pos, value_width));
+      value_pos += value_width;
+      continue;
+    }
+    const id_type has_leaf = (flags[((i / 32) * 2) + 1] >> (i % 32)) & 1;
+    const id_type label_id =
+        Details::extract_bits(label_stream, label_pos, label_width);
+    const id_type delta =
+        Details::extract_bits(delta_stream, delta_pos, delta_width);
+    label_pos += label_width;
+    delta_pos += delta_width;
+    const std::size_t id = begin + i;
+    const std::size_t base = ((delta & 1) == 0) ? (id + (delta >> 1)) :
+        (id - (delta >> 1) - 1);
+    const id_type offset = static_cast<id_type>(id ^ base);
+    units[i] = label_byte(labels, label_id) | (has_leaf << 8) |
+        ((offset < (1U << 21)) ? (offset << 10) : ((offset << 2) | (1U << 9)));
+  }
+}
+
+template <typename Dictionary>
+inline bool CompressedDoubleArray<Dictionary>::is_valid_block(
+    const id_type *words, std::size_t num_words, std::size_t begin,
+    std::size_t num_units) {
+  // The widths have 5 bits each, so only the number of labels is tested.
+  const std::size_t num_labels = words[0] & 0x1FF;
+  const std::size_t header_size = 2 + ((num_labels + 3) / 4);
+  if (num_words < 2 || (words[0] >> 19) != 0 || num_labels > 256 ||
+      num_words < header_size + (BLOCK_SIZE / 16)) {
+    return false;
+  }
+
+  const id_type *flags = words + header_size;
+  std::size_t num_leaves = 0;
+  for (std::size_t i = 0; i < BLOCK_SIZE / 32; ++i) {
+    for (id_type leaf_flags = flags[i * 2]; leaf_flags != 0;
+        leaf_flags &= leaf_flags - 1) {
+      ++num_leaves;
+    }
+  }
+  const std::size_t num_nodes = BLOCK_SIZE - num_leaves;
+  const std::size_t label_width =
+      (num_labels > 1) ? bit_width(num_labels - 1) : 0;
+  const std::size_t delta_width = (words[0] >> 9) & 0x1F;
+  const std::size_t value_width = (words[0] >> 14) & 0x1F;
+  if (num_words != header_size + (BLOCK_SIZE / 16) +
+      (((num_nodes * label_width) + 31) / 32) +
+      (((num_nodes * delta_width) + 31) / 32) +
+      (((num_leaves * value_width) + 31) / 32)) {
+    return false;
+  }
+
+  const id_type *label_stream = flags + (BLOCK_SIZE / 16);
+  for (std::size_t i = 0; i < num_nodes; ++i) {
+    if (Details::extract_bits(label_stream, i * label_width, label_width) >=
+        num_labels) {
+      return false;
+    }
+  }
+
+  id_type units[BLOCK_SIZE];
+  decode_block(words, begin, units);
+  const unit_type *block = reinterpret_cast<const unit_type *>(units);
+  for (std::size_t i = 0; i < BLOCK_SIZE; ++i) {
+    if ((units[i] >> 31) == 0 &&
+        (((begin + i) ^ block[i].offset()) | 0xFF) >= num_units) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <typename Dictionary>
+inline std::size_t CompressedDoubleArray<Dictionary>::load_block(
+    std::size_t block_id) const {
+  // The victim is chosen by the CLOCK algorithm, which approximates LRU.
+  // A hit only sets the flag of its slot, and the hand of the clock clears
+  // the flags of slots until it finds a slot which has not been used since
+  // the last round.
+  std::size_t slot;
+  if (num_used_slots_ < cache_size_) {
+    slot = num_used_slots_++;
+  } else {
+    while (slot_flags_[clock_hand_] != 0) {
+      slot_flags_[clock_hand_] = 0;
+      clock_hand_ = (clock_hand_ + 1) % cache_size_;
+    }
+    slot = clock_hand_;
+    clock_hand_ = (clock_hand_ + 1) % cache_size_;
+    block_slots_[slot_blocks_[slot]] = 0;
+  }
+  slot_blocks_[slot] = block_id;
+  slot_flags_[slot] = 1;
+  block_slots_[block_id] = slot + 1;
+  decode_block(&words_[block_offsets_[block_id]], block_id * BLOCK_SIZE,
+      reinterpret_cast<id_type *>(&cache_units_[slot * BLOCK_SIZE]));
+  return slot;
+}
+
+template <typename Dictionary>
+inline void CompressedDoubleArray<Dictionary>::set_cache_size(
+    std::size_t num_blocks) {
+  if (num_blocks == 0) {
+    DARTS_THROW("failed to set cache size: zero blocks");
+  }
+  cache_size_ = num_blocks;
+  reset_cache();
+}
+
+template <typename Dictionary>
+inline void CompressedDoubleArray<Dictionary>::reset_cache() {
+  cache_units_.clear();
+  slot_blocks_.clear();
+  slot_flags_.clear();
+  block_slots_.clear();
+  clock_hand_ = 0;
+  num_used_slots_ = 0;
+  if (num_blocks_ == 0) {
+    return;
+  }
+
+  // A cache never has more slots than blocks, so that load_block() fills
+  // all the slots before it evicts a block.
+  const std::size_t cache_size =
+      (cache_size_ < num_blocks_) ? cache_size_ : num_blocks_;
+  try {
+    cache_units_.reset(new unit_type[cache_size * BLOCK_SIZE]);
+    slot_blocks_.reset(new std::size_t[cache_size]);
+    slot_flags_.reset(new uchar_type[cache_size]);
+    block_slots_.reset(new std::size_t[num_blocks_]);
+  } catch (const std::bad_alloc &) {
+    DARTS_THROW("failed to reset cache: std::bad_alloc");
+  }
+  for (std::size_t i = 0; i < num_blocks_; ++i) {
+    block_slots_[i] = 0;
+  }
+}
+
+template <typename Dictionary>
+template <typename U>
+inline U CompressedDoubleArray<Dictionary>::exactMatchSearch(
+    const key_type *key, std::size_t length, std::size_t node_pos) const {
+  U result;
+  set_result(&result, static_cast<value_type>(-1), 0);
+
+  unit_type node = unit(node_pos);
+  std::size_t i = 0;
+  for ( ; has_char(key, length, i); ++i) {
+    node_pos ^= node.offset() ^ remap(key[i]);
+    node = unit(node_pos);
+    if (node.label() != remap(key[i])) {
+      return result;
+    }
+  }
+
+  if (!node.has_leaf()) {
+    return result;
+  }
+  set_result(&result, static_cast<value_type>(
+      unit(node_pos ^ node.offset()).value()), i);
+  return result;
+}
+
+template <typename Dictionary>
+template <typename U>
+inline std::size_t CompressedDoubleArray<Dictionary>::commonPrefixSearch(
+    const key_type *key, U *results, std::size_t max_num_results,
+    std::size_t length, std::size_t node_pos) const {
+  return commonPrefixSearch(key,
+      ResultCollector<U>(results, max_num_results), length, node_pos);
+}
+
+template <typename Dictionary>
+template <typename F>
+inline std::size_t CompressedDoubleArray<Dictionary>::commonPrefixSearch(
+    const key_type *key, F callback, std::size_t length,
+    std::size_t node_pos) const {
+  std::size_t num_results = 0;
+
+  unit_type node = unit(node_pos);
+  node_pos ^= node.offset();
+  for (std::size_t i = 0; has_char(key, length, i); ++i) {
+    node_pos ^= remap(key[i]);
+    node = unit(node_pos);
+    if (node.label() != remap(key[i])) {
+      return num_results;
+    }
+
+    node_pos ^= node.offset();
+    if (node.has_leaf()) {
+      ++num_results;
+      if (!callback(static_cast<value_type>(unit(node_pos).value()), i + 1)) {
+        return num_results;
+      }
+    }
+  }
+  return num_results;
+}
+
+template <typename Dictionary>
+inline typename CompressedDoubleArray<Dictionary>::value_type
+CompressedDoubleArray<Dictionary>::traverse(const key_type *key,
+    std::size_t &node_pos, std::size_t &key_pos, std::size_t length) const {
+  std::size_t id = node_pos;
+  unit_type node = unit(id);
+
+  for ( ; has_char(key, length, key_pos); ++key_pos) {
+    id ^= node.offset() ^ remap(key[key_pos]);
+    node = unit(id);
+    if (node.label() != remap(key[key_pos])) {
+      return static_cast<value_type>(-2);
+    }
+    node_pos = id;
+  }
+
+  if (!node.has_leaf()) {
+    return static_cast<value_type>(-1);
+  }
+  return static_cast<value_type>(unit(id ^ node.offset()).value());
+}
+
+template <typename Dictionary>
+inline int CompressedDoubleArray<Dictionary>::open(const char *file_name,
+    const char *mode, std::size_t offset) {
+#ifdef _MSC_VER
+  std::FILE *file;
+  if (::fopen_s(&file, file_name, mode) != 0) {
+    return -1;
+  }
+#else
+  std::FILE *file = std::fopen(file_name, mode);
+  if (file == NULL) {
+    return -1;
+  }
+#endif
+
+  if (std::fseek(file, 0, SEEK_END) != 0) {
+    std::fclose(file);
+    return -1;
+  }
+  const std::size_t file_size = std::ftell(file);
+  uchar_type bytes[Details::FileHeader::MAX_SIZE];
+  Details::FileHeader header;
+  if (offset > file_size ||
+      file_size - offset < Details::FileHeader::SIZE ||
+      std::fseek(file, offset, SEEK_SET) != 0 ||
+      std::fread(bytes, 1, Details::FileHeader::SIZE, file) !=
+      Details::FileHeader::SIZE ||
+      !header.read(bytes) || header.unit_size() != 1 ||
+      header.header_size() > file_size - offset ||
+      (header.has_remap_table() &&
+       (std::fread(bytes + Details::FileHeader::SIZE, 1, 256, file) != 256 ||
+        !header.read_remap_table(bytes + Details::FileHeader::SIZE)))) {
+    std::fclose(file);
+    return -1;
+  }
+
+  // The offsets and the words must be within the file before they are
+  // allocated.
+  const std::size_t num_units = header.num_keys();
+  const std::size_t num_blocks = (num_units + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  const std::size_t num_bytes = header.num_units();
+  if (num_blocks == 0 ||
+      num_bytes > file_size - offset - header.header_size() ||
+      num_bytes % sizeof(id_type) != 0 ||
+      num_blocks >= num_bytes / sizeof(id_type) - 1 ||
+      std::fseek(file, offset + header.header_size(), SEEK_SET) != 0) {
+    std::fclose(file);
+    return -1;
+  }
+  const std::size_t num_words =
+      (num_bytes / sizeof(id_type)) - (num_blocks + 1);
+
+  Details::AutoArray<id_type> block_offsets;
+  Details::AutoArray<id_type> words;
+  try {
+    block_offsets.reset(new id_type[num_blocks + 1]);
+    words.reset(new id_type[num_words]);
+  } catch (const std::bad_alloc &) {
+    std::fclose(file);
+    DARTS_THROW("failed to open compressed double-array: "
+        "std::bad_alloc");
+  }
+  if (std::fread(&block_offsets[0], sizeof(id_type), num_blocks + 1, file) !=
+      num_blocks + 1 ||
+      std::fread(&words[0], sizeof(id_type), num_words, file) != num_words) {
+    std::fclose(file);
+    return -1;
+  }
+  std::fclose(file);
+
+  if (Details::crc32c(header.compute_checksum(&block_offsets[0],
+      sizeof(id_type) * (num_blocks + 1)), &words[0],
+      sizeof(id_type) * num_words) != header.checksum() ||
+      block_offsets[0] != 0 || block_offsets[num_blocks] + 2 > num_words) {
+    return -1;
+  }
+  for (std::size_t i = 0; i < num_blocks; ++i) {
+    if (block_offsets[i] >= block_offsets[i + 1] ||
+        !is_valid_block(&words[block_offsets[i]],
+        block_offsets[i + 1] - block_offsets[i], i * BLOCK_SIZE,
+        num_blocks * BLOCK_SIZE)) {
+      return -1;
+    }
+  }
+
+  clear();
+
+  num_units_ = num_units;
+  num_blocks_ = num_blocks;
+  num_words_ = num_words;
+  words_.swap(&words);
+  block_offsets_.swap(&block_offsets);
+  for (std::size_t i = 0; i < 256; ++i) {
+    remap_[i] = header.has_remap_table() ? header.remap_table()[i] :
+        static_cast<uchar_type>(i);
+  }
+  reset_cache();
+  return 0;
+}
+
+template <typename Dictionary>
+inline int CompressedDoubleArray<Dictionary>::save(const char *file_name,
+    const char *mode, std::size_t offset) const {
+  if (num_units_ == 0) {
+    return -1;
+  }
+
+#ifdef _MSC_VER
+  std::FILE *file;
+  if (::fopen_s(&file, file_name, mode) != 0) {
+    return -1;
+  }
+#else
+  std::FILE *file = std::fopen(file_name, mode);
+  if (file == NULL) {
+    return -1;
+  }
+#endif
+
+  Details::FileHeader header;
+  header.set_unit_size(1);
+  header.set_num_keys(num_units_);
+  header.set_num_units(sizeof(id_type) * (num_blocks_ + 1 + num_words_));
+  header.set_remap_table(remap_);
+  header.set_checksum(Details::crc32c(header.compute_checksum(
+      &block_offsets_[0], sizeof(id_type) * (num_blocks_ + 1)), &words_[0],
+      sizeof(id_type) * num_words_));
+  uchar_type bytes[Details::FileHeader::MAX_SIZE];
+  header.write(bytes);
+
+  if (std::fseek(file, offset, SEEK_SET) != 0 ||
+      std::fwrite(bytes, 1, header.header_size(), file) !=
+      header.header_size() ||
+      std::fwrite(&block_offsets_[0], sizeof(id_type), num_blocks_ + 1,
+      file) != num_blocks_ + 1 ||
+      std::fwrite(&words_[0], sizeof(id_type), num_words_, file) !=
+      num_words_) {
+    std::fclose(file);
+    return -1;
+  }
+  std::fclose(file);
+  return 0;
+}
+
+}  // namespace Darts
+
+
+#endif  // DARTS_COMPRESSED_H_
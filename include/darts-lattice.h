@@ -0,0 +1,230 @@
+#ifndef DARTS_LATTICE_H_
+#define DARTS_LATTICE_H_
+
+#include "darts.h"
+
+// <Darts::Lattice> segments a text into words of a dictionary. It builds a
+// word lattice over the text by using commonPrefixSearch() at each position
+// and then finds the best path by the Viterbi algorithm, where the cost of a
+// word is the value associated with it in the dictionary. Lattice nodes are
+// allocated from arrays kept in the <Lattice>, and the arrays are reused for
+// the next text, so that segmenting many sentences with the same <Lattice>
+// does not allocate memory once the arrays have grown enough.
+
+namespace Darts {
+
+template <typename Dictionary>
+class Lattice {
+ public:
+  typedef typename Dictionary::key_type key_type;
+  typedef typename Dictionary::value_type value_type;
+  typedef long cost_type;
+
+  // <node_type> is a lattice node, that is, a word which starts at `begin'
+  // and consists of `length' characters. The `value' of an unknown word is
+  // -1. `total_cost' is the cost of the best path from the beginning of the
+  // text to the end of this node, and `prev' is the ID of the previous node
+  // on that path, or <NO_NODE> for the first word.
+  struct node_type {
+    std::size_t begin;
+    std::size_t length;
+    value_type value;
+    cost_type cost;
+    cost_type total_cost;
+    std::size_t prev;
+  };
+
+  enum { NO_NODE = -1 };
+
+  // <UnknownMode> decides where an unknown word is added to the lattice. An
+  // unknown word consists of a single character. UNKNOWN_NONE never adds
+  // unknown words, so segment() fails if there is no path of known words.
+  // UNKNOWN_IF_NO_WORD adds an unknown word at a position where no known
+  // word starts, and UNKNOWN_ALWAYS adds one at every position.
+  enum UnknownMode {
+    UNKNOWN_NONE,
+    UNKNOWN_IF_NO_WORD,
+    UNKNOWN_ALWAYS
+  };
+
+  Lattice() : unknown_mode_(UNKNOWN_IF_NO_WORD), unknown_cost_(10000),
+      is_utf8_(true), nodes_(), ends_(), path_() {}
+
+  // set_unknown_mode() and set_unknown_cost() configure unknown words. If
+  // set_utf8() is given true, which is the default, an unknown word spans a
+  // whole UTF-8 character. Otherwise, it spans a single byte.
+  void set_unknown_mode(UnknownMode mode) {
+    unknown_mode_ = mode;
+  }
+  void set_unknown_cost(cost_type cost) {
+    unknown_cost_ = cost;
+  }
+  void set_utf8(bool is_utf8) {
+    is_utf8_ = is_utf8;
+  }
+
+  // segment() builds the lattice of `text' and finds the best path. If
+  // `length' is 0, `text' is handled as a zero-terminated string. segment()
+  // returns the number of words on the best path, and 0 if there is no path.
+  // The words are available through word() until the next segment().
+  inline std::size_t segment(const Dictionary &dic, const key_type *text,
+      std::size_t length = 0);
+
+  // word() returns the `i'-th word on the best path.
+  const node_type &word(std::size_t i) const {
+    return nodes_[path_[i]];
+  }
+  std::size_t num_words() const {
+    return path_.size();
+  }
+  // cost() returns the total cost of the best path.
+  cost_type cost() const {
+    return path_.empty() ? 0 : word(num_words() - 1).total_cost;
+  }
+
+  // node() and num_nodes() give access to all the nodes of the lattice.
+  const node_type &node(std::size_t id) const {
+    return nodes_[id];
+  }
+  std::size_t num_nodes() const {
+    return nodes_.size();
+  }
+
+  // clear() frees memory allocated to the lattice.
+  void clear() {
+    nodes_.clear();
+    ends_.clear();
+    path_.clear();
+  }
+
+ private:
+  // <End> keeps the best node which ends at a position.
+  struct End {
+    cost_type total_cost;
+    std::size_t node_id;
+  };
+
+  // <NodeAdder> is the callback of commonPrefixSearch().
+  class NodeAdder {
+   public:
+    NodeAdder(Lattice *lattice, std::size_t begin)
+        : lattice_(lattice), begin_(begin) {}
+
+    bool operator()(value_type value, std::size_t length) {
+      lattice_->add_node(begin_, length, value,
+          static_cast<cost_type>(value));
+      return true;
+    }
+
+   private:
+    Lattice *lattice_;
+    std::size_t begin_;
+  };
+
+  UnknownMode unknown_mode_;
+  cost_type unknown_cost_;
+  bool is_utf8_;
+  Details::AutoPool<node_type> nodes_;
+  Details::AutoPool<End> ends_;
+  Details::AutoPool<std::size_t> path_;
+
+  // Disallows copy and assignment.
+  Lattice(const Lattice &);
+  Lattice &operator=(const Lattice &);
+
+  inline void add_node(std::size_t begin, std::size_t length,
+      value_type value, cost_type cost);
+  inline std::size_t char_length(const key_type *text,
+      std::size_t length) const;
+};
+
+template <typename Dictionary>
+inline std::size_t Lattice<Dictionary>::segment(const Dictionary &dic,
+    const key_type *text, std::size_t length) {
+  if (length == 0) {
+    while (text[length] != '\0') {
+      ++length;
+    }
+  }
+
+  nodes_.resize(0);
+  path_.resize(0);
+  End unreachable;
+  unreachable.total_cost = 0;
+  unreachable.node_id = static_cast<std::size_t>(NO_NODE);
+  ends_.resize(0);
+  ends_.resize(length + 1, unreachable);
+
+  // Positions are visited from left to right, and a position is reachable
+  // iff it is the beginning of the text or some node ends there. So, when a
+  // position is visited, its best node has been fixed.
+  for (std::size_t pos = 0; pos < length; ++pos) {
+    if (pos != 0 && ends_[pos].node_id == static_cast<std::size_t>(NO_NODE)) {
+      continue;
+    }
+    std::size_t num_words = dic.commonPrefixSearch(text + pos,
+        NodeAdder(this, pos), length - pos);
+    if (unknown_mode_ == UNKNOWN_ALWAYS ||
+        (unknown_mode_ == UNKNOWN_IF_NO_WORD && num_words == 0)) {
+      add_node(pos, char_length(text + pos, length - pos),
+          static_cast<value_type>(-1), unknown_cost_);
+    }
+  }
+
+  if (length == 0 ||
+      ends_[length].node_id == static_cast<std::size_t>(NO_NODE)) {
+    return 0;
+  }
+  for (std::size_t id = ends_[length].node_id;
+      id != static_cast<std::size_t>(NO_NODE); id = nodes_[id].prev) {
+    path_.append(id);
+  }
+  for (std::size_t i = 0, j = path_.size() - 1; i < j; ++i, --j) {
+    std::size_t id = path_[i];
+    path_[i] = path_[j];
+    path_[j] = id;
+  }
+  return path_.size();
+}
+
+template <typename Dictionary>
+inline void Lattice<Dictionary>::add_node(std::size_t begin,
+    std::size_t length, value_type value, cost_type cost) {
+  node_type node;
+  node.begin = begin;
+  node.length = length;
+  node.value = value;
+  node.cost = cost;
+  node.total_cost = ((begin != 0) ? ends_[begin].total_cost : 0) + cost;
+  node.prev = (begin != 0) ? ends_[begin].node_id :
+      static_cast<std::size_t>(NO_NODE);
+  nodes_.append(node);
+
+  End &end = ends_[begin + length];
+  if (end.node_id == static_cast<std::size_t>(NO_NODE) ||
+      node.total_cost < end.total_cost) {
+    end.total_cost = node.total_cost;
+    end.node_id = nodes_.size() - 1;
+  }
+}
+
+template <typename Dictionary>
+inline std::size_t Lattice<Dictionary>::char_length(const key_type *text,
+    std::size_t length) const {
+  std::size_t char_length = 1;
+  if (is_utf8_) {
+    const Details::uchar_type lead = static_cast<Details::uchar_type>(*text);
+    if (lead >= 0xF0) {
+      char_length = 4;
+    } else if (lead >= 0xE0) {
+      char_length = 3;
+    } else if (lead >= 0xC0) {
+      char_length = 2;
+    }
+  }
+  return (char_length < length) ? char_length : length;
+}
+
+}  // namespace Darts
+
+#endif  // DARTS_LATTICE_H_
@@ -0,0 +1,321 @@
+#ifndef DARTS_PAYLOAD_H_
+#define DARTS_PAYLOAD_H_
+
+#include <cstring>
+
+#include "darts.h"
+
+// <Darts::PayloadDoubleArray> associates each key with a payload of any
+// plain type, such as a 64-bit integer, a floating-point number or a small
+// struct, instead of a non-negative <int>. The payloads are deduplicated and
+// packed into a side array, and the leaf of each key keeps the index of its
+// payload in the array. As the keys with the same payload have the same
+// value in the dictionary, their common suffixes are still merged by the
+// DAWG. Payloads are compared and saved byte by byte, so <Payload> must be
+// copyable with std::memcpy(), and the padding bytes of a struct should be
+// zero-filled to be deduplicated. A file written by save() has 2 sections,
+// each of which starts with a <Details::FileHeader> as well as a file written
+// by save() with <Darts::SAVE_HEADER>.
+//   units     the header of the dictionary and its units, which can also be
+//             opened alone by open() of <DoubleArrayImpl>
+//   payloads  a header whose unit size is the size of <Payload> and whose
+//             number of units is the number of payloads, followed by the
+//             payloads
+// The checksums of the headers cover the units and the payloads.
+
+namespace Darts {
+
+template <typename Payload, typename Dictionary = DoubleArray>
+class PayloadDoubleArray {
+ public:
+  typedef Payload payload_type;
+  typedef typename Dictionary::key_type key_type;
+  // A value in the dictionary is the index of a payload.
+  typedef typename Dictionary::value_type value_type;
+
+  PayloadDoubleArray() : dic_(), payloads_(), num_payloads_(0) {}
+
+  // build() constructs a dictionary from given key-payload pairs. The
+  // arguments other than `payloads' work as well as in build() of
+  // <DoubleArrayImpl>, and the keys must be arranged in key order.
+  inline int build(std::size_t num_keys, const key_type * const *keys,
+      const std::size_t *lengths, const payload_type *payloads,
+      Details::progress_func_type progress_func = NULL, int flags = 0,
+      const unsigned char *remap_table = NULL);
+
+  // exactMatchSearch() returns a pointer to the payload of the given key, or
+  // NULL if the key does not exist. `length' and `node_pos' work as well as
+  // in exactMatchSearch() of <DoubleArrayImpl>.
+  inline const payload_type *exactMatchSearch(const key_type *key,
+      std::size_t length = 0, std::size_t node_pos = 0) const;
+
+  // commonPrefixSearch() calls callback(payload, length) for each key which
+  // matches a prefix of the given string, where `payload' is a const
+  // reference. The other arguments and the return value are the same as
+  // those of the callback version in <DoubleArrayImpl>.
+  template <class F>
+  inline std::size_t commonPrefixSearch(const key_type *key, F callback,
+      std::size_t length = 0, std::size_t node_pos = 0) const;
+
+  // payload() converts a value found through dictionary(), for example by
+  // predictiveSearch(), into its payload.
+  const payload_type &payload(value_type id) const {
+    return payloads_[static_cast<std::size_t>(id)];
+  }
+  // num_payloads() returns the number of distinct payloads.
+  std::size_t num_payloads() const {
+    return num_payloads_;
+  }
+  const Dictionary &dictionary() const {
+    return dic_;
+  }
+
+  // open() and save() read and write a file of the units and the payloads.
+  // A file is rejected if its unit size or payload size does not match this
+  // type, if the sections exceed the file or if a checksum does not match.
+  // The remap table, build_flags() and num_keys() of the dictionary are
+  // restored as well as in open() of <DoubleArrayImpl>. The arguments and the
+  // return values are the same as those of <DoubleArrayImpl> except that
+  // open() has no `size'.
+  inline int open(const char *file_name, const char *mode = "rb",
+      std::size_t offset = 0);
+  inline int save(const char *file_name, const char *mode = "wb",
+      std::size_t offset = 0) const;
+
+  // clear() frees memory allocated to the dictionary and the payloads.
+  void clear() {
+    dic_.clear();
+    payloads_.clear();
+    num_payloads_ = 0;
+  }
+
+ private:
+  Dictionary dic_;
+  Details::AutoArray<payload_type> payloads_;
+  std::size_t num_payloads_;
+
+  // Disallows copy and assignment.
+  PayloadDoubleArray(const PayloadDoubleArray &);
+  PayloadDoubleArray &operator=(const PayloadDoubleArray &);
+
+  // convert() converts values into payloads for commonPrefixSearch().
+  template <typename, typename>
+  friend class Details::ConvertingCollector;
+  const payload_type &convert(value_type id) const {
+    return payload(id);
+  }
+
+  // is_valid_units_header() and is_valid_payloads_header() test the headers
+  // of the sections against `size', the number of bytes from the header to
+  // the end of the file.
+  inline bool is_valid_units_header(const Details::FileHeader &header,
+      std::size_t size) const;
+  static inline bool is_valid_payloads_header(
+      const Details::FileHeader &header, std::size_t size);
+};
+
+template <typename Payload, typename Dictionary>
+inline int PayloadDoubleArray<Payload, Dictionary>::build(
+    std::size_t num_keys, const key_type * const *keys,
+    const std::size_t *lengths, const payload_type *payloads,
+    Details::progress_func_type progress_func, int flags,
+    const unsigned char *remap_table) {
+  clear();
+
+  // Distinct payloads are numbered in order of appearance, as well as the
+  // DAWG numbers distinct nodes.
+  Details::AutoArray<value_type> ids;
+  Details::Deduplicator deduplicator;
+  try {
+    ids.reset(new value_type[num_keys]);
+    deduplicator.reserve(num_keys);
+  } catch (const std::bad_alloc &) {
+    DARTS_THROW("failed to build payloads: std::bad_alloc");
+  }
+  for (std::size_t i = 0; i < num_keys; ++i) {
+    ids[i] = static_cast<value_type>(
+        deduplicator.insert(&payloads[i], sizeof(payload_type)));
+  }
+
+  dic_.build(num_keys, keys, lengths, &ids[0], progress_func, flags,
+      remap_table);
+
+  const std::size_t num_payloads = deduplicator.size();
+  try {
+    payloads_.reset(new payload_type[num_payloads]);
+  } catch (const std::bad_alloc &) {
+    dic_.clear();
+    DARTS_THROW("failed to build payloads: std::bad_alloc");
+  }
+  for (std::size_t i = 0; i < num_payloads; ++i) {
+    payloads_[i] = *static_cast<const payload_type *>(deduplicator.item(i));
+  }
+  num_payloads_ = num_payloads;
+  return 0;
+}
+
+template <typename Payload, typename Dictionary>
+inline const typename PayloadDoubleArray<Payload, Dictionary>::payload_type *
+PayloadDoubleArray<Payload, Dictionary>::exactMatchSearch(
+    const key_type *key, std::size_t length, std::size_t node_pos) const {
+  const value_type id =
+      dic_.template exactMatchSearch<value_type>(key, length, node_pos);
+  return (id < 0) ? NULL : &payload(id);
+}
+
+template <typename Payload, typename Dictionary>
+template <class F>
+inline std::size_t PayloadDoubleArray<Payload, Dictionary>::commonPrefixSearch(
+    const key_type *key, F callback, std::size_t length,
+    std::size_t node_pos) const {
+  return dic_.commonPrefixSearch(key,
+      Details::ConvertingCollector<PayloadDoubleArray, F>(this, callback),
+      length, node_pos);
+}
+
+template <typename Payload, typename Dictionary>
+inline int PayloadDoubleArray<Payload, Dictionary>::open(
+    const char *file_name, const char *mode, std::size_t offset) {
+#ifdef _MSC_VER
+  std::FILE *file;
+  if (::fopen_s(&file, file_name, mode) != 0) {
+    return -1;
+  }
+#else
+  std::FILE *file = std::fopen(file_name, mode);
+  if (file == NULL) {
+    return -1;
+  }
+#endif
+
+  if (std::fseek(file, 0, SEEK_END) != 0) {
+    std::fclose(file);
+    return -1;
+  }
+  const std::size_t file_size = std::ftell(file);
+  Details::uchar_type bytes[Details::FileHeader::SIZE];
+  Details::FileHeader header;
+  if (offset > file_size ||
+      file_size - offset < Details::FileHeader::SIZE ||
+      std::fseek(file, offset, SEEK_SET) != 0 ||
+      std::fread(bytes, 1, Details::FileHeader::SIZE, file) !=
+      Details::FileHeader::SIZE ||
+      !header.read(bytes) ||
+      !is_valid_units_header(header, file_size - offset)) {
+    std::fclose(file);
+    return -1;
+  }
+  const std::size_t payloads_offset = offset + header.header_size() +
+      header.unit_size() * header.num_units();
+
+  // The sections must be within the file before the payloads are allocated.
+  Details::FileHeader payloads_header;
+  if (file_size - payloads_offset < Details::FileHeader::SIZE ||
+      std::fseek(file, payloads_offset, SEEK_SET) != 0 ||
+      std::fread(bytes, 1, Details::FileHeader::SIZE, file) !=
+      Details::FileHeader::SIZE ||
+      !payloads_header.read(bytes) ||
+      !is_valid_payloads_header(payloads_header,
+      file_size - payloads_offset) ||
+      std::fseek(file, payloads_offset + payloads_header.header_size(),
+      SEEK_SET) != 0) {
+    std::fclose(file);
+    return -1;
+  }
+
+  const std::size_t num_payloads = payloads_header.num_units();
+  Details::AutoArray<payload_type> buf;
+  try {
+    buf.reset(new payload_type[num_payloads + 1]);
+  } catch (const std::bad_alloc &) {
+    std::fclose(file);
+    DARTS_THROW("failed to open payloads: std::bad_alloc");
+  }
+  if (std::fread(&buf[0], sizeof(payload_type), num_payloads, file) !=
+      num_payloads) {
+    std::fclose(file);
+    return -1;
+  }
+  std::fclose(file);
+
+  if (Details::crc32c(0, &buf[0], sizeof(payload_type) * num_payloads) !=
+      payloads_header.checksum() ||
+      dic_.open(file_name, mode, offset, payloads_offset - offset) != 0) {
+    return -1;
+  }
+  payloads_.swap(&buf);
+  num_payloads_ = num_payloads;
+  return 0;
+}
+
+template <typename Payload, typename Dictionary>
+inline int PayloadDoubleArray<Payload, Dictionary>::save(
+    const char *file_name, const char *mode, std::size_t offset) const {
+  if (dic_.size() == 0) {
+    return -1;
+  }
+
+#ifdef _MSC_VER
+  std::FILE *file;
+  if (::fopen_s(&file, file_name, mode) != 0) {
+    return -1;
+  }
+#else
+  std::FILE *file = std::fopen(file_name, mode);
+  if (file == NULL) {
+    return -1;
+  }
+#endif
+
+  Details::FileHeader header;
+  header.set_dictionary(dic_);
+  Details::uchar_type bytes[Details::FileHeader::MAX_SIZE];
+  header.write(bytes);
+
+  // `payloads_' is empty if the dictionary has no keys.
+  const std::size_t payloads_size = sizeof(payload_type) * num_payloads_;
+  Details::FileHeader payloads_header;
+  payloads_header.set_unit_size(sizeof(payload_type));
+  payloads_header.set_num_units(num_payloads_);
+  payloads_header.set_checksum((num_payloads_ != 0) ?
+      Details::crc32c(0, &payloads_[0], payloads_size) : 0);
+  Details::uchar_type payloads_bytes[Details::FileHeader::SIZE];
+  payloads_header.write(payloads_bytes);
+
+  if (std::fseek(file, offset, SEEK_SET) != 0 ||
+      std::fwrite(bytes, 1, header.header_size(), file) !=
+      header.header_size() ||
+      std::fwrite(dic_.array(), dic_.unit_size(), dic_.size(), file) !=
+      dic_.size() ||
+      std::fwrite(payloads_bytes, 1, Details::FileHeader::SIZE, file) !=
+      Details::FileHeader::SIZE ||
+      (num_payloads_ != 0 && std::fwrite(&payloads_[0],
+      sizeof(payload_type), num_payloads_, file) != num_payloads_)) {
+    std::fclose(file);
+    return -1;
+  }
+  std::fclose(file);
+  return 0;
+}
+
+template <typename Payload, typename Dictionary>
+inline bool PayloadDoubleArray<Payload, Dictionary>::is_valid_units_header(
+    const Details::FileHeader &header, std::size_t size) const {
+  return header.unit_size() == dic_.unit_size() &&
+      header.header_size() <= size &&
+      header.num_units() <= (size - header.header_size()) / dic_.unit_size();
+}
+
+template <typename Payload, typename Dictionary>
+inline bool PayloadDoubleArray<Payload, Dictionary>::is_valid_payloads_header(
+    const Details::FileHeader &header, std::size_t size) {
+  return header.unit_size() == sizeof(payload_type) &&
+      header.header_size() <= size &&
+      header.num_units() <=
+      (size - header.header_size()) / sizeof(payload_type);
+}
+
+}  // namespace Darts
+
+
+#endif  // DARTS_PAYLOAD_H_
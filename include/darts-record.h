@@ -0,0 +1,522 @@
+#ifndef DARTS_RECORD_H_
+#define DARTS_RECORD_H_
+
+#include <cstring>
+
+#include "darts.h"
+
+// <Darts::RecordDoubleArray> associates each key with a record, that is, a
+// byte string of any length such as a reading or a list of features. The
+// records are deduplicated and packed into an arena, where each record is
+// prefixed with its length as a variable-length integer of 7 bits per byte.
+// The leaf of each key keeps the index of its record, and an offset table
+// converts the index into the position of the record in the arena. Searches
+// return a pointer into the arena and the length of a record, so records are
+// never copied. save() writes the units, the offset table and the arena into
+// one file, and openMapped() maps the file at once. A file has 2 sections,
+// each of which starts with a <Details::FileHeader> as well as a file written
+// by save() with <Darts::SAVE_HEADER>.
+//   units    the header of the dictionary and its units, which can also be
+//            opened alone by open() of <DoubleArrayImpl>
+//   records  a header whose unit size is 1, whose number of units is the
+//            number of bytes of the offset table and the arena and whose
+//            number of keys is the number of records, followed by the offset
+//            table and the arena
+// The checksums of the headers cover the units and the records.
+
+namespace Darts {
+
+template <typename Dictionary = DoubleArray>
+class RecordDoubleArray {
+ public:
+  typedef typename Dictionary::key_type key_type;
+  // A value in the dictionary is the index of a record.
+  typedef typename Dictionary::value_type value_type;
+
+  // <record_type> points to a record in the arena. `data' is NULL if a
+  // search fails.
+  struct record_type {
+    const char *data;
+    std::size_t length;
+  };
+
+  RecordDoubleArray() : dic_(), offsets_buf_(), arena_buf_(), offsets_(NULL),
+      arena_(NULL), num_records_(0), arena_size_(0), file_() {}
+  ~RecordDoubleArray() {
+    clear();
+  }
+
+  // build() constructs a dictionary from given key-record pairs. If
+  // `record_lengths' is NULL, `records' is handled as an array of
+  // zero-terminated strings. The other arguments work as well as in build()
+  // of <DoubleArrayImpl>, and the keys must be arranged in key order. build()
+  // throws a <Darts::Exception> if the arena exceeds 4GB.
+  inline int build(std::size_t num_keys, const key_type * const *keys,
+      const std::size_t *lengths, const char * const *records,
+      const std::size_t *record_lengths = NULL,
+      Details::progress_func_type progress_func = NULL, int flags = 0,
+      const unsigned char *remap_table = NULL);
+
+  // exactMatchSearch() returns the record of the given key. `data' of the
+  // result is NULL if the key does not exist. `length' and `node_pos' work as
+  // well as in exactMatchSearch() of <DoubleArrayImpl>.
+  inline record_type exactMatchSearch(const key_type *key,
+      std::size_t length = 0, std::size_t node_pos = 0) const;
+
+  // commonPrefixSearch() calls callback(record, length) for each key which
+  // matches a prefix of the given string, where `record' is a const reference
+  // to a <record_type>. The other arguments and the return value are the same
+  // as those of the callback version in <DoubleArrayImpl>.
+  template <class F>
+  inline std::size_t commonPrefixSearch(const key_type *key, F callback,
+      std::size_t length = 0, std::size_t node_pos = 0) const;
+
+  // record() converts a value found through dictionary(), for example by
+  // predictiveSearch(), into its record. `data' of the result is NULL if `id'
+  // is negative or not less than num_records().
+  record_type record(value_type id) const {
+    record_type result;
+    result.data = NULL;
+    result.length = 0;
+    if (static_cast<std::size_t>(id) >= num_records_) {
+      return result;
+    }
+    const char *data = arena_ + offsets_[static_cast<std::size_t>(id)];
+    for (std::size_t shift = 0; ; shift += 7) {
+      const Details::uchar_type byte = static_cast<Details::uchar_type>(
+          *data++);
+      result.length |= static_cast<std::size_t>(byte & 0x7F) << shift;
+      if ((byte & 0x80) == 0) {
+        break;
+      }
+    }
+    result.data = data;
+    return result;
+  }
+  // num_records() returns the number of distinct records, and arena_size()
+  // returns the number of bytes of the arena including the length prefixes.
+  std::size_t num_records() const {
+    return num_records_;
+  }
+  std::size_t arena_size() const {
+    return arena_size_;
+  }
+  const Dictionary &dictionary() const {
+    return dic_;
+  }
+
+  // open() and save() read and write a file which consists of the units and
+  // the records. A file is rejected if its unit size does not match this
+  // type, if a checksum does not match or if an offset is out of the arena.
+  // The remap table, build_flags() and num_keys() of the dictionary are
+  // restored as well as in open() of <DoubleArrayImpl>. The arguments and
+  // the return values are the same as those of <DoubleArrayImpl> except that
+  // open() has no `size'.
+  inline int open(const char *file_name, const char *mode = "rb",
+      std::size_t offset = 0);
+  inline int save(const char *file_name, const char *mode = "wb",
+      std::size_t offset = 0) const;
+  // openMapped() works as well as open() but maps the whole file into memory
+  // read-only instead of reading it, as well as openMapped() of
+  // <DoubleArrayImpl>. The units section is given to openMapped() of the
+  // dictionary, and the records are validated as well as in open(), which
+  // reads the whole mapping once. On a system without mmap(), openMapped()
+  // reads the whole file into memory instead.
+  inline int openMapped(const char *file_name, std::size_t offset = 0);
+
+  // clear() frees memory allocated to the dictionary and the records, and
+  // unmaps a file mapped by openMapped().
+  void clear() {
+    dic_.clear();
+    offsets_buf_.clear();
+    arena_buf_.clear();
+    offsets_ = NULL;
+    arena_ = NULL;
+    num_records_ = 0;
+    arena_size_ = 0;
+    file_.clear();
+  }
+
+ private:
+  Dictionary dic_;
+  Details::AutoArray<Details::id_type> offsets_buf_;
+  Details::AutoArray<char> arena_buf_;
+  const Details::id_type *offsets_;
+  const char *arena_;
+  std::size_t num_records_;
+  std::size_t arena_size_;
+  Details::MappedFile file_;
+
+  // Disallows copy and assignment.
+  RecordDoubleArray(const RecordDoubleArray &);
+  RecordDoubleArray &operator=(const RecordDoubleArray &);
+
+  // convert() converts values into records for commonPrefixSearch().
+  template <typename, typename>
+  friend class Details::ConvertingCollector;
+  record_type convert(value_type id) const {
+    return record(id);
+  }
+  static std::size_t prefix_size(std::size_t length) {
+    std::size_t size = 1;
+    while (length >= 0x80) {
+      length >>= 7;
+      ++size;
+    }
+    return size;
+  }
+
+  // is_valid_record() tests whether a record starts at `offset' and ends
+  // within the arena.
+  static inline bool is_valid_record(const char *arena,
+      std::size_t arena_size, std::size_t offset);
+  // is_valid_units_header() and is_valid_records_header() test the headers of
+  // the sections against `size', the number of bytes from the header to the
+  // end of the file. is_valid_records_header() also gets the number of
+  // records and the size of the arena.
+  inline bool is_valid_units_header(const Details::FileHeader &header,
+      std::size_t size) const;
+  static inline bool is_valid_records_header(
+      const Details::FileHeader &header, std::size_t size,
+      std::size_t *num_records, std::size_t *arena_size);
+  // is_valid_records() tests the checksum of the records and every offset.
+  static inline bool is_valid_records(const Details::FileHeader &header,
+      const Details::id_type *offsets, std::size_t num_records,
+      const char *arena, std::size_t arena_size);
+  static Details::id_type records_checksum(const Details::id_type *offsets,
+      std::size_t num_records, const char *arena, std::size_t arena_size) {
+    return Details::crc32c(Details::crc32c(0, offsets,
+        sizeof(Details::id_type) * num_records), arena, arena_size);
+  }
+};
+
+template <typename Dictionary>
+inline int RecordDoubleArray<Dictionary>::build(std::size_t num_keys,
+    const key_type * const *keys, const std::size_t *lengths,
+    const char * const *records, const std::size_t *record_lengths,
+    Details::progress_func_type progress_func, int flags,
+    const unsigned char *remap_table) {
+  clear();
+
+  // Distinct records are numbered in order of appearance.
+  Details::AutoArray<value_type> ids;
+  Details::Deduplicator deduplicator;
+  Details::AutoArray<std::size_t> record_lengths_buf;
+  try {
+    ids.reset(new value_type[num_keys]);
+    deduplicator.reserve(num_keys);
+    if (record_lengths == NULL) {
+      record_lengths_buf.reset(new std::size_t[num_keys]);
+    }
+  } catch (const std::bad_alloc &) {
+    DARTS_THROW("failed to build records: std::bad_alloc");
+  }
+  if (record_lengths == NULL) {
+    for (std::size_t i = 0; i < num_keys; ++i) {
+      record_lengths_buf[i] = std::strlen(records[i]);
+    }
+    record_lengths = &record_lengths_buf[0];
+  }
+
+  std::size_t arena_size = 0;
+  for (std::size_t i = 0; i < num_keys; ++i) {
+    const std::size_t num_records = deduplicator.size();
+    const std::size_t id = deduplicator.insert(records[i], record_lengths[i]);
+    if (id == num_records) {
+      arena_size += prefix_size(record_lengths[i]) + record_lengths[i];
+      if (arena_size > static_cast<Details::id_type>(-1)) {
+        DARTS_THROW("failed to build records: too large arena");
+      }
+    }
+    ids[i] = static_cast<value_type>(id);
+  }
+  const std::size_t num_records = deduplicator.size();
+
+  dic_.build(num_keys, keys, lengths, &ids[0], progress_func, flags,
+      remap_table);
+
+  try {
+    offsets_buf_.reset(new Details::id_type[num_records]);
+    arena_buf_.reset(new char[arena_size + 1]);
+  } catch (const std::bad_alloc &) {
+    clear();
+    DARTS_THROW("failed to build records: std::bad_alloc");
+  }
+  std::size_t pos = 0;
+  for (std::size_t i = 0; i < num_records; ++i) {
+    offsets_buf_[i] = static_cast<Details::id_type>(pos);
+    std::size_t length = deduplicator.length(i);
+    while (length >= 0x80) {
+      arena_buf_[pos++] = static_cast<char>((length & 0x7F) | 0x80);
+      length >>= 7;
+    }
+    arena_buf_[pos++] = static_cast<char>(length);
+    std::memcpy(&arena_buf_[pos], deduplicator.item(i),
+        deduplicator.length(i));
+    pos += deduplicator.length(i);
+  }
+  offsets_ = &offsets_buf_[0];
+  arena_ = &arena_buf_[0];
+  num_records_ = num_records;
+  arena_size_ = arena_size;
+  return 0;
+}
+
+template <typename Dictionary>
+inline typename RecordDoubleArray<Dictionary>::record_type
+RecordDoubleArray<Dictionary>::exactMatchSearch(const key_type *key,
+    std::size_t length, std::size_t node_pos) const {
+  return record(dic_.template exactMatchSearch<value_type>(key, length,
+      node_pos));
+}
+
+template <typename Dictionary>
+template <class F>
+inline std::size_t RecordDoubleArray<Dictionary>::commonPrefixSearch(
+    const key_type *key, F callback, std::size_t length,
+    std::size_t node_pos) const {
+  return dic_.commonPrefixSearch(key,
+      Details::ConvertingCollector<RecordDoubleArray, F>(this, callback),
+      length, node_pos);
+}
+
+template <typename Dictionary>
+inline int RecordDoubleArray<Dictionary>::open(const char *file_name,
+    const char *mode, std::size_t offset) {
+#ifdef _MSC_VER
+  std::FILE *file;
+  if (::fopen_s(&file, file_name, mode) != 0) {
+    return -1;
+  }
+#else
+  std::FILE *file = std::fopen(file_name, mode);
+  if (file == NULL) {
+    return -1;
+  }
+#endif
+
+  if (std::fseek(file, 0, SEEK_END) != 0) {
+    std::fclose(file);
+    return -1;
+  }
+  const std::size_t file_size = std::ftell(file);
+  Details::uchar_type bytes[Details::FileHeader::SIZE];
+  Details::FileHeader header;
+  if (offset > file_size ||
+      file_size - offset < Details::FileHeader::SIZE ||
+      std::fseek(file, offset, SEEK_SET) != 0 ||
+      std::fread(bytes, 1, Details::FileHeader::SIZE, file) !=
+      Details::FileHeader::SIZE ||
+      !header.read(bytes) ||
+      !is_valid_units_header(header, file_size - offset)) {
+    std::fclose(file);
+    return -1;
+  }
+  const std::size_t records_offset = offset + header.header_size() +
+      header.unit_size() * header.num_units();
+
+  Details::FileHeader records_header;
+  std::size_t num_records, arena_size;
+  if (file_size - records_offset < Details::FileHeader::SIZE ||
+      std::fseek(file, records_offset, SEEK_SET) != 0 ||
+      std::fread(bytes, 1, Details::FileHeader::SIZE, file) !=
+      Details::FileHeader::SIZE ||
+      !records_header.read(bytes) ||
+      !is_valid_records_header(records_header, file_size - records_offset,
+      &num_records, &arena_size) ||
+      std::fseek(file, records_offset + records_header.header_size(),
+      SEEK_SET) != 0) {
+    std::fclose(file);
+    return -1;
+  }
+
+  Details::AutoArray<Details::id_type> offsets_buf;
+  Details::AutoArray<char> arena_buf;
+  try {
+    offsets_buf.reset(new Details::id_type[num_records + 1]);
+    arena_buf.reset(new char[arena_size + 1]);
+  } catch (const std::bad_alloc &) {
+    std::fclose(file);
+    DARTS_THROW("failed to open records: std::bad_alloc");
+  }
+  if (std::fread(&offsets_buf[0], sizeof(Details::id_type), num_records,
+      file) != num_records ||
+      std::fread(&arena_buf[0], 1, arena_size, file) != arena_size) {
+    std::fclose(file);
+    return -1;
+  }
+  std::fclose(file);
+
+  if (!is_valid_records(records_header, &offsets_buf[0], num_records,
+      &arena_buf[0], arena_size) ||
+      dic_.open(file_name, mode, offset, records_offset - offset) != 0) {
+    return -1;
+  }
+  file_.clear();
+  offsets_buf_.swap(&offsets_buf);
+  arena_buf_.swap(&arena_buf);
+  offsets_ = &offsets_buf_[0];
+  arena_ = &arena_buf_[0];
+  num_records_ = num_records;
+  arena_size_ = arena_size;
+  return 0;
+}
+
+template <typename Dictionary>
+inline int RecordDoubleArray<Dictionary>::openMapped(const char *file_name,
+    std::size_t offset) {
+  Details::MappedFile file;
+  if (!file.open(file_name, offset, 0) ||
+      file.size() < Details::FileHeader::SIZE) {
+    return -1;
+  }
+  const std::size_t size = file.size();
+  const Details::uchar_type *bytes = file.data();
+  Details::FileHeader header;
+  if (!header.read(bytes) || !is_valid_units_header(header, size)) {
+    return -1;
+  }
+  const std::size_t units_size = header.header_size() +
+      header.unit_size() * header.num_units();
+  const Details::uchar_type *records = bytes + units_size;
+  const std::size_t records_size = size - units_size;
+
+  Details::FileHeader records_header;
+  std::size_t num_records, arena_size;
+  if (records_size < Details::FileHeader::SIZE ||
+      !records_header.read(records) ||
+      !is_valid_records_header(records_header, records_size, &num_records,
+      &arena_size)) {
+    return -1;
+  }
+  const Details::id_type *offsets = reinterpret_cast<const Details::id_type *>(
+      records + records_header.header_size());
+  const char *arena = reinterpret_cast<const char *>(offsets + num_records);
+  // The dictionary maps its units section by itself, which restores the remap
+  // table, build_flags() and num_keys().
+  if (!is_valid_records(records_header, offsets, num_records, arena,
+      arena_size) || dic_.openMapped(file_name, offset, units_size) != 0) {
+    return -1;
+  }
+
+  offsets_buf_.clear();
+  arena_buf_.clear();
+  offsets_ = offsets;
+  arena_ = arena;
+  num_records_ = num_records;
+  arena_size_ = arena_size;
+  file_.swap(&file);
+  return 0;
+}
+
+template <typename Dictionary>
+inline int RecordDoubleArray<Dictionary>::save(const char *file_name,
+    const char *mode, std::size_t offset) const {
+  if (dic_.size() == 0) {
+    return -1;
+  }
+
+#ifdef _MSC_VER
+  std::FILE *file;
+  if (::fopen_s(&file, file_name, mode) != 0) {
+    return -1;
+  }
+#else
+  std::FILE *file = std::fopen(file_name, mode);
+  if (file == NULL) {
+    return -1;
+  }
+#endif
+
+  Details::FileHeader header;
+  header.set_dictionary(dic_);
+  Details::uchar_type bytes[Details::FileHeader::MAX_SIZE];
+  header.write(bytes);
+
+  Details::FileHeader records_header;
+  records_header.set_unit_size(1);
+  records_header.set_num_keys(num_records_);
+  records_header.set_num_units(sizeof(Details::id_type) * num_records_ +
+      arena_size_);
+  records_header.set_checksum(records_checksum(offsets_, num_records_,
+      arena_, arena_size_));
+  Details::uchar_type records_bytes[Details::FileHeader::SIZE];
+  records_header.write(records_bytes);
+
+  if (std::fseek(file, offset, SEEK_SET) != 0 ||
+      std::fwrite(bytes, 1, header.header_size(), file) !=
+      header.header_size() ||
+      std::fwrite(dic_.array(), dic_.unit_size(), dic_.size(), file) !=
+      dic_.size() ||
+      std::fwrite(records_bytes, 1, Details::FileHeader::SIZE, file) !=
+      Details::FileHeader::SIZE ||
+      std::fwrite(offsets_, sizeof(Details::id_type), num_records_, file) !=
+      num_records_ ||
+      std::fwrite(arena_, 1, arena_size_, file) != arena_size_) {
+    std::fclose(file);
+    return -1;
+  }
+  std::fclose(file);
+  return 0;
+}
+
+template <typename Dictionary>
+inline bool RecordDoubleArray<Dictionary>::is_valid_record(const char *arena,
+    std::size_t arena_size, std::size_t offset) {
+  std::size_t length = 0;
+  for (std::size_t shift = 0; ; shift += 7) {
+    if (offset >= arena_size || shift >= 8 * sizeof(std::size_t)) {
+      return false;
+    }
+    const Details::uchar_type byte =
+        static_cast<Details::uchar_type>(arena[offset++]);
+    length |= static_cast<std::size_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      break;
+    }
+  }
+  return length <= arena_size - offset;
+}
+
+template <typename Dictionary>
+inline bool RecordDoubleArray<Dictionary>::is_valid_units_header(
+    const Details::FileHeader &header, std::size_t size) const {
+  return header.unit_size() == dic_.unit_size() &&
+      header.header_size() <= size &&
+      header.num_units() <= (size - header.header_size()) / dic_.unit_size();
+}
+
+template <typename Dictionary>
+inline bool RecordDoubleArray<Dictionary>::is_valid_records_header(
+    const Details::FileHeader &header, std::size_t size,
+    std::size_t *num_records, std::size_t *arena_size) {
+  if (header.unit_size() != 1 || header.header_size() > size ||
+      header.num_units() > size - header.header_size() ||
+      header.num_keys() > header.num_units() / sizeof(Details::id_type)) {
+    return false;
+  }
+  *num_records = header.num_keys();
+  *arena_size = header.num_units() -
+      sizeof(Details::id_type) * header.num_keys();
+  return true;
+}
+
+template <typename Dictionary>
+inline bool RecordDoubleArray<Dictionary>::is_valid_records(
+    const Details::FileHeader &header, const Details::id_type *offsets,
+    std::size_t num_records, const char *arena, std::size_t arena_size) {
+  if (records_checksum(offsets, num_records, arena, arena_size) !=
+      header.checksum()) {
+    return false;
+  }
+  for (std::size_t i = 0; i < num_records; ++i) {
+    if (!is_valid_record(arena, arena_size, offsets[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace Darts
+
+#endif  // DARTS_RECORD_H_
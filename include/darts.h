@@ -2,24 +2,77 @@
 #define DARTS_H_
 
 #include <cstdio>
+#include <cstring>
 #include <exception>
 #include <new>
 
+// The AVX2 kernel of exactMatchSearchBatch() is used if DARTS_USE_AVX2 is
+// defined and the compiler targets AVX2 (e.g. -mavx2). It is not enabled by
+// default because gather instructions are slow on some processors, and then
+// the prefetching scalar loop is faster. Please measure before enabling it.
+// The same macro also lets build() search the bitmaps of free units with
+// AVX2, which does not change the resulting dictionary.
+#if defined(DARTS_USE_AVX2) && defined(__AVX2__)
+ #define DARTS_HAS_AVX2_KERNEL
+ #include <immintrin.h>
+#endif  // defined(DARTS_USE_AVX2) && defined(__AVX2__)
+
+// openMapped() maps a dictionary file with mmap() on POSIX systems. On other
+// systems, it reads the whole file into memory instead. Likewise,
+// build() uses POSIX threads for set_num_threads(), and it builds on the
+// calling thread on other systems. buildFile() seeks with fseeko() on POSIX
+// systems and _fseeki64() with MSVC, so that it can write files over 2GB.
+// The checksum of a file header is computed with the CRC32C instruction if the
+// compiler targets SSE4.2 (e.g. -msse4.2) or the CRC extension of ARMv8
+// (e.g. -march=armv8-a+crc). Otherwise, a table-driven loop is used.
+#if defined(__SSE4_2__)
+ #define DARTS_HAS_SSE42_CRC32C
+ #include <nmmintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+ #define DARTS_HAS_ARM_CRC32C
+ #include <arm_acle.h>
+#endif  // defined(__SSE4_2__)
+
+#if defined(__unix__) || defined(__APPLE__)
+ #define DARTS_HAS_MMAP
+ #define DARTS_HAS_THREADS
+ #include <fcntl.h>
+ #include <pthread.h>
+ #include <sys/mman.h>
+ #include <sys/stat.h>
+ #include <unistd.h>
+#endif  // defined(__unix__) || defined(__APPLE__)
+
 #define DARTS_VERSION "0.32"
 
 // DARTS_THROW() throws a <Darts::Exception> whose message starts with the
 // file name and the line number. For example, DARTS_THROW("error message") at
 // line 123 of "darts.h" throws a <Darts::Exception> which has a pointer to
 // "darts.h:123: exception: error message". The message is available by using
-// what() as well as that of <std::exception>.
+// what() as well as that of <std::exception>. Unlike the other macros,
+// DARTS_THROW() is left defined at the end of this header for the other
+// headers of Darts-clone, such as darts-bundle.h.
 #define DARTS_INT_TO_STR(value) #value
 #define DARTS_LINE_TO_STR(line) DARTS_INT_TO_STR(line)
 #define DARTS_LINE_STR DARTS_LINE_TO_STR(__LINE__)
 #define DARTS_THROW(msg) throw Darts::Details::Exception( \
   __FILE__ ":" DARTS_LINE_STR ": exception: " msg)
 
+// DARTS_PREFETCH() hints that the unit pointed to by `ptr' will be read soon.
+// It is used to overlap cache misses of independent searches, and it does
+// nothing if the compiler does not provide a prefetch intrinsic.
+#if defined(__GNUC__)
+ #define DARTS_PREFETCH(ptr) __builtin_prefetch(ptr)
+#else  // defined(__GNUC__)
+ #define DARTS_PREFETCH(ptr)
+#endif  // defined(__GNUC__)
+
 namespace Darts {
 
+// <LargeUnits> is given as the 4th template argument of <DoubleArrayImpl> to
+// use 8-byte units instead of 4-byte units. See also <LargeDoubleArray>.
+struct LargeUnits {};
+
 // The following namespace hides the internal types and classes.
 namespace Details {
 
@@ -79,6 +132,265 @@ class DoubleArrayUnit {
   // Copyable.
 };
 
+// <DoubleArrayLargeUnit> is the type of 8-byte units. The 1st word has the
+// same layout as <DoubleArrayUnit> except that its bits 9-30 keep the upper
+// bits of the offset, and the 2nd word keeps the lower 32 bits of the offset.
+// So, an offset has 54 bits and it is not restricted like that of
+// <DoubleArrayUnit>.
+class DoubleArrayLargeUnit {
+ public:
+  DoubleArrayLargeUnit() : unit_(), offset_() {}
+
+  bool has_leaf() const {
+    return ((unit_ >> 8) & 1) == 1;
+  }
+  value_type value() const {
+    return static_cast<value_type>(unit_ & ((1U << 31) - 1));
+  }
+  id_type label() const {
+    return unit_ & ((1U << 31) | 0xFF);
+  }
+  // The upper bits are shifted in 2 steps so that the shifts are valid even
+  // if <std::size_t> is a 32-bit integer type.
+  std::size_t offset() const {
+    return offset_ |
+        ((static_cast<std::size_t>((unit_ >> 9) & 0x3FFFFF) << 16) << 16);
+  }
+
+ private:
+  id_type unit_;
+  id_type offset_;
+
+  // Copyable.
+};
+
+// A unit policy gives the types which depend on the size of units. The 4th
+// template argument of <DoubleArrayImpl> is converted into a unit policy by
+// <UnitPolicy>, and it selects <SmallUnitPolicy> unless it is <LargeUnits>.
+// `id_type' of a policy is the type of unit IDs, and is_valid_offset()
+// tells whether a unit can keep a relative offset or not.
+class DoubleArrayBuilderUnit;
+class DoubleArrayLargeBuilderUnit;
+class DawgBuilder;
+
+struct SmallUnitPolicy {
+  typedef Details::id_type id_type;
+  typedef DoubleArrayUnit unit_type;
+  typedef DoubleArrayBuilderUnit builder_unit_type;
+
+  enum { UPPER_MASK = 0xFF << 21 };
+  enum { LOWER_MASK = 0xFF };
+
+  static bool is_valid_offset(id_type offset) {
+    return !(offset & UPPER_MASK) || !(offset & LOWER_MASK);
+  }
+};
+
+struct LargeUnitPolicy {
+  typedef std::size_t id_type;
+  typedef DoubleArrayLargeUnit unit_type;
+  typedef DoubleArrayLargeBuilderUnit builder_unit_type;
+
+  static bool is_valid_offset(id_type) {
+    return true;
+  }
+};
+
+template <typename T>
+struct UnitPolicy {
+  typedef SmallUnitPolicy type;
+};
+
+template <>
+struct UnitPolicy<LargeUnits> {
+  typedef LargeUnitPolicy type;
+};
+
+// <DoubleArrayLink> keeps the Aho-Corasick links of a unit. They are stored
+// in a side array so that the units keep their 4-byte layout. failure() is the
+// unit of the longest proper suffix which is also a prefix of some key, and
+// output() is the nearest unit that has a leaf on the chain of failure(), or
+// 0 if there is no such unit. A leaf unit has no links, so its failure field
+// keeps the length of its key instead. <Id> is `id_type' of a unit policy.
+template <typename Id>
+class DoubleArrayLink {
+ public:
+  DoubleArrayLink() : failure_(0), output_(0) {}
+
+  void set_failure(Id failure) {
+    failure_ = failure;
+  }
+  void set_output(Id output) {
+    output_ = output;
+  }
+  void set_length(Id length) {
+    failure_ = length;
+  }
+
+  Id failure() const {
+    return failure_;
+  }
+  Id output() const {
+    return output_;
+  }
+  // length() is available when and only when the unit is a leaf unit.
+  std::size_t length() const {
+    return failure_;
+  }
+
+ private:
+  Id failure_;
+  Id output_;
+
+  // Copyable.
+};
+
+// <DoubleArrayLabelUnit> keeps the label of the first child of a unit and the
+// label of the next sibling of the unit, so that children are enumerated
+// without testing all the 256 labels. Siblings are linked in ascending order
+// of labels and a leaf unit, labeled '\0', always comes first. So, a sibling
+// label of '\0' means that there is no next sibling.
+class DoubleArrayLabelUnit {
+ public:
+  DoubleArrayLabelUnit() : child_('\0'), sibling_('\0') {}
+
+  void set_child(uchar_type child) {
+    child_ = child;
+  }
+  void set_sibling(uchar_type sibling) {
+    sibling_ = sibling;
+  }
+
+  uchar_type child() const {
+    return child_;
+  }
+  uchar_type sibling() const {
+    return sibling_;
+  }
+
+ private:
+  uchar_type child_;
+  uchar_type sibling_;
+
+  // Copyable.
+};
+
+#ifdef DARTS_HAS_AVX2_KERNEL
+
+// exact_match_search_x8() is the AVX2 kernel of exactMatchSearchBatch(). It
+// tests <X8_NUM_KEYS> keys in lockstep as <X8_NUM_GROUPS> groups of 8 lanes:
+// the units of each group are read by a gather instruction, and then offset(),
+// label() and has_leaf() are decoded and compared in SIMD registers. A lane is
+// masked off when its key ends or a transition fails. The groups are
+// independent, so their gathers overlap cache misses.
+// The kernel handles only short keys, and it returns false without searching
+// if any of the keys is longer than <X8_MAX_KEY_LENGTH>. Otherwise, it stores
+// the values and the lengths of the keys into `values' and `result_lengths'.
+// The value of a missing key is -1 and its length is 0. Characters are
+// converted into labels by `remap_table'.
+enum { X8_NUM_GROUPS = 4 };
+enum { X8_NUM_KEYS = X8_NUM_GROUPS * 8 };
+enum { X8_MAX_KEY_LENGTH = 16 };
+
+inline __m256i x8_offsets(__m256i units) {
+  // offset() is (unit_ >> 10) << ((unit_ & (1U << 9)) >> 6).
+  return _mm256_sllv_epi32(_mm256_srli_epi32(units, 10),
+      _mm256_srli_epi32(_mm256_and_si256(units,
+      _mm256_set1_epi32(1 << 9)), 6));
+}
+
+inline bool exact_match_search_x8(const DoubleArrayUnit *array,
+    const uchar_type *remap_table, const char_type * const *keys,
+    const std::size_t *lengths, id_type node_pos, value_type *values,
+    std::size_t *result_lengths) {
+  // The i-th characters of the keys are arranged in `labels[i]' so that each
+  // step reads them with a single load per group. Ended keys are padded with
+  // '\0'.
+  int key_lengths[X8_NUM_KEYS];
+  int max_key_length = 0;
+  for (int i = 0; i < X8_NUM_KEYS; ++i) {
+    std::size_t length = (lengths != NULL) ? lengths[i] : 0;
+    if (length == 0) {
+      while (length <= X8_MAX_KEY_LENGTH && keys[i][length] != '\0') {
+        ++length;
+      }
+    }
+    if (length > X8_MAX_KEY_LENGTH) {
+      return false;
+    }
+    key_lengths[i] = static_cast<int>(length);
+    if (key_lengths[i] > max_key_length) {
+      max_key_length = key_lengths[i];
+    }
+  }
+
+  int labels[X8_MAX_KEY_LENGTH][X8_NUM_KEYS];
+  for (int i = 0; i < max_key_length; ++i) {
+    for (int j = 0; j < X8_NUM_KEYS; ++j) {
+      labels[i][j] = (i < key_lengths[j]) ?
+          remap_table[static_cast<uchar_type>(keys[j][i])] : 0;
+    }
+  }
+
+  const int *base = reinterpret_cast<const int *>(array);
+  const __m256i label_mask = _mm256_set1_epi32(
+      static_cast<int>((1U << 31) | 0xFF));
+
+  __m256i lengths_x8[X8_NUM_GROUPS];
+  __m256i ids[X8_NUM_GROUPS];
+  __m256i units[X8_NUM_GROUPS];
+  __m256i is_alive[X8_NUM_GROUPS];
+  for (int g = 0; g < X8_NUM_GROUPS; ++g) {
+    lengths_x8[g] = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(key_lengths + (g * 8)));
+    ids[g] = _mm256_set1_epi32(static_cast<int>(node_pos));
+    units[g] = _mm256_set1_epi32(base[node_pos]);
+    is_alive[g] = _mm256_set1_epi32(-1);
+  }
+
+  for (int i = 0; i < max_key_length; ++i) {
+    const __m256i key_pos = _mm256_set1_epi32(i);
+    for (int g = 0; g < X8_NUM_GROUPS; ++g) {
+      __m256i is_moving = _mm256_and_si256(is_alive[g],
+          _mm256_cmpgt_epi32(lengths_x8[g], key_pos));
+      __m256i labels_x8 = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i *>(labels[i] + (g * 8)));
+      __m256i next_ids = _mm256_xor_si256(_mm256_xor_si256(ids[g],
+          x8_offsets(units[g])), labels_x8);
+
+      ids[g] = _mm256_blendv_epi8(ids[g], next_ids, is_moving);
+      units[g] = _mm256_mask_i32gather_epi32(units[g], base, ids[g],
+          is_moving, 4);
+
+      __m256i is_matched = _mm256_cmpeq_epi32(
+          _mm256_and_si256(units[g], label_mask), labels_x8);
+      is_alive[g] = _mm256_andnot_si256(
+          _mm256_andnot_si256(is_matched, is_moving), is_alive[g]);
+    }
+  }
+
+  for (int g = 0; g < X8_NUM_GROUPS; ++g) {
+    __m256i has_leaves = _mm256_cmpeq_epi32(_mm256_and_si256(units[g],
+        _mm256_set1_epi32(1 << 8)), _mm256_set1_epi32(1 << 8));
+    __m256i is_found = _mm256_and_si256(is_alive[g], has_leaves);
+    __m256i leaves = _mm256_mask_i32gather_epi32(_mm256_set1_epi32(-1), base,
+        _mm256_xor_si256(ids[g], x8_offsets(units[g])), is_found, 4);
+    __m256i values_x8 = _mm256_blendv_epi8(_mm256_set1_epi32(-1),
+        _mm256_and_si256(leaves, _mm256_set1_epi32(0x7FFFFFFF)), is_found);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(values + (g * 8)),
+        values_x8);
+
+    int found_mask = _mm256_movemask_ps(_mm256_castsi256_ps(is_found));
+    for (int i = 0; i < 8; ++i) {
+      result_lengths[(g * 8) + i] =
+          ((found_mask >> i) & 1) ? key_lengths[(g * 8) + i] : 0;
+    }
+  }
+  return true;
+}
+
+#endif  // DARTS_HAS_AVX2_KERNEL
+
 // Darts-clone throws an <Exception> for memory allocation failure, invalid
 // arguments or a too large offset. The last case means that there are too many
 // keys in the given set of keys. Note that the `msg' of <Exception> must be a
@@ -102,1703 +414,5699 @@ class Exception : public std::exception {
   Exception &operator=(const Exception &);
 };
 
-}  // namespace Details
-
-// <DoubleArrayImpl> is the interface of Darts-clone. Note that other
-// classes should not be accessed from outside.
 //
-// <DoubleArrayImpl> has 4 template arguments but only the 3rd one is used as
-// the type of values. Note that the given <T> is used only from outside, and
-// the internal value type is not changed from <Darts::Details::value_type>.
-// In build(), given values are casted from <T> to <Darts::Details::value_type>
-// by using static_cast. On the other hand, values are casted from
-// <Darts::Details::value_type> to <T> in searching dictionaries.
-template <typename, typename, typename T, typename>
-class DoubleArrayImpl {
- public:
-  // Even if this <value_type> is changed, the internal value type is still
-  // <Darts::Details::value_type>. Other types, such as 64-bit integer types
-  // and floating-point number types, should not be used.
-  typedef T value_type;
-  // A key is reprenseted by a sequence of <key_type>s. For example,
-  // exactMatchSearch() takes a <const key_type *>.
-  typedef Details::char_type key_type;
-  // In searching dictionaries, the values associated with the matched keys are
-  // stored into or returned as <result_type>s.
-  typedef value_type result_type;
-
-  // <result_pair_type> enables applications to get the lengths of the matched
-  // keys in addition to the values.
-  struct result_pair_type {
-    value_type value;
-    std::size_t length;
-  };
+// Memory management of array.
+//
 
-  // The constructor initializes member variables with 0 and NULLs.
-  DoubleArrayImpl() : size_(0), array_(NULL), buf_(NULL) {}
-  // The destructor frees memory allocated for units and then initializes
-  // member variables with 0 and NULLs.
-  virtual ~DoubleArrayImpl() {
+template <typename T>
+class AutoArray {
+ public:
+  explicit AutoArray(T *array = NULL) : array_(array) {}
+  ~AutoArray() {
     clear();
   }
 
-  // <DoubleArrayImpl> has 2 kinds of set_result()s. The 1st set_result() is to
-  // set a value to a <value_type>. The 2nd set_result() is to set a value and
-  // a length to a <result_pair_type>. By using set_result()s, search methods
-  // can return the 2 kinds of results in the same way.
-  // Why the set_result()s are non-static? It is for compatibility.
-  //
-  // The 1st set_result() takes a length as the 3rd argument but it is not
-  // used. If a compiler does a good job, codes for getting the length may be
-  // removed.
-  void set_result(value_type *result, value_type value, std::size_t) const {
-    *result = value;
+  const T &operator[](std::size_t id) const {
+    return array_[id];
   }
-  // The 2nd set_result() uses both `value' and `length'.
-  void set_result(result_pair_type *result,
-      value_type value, std::size_t length) const {
-    result->value = value;
-    result->length = length;
+  T &operator[](std::size_t id) {
+    return array_[id];
   }
 
-  // set_array() calls clear() in order to free memory allocated to the old
-  // array and then sets a new array. This function is useful to set a memory-
-  // mapped array. Note that the array set by set_array() is not freed in
-  // clear() and the destructor of <DoubleArrayImpl>.
-  // set_array() can also set the size of the new array but the size is not
-  // used in search methods. So it works well even if the 2nd argument is 0 or
-  // omitted. Remember that size() and total_size() returns 0 in such a case.
-  void set_array(const void *ptr, std::size_t size = 0) {
-    clear();
-    array_ = static_cast<const unit_type *>(ptr);
-    size_ = size;
-  }
-  // array() returns a pointer to the array of units.
-  const void *array() const {
-    return array_;
+  bool empty() const {
+    return array_ == NULL;
   }
 
-  // clear() frees memory allocated to units and then initializes member
-  // variables with 0 and NULLs. Note that clear() does not free memory if the
-  // array of units was set by set_array(). In such a case, `array_' is not
-  // NULL and `buf_' is NULL.
   void clear() {
-    size_ = 0;
-    array_ = NULL;
-    if (buf_ != NULL) {
-      delete[] buf_;
-      buf_ = NULL;
+    if (array_ != NULL) {
+      delete[] array_;
+      array_ = NULL;
     }
   }
+  void swap(AutoArray *array) {
+    T *temp = array_;
+    array_ = array->array_;
+    array->array_ = temp;
+  }
+  void reset(T *array = NULL) {
+    AutoArray(array).swap(this);
+  }
 
-  // unit_size() returns the size of each unit. The size must be 4 bytes.
-  std::size_t unit_size() const {
-    return sizeof(unit_type);
+ private:
+  T *array_;
+
+  // Disallows copy and assignment.
+  AutoArray(const AutoArray &);
+  AutoArray &operator=(const AutoArray &);
+};
+
+//
+// Memory management of resizable array.
+//
+
+template <typename T>
+class AutoPool {
+ public:
+  AutoPool() : buf_(), size_(0), capacity_(0) {}
+  ~AutoPool() { clear(); }
+
+  const T &operator[](std::size_t id) const {
+    return *(reinterpret_cast<const T *>(&buf_[0]) + id);
+  }
+  T &operator[](std::size_t id) {
+    return *(reinterpret_cast<T *>(&buf_[0]) + id);
+  }
+
+  bool empty() const {
+    return size_ == 0;
   }
-  // size() returns the number of units. It can be 0 if set_array() is used.
   std::size_t size() const {
     return size_;
   }
-  // total_size() returns the number of bytes allocated to the array of units.
-  // It can be 0 if set_array() is used.
-  std::size_t total_size() const {
-    return unit_size() * size();
-  }
-  // nonzero_size() exists for compatibility. It always returns the number of
-  // units because it takes long time to count the number of non-zero units.
-  std::size_t nonzero_size() const {
-    return size();
+
+  void clear() {
+    resize(0);
+    buf_.clear();
+    size_ = 0;
+    capacity_ = 0;
   }
 
-  // build() constructs a dictionary from given key-value pairs. If `lengths'
-  // is NULL, `keys' is handled as an array of zero-terminated strings. If
-  // `values' is NULL, the index in `keys' is associated with each key, i.e.
-  // the ith key has (i - 1) as its value.
-  // Note that the key-value pairs must be arranged in key order and the values
-  // must not be negative. Also, if there are duplicate keys, only the first
-  // pair will be stored in the resultant dictionary.
-  // `progress_func' is a pointer to a callback function. If it is not NULL,
-  // it will be called in build() so that the caller can check the progress of
-  // dictionary construction. For details, please see the definition of
-  // <Darts::Details::progress_func_type>.
-  // The return value of build() is 0, and it indicates the success of the
-  // operation. Otherwise, build() throws a <Darts::Exception>, which is a
-  // derived class of <std::exception>.
-  // build() uses another construction algorithm if `values' is not NULL. In
-  // this case, Darts-clone uses a Directed Acyclic Word Graph (DAWG) instead
-  // of a trie because a DAWG is likely to be more compact than a trie.
-  int build(std::size_t num_keys, const key_type * const *keys,
-      const std::size_t *lengths = NULL, const value_type *values = NULL,
-      Details::progress_func_type progress_func = NULL);
+  void push_back(const T &value) {
+    append(value);
+  }
+  void pop_back() {
+    (*this)[--size_].~T();
+  }
 
-  // open() reads an array of units from the specified file. And if it goes
-  // well, the old array will be freed and replaced with the new array read
-  // from the file. `offset' specifies the number of bytes to be skipped before
-  // reading an array. `size' specifies the number of bytes to be read from the
-  // file. If the `size' is 0, the whole file will be read.
-  // open() returns 0 iff the operation succeeds. Otherwise, it returns a
-  // non-zero value or throws a <Darts::Exception>. The exception is thrown
-  // when and only when a memory allocation fails.
-  int open(const char *file_name, const char *mode = "rb",
-      std::size_t offset = 0, std::size_t size = 0);
-  // save() writes the array of units into the specified file. `offset'
-  // specifies the number of bytes to be skipped before writing the array.
-  // open() returns 0 iff the operation succeeds. Otherwise, it returns a
-  // non-zero value.
-  int save(const char *file_name, const char *mode = "wb",
-      std::size_t offset = 0) const;
-
-  // The 1st exactMatchSearch() tests whether the given key exists or not, and
-  // if it exists, its value and length are set to `result'. Otherwise, the
-  // value and the length of `result' are set to -1 and 0 respectively.
-  // Note that if `length' is 0, `key' is handled as a zero-terminated string.
-  // `node_pos' specifies the start position of matching. This argument enables
-  // the combination of exactMatchSearch() and traverse(). For example, if you
-  // want to test "xyzA", "xyzBC", and "xyzDE", you can use traverse() to get
-  // the node position corresponding to "xyz" and then you can use
-  // exactMatchSearch() to test "A", "BC", and "DE" from that position.
-  // Note that the length of `result' indicates the length from the `node_pos'.
-  // In the above example, the lengths are { 1, 2, 2 }, not { 4, 5, 5 }.
-  template <class U>
-  void exactMatchSearch(const key_type *key, U &result,
-      std::size_t length = 0, std::size_t node_pos = 0) const {
-    result = exactMatchSearch<U>(key, length, node_pos);
+  void append() {
+    if (size_ == capacity_)
+      resize_buf(size_ + 1);
+    new(&(*this)[size_++]) T;
+  }
+  void append(const T &value) {
+    if (size_ == capacity_)
+      resize_buf(size_ + 1);
+    new(&(*this)[size_++]) T(value);
   }
-  // The 2nd exactMatchSearch() returns a result instead of updating the 2nd
-  // argument. So, the following exactMatchSearch() has only 3 arguments.
-  template <class U>
-  inline U exactMatchSearch(const key_type *key, std::size_t length = 0,
-      std::size_t node_pos = 0) const;
 
-  // commonPrefixSearch() searches for keys which match a prefix of the given
-  // string. If `length' is 0, `key' is handled as a zero-terminated string.
-  // The values and the lengths of at most `max_num_results' matched keys are
-  // stored in `results'. commonPrefixSearch() returns the number of matched
-  // keys. Note that the return value can be larger than `max_num_results' if
-  // there are more than `max_num_results' matches. If you want to get all the
-  // results, allocate more spaces and call commonPrefixSearch() again.
-  // `node_pos' works as well as in exactMatchSearch().
-  template <class U>
-  inline std::size_t commonPrefixSearch(const key_type *key, U *results,
-      std::size_t max_num_results, std::size_t length = 0,
-      std::size_t node_pos = 0) const;
+  void resize(std::size_t size) {
+    while (size_ > size) {
+      (*this)[--size_].~T();
+    }
+    if (size > capacity_) {
+      resize_buf(size);
+    }
+    while (size_ < size) {
+      new(&(*this)[size_++]) T;
+    }
+  }
+  void resize(std::size_t size, const T &value) {
+    while (size_ > size) {
+      (*this)[--size_].~T();
+    }
+    if (size > capacity_) {
+      resize_buf(size);
+    }
+    while (size_ < size) {
+      new(&(*this)[size_++]) T(value);
+    }
+  }
 
-  // In Darts-clone, a dictionary is a deterministic finite-state automaton
-  // (DFA) and traverse() tests transitions on the DFA. The initial state is
-  // `node_pos' and traverse() chooses transitions labeled key[key_pos],
-  // key[key_pos + 1], ... in order. If there is not a transition labeled
-  // key[key_pos + i], traverse() terminates the transitions at that state and
-  // returns -2. Otherwise, traverse() ends without a termination and returns
-  // -1 or a nonnegative value, -1 indicates that the final state was not an
-  // accept state. When a nonnegative value is returned, it is the value
-  // associated with the final accept state. That is, traverse() returns the
-  // value associated with the given key if it exists. Note that traverse()
-  // updates `node_pos' and `key_pos' after each transition.
-  inline value_type traverse(const key_type *key, std::size_t &node_pos,
-      std::size_t &key_pos, std::size_t length = 0) const;
+  void reserve(std::size_t size) {
+    if (size > capacity_) {
+      resize_buf(size);
+    }
+  }
 
  private:
-  typedef Details::uchar_type uchar_type;
-  typedef Details::id_type id_type;
-  typedef Details::DoubleArrayUnit unit_type;
-
+  AutoArray<char> buf_;
   std::size_t size_;
-  const unit_type *array_;
-  unit_type *buf_;
+  std::size_t capacity_;
 
   // Disallows copy and assignment.
-  DoubleArrayImpl(const DoubleArrayImpl &);
-  DoubleArrayImpl &operator=(const DoubleArrayImpl &);
+  AutoPool(const AutoPool &);
+  AutoPool &operator=(const AutoPool &);
+
+  void resize_buf(std::size_t size);
 };
 
-// <DoubleArray> is the typical instance of <DoubleArrayImpl>. It uses <int>
-// as the type of values and it is suitable for most cases.
-typedef DoubleArrayImpl<void, void, int, void> DoubleArray;
+template <typename T>
+void AutoPool<T>::resize_buf(std::size_t size) {
+  std::size_t capacity;
+  if (size >= capacity_ * 2) {
+    capacity = size;
+  } else {
+    capacity = 1;
+    while (capacity < size) {
+      capacity <<= 1;
+    }
+  }
 
-// The interface section ends here. For using Darts-clone, there is no need
-// to read the remaining section, which gives the implementation of
-// Darts-clone.
+  AutoArray<char> buf;
+  try {
+    buf.reset(new char[sizeof(T) * capacity]);
+  } catch (const std::bad_alloc &) {
+    DARTS_THROW("failed to resize pool: std::bad_alloc");
+  }
+
+  if (size_ > 0) {
+    T *src = reinterpret_cast<T *>(&buf_[0]);
+    T *dest = reinterpret_cast<T *>(&buf[0]);
+    for (std::size_t i = 0; i < size_; ++i) {
+      new(&dest[i]) T(src[i]);
+      src[i].~T();
+    }
+  }
+
+  buf_.swap(&buf);
+  capacity_ = capacity;
+}
 
 //
-// Member functions of DoubleArrayImpl (except build()).
+// Memory management of stack.
 //
 
-template <typename A, typename B, typename T, typename C>
-int DoubleArrayImpl<A, B, T, C>::open(const char *file_name,
-    const char *mode, std::size_t offset, std::size_t size) {
-#ifdef _MSC_VER
-  std::FILE *file;
-  if (::fopen_s(&file, file_name, mode) != 0) {
-    return -1;
-  }
-#else
-  std::FILE *file = std::fopen(file_name, mode);
-  if (file == NULL) {
-    return -1;
+template <typename T>
+class AutoStack {
+ public:
+  AutoStack() : pool_() {}
+  ~AutoStack() {
+    clear();
   }
-#endif
 
-  if (size == 0) {
-    if (std::fseek(file, 0, SEEK_END) != 0) {
-      std::fclose(file);
-      return -1;
-    }
-    size = std::ftell(file) - offset;
+  const T &top() const {
+    return pool_[size() - 1];
+  }
+  T &top() {
+    return pool_[size() - 1];
   }
 
-  size /= unit_size();
-  if (size < 256 || (size & 0xFF) != 0) {
-    std::fclose(file);
-    return -1;
+  bool empty() const {
+    return pool_.empty();
+  }
+  std::size_t size() const {
+    return pool_.size();
   }
 
-  if (std::fseek(file, offset, SEEK_SET) != 0) {
-    std::fclose(file);
-    return -1;
+  void push(const T &value) {
+    pool_.push_back(value);
+  }
+  void pop() {
+    pool_.pop_back();
   }
 
-  unit_type units[256];
-  if (std::fread(units, unit_size(), 256, file) != 256) {
-    std::fclose(file);
-    return -1;
+  void clear() {
+    pool_.clear();
   }
 
-  if (units[0].label() != '\0' || units[0].has_leaf() ||
-      units[0].offset() == 0 || units[0].offset() >= 512) {
-    std::fclose(file);
-    return -1;
+ private:
+  AutoPool<T> pool_;
+
+  // Disallows copy and assignment.
+  AutoStack(const AutoStack &);
+  AutoStack &operator=(const AutoStack &);
+};
+
+//
+// CRC32C (Castagnoli) checksum.
+//
+
+#if defined(DARTS_HAS_SSE42_CRC32C) || defined(DARTS_HAS_ARM_CRC32C)
+// crc32c_byte() and crc32c_word() apply the instruction to a byte and to a
+// word of <CRC32C_WORD_SIZE> bytes. They do not invert `crc'.
+#if defined(DARTS_HAS_ARM_CRC32C) || defined(__x86_64__)
+enum { CRC32C_WORD_SIZE = 8 };
+#else  // defined(DARTS_HAS_ARM_CRC32C) || defined(__x86_64__)
+enum { CRC32C_WORD_SIZE = 4 };
+#endif  // defined(DARTS_HAS_ARM_CRC32C) || defined(__x86_64__)
+
+inline id_type crc32c_byte(id_type crc, uchar_type byte) {
+#ifdef DARTS_HAS_SSE42_CRC32C
+  return _mm_crc32_u8(crc, byte);
+#else  // DARTS_HAS_SSE42_CRC32C
+  return __crc32cb(crc, byte);
+#endif  // DARTS_HAS_SSE42_CRC32C
+}
+
+inline id_type crc32c_word(id_type crc, const uchar_type *bytes) {
+#if defined(DARTS_HAS_SSE42_CRC32C) && defined(__x86_64__)
+  return static_cast<id_type>(_mm_crc32_u64(crc,
+      *reinterpret_cast<const unsigned long long *>(bytes)));
+#elif defined(DARTS_HAS_SSE42_CRC32C)
+  return _mm_crc32_u32(crc, *reinterpret_cast<const id_type *>(bytes));
+#else  // defined(DARTS_HAS_SSE42_CRC32C) && defined(__x86_64__)
+  return __crc32cd(crc, *reinterpret_cast<const unsigned long long *>(bytes));
+#endif  // defined(DARTS_HAS_SSE42_CRC32C) && defined(__x86_64__)
+}
+
+// The instruction has a latency of a few cycles, so crc32c() splits a long
+// input into 3 blocks of <CRC32C_BLOCK_SIZE> bytes at a time and computes
+// their checksums in parallel. The checksum of a block is then appended to
+// that of the previous block by shifting it over <CRC32C_BLOCK_SIZE> zero
+// bytes, which is a linear operator on 32-bit states.
+enum { CRC32C_BLOCK_SIZE = 4096 };
+
+inline id_type crc32c_shift(const id_type *shift_table, id_type crc) {
+  id_type result = 0;
+  for (std::size_t i = 0; crc != 0; ++i, crc >>= 1) {
+    if ((crc & 1) != 0) {
+      result ^= shift_table[i];
+    }
   }
-  for (id_type i = 1; i < 256; ++i) {
-    if (units[i].label() <= 0xFF && units[i].offset() >= size) {
-      std::fclose(file);
-      return -1;
+  return result;
+}
+#endif  // defined(DARTS_HAS_SSE42_CRC32C) || defined(DARTS_HAS_ARM_CRC32C)
+
+// crc32c() updates `crc' with `size' bytes. The initial value is 0.
+inline id_type crc32c(id_type crc, const void *data, std::size_t size) {
+  const uchar_type *bytes = static_cast<const uchar_type *>(data);
+  crc = ~crc;
+#if defined(DARTS_HAS_SSE42_CRC32C) || defined(DARTS_HAS_ARM_CRC32C)
+  for ( ; size > 0 &&
+      (reinterpret_cast<std::size_t>(bytes) % CRC32C_WORD_SIZE) != 0;
+      ++bytes, --size) {
+    crc = crc32c_byte(crc, *bytes);
+  }
+  if (size >= CRC32C_BLOCK_SIZE * 3 * 8) {
+    // The i-th entry of the table is bit i shifted over a block.
+    static const uchar_type zeros[CRC32C_WORD_SIZE] = { 0 };
+    id_type shift_table[32];
+    for (std::size_t i = 0; i < 32; ++i) {
+      id_type value = static_cast<id_type>(1) << i;
+      for (std::size_t j = 0; j < CRC32C_BLOCK_SIZE; j += CRC32C_WORD_SIZE) {
+        value = crc32c_word(value, zeros);
+      }
+      shift_table[i] = value;
+    }
+    for ( ; size >= CRC32C_BLOCK_SIZE * 3;
+        bytes += CRC32C_BLOCK_SIZE * 3, size -= CRC32C_BLOCK_SIZE * 3) {
+      id_type crc1 = 0, crc2 = 0;
+      for (std::size_t i = 0; i < CRC32C_BLOCK_SIZE; i += CRC32C_WORD_SIZE) {
+        crc = crc32c_word(crc, bytes + i);
+        crc1 = crc32c_word(crc1, bytes + CRC32C_BLOCK_SIZE + i);
+        crc2 = crc32c_word(crc2, bytes + (CRC32C_BLOCK_SIZE * 2) + i);
+      }
+      crc = crc32c_shift(shift_table, crc) ^ crc1;
+      crc = crc32c_shift(shift_table, crc) ^ crc2;
     }
   }
-
-  unit_type *buf;
-  try {
-    buf = new unit_type[size];
-    for (id_type i = 0; i < 256; ++i) {
-      buf[i] = units[i];
+  for ( ; size >= CRC32C_WORD_SIZE;
+      bytes += CRC32C_WORD_SIZE, size -= CRC32C_WORD_SIZE) {
+    crc = crc32c_word(crc, bytes);
+  }
+  for ( ; size > 0; ++bytes, --size) {
+    crc = crc32c_byte(crc, *bytes);
+  }
+#else  // defined(DARTS_HAS_SSE42_CRC32C) || defined(DARTS_HAS_ARM_CRC32C)
+  // The table-driven loop processes 8 bytes at a time (slicing-by-8). The
+  // table is made for each call because it takes much less time than
+  // checksumming a dictionary.
+  id_type table[8][256];
+  for (id_type i = 0; i < 256; ++i) {
+    id_type value = i;
+    for (int j = 0; j < 8; ++j) {
+      value = (value >> 1) ^ ((value & 1) ? 0x82F63B78U : 0);
     }
-  } catch (const std::bad_alloc &) {
-    std::fclose(file);
-    DARTS_THROW("failed to open double-array: std::bad_alloc");
+    table[0][i] = value;
   }
-
-  if (size > 256) {
-    if (std::fread(buf + 256, unit_size(), size - 256, file) != size - 256) {
-      std::fclose(file);
-      delete[] buf;
-      return -1;
+  for (id_type i = 0; i < 256; ++i) {
+    for (int j = 1; j < 8; ++j) {
+      table[j][i] = (table[j - 1][i] >> 8) ^ table[0][table[j - 1][i] & 0xFF];
     }
   }
-  std::fclose(file);
+  for ( ; size >= 8; bytes += 8, size -= 8) {
+    const id_type lower = crc ^ (bytes[0] | (bytes[1] << 8) |
+        (bytes[2] << 16) | (static_cast<id_type>(bytes[3]) << 24));
+    const id_type upper = bytes[4] | (bytes[5] << 8) |
+        (bytes[6] << 16) | (static_cast<id_type>(bytes[7]) << 24);
+    crc = table[7][lower & 0xFF] ^ table[6][(lower >> 8) & 0xFF] ^
+        table[5][(lower >> 16) & 0xFF] ^ table[4][lower >> 24] ^
+        table[3][upper & 0xFF] ^ table[2][(upper >> 8) & 0xFF] ^
+        table[1][(upper >> 16) & 0xFF] ^ table[0][upper >> 24];
+  }
+  for ( ; size > 0; ++bytes, --size) {
+    crc = (crc >> 8) ^ table[0][(crc ^ *bytes) & 0xFF];
+  }
+#endif  // defined(DARTS_HAS_SSE42_CRC32C) || defined(DARTS_HAS_ARM_CRC32C)
+  return ~crc;
+}
 
-  clear();
+//
+// Header of dictionary files.
+//
 
-  size_ = size;
-  array_ = buf;
-  buf_ = buf;
-  return 0;
+// seek_file() moves to `offset' bytes from the beginning of a file. It uses
+// a 64-bit offset where available, because std::fseek() takes a <long>,
+// which has only 32 bits on some systems. It returns false if the offset is
+// out of the range of the system.
+inline bool seek_file(std::FILE *file, std::size_t offset) {
+#if defined(_MSC_VER)
+  const __int64 file_offset = static_cast<__int64>(offset);
+  return file_offset >= 0 &&
+      static_cast<std::size_t>(file_offset) == offset &&
+      ::_fseeki64(file, file_offset, SEEK_SET) == 0;
+#elif defined(DARTS_HAS_MMAP)
+  const off_t file_offset = static_cast<off_t>(offset);
+  return file_offset >= 0 &&
+      static_cast<std::size_t>(file_offset) == offset &&
+      ::fseeko(file, file_offset, SEEK_SET) == 0;
+#else  // defined(_MSC_VER)
+  const long file_offset = static_cast<long>(offset);
+  return file_offset >= 0 &&
+      static_cast<std::size_t>(file_offset) == offset &&
+      std::fseek(file, file_offset, SEEK_SET) == 0;
+#endif  // defined(_MSC_VER)
 }
 
-template <typename A, typename B, typename T, typename C>
-int DoubleArrayImpl<A, B, T, C>::save(const char *file_name,
-    const char *mode, std::size_t offset) const {
-  if (size() == 0) {
-    return -1;
+// <MappedFile> maps a part of a file into memory read-only with mmap() on
+// POSIX systems, or reads it into a buffer on other systems, and unmaps or
+// frees it in clear() and the destructor. It is shared by openMapped() of
+// <DoubleArrayImpl> and the containers built on it.
+class MappedFile {
+ public:
+  MappedFile() : data_(NULL), size_(0), map_addr_(NULL), map_size_(0),
+      buf_() {}
+  ~MappedFile() {
+    clear();
   }
 
+  // open() maps `size' bytes from `offset' of the specified file, or the
+  // rest of the file if `size' is 0. `offset' need not be aligned to a page.
+  // It returns false if the file cannot be opened or has no such bytes, and
+  // throws a <Darts::Exception> if a buffer cannot be allocated. The old
+  // mapping is kept if open() fails.
+  inline bool open(const char *file_name, std::size_t offset,
+      std::size_t size);
+
+  const uchar_type *data() const {
+    return data_;
+  }
+  std::size_t size() const {
+    return size_;
+  }
+
+  void swap(MappedFile *file) {
+    const uchar_type *data = data_;
+    data_ = file->data_;
+    file->data_ = data;
+    std::size_t size = size_;
+    size_ = file->size_;
+    file->size_ = size;
+    void *map_addr = map_addr_;
+    map_addr_ = file->map_addr_;
+    file->map_addr_ = map_addr;
+    std::size_t map_size = map_size_;
+    map_size_ = file->map_size_;
+    file->map_size_ = map_size;
+    buf_.swap(&file->buf_);
+  }
+  void clear() {
+#ifdef DARTS_HAS_MMAP
+    if (map_addr_ != NULL) {
+      ::munmap(map_addr_, map_size_);
+    }
+#endif  // DARTS_HAS_MMAP
+    data_ = NULL;
+    size_ = 0;
+    map_addr_ = NULL;
+    map_size_ = 0;
+    buf_.clear();
+  }
+
+ private:
+  const uchar_type *data_;
+  std::size_t size_;
+  void *map_addr_;
+  std::size_t map_size_;
+  // The buffer consists of <std::size_t>s so that it is aligned for 8-byte
+  // units.
+  AutoArray<std::size_t> buf_;
+
+  // Disallows copy and assignment.
+  MappedFile(const MappedFile &);
+  MappedFile &operator=(const MappedFile &);
+};
+
+inline bool MappedFile::open(const char *file_name, std::size_t offset,
+    std::size_t size) {
+#ifdef DARTS_HAS_MMAP
+  int fd = ::open(file_name, O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+  struct stat file_stat;
+  if (::fstat(fd, &file_stat) != 0 ||
+      offset > static_cast<std::size_t>(file_stat.st_size)) {
+    ::close(fd);
+    return false;
+  }
+  const std::size_t file_size = static_cast<std::size_t>(file_stat.st_size);
+  if (size == 0) {
+    size = file_size - offset;
+  }
+  if (size == 0 || size > file_size - offset) {
+    ::close(fd);
+    return false;
+  }
+
+  // mmap() takes an offset aligned to a page, so the mapping starts at the
+  // beginning of the page which contains `offset'.
+  const std::size_t page_size =
+      static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+  const std::size_t map_offset = offset - (offset % page_size);
+  const std::size_t map_size = offset - map_offset + size;
+  void *map_addr = ::mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd,
+      static_cast<off_t>(map_offset));
+  ::close(fd);
+  if (map_addr == MAP_FAILED) {
+    return false;
+  }
+
+  clear();
+  data_ = static_cast<const uchar_type *>(map_addr) + (offset - map_offset);
+  size_ = size;
+  map_addr_ = map_addr;
+  map_size_ = map_size;
+  return true;
+#else  // DARTS_HAS_MMAP
 #ifdef _MSC_VER
   std::FILE *file;
-  if (::fopen_s(&file, file_name, mode) != 0) {
-    return -1;
+  if (::fopen_s(&file, file_name, "rb") != 0) {
+    return false;
   }
 #else
-  std::FILE *file = std::fopen(file_name, mode);
+  std::FILE *file = std::fopen(file_name, "rb");
   if (file == NULL) {
-    return -1;
+    return false;
   }
 #endif
-
-  if (std::fseek(file, offset, SEEK_SET) != 0) {
+  if (std::fseek(file, 0, SEEK_END) != 0) {
     std::fclose(file);
-    return -1;
+    return false;
+  }
+  const std::size_t file_size = std::ftell(file);
+  if (offset > file_size) {
+    std::fclose(file);
+    return false;
+  }
+  if (size == 0) {
+    size = file_size - offset;
+  }
+  if (size == 0 || size > file_size - offset || !seek_file(file, offset)) {
+    std::fclose(file);
+    return false;
   }
 
-  if (std::fwrite(array_, unit_size(), size(), file) != size()) {
+  AutoArray<std::size_t> buf;
+  try {
+    buf.reset(new std::size_t[size / sizeof(std::size_t) + 1]);
+  } catch (const std::bad_alloc &) {
     std::fclose(file);
-    return -1;
+    DARTS_THROW("failed to open file: std::bad_alloc");
+  }
+  if (std::fread(&buf[0], 1, size, file) != size) {
+    std::fclose(file);
+    return false;
   }
   std::fclose(file);
-  return 0;
-}
 
-template <typename A, typename B, typename T, typename C>
-template <typename U>
-inline U DoubleArrayImpl<A, B, T, C>::exactMatchSearch(const key_type *key,
-    std::size_t length, std::size_t node_pos) const {
-  U result;
-  set_result(&result, static_cast<value_type>(-1), 0);
+  clear();
+  data_ = reinterpret_cast<const uchar_type *>(&buf[0]);
+  size_ = size;
+  buf_.swap(&buf);
+  return true;
+#endif  // DARTS_HAS_MMAP
+}
 
-  unit_type unit = array_[node_pos];
-  if (length != 0) {
-    for (std::size_t i = 0; i < length; ++i) {
-      node_pos ^= unit.offset() ^ static_cast<uchar_type>(key[i]);
-      unit = array_[node_pos];
-      if (unit.label() != static_cast<uchar_type>(key[i])) {
-        return result;
-      }
-    }
-  } else {
-    for ( ; key[length] != '\0'; ++length) {
-      node_pos ^= unit.offset() ^ static_cast<uchar_type>(key[length]);
-      unit = array_[node_pos];
-      if (unit.label() != static_cast<uchar_type>(key[length])) {
-        return result;
+// write_int() and read_int() encode and decode a little-endian integer of
+// `num_bytes' bytes. They are shared by the headers of all the file formats
+// of Darts-clone. read_int() returns false if the value does not fit in
+// <std::size_t>.
+inline void write_int(std::size_t value, std::size_t num_bytes,
+    uchar_type *bytes) {
+  for (std::size_t i = 0; i < num_bytes; ++i) {
+    bytes[i] = static_cast<uchar_type>(value & 0xFF);
+    value = (value >> 4) >> 4;
+  }
+}
+inline bool read_int(const uchar_type *bytes, std::size_t num_bytes,
+    std::size_t *value) {
+  *value = 0;
+  for (std::size_t i = num_bytes; i > 0; --i) {
+    if (i > sizeof(std::size_t)) {
+      if (bytes[i - 1] != 0) {
+        return false;
       }
+    } else {
+      *value = ((*value << 4) << 4) | bytes[i - 1];
     }
   }
+  return true;
+}
 
-  if (!unit.has_leaf()) {
-    return result;
+// is_valid_remap_table() tests whether a remap table maps '\0' and only '\0'
+// to '\0'.
+inline bool is_valid_remap_table(const uchar_type *remap_table) {
+  for (std::size_t i = 0; i < 256; ++i) {
+    if ((remap_table[i] == '\0') != (i == 0)) {
+      return false;
+    }
   }
-  unit = array_[node_pos ^ unit.offset()];
-  set_result(&result, static_cast<value_type>(unit.value()), length);
-  return result;
+  return true;
 }
 
-template <typename A, typename B, typename T, typename C>
-template <typename U>
-inline std::size_t DoubleArrayImpl<A, B, T, C>::commonPrefixSearch(
-    const key_type *key, U *results, std::size_t max_num_results,
-    std::size_t length, std::size_t node_pos) const {
-  std::size_t num_results = 0;
+// <FileHeader> is the header which save() writes before the units if
+// <Darts::SAVE_HEADER> is given. It has the following fields, where integers
+// are little-endian.
+//   0   magic "DARTSDIC"
+//   8   format version (4 bytes)
+//   12  header size, which is a multiple of 64 (4 bytes)
+//   16  unit size (4 bytes)
+//   20  build flags and <REMAP_TABLE_FLAG> (4 bytes)
+//   24  number of keys (8 bytes)
+//   32  number of units (8 bytes)
+//   40  CRC32C of the remap table, if any, and the units (4 bytes)
+//   44  CRC32C of the bytes 0-43 (4 bytes)
+//   48  zero padding
+//   64  remap table (256 bytes) if <REMAP_TABLE_FLAG> is set
+// The padding keeps the units aligned to 64 bytes in a file, so that a
+// mapped array starts at a cache line if the header starts at a page.
+class FileHeader {
+ public:
+  enum { SIZE = 64, MAX_SIZE = SIZE + 256, FORMAT_VERSION = 1 };
+  enum { REMAP_TABLE_FLAG = 1 << 16 };
 
-  unit_type unit = array_[node_pos];
-  node_pos ^= unit.offset();
-  if (length != 0) {
-    for (std::size_t i = 0; i < length; ++i) {
-      node_pos ^= static_cast<uchar_type>(key[i]);
-      unit = array_[node_pos];
-      if (unit.label() != static_cast<uchar_type>(key[i])) {
-        return num_results;
-      }
+  FileHeader() : unit_size_(0), flags_(0), num_keys_(0), num_units_(0),
+      checksum_(0), header_size_(SIZE), has_remap_table_(false) {}
 
-      node_pos ^= unit.offset();
-      if (unit.has_leaf()) {
-        if (num_results < max_num_results) {
-          set_result(&results[num_results], static_cast<value_type>(
-              array_[node_pos].value()), i + 1);
-        }
-        ++num_results;
+  // has_magic() tests whether `bytes' starts with a header.
+  static bool has_magic(const uchar_type *bytes) {
+    for (std::size_t i = 0; i < 8; ++i) {
+      if (bytes[i] != static_cast<uchar_type>(magic()[i])) {
+        return false;
       }
     }
-  } else {
-    for ( ; key[length] != '\0'; ++length) {
-      node_pos ^= static_cast<uchar_type>(key[length]);
-      unit = array_[node_pos];
-      if (unit.label() != static_cast<uchar_type>(key[length])) {
-        return num_results;
-      }
+    return true;
+  }
+
+  // read() parses the first <SIZE> bytes of a header. It returns false if the
+  // header is broken or its version is unknown. If has_remap_table() is true
+  // after read(), pass the next 256 bytes to read_remap_table().
+  inline bool read(const uchar_type *bytes);
+  // read_remap_table() copies a remap table and returns false if it is not
+  // valid for build() of <DoubleArrayImpl>.
+  inline bool read_remap_table(const uchar_type *bytes);
+  // write() fills header_size() bytes, which are at most <MAX_SIZE>, with the
+  // header and the remap table.
+  inline void write(uchar_type *bytes) const;
+
+  // set_dictionary() sets the fields and the remap table for the units of
+  // `dic', and then computes the checksum.
+  template <typename Dictionary>
+  void set_dictionary(const Dictionary &dic) {
+    set_unit_size(dic.unit_size());
+    set_flags(dic.build_flags());
+    set_num_keys(dic.num_keys());
+    set_num_units(dic.size());
+    set_remap_table(dic.remap_table());
+    set_checksum(compute_checksum(dic.array(), dic.total_size()));
+  }
+  // compute_checksum() returns the checksum of the remap table and `size'
+  // bytes of units.
+  id_type compute_checksum(const void *units, std::size_t size) const {
+    return crc32c(has_remap_table_ ? crc32c(0, remap_table_, 256) : 0,
+        units, size);
+  }
 
-      node_pos ^= unit.offset();
-      if (unit.has_leaf()) {
-        if (num_results < max_num_results) {
-          set_result(&results[num_results], static_cast<value_type>(
-              array_[node_pos].value()), length + 1);
-        }
-        ++num_results;
-      }
+  std::size_t unit_size() const {
+    return unit_size_;
+  }
+  int flags() const {
+    return flags_;
+  }
+  std::size_t num_keys() const {
+    return num_keys_;
+  }
+  std::size_t num_units() const {
+    return num_units_;
+  }
+  id_type checksum() const {
+    return checksum_;
+  }
+  std::size_t header_size() const {
+    return header_size_;
+  }
+  bool has_remap_table() const {
+    return has_remap_table_;
+  }
+  // remap_table() returns NULL if the header has no remap table.
+  const uchar_type *remap_table() const {
+    return has_remap_table_ ? remap_table_ : NULL;
+  }
+
+  void set_unit_size(std::size_t unit_size) {
+    unit_size_ = unit_size;
+  }
+  void set_flags(int flags) {
+    flags_ = flags;
+  }
+  void set_num_keys(std::size_t num_keys) {
+    num_keys_ = num_keys;
+  }
+  void set_num_units(std::size_t num_units) {
+    num_units_ = num_units;
+  }
+  void set_checksum(id_type checksum) {
+    checksum_ = checksum;
+  }
+  // set_remap_table() keeps a copy of `remap_table'. The identity mapping and
+  // NULL are not kept, so that a dictionary without a remap table has the
+  // header of <SIZE> bytes.
+  void set_remap_table(const uchar_type *remap_table) {
+    has_remap_table_ = false;
+    for (std::size_t i = 0; remap_table != NULL && i < 256; ++i) {
+      remap_table_[i] = remap_table[i];
+      has_remap_table_ = has_remap_table_ || (remap_table[i] != i);
     }
+    header_size_ = has_remap_table_ ? MAX_SIZE : SIZE;
   }
 
-  return num_results;
-}
+ private:
+  std::size_t unit_size_;
+  int flags_;
+  std::size_t num_keys_;
+  std::size_t num_units_;
+  id_type checksum_;
+  std::size_t header_size_;
+  bool has_remap_table_;
+  uchar_type remap_table_[256];
 
-template <typename A, typename B, typename T, typename C>
-inline typename DoubleArrayImpl<A, B, T, C>::value_type
-DoubleArrayImpl<A, B, T, C>::traverse(const key_type *key,
-    std::size_t &node_pos, std::size_t &key_pos, std::size_t length) const {
-  id_type id = static_cast<id_type>(node_pos);
-  unit_type unit = array_[id];
+  // Copyable.
 
-  if (length != 0) {
-    for ( ; key_pos < length; ++key_pos) {
-      id ^= unit.offset() ^ static_cast<uchar_type>(key[key_pos]);
-      unit = array_[id];
-      if (unit.label() != static_cast<uchar_type>(key[key_pos])) {
-        return static_cast<value_type>(-2);
-      }
-      node_pos = id;
-    }
-  } else {
-    for ( ; key[key_pos] != '\0'; ++key_pos) {
-      id ^= unit.offset() ^ static_cast<uchar_type>(key[key_pos]);
-      unit = array_[id];
-      if (unit.label() != static_cast<uchar_type>(key[key_pos])) {
-        return static_cast<value_type>(-2);
-      }
-      node_pos = id;
-    }
+  static const char *magic() {
+    return "DARTSDIC";
   }
 
-  if (!unit.has_leaf()) {
-    return static_cast<value_type>(-1);
+};
+
+inline bool FileHeader::read(const uchar_type *bytes) {
+  std::size_t version, header_size, unit_size, flags, num_keys, num_units,
+      checksum, header_checksum;
+  if (!has_magic(bytes) ||
+      !read_int(bytes + 8, 4, &version) ||
+      !read_int(bytes + 12, 4, &header_size) ||
+      !read_int(bytes + 16, 4, &unit_size) ||
+      !read_int(bytes + 20, 4, &flags) ||
+      !read_int(bytes + 24, 8, &num_keys) ||
+      !read_int(bytes + 32, 8, &num_units) ||
+      !read_int(bytes + 40, 4, &checksum) ||
+      !read_int(bytes + 44, 4, &header_checksum)) {
+    return false;
   }
-  unit = array_[id ^ unit.offset()];
-  return static_cast<value_type>(unit.value());
+  const bool has_remap_table = (flags & REMAP_TABLE_FLAG) != 0;
+  if (version != FORMAT_VERSION ||
+      header_size < (has_remap_table ? MAX_SIZE : SIZE) ||
+      header_size % 64 != 0 || header_checksum != crc32c(0, bytes, 44)) {
+    return false;
+  }
+  unit_size_ = unit_size;
+  flags_ = static_cast<int>(flags & ~static_cast<std::size_t>(
+      REMAP_TABLE_FLAG));
+  num_keys_ = num_keys;
+  num_units_ = num_units;
+  checksum_ = static_cast<id_type>(checksum);
+  header_size_ = header_size;
+  has_remap_table_ = has_remap_table;
+  return true;
 }
 
-namespace Details {
+inline bool FileHeader::read_remap_table(const uchar_type *bytes) {
+  if (!is_valid_remap_table(bytes)) {
+    return false;
+  }
+  for (std::size_t i = 0; i < 256; ++i) {
+    remap_table_[i] = bytes[i];
+  }
+  return true;
+}
+
+inline void FileHeader::write(uchar_type *bytes) const {
+  for (std::size_t i = 0; i < 8; ++i) {
+    bytes[i] = static_cast<uchar_type>(magic()[i]);
+  }
+  write_int(FORMAT_VERSION, 4, bytes + 8);
+  write_int(has_remap_table_ ? MAX_SIZE : SIZE, 4, bytes + 12);
+  write_int(unit_size_, 4, bytes + 16);
+  write_int(static_cast<std::size_t>(flags_) |
+      (has_remap_table_ ? REMAP_TABLE_FLAG : 0), 4, bytes + 20);
+  write_int(num_keys_, 8, bytes + 24);
+  write_int(num_units_, 8, bytes + 32);
+  write_int(checksum_, 4, bytes + 40);
+  write_int(crc32c(0, bytes, 44), 4, bytes + 44);
+  for (std::size_t i = 48; i < SIZE; ++i) {
+    bytes[i] = 0;
+  }
+  for (std::size_t i = 0; has_remap_table_ && i < 256; ++i) {
+    bytes[SIZE + i] = remap_table_[i];
+  }
+}
 
 //
-// Memory management of array.
+// Helpers of the containers built on dictionaries.
 //
 
-template <typename T>
-class AutoArray {
+// <Deduplicator> numbers distinct byte strings in order of appearance by
+// using an open addressing hash table. It is shared by the containers which
+// keep a value per distinct payload or record, so that the keys with the
+// same value still share their suffixes in a DAWG. The strings are not
+// copied, so they must be kept until the <Deduplicator> is cleared.
+class Deduplicator {
  public:
-  explicit AutoArray(T *array = NULL) : array_(array) {}
-  ~AutoArray() {
-    clear();
-  }
+  Deduplicator() : table_(), items_(), lengths_(), table_size_(0),
+      num_items_(0) {}
 
-  const T &operator[](std::size_t id) const {
-    return array_[id];
+  // reserve() allocates memory for at most `max_num_items' strings. It throws
+  // std::bad_alloc as well as new[].
+  inline void reserve(std::size_t max_num_items);
+  // insert() returns the ID of the given string, which is size() if the
+  // string is new.
+  inline std::size_t insert(const void *item, std::size_t length);
+
+  std::size_t size() const {
+    return num_items_;
   }
-  T &operator[](std::size_t id) {
-    return array_[id];
+  const void *item(std::size_t id) const {
+    return items_[id];
   }
-
-  bool empty() const {
-    return array_ == NULL;
+  std::size_t length(std::size_t id) const {
+    return lengths_[id];
   }
 
-  void clear() {
-    if (array_ != NULL) {
-      delete[] array_;
-      array_ = NULL;
+ private:
+  AutoArray<std::size_t> table_;
+  AutoArray<const void *> items_;
+  AutoArray<std::size_t> lengths_;
+  std::size_t table_size_;
+  std::size_t num_items_;
+
+  // Disallows copy and assignment.
+  Deduplicator(const Deduplicator &);
+  Deduplicator &operator=(const Deduplicator &);
+
+  static std::size_t hash(const uchar_type *bytes, std::size_t length) {
+    id_type hash_value = 2166136261U;
+    for (std::size_t i = 0; i < length; ++i) {
+      hash_value = (hash_value ^ bytes[i]) * 16777619U;
     }
+    return hash_value;
   }
-  void swap(AutoArray *array) {
-    T *temp = array_;
-    array_ = array->array_;
-    array->array_ = temp;
+};
+
+inline void Deduplicator::reserve(std::size_t max_num_items) {
+  std::size_t table_size = 1;
+  while (table_size < max_num_items * 2) {
+    table_size <<= 1;
   }
-  void reset(T *array = NULL) {
-    AutoArray(array).swap(this);
+  table_.reset(new std::size_t[table_size]);
+  items_.reset(new const void *[max_num_items + 1]);
+  lengths_.reset(new std::size_t[max_num_items + 1]);
+  for (std::size_t i = 0; i < table_size; ++i) {
+    table_[i] = 0;
+  }
+  table_size_ = table_size;
+  num_items_ = 0;
+}
+
+inline std::size_t Deduplicator::insert(const void *item,
+    std::size_t length) {
+  const uchar_type *bytes = static_cast<const uchar_type *>(item);
+  std::size_t slot = hash(bytes, length) & (table_size_ - 1);
+  while (table_[slot] != 0) {
+    const std::size_t id = table_[slot] - 1;
+    if (lengths_[id] == length && (length == 0 ||
+        std::memcmp(items_[id], item, length) == 0)) {
+      return id;
+    }
+    slot = (slot + 1) & (table_size_ - 1);
+  }
+  items_[num_items_] = item;
+  lengths_[num_items_] = length;
+  table_[slot] = ++num_items_;
+  return num_items_ - 1;
+}
+
+// <ConvertingCollector> is the callback of commonPrefixSearch() for the
+// containers built on dictionaries. It converts each value into what the
+// container associates with it by convert() of the container, and passes
+// the result to `callback'.
+template <typename Container, typename F>
+class ConvertingCollector {
+ public:
+  ConvertingCollector(const Container *container, F callback)
+      : container_(container), callback_(callback) {}
+
+  template <typename V>
+  bool operator()(V value, std::size_t length) {
+    return callback_(container_->convert(value), length);
   }
 
  private:
-  T *array_;
+  const Container *container_;
+  F callback_;
+};
 
-  // Disallows copy and assignment.
-  AutoArray(const AutoArray &);
-  AutoArray &operator=(const AutoArray &);
+}  // namespace Details
+
+// build() of <DoubleArrayImpl> takes a combination of the following flags as
+// its last argument.
+enum BuildFlags {
+  // BUILD_TRIE arranges the keys as a trie even if values are given. Without
+  // this flag, a DAWG is used in that case because it is more compact.
+  BUILD_TRIE = 1 << 0,
+  // BUILD_LINKS computes the Aho-Corasick links used by scan(). The links
+  // require a trie, so BUILD_LINKS implies BUILD_TRIE.
+  BUILD_LINKS = 1 << 1,
+  // BUILD_LABEL_INDEX keeps the labels of children and siblings in a side
+  // array of 2 bytes per unit. It makes predictiveSearch() faster.
+  BUILD_LABEL_INDEX = 1 << 2,
+  // BUILD_PARENTS keeps the parent of each unit and the leaf of each key so
+  // that restoreKey() can rebuild keys. A parent is unique only in a trie, so
+  // BUILD_PARENTS implies BUILD_TRIE.
+  BUILD_PARENTS = 1 << 3,
+  // BUILD_TAIL stops each path of the trie at the first unit which leads to
+  // only one key, and stores the rest of the key in a tail appended to the
+  // array of units. It makes the array much smaller if keys have long unique
+  // suffixes. BUILD_TAIL implies BUILD_TRIE and cannot be combined with
+  // BUILD_LINKS or BUILD_PARENTS. A dictionary built with BUILD_TAIL supports
+  // exactMatchSearch(), exactMatchSearchBatch(), commonPrefixSearch() and
+  // longestPrefixSearch(). The other searches, that is, traverse(),
+  // predictiveSearch(), fuzzySearch(), patternSearch(), scan() and
+  // restoreKey(), throw a <Darts::Exception> for such a dictionary, because a
+  // path may end in a tail.
+  BUILD_TAIL = 1 << 4
 };
 
-//
-// Memory management of resizable array.
-//
+// save() of <DoubleArrayImpl> takes a combination of the following flags as
+// its last argument.
+enum SaveFlags {
+  // SAVE_HEADER writes a header of 64 bytes before the units. The header
+  // keeps the format version, the unit size, the build flags, the number of
+  // keys, the number of units and a CRC32C checksum of the units. If the
+  // dictionary has a remap table, the table follows in 256 bytes. open() and
+  // openMapped() detect the header, restore the remap table, and reject a
+  // file if its unit size does not match or the checksum shows that the
+  // units are truncated or broken. Without this flag, save() writes only the
+  // units as before, which can be given to set_array() as is.
+  SAVE_HEADER = 1 << 0
+};
 
-template <typename T>
-class AutoPool {
+// <Pattern> is a pattern for patternSearch() of <DoubleArrayImpl>. A pattern
+// matches a whole key and consists of the following atoms.
+//   ?      any character.
+//   *      any sequence of characters, including an empty one.
+//   [...]  a character in the class, such as [abc] and [0-9]. If the class
+//          starts with ^ or !, it matches a character not in the class.
+//   \x     the character x, even if x is a special character.
+//   x+     one or more occurrences of the atom x, such as [0-9]+.
+// Other characters match themselves. compile() converts a pattern into a
+// nondeterministic automaton whose states are the bits of an <id_type>, so a
+// pattern can have at most <MAX_NUM_ATOMS> atoms, where x+ counts as two.
+// A <Pattern> also keeps the stacks used by patternSearch(), and they are
+// reused by later searches.
+class Pattern {
  public:
-  AutoPool() : buf_(), size_(0), capacity_(0) {}
-  ~AutoPool() { clear(); }
+  enum { MAX_NUM_ATOMS = 31 };
 
-  const T &operator[](std::size_t id) const {
-    return *(reinterpret_cast<const T *>(&buf_[0]) + id);
-  }
-  T &operator[](std::size_t id) {
-    return *(reinterpret_cast<T *>(&buf_[0]) + id);
+  Pattern() : num_atoms_(-1), star_states_(0), ids_(), labels_(), states_(),
+      key_() {
+    clear_states();
   }
 
-  bool empty() const {
-    return size_ == 0;
+  // compile() returns 0 iff the pattern is valid. Otherwise, it returns -1
+  // and the pattern matches nothing. If `length' is 0, `pattern' is handled
+  // as a zero-terminated string.
+  inline int compile(const char *pattern, std::size_t length = 0);
+
+ private:
+  typedef Details::id_type id_type;
+  typedef Details::uchar_type uchar_type;
+
+  // The i-th bit of a state set means that the first i atoms have matched,
+  // and the (`num_atoms_')-th bit means that the whole pattern has matched.
+  // `match_states_[c]' has the bits of the atoms which accept `c'.
+  int num_atoms_;
+  id_type star_states_;
+  id_type match_states_[256];
+
+  Details::AutoPool<std::size_t> ids_;
+  Details::AutoPool<id_type> labels_;
+  Details::AutoPool<id_type> states_;
+  Details::AutoPool<char> key_;
+
+  // Disallows copy and assignment.
+  Pattern(const Pattern &);
+  Pattern &operator=(const Pattern &);
+
+  bool is_valid() const {
+    return num_atoms_ >= 0;
   }
-  std::size_t size() const {
-    return size_;
+  id_type start_state() const {
+    return close(1);
   }
-
-  void clear() {
-    resize(0);
-    buf_.clear();
-    size_ = 0;
-    capacity_ = 0;
+  id_type accept_state() const {
+    return 1U << num_atoms_;
   }
 
-  void push_back(const T &value) {
-    append(value);
+  // close() adds the states reached by skipping atoms which accept an empty
+  // sequence.
+  id_type close(id_type states) const {
+    for ( ; ; ) {
+      id_type next_states = states | ((states & star_states_) << 1);
+      if (next_states == states) {
+        return states;
+      }
+      states = next_states;
+    }
   }
-  void pop_back() {
-    (*this)[--size_].~T();
+  // transit() returns the states after reading a label accepted by the atoms
+  // in `label_states'. A repeated atom stays in its state, and the others
+  // move to the next state.
+  id_type transit(id_type states, id_type label_states) const {
+    states &= label_states;
+    return close(((states & ~star_states_) << 1) | (states & star_states_));
   }
 
-  void append() {
-    if (size_ == capacity_)
-      resize_buf(size_ + 1);
-    new(&(*this)[size_++]) T;
+  void clear_states() {
+    for (std::size_t i = 0; i < 256; ++i) {
+      match_states_[i] = 0;
+    }
+    star_states_ = 0;
   }
-  void append(const T &value) {
-    if (size_ == capacity_)
-      resize_buf(size_ + 1);
-    new(&(*this)[size_++]) T(value);
+  static bool is_end(const char *pattern, std::size_t length,
+      std::size_t pos) {
+    return (length != 0) ? (pos >= length) : (pattern[pos] == '\0');
   }
+  inline int add_atom(const bool *labels, bool is_star);
 
-  void resize(std::size_t size) {
-    while (size_ > size) {
-      (*this)[--size_].~T();
-    }
-    if (size > capacity_) {
-      resize_buf(size);
-    }
-    while (size_ < size) {
-      new(&(*this)[size_++]) T;
+  template <typename, typename, typename, typename>
+  friend class DoubleArrayImpl;
+};
+
+inline int Pattern::compile(const char *pattern, std::size_t length) {
+  num_atoms_ = 0;
+  clear_states();
+
+  bool labels[256];
+  std::size_t i = 0;
+  while (!is_end(pattern, length, i)) {
+    const uchar_type c = static_cast<uchar_type>(pattern[i++]);
+    for (std::size_t j = 0; j < 256; ++j) {
+      labels[j] = false;
     }
-  }
-  void resize(std::size_t size, const T &value) {
-    while (size_ > size) {
-      (*this)[--size_].~T();
+
+    if (c == '*') {
+      for (std::size_t j = 1; j < 256; ++j) {
+        labels[j] = true;
+      }
+      if (add_atom(labels, true) != 0) {
+        return -1;
+      }
+      continue;
+    } else if (c == '+') {
+      // '+' must follow an atom, and it is read together with the atom.
+      num_atoms_ = -1;
+      return -1;
+    } else if (c == '?') {
+      for (std::size_t j = 1; j < 256; ++j) {
+        labels[j] = true;
+      }
+    } else if (c == '\\') {
+      if (is_end(pattern, length, i)) {
+        num_atoms_ = -1;
+        return -1;
+      }
+      labels[static_cast<uchar_type>(pattern[i++])] = true;
+    } else if (c == '[') {
+      bool is_negative = false;
+      if (!is_end(pattern, length, i) &&
+          (pattern[i] == '^' || pattern[i] == '!')) {
+        is_negative = true;
+        ++i;
+      }
+      const std::size_t class_begin = i;
+      for ( ; ; ) {
+        if (is_end(pattern, length, i)) {
+          num_atoms_ = -1;
+          return -1;
+        }
+        const uchar_type first = static_cast<uchar_type>(pattern[i++]);
+        if (first == ']' && i - 1 != class_begin) {
+          break;
+        }
+        uchar_type last = first;
+        if (!is_end(pattern, length, i) && pattern[i] == '-' &&
+            !is_end(pattern, length, i + 1) && pattern[i + 1] != ']') {
+          last = static_cast<uchar_type>(pattern[i + 1]);
+          i += 2;
+        }
+        for (std::size_t j = first; j <= last; ++j) {
+          labels[j] = true;
+        }
+      }
+      if (is_negative) {
+        for (std::size_t j = 1; j < 256; ++j) {
+          labels[j] = !labels[j];
+        }
+      }
+      labels[0] = false;
+    } else {
+      labels[c] = true;
     }
-    if (size > capacity_) {
-      resize_buf(size);
+
+    if (add_atom(labels, false) != 0) {
+      return -1;
     }
-    while (size_ < size) {
-      new(&(*this)[size_++]) T(value);
+    // x+ is compiled as x followed by x*, where x* is a repeated atom.
+    if (!is_end(pattern, length, i) && pattern[i] == '+') {
+      ++i;
+      if (add_atom(labels, true) != 0) {
+        return -1;
+      }
     }
   }
+  return 0;
+}
 
-  void reserve(std::size_t size) {
-    if (size > capacity_) {
-      resize_buf(size);
+inline int Pattern::add_atom(const bool *labels, bool is_star) {
+  if (num_atoms_ >= MAX_NUM_ATOMS) {
+    num_atoms_ = -1;
+    return -1;
+  }
+  const id_type state = 1U << num_atoms_;
+  for (std::size_t i = 0; i < 256; ++i) {
+    if (labels[i]) {
+      match_states_[i] |= state;
     }
   }
+  if (is_star) {
+    star_states_ |= state;
+  }
+  ++num_atoms_;
+  return 0;
+}
 
- private:
-  AutoArray<char> buf_;
-  std::size_t size_;
-  std::size_t capacity_;
+template <typename Dictionary>
+class DoubleArrayStreamBuilder;
 
-  // Disallows copy and assignment.
-  AutoPool(const AutoPool &);
-  AutoPool &operator=(const AutoPool &);
+// <DoubleArrayImpl> is the interface of Darts-clone. Note that other
+// classes, except <DoubleArrayStreamBuilder>, should not be accessed from
+// outside.
+//
+// <DoubleArrayImpl> has 4 template arguments. The 3rd one is used as the type
+// of values. Note that the given <T> is used only from outside, and the
+// internal value type is not changed from <Darts::Details::value_type>.
+// In build(), given values are casted from <T> to <Darts::Details::value_type>
+// by using static_cast. On the other hand, values are casted from
+// <Darts::Details::value_type> to <T> in searching dictionaries.
+// The 4th one selects the size of units. <Darts::LargeUnits> selects 8-byte
+// units and any other type selects 4-byte units. The 1st and 2nd ones are not
+// used.
+template <typename, typename, typename T, typename C>
+class DoubleArrayImpl {
+ public:
+  // Even if this <value_type> is changed, the internal value type is still
+  // <Darts::Details::value_type>. Other types, such as 64-bit integer types
+  // and floating-point number types, should not be used.
+  typedef T value_type;
+  // A key is reprenseted by a sequence of <key_type>s. For example,
+  // exactMatchSearch() takes a <const key_type *>.
+  typedef Details::char_type key_type;
+  // In searching dictionaries, the values associated with the matched keys are
+  // stored into or returned as <result_type>s.
+  typedef value_type result_type;
 
-  void resize_buf(std::size_t size);
-};
+  // <result_pair_type> enables applications to get the lengths of the matched
+  // keys in addition to the values.
+  struct result_pair_type {
+    value_type value;
+    std::size_t length;
+  };
 
-template <typename T>
-void AutoPool<T>::resize_buf(std::size_t size) {
-  std::size_t capacity;
-  if (size >= capacity_ * 2) {
-    capacity = size;
-  } else {
-    capacity = 1;
-    while (capacity < size) {
-      capacity <<= 1;
-    }
+  // The constructor initializes member variables with 0 and NULLs.
+  DoubleArrayImpl() : size_(0), array_(NULL), buf_(NULL), links_(NULL),
+      links_buf_(NULL), labels_(NULL), labels_buf_(NULL), parents_(NULL),
+      leaves_(NULL), num_leaves_(0), parents_buf_(NULL), has_tails_(false),
+      file_(), flags_(0), num_keys_(0), num_threads_(1) {
+    set_remap_table(NULL);
+  }
+  // The destructor frees memory allocated for units and then initializes
+  // member variables with 0 and NULLs.
+  virtual ~DoubleArrayImpl() {
+    clear();
   }
 
-  AutoArray<char> buf;
-  try {
-    buf.reset(new char[sizeof(T) * capacity]);
-  } catch (const std::bad_alloc &) {
-    DARTS_THROW("failed to resize pool: std::bad_alloc");
+  // <DoubleArrayImpl> has 2 kinds of set_result()s. The 1st set_result() is to
+  // set a value to a <value_type>. The 2nd set_result() is to set a value and
+  // a length to a <result_pair_type>. By using set_result()s, search methods
+  // can return the 2 kinds of results in the same way.
+  // Why the set_result()s are non-static? It is for compatibility.
+  //
+  // The 1st set_result() takes a length as the 3rd argument but it is not
+  // used. If a compiler does a good job, codes for getting the length may be
+  // removed.
+  void set_result(value_type *result, value_type value, std::size_t) const {
+    *result = value;
+  }
+  // The 2nd set_result() uses both `value' and `length'.
+  void set_result(result_pair_type *result,
+      value_type value, std::size_t length) const {
+    result->value = value;
+    result->length = length;
   }
 
-  if (size_ > 0) {
-    T *src = reinterpret_cast<T *>(&buf_[0]);
-    T *dest = reinterpret_cast<T *>(&buf[0]);
-    for (std::size_t i = 0; i < size_; ++i) {
-      new(&dest[i]) T(src[i]);
-      src[i].~T();
+  // set_array() calls clear() in order to free memory allocated to the old
+  // array and then sets a new array. This function is useful to set a memory-
+  // mapped array. Note that the array set by set_array() is not freed in
+  // clear() and the destructor of <DoubleArrayImpl>.
+  // set_array() can also set the size of the new array but the size is not
+  // used in search methods. So it works well even if the 2nd argument is 0 or
+  // omitted. Remember that size() and total_size() returns 0 in such a case.
+  void set_array(const void *ptr, std::size_t size = 0) {
+    clear();
+    array_ = static_cast<const unit_type *>(ptr);
+    size_ = size;
+    has_tails_ = (array_ != NULL) && array_[0].has_leaf();
+    flags_ = has_tails_ ? BUILD_TAIL : 0;
+  }
+  // is_valid_array() tests whether `ptr' points to an array of `size' units
+  // which may be given to set_array(), as well as open() and openMapped()
+  // test a file. Only the size and the first 256 units are tested.
+  static bool is_valid_array(const void *ptr, std::size_t size) {
+    return size >= 256 && (size & 0xFF) == 0 &&
+        is_valid_root(static_cast<const unit_type *>(ptr), size);
+  }
+  // array() returns a pointer to the array of units.
+  const void *array() const {
+    return array_;
+  }
+
+  // clear() frees memory allocated to units and then initializes member
+  // variables with 0 and NULLs. Note that clear() does not free memory if the
+  // array of units was set by set_array(). In such a case, `array_' is not
+  // NULL and `buf_' is NULL. A mapping created by openMapped() is unmapped.
+  // clear() keeps the remap table.
+  void clear() {
+    size_ = 0;
+    array_ = NULL;
+    if (buf_ != NULL) {
+      delete[] buf_;
+      buf_ = NULL;
     }
+    file_.clear();
+    links_ = NULL;
+    if (links_buf_ != NULL) {
+      delete[] links_buf_;
+      links_buf_ = NULL;
+    }
+    labels_ = NULL;
+    if (labels_buf_ != NULL) {
+      delete[] labels_buf_;
+      labels_buf_ = NULL;
+    }
+    parents_ = NULL;
+    leaves_ = NULL;
+    num_leaves_ = 0;
+    if (parents_buf_ != NULL) {
+      delete[] parents_buf_;
+      parents_buf_ = NULL;
+    }
+    has_tails_ = false;
+    flags_ = 0;
+    num_keys_ = 0;
   }
 
-  buf_.swap(&buf);
-  capacity_ = capacity;
-}
+  // unit_size() returns the size of each unit. The size is 4 bytes, or 8 bytes
+  // if <Darts::LargeUnits> is given.
+  std::size_t unit_size() const {
+    return sizeof(unit_type);
+  }
+  // size() returns the number of units, including the units which keep tails
+  // if the dictionary has been built with <Darts::BUILD_TAIL>. It can be 0 if
+  // set_array() is used.
+  std::size_t size() const {
+    return size_;
+  }
+  // total_size() returns the number of bytes allocated to the array of units.
+  // It can be 0 if set_array() is used.
+  std::size_t total_size() const {
+    return unit_size() * size();
+  }
+  // build_flags() and num_keys() return the flags and the number of keys
+  // given to build(). They are saved in a file header and restored by open()
+  // and openMapped(). Otherwise, they are 0 except that build_flags() has
+  // <Darts::BUILD_TAIL> if the dictionary has tails. Note that the side arrays
+  // of <Darts::BUILD_LINKS>, <Darts::BUILD_LABEL_INDEX> and
+  // <Darts::BUILD_PARENTS> are not saved, so build_flags() may have these
+  // flags after open() although the side arrays are gone. buildLinks() and
+  // buildParents() restore the links and the parents.
+  int build_flags() const {
+    return flags_;
+  }
+  std::size_t num_keys() const {
+    return num_keys_;
+  }
+  // nonzero_size() exists for compatibility. It always returns the number of
+  // units because it takes long time to count the number of non-zero units.
+  std::size_t nonzero_size() const {
+    return size();
+  }
 
-//
-// Memory management of stack.
-//
+  // build() constructs a dictionary from given key-value pairs. If `lengths'
+  // is NULL, `keys' is handled as an array of zero-terminated strings. If
+  // `values' is NULL, the index in `keys' is associated with each key, i.e.
+  // the ith key has (i - 1) as its value.
+  // Note that the key-value pairs must be arranged in key order and the values
+  // must not be negative. Also, if there are duplicate keys, only the first
+  // pair will be stored in the resultant dictionary.
+  // `progress_func' is a pointer to a callback function. If it is not NULL,
+  // it will be called in build() so that the caller can check the progress of
+  // dictionary construction. For details, please see the definition of
+  // <Darts::Details::progress_func_type>.
+  // The return value of build() is 0, and it indicates the success of the
+  // operation. Otherwise, build() throws a <Darts::Exception>, which is a
+  // derived class of <std::exception>.
+  // build() uses another construction algorithm if `values' is not NULL. In
+  // this case, Darts-clone uses a Directed Acyclic Word Graph (DAWG) instead
+  // of a trie because a DAWG is likely to be more compact than a trie.
+  // `flags' is a combination of <Darts::BuildFlags> for optional features.
+  // `remap_table' is an optional table of 256 bytes which converts each
+  // character of keys into a label, such as a table for case folding. The
+  // table is kept in the dictionary and applied to queries as well. It must
+  // map '\0' and only '\0' to '\0', and the keys must be arranged in order
+  // of the remapped keys. Keys which become the same are handled as
+  // duplicates. A remap table need not be invertible, so predictiveSearch(),
+  // fuzzySearch(), patternSearch() and restoreKey() return keys of labels,
+  // that is, the remapped keys. patternSearch() maps the characters of a
+  // pattern through the table, so an atom accepts a label if it accepts any
+  // character mapped to the label.
+  int build(std::size_t num_keys, const key_type * const *keys,
+      const std::size_t *lengths = NULL, const value_type *values = NULL,
+      Details::progress_func_type progress_func = NULL, int flags = 0,
+      const unsigned char *remap_table = NULL);
+  // buildFile() builds a dictionary from keys which do not fit in memory and
+  // writes it to the specified file instead of keeping it. The keys are read
+  // twice from `reader', which must have the following member functions.
+  //   bool read(const key_type **key, std::size_t *length, value_type *value)
+  //     sets the next key-value pair and returns true, or returns false at
+  //     the end of keys. The key must stay valid until the next call.
+  //   void rewind()
+  //     restarts reading from the first key.
+  // The keys must be arranged in key order as well as in build(). The 1st
+  // pass finds the units near the root, whose subtrees are too large for
+  // `memory_limit' bytes. They are arranged in memory, and then the 2nd pass
+  // arranges the subtrees below them in chunks of about a quarter of the
+  // limit and writes each chunk to the file as soon as it is fixed. The
+  // limit is an estimate, and the units near the root can exceed it if most
+  // of the keys have long common prefixes. The result is always a trie, and
+  // other <Darts::BuildFlags> are not supported. `flags' is a combination
+  // of <Darts::SaveFlags>. Use <LargeDoubleArray> for a dictionary whose
+  // offsets do not fit in 29 bits. buildFile() does not modify this
+  // dictionary, so open() or openMapped() the file to use the result. It
+  // returns 0 iff the file is written, a non-zero value if the file cannot
+  // be written, or throws a <Darts::Exception> as well as build().
+  template <typename Reader>
+  int buildFile(Reader *reader, const char *file_name,
+      std::size_t memory_limit,
+      Details::progress_func_type progress_func = NULL, int flags = 0) const;
+
+  // relocate() rearranges the units so that the units visited by the given
+  // sample of queries are packed into the first blocks in order of their
+  // visit counts, and the hottest child of each unit shares a cache line of
+  // 64 bytes with the unit if possible. The hot part of a dictionary then
+  // occupies fewer cache lines and pages. The queries are walked as well as
+  // in exactMatchSearch(), and `lengths' works as well as in build(). The
+  // dictionary must have its size, that is, set_array() without a size is
+  // not enough, and it must not have been built with <Darts::BUILD_LINKS>,
+  // <Darts::BUILD_PARENTS> or <Darts::BUILD_TAIL>. The side array of
+  // <Darts::BUILD_LABEL_INDEX> is rebuilt. relocate() returns 0 or throws a
+  // <Darts::Exception> as well as build().
+  int relocate(std::size_t num_queries, const key_type * const *queries,
+      const std::size_t *lengths = NULL);
+
+  // set_remap_table() replaces the remap table. save() keeps the table in the
+  // header of <Darts::SAVE_HEADER>, and open() and openMapped() restore it
+  // from a file with a header. A file without a header has no room for the
+  // table, so it must be set again after open() or set_array() of such a
+  // file. Passing NULL restores the identity mapping. remap_table() returns
+  // the current table, which always has 256 entries.
+  void set_remap_table(const unsigned char *remap_table) {
+    for (std::size_t i = 0; i < 256; ++i) {
+      remap_[i] = (remap_table != NULL) ? remap_table[i] :
+          static_cast<uchar_type>(i);
+    }
+  }
+  const unsigned char *remap_table() const {
+    return remap_;
+  }
 
-template <typename T>
-class AutoStack {
- public:
-  AutoStack() : pool_() {}
-  ~AutoStack() {
-    clear();
+  // set_num_threads() sets the number of threads used by build(). If it is
+  // greater than 1, build() arranges the units near the root first and then
+  // arranges the subtrees below them in parallel. The result is the same for
+  // any number of threads greater than 1, but it is not the same as the
+  // result of 1 thread and can be slightly larger. A DAWG, which is built if
+  // `values' is given, and a dictionary with <Darts::BUILD_PARENTS> or
+  // <Darts::BUILD_TAIL> are always built by 1 thread, and so is a dictionary
+  // on a system without POSIX threads. The setting is kept by clear().
+  void set_num_threads(std::size_t num_threads) {
+    num_threads_ = (num_threads != 0) ? num_threads : 1;
+  }
+  std::size_t num_threads() const {
+    return num_threads_;
   }
 
-  const T &top() const {
-    return pool_[size() - 1];
-  }
-  T &top() {
-    return pool_[size() - 1];
-  }
+  // open() reads an array of units from the specified file. And if it goes
+  // well, the old array will be freed and replaced with the new array read
+  // from the file. `offset' specifies the number of bytes to be skipped before
+  // reading an array. `size' specifies the number of bytes to be read from the
+  // file. If the `size' is 0, the whole file will be read. If the file starts
+  // with a header written by save() with <Darts::SAVE_HEADER>, `size'
+  // includes the header, and open() verifies the units with the checksum.
+  // open() returns 0 iff the operation succeeds. Otherwise, it returns a
+  // non-zero value or throws a <Darts::Exception>. The exception is thrown
+  // when and only when a memory allocation fails.
+  int open(const char *file_name, const char *mode = "rb",
+      std::size_t offset = 0, std::size_t size = 0);
+  // openMapped() works as well as open() but maps the file into memory
+  // read-only instead of reading it. The units are loaded on demand by the OS,
+  // and processes which map the same file share its pages in the page cache.
+  // The mapping is kept until clear() or the destructor, and the file must
+  // not be modified while it is mapped. `offset' need not be aligned to a
+  // page. Note that verifying the checksum of a file with a header reads the
+  // whole file once. openMapped() returns 0 iff the operation succeeds.
+  // Otherwise, it returns a non-zero value, or throws a <Darts::Exception>
+  // if a buffer cannot be allocated on a system without mmap().
+  int openMapped(const char *file_name, std::size_t offset = 0,
+      std::size_t size = 0);
+  // save() writes the array of units into the specified file. `offset'
+  // specifies the number of bytes to be skipped before writing the array.
+  // `flags' is a combination of <Darts::SaveFlags>.
+  // open() returns 0 iff the operation succeeds. Otherwise, it returns a
+  // non-zero value.
+  int save(const char *file_name, const char *mode = "wb",
+      std::size_t offset = 0, int flags = 0) const;
+
+  // The 1st exactMatchSearch() tests whether the given key exists or not, and
+  // if it exists, its value and length are set to `result'. Otherwise, the
+  // value and the length of `result' are set to -1 and 0 respectively.
+  // Note that if `length' is 0, `key' is handled as a zero-terminated string.
+  // `node_pos' specifies the start position of matching. This argument enables
+  // the combination of exactMatchSearch() and traverse(). For example, if you
+  // want to test "xyzA", "xyzBC", and "xyzDE", you can use traverse() to get
+  // the node position corresponding to "xyz" and then you can use
+  // exactMatchSearch() to test "A", "BC", and "DE" from that position.
+  // Note that the length of `result' indicates the length from the `node_pos'.
+  // In the above example, the lengths are { 1, 2, 2 }, not { 4, 5, 5 }.
+  template <class U>
+  void exactMatchSearch(const key_type *key, U &result,
+      std::size_t length = 0, std::size_t node_pos = 0) const {
+    result = exactMatchSearch<U>(key, length, node_pos);
+  }
+  // The 2nd exactMatchSearch() returns a result instead of updating the 2nd
+  // argument. So, the following exactMatchSearch() has only 3 arguments.
+  template <class U>
+  inline U exactMatchSearch(const key_type *key, std::size_t length = 0,
+      std::size_t node_pos = 0) const;
+
+  // exactMatchSearchBatch() does exactMatchSearch() for each of `num_keys'
+  // keys and stores the i-th result into `results[i]'. If `lengths' is NULL,
+  // all the keys are handled as zero-terminated strings, and a zero in
+  // `lengths' also indicates a zero-terminated string.
+  // exactMatchSearchBatch() walks a group of keys at the same time and
+  // prefetches the next unit of each key before reading it. So, the cache
+  // misses of different keys overlap, and the throughput is much better than
+  // that of exactMatchSearch() if the dictionary does not fit in cache.
+  // If DARTS_USE_AVX2 is defined and AVX2 is available (e.g. -mavx2), groups
+  // of short keys are tested in lockstep by a SIMD kernel using gathers.
+  template <class U>
+  inline void exactMatchSearchBatch(const key_type * const *keys,
+      const std::size_t *lengths, std::size_t num_keys, U *results,
+      std::size_t node_pos = 0) const;
+
+  // commonPrefixSearch() searches for keys which match a prefix of the given
+  // string. If `length' is 0, `key' is handled as a zero-terminated string.
+  // The values and the lengths of at most `max_num_results' matched keys are
+  // stored in `results'. commonPrefixSearch() returns the number of matched
+  // keys. Note that the return value can be larger than `max_num_results' if
+  // there are more than `max_num_results' matches. If you want to get all the
+  // results, allocate more spaces and call commonPrefixSearch() again.
+  // `node_pos' works as well as in exactMatchSearch().
+  template <class U>
+  inline std::size_t commonPrefixSearch(const key_type *key, U *results,
+      std::size_t max_num_results, std::size_t length = 0,
+      std::size_t node_pos = 0) const;
+  // The 2nd commonPrefixSearch() passes each match to a function object
+  // instead of storing it into an array, so there is no limit on the number
+  // of results. `callback' is called as callback(value, length) in order of
+  // length, and it must return a value convertible to bool, true to continue
+  // the search or false to stop it. commonPrefixSearch() returns the number of
+  // matches passed to `callback'. Note that `callback' must be an object, not
+  // a plain function, because a function pointer is handled as `results' of
+  // the 1st commonPrefixSearch().
+  template <class F>
+  inline std::size_t commonPrefixSearch(const key_type *key, F callback,
+      std::size_t length = 0, std::size_t node_pos = 0) const;
+
+  // longestPrefixSearch() searches for the longest key which matches a prefix
+  // of the given string. It works like taking the last result of
+  // commonPrefixSearch() but only remembers the deepest match during the walk
+  // and reads its value once at the end. If there is no such key, the value
+  // and the length of the result are set to -1 and 0 respectively.
+  // The 1st longestPrefixSearch() updates `result' and the 2nd one returns a
+  // result as well as exactMatchSearch(). If `length' is 0, `key' is handled
+  // as a zero-terminated string. `node_pos' works as well as in
+  // exactMatchSearch().
+  template <class U>
+  void longestPrefixSearch(const key_type *key, U &result,
+      std::size_t length = 0, std::size_t node_pos = 0) const {
+    result = longestPrefixSearch<U>(key, length, node_pos);
+  }
+  template <class U>
+  inline U longestPrefixSearch(const key_type *key, std::size_t length = 0,
+      std::size_t node_pos = 0) const;
+
+  // <PredictiveIterator> enumerates the results of predictiveSearch(). next()
+  // moves to the next key and returns true, or returns false if there are no
+  // more keys. After next() returns true, key() returns the key, which is
+  // zero-terminated, and length() and value() return its length and value.
+  // The buffer of key() and the stack for the traversal are reused by later
+  // searches, so an iterator should be kept for repeated searches.
+  class PredictiveIterator {
+   public:
+    PredictiveIterator() : dic_(NULL), key_(), stack_(), value_(-1) {}
+
+    inline bool next();
+
+    const key_type *key() const {
+      return key_.empty() ? "" : &key_[0];
+    }
+    std::size_t length() const {
+      return key_.empty() ? 0 : (key_.size() - 1);
+    }
+    value_type value() const {
+      return value_;
+    }
+
+   private:
+    // A <Frame> is a unit on the current path and the label of its next child
+    // to be visited. A label larger than 0xFF means that no child is left.
+    struct Frame {
+      std::size_t id;
+      std::size_t label;
+    };
+
+    const DoubleArrayImpl *dic_;
+    Details::AutoPool<key_type> key_;
+    Details::AutoPool<Frame> stack_;
+    value_type value_;
+
+    // Disallows copy and assignment.
+    PredictiveIterator(const PredictiveIterator &);
+    PredictiveIterator &operator=(const PredictiveIterator &);
+
+    inline void start(const DoubleArrayImpl *dic, const key_type *key,
+        std::size_t length, std::size_t node_pos);
+    inline void push(std::size_t id);
+
+    friend class DoubleArrayImpl;
+  };
+
+  // predictiveSearch() finds the keys which start with the given key and
+  // makes `iterator' enumerate them in key order. If `length' is 0, `key' is
+  // handled as a zero-terminated string. `node_pos' works as well as in
+  // exactMatchSearch(), and then the given key and the keys from `iterator'
+  // start from `node_pos'. Children of each unit are found by testing labels,
+  // or by following the side array if the dictionary has been built with
+  // <Darts::BUILD_LABEL_INDEX>. Note that the side array is not saved by
+  // save().
+  void predictiveSearch(const key_type *key, PredictiveIterator *iterator,
+      std::size_t length = 0, std::size_t node_pos = 0) const {
+    if (has_tails_) {
+      DARTS_THROW("failed to search double-array: tails are not supported");
+    }
+    iterator->start(this, key, length, node_pos);
+  }
+
+  // fuzzySearch() finds the keys within the Levenshtein distance
+  // `max_distance' from the given key. It walks the dictionary with a row of
+  // the edit distance table per depth and skips a whole subtree as soon as
+  // every entry of the row exceeds `max_distance', so the cost depends on the
+  // number of visited units rather than the number of edit candidates.
+  // `callback' is called as callback(value, key, length, distance) for each
+  // match in key order, where `key' is the matched key as a zero-terminated
+  // string, and it returns false to stop the search. fuzzySearch() returns
+  // the number of matches passed to `callback'. If `length' is 0, `key' is
+  // handled as a zero-terminated string, and `node_pos' works as well as in
+  // predictiveSearch(). Children are enumerated by using the side array of
+  // <Darts::BUILD_LABEL_INDEX> if available.
+  template <class F>
+  inline std::size_t fuzzySearch(const key_type *key,
+      std::size_t max_distance, F callback, std::size_t length = 0,
+      std::size_t node_pos = 0) const;
+
+  // patternSearch() finds the keys which match a compiled <Pattern>. It walks
+  // the dictionary and the automaton of the pattern together, and follows
+  // only the transitions which keep some states of the automaton alive, so
+  // the keys which cannot match are never enumerated. `callback' is called as
+  // callback(value, key, length) for each match in key order, where `key' is
+  // the matched key as a zero-terminated string, and it returns false to stop
+  // the search. patternSearch() returns the number of matches passed to
+  // `callback'. The search starts from `node_pos' as well as traverse(). The
+  // stacks kept in `pattern' are reused, so searching with the same
+  // <Pattern> again does not allocate memory.
+  template <class F>
+  inline std::size_t patternSearch(Pattern *pattern, F callback,
+      std::size_t node_pos = 0) const;
+
+  // restoreKey() rebuilds the `key_id'-th key given to build() by following
+  // the parents from its leaf up to the root. It is available when and only
+  // when the dictionary has been built with <Darts::BUILD_PARENTS> or
+  // buildParents() has been called, and otherwise it throws a
+  // <Darts::Exception>. A key ID is also the value of the key if `values' was
+  // NULL in build(). restoreKey() returns the length of the key. If the
+  // length is less than `size', the key is stored into `key' as a
+  // zero-terminated string. Otherwise, `key' is not modified, so allocate
+  // more space and call restoreKey() again. If `key_id' is out of range,
+  // restoreKey() returns 0 and stores an empty string.
+  inline std::size_t restoreKey(std::size_t key_id, key_type *key,
+      std::size_t size) const;
+  // buildParents() computes the parents and the leaves from the units, for
+  // example after open() or openMapped(), which do not save them. The leaves
+  // are numbered in key order by a depth-first walk, so a key ID counts the
+  // distinct keys and matches the index given to build() unless build() was
+  // given duplicate keys. buildParents() returns 0, or throws a
+  // <Darts::Exception> if size() is 0, if the dictionary has tails or if it
+  // is not a trie, that is, if a unit is shared by keys as in a DAWG.
+  inline int buildParents();
+
+  // In Darts-clone, a dictionary is a deterministic finite-state automaton
+  // (DFA) and traverse() tests transitions on the DFA. The initial state is
+  // `node_pos' and traverse() chooses transitions labeled key[key_pos],
+  // key[key_pos + 1], ... in order. If there is not a transition labeled
+  // key[key_pos + i], traverse() terminates the transitions at that state and
+  // returns -2. Otherwise, traverse() ends without a termination and returns
+  // -1 or a nonnegative value, -1 indicates that the final state was not an
+  // accept state. When a nonnegative value is returned, it is the value
+  // associated with the final accept state. That is, traverse() returns the
+  // value associated with the given key if it exists. Note that traverse()
+  // updates `node_pos' and `key_pos' after each transition.
+  inline value_type traverse(const key_type *key, std::size_t &node_pos,
+      std::size_t &key_pos, std::size_t length = 0) const;
+
+  // scan() finds all the keys which occur in the given text, in a single pass
+  // over the text by using the Aho-Corasick links. It is available when and
+  // only when the dictionary has been built with <Darts::BUILD_LINKS> or
+  // buildLinks() has been called, and otherwise it throws a
+  // <Darts::Exception>. The links are not saved, so call buildLinks() after
+  // open() or openMapped().
+  // `callback' is called as callback(value, begin, length) for each
+  // occurrence, where `begin' is the position of the occurrence in `text'.
+  // Occurrences are reported in order of their end positions, and longer ones
+  // come first if they end at the same position. `callback' returns false to
+  // stop the scan. scan() returns the number of occurrences passed to
+  // `callback'. If `length' is 0, `text' is handled as a zero-terminated
+  // string.
+  template <class F>
+  inline std::size_t scan(const key_type *text, std::size_t length,
+      F callback) const;
+  // buildLinks() computes the Aho-Corasick links from the units, for example
+  // after open() or openMapped(), so that scan() becomes available. The keys
+  // are not given, so all the labels from 1 to 255 are tested for each unit,
+  // which is slower than <Darts::BUILD_LINKS>. buildLinks() returns 0, or
+  // throws a <Darts::Exception> if size() is 0, if the dictionary has tails
+  // or if it is not a trie, that is, if a unit is shared by keys as in a
+  // DAWG.
+  inline int buildLinks();
+
+ private:
+  typedef Details::uchar_type uchar_type;
+  typedef typename Details::UnitPolicy<C>::type policy_type;
+  typedef typename policy_type::id_type id_type;
+  typedef typename policy_type::unit_type unit_type;
+  typedef Details::DoubleArrayLink<id_type> link_type;
+  typedef Details::DoubleArrayLabelUnit label_unit_type;
+
+  // remap() converts a character of a query into a label.
+  uchar_type remap(key_type c) const {
+    return remap_[static_cast<uchar_type>(c)];
+  }
+  // has_char() tests whether `key' has the `pos'-th character, where `key' is
+  // a zero-terminated string if `length' is 0.
+  static bool has_char(const key_type *key, std::size_t length,
+      std::size_t pos) {
+    return (length != 0) ? (pos < length) : (key[pos] != '\0');
+  }
+
+  // tail() returns the tail of the leaf unit at `id' in a dictionary built
+  // with <Darts::BUILD_TAIL>. The 1st word of a tail is the value, and the
+  // rest of the key follows as a zero-terminated string.
+  const Details::id_type *tail(std::size_t id) const {
+    return reinterpret_cast<const Details::id_type *>(array_) +
+        array_[id].value();
+  }
+
+  // <ResultCollector> and <LongestCollector> let the callback version of
+  // tail_prefix_search() serve the other prefix searches.
+  template <class U>
+  class ResultCollector {
+   public:
+    ResultCollector(const DoubleArrayImpl *dic, U *results,
+        std::size_t max_num_results) : dic_(dic), results_(results),
+        max_num_results_(max_num_results), num_results_(0) {}
+
+    bool operator()(value_type value, std::size_t length) {
+      if (num_results_ < max_num_results_) {
+        dic_->set_result(&results_[num_results_], value, length);
+      }
+      ++num_results_;
+      return true;
+    }
+
+   private:
+    const DoubleArrayImpl *dic_;
+    U *results_;
+    std::size_t max_num_results_;
+    std::size_t num_results_;
+  };
+  template <class U>
+  class LongestCollector {
+   public:
+    LongestCollector(const DoubleArrayImpl *dic, U *result)
+        : dic_(dic), result_(result) {}
+
+    bool operator()(value_type value, std::size_t length) {
+      dic_->set_result(result_, value, length);
+      return true;
+    }
+
+   private:
+    const DoubleArrayImpl *dic_;
+    U *result_;
+  };
+
+  // exact_match_search_lanes() keeps up to <BATCH_SIZE> keys in flight.
+  enum { BATCH_SIZE = 16 };
+
+  std::size_t size_;
+  const unit_type *array_;
+  unit_type *buf_;
+  const link_type *links_;
+  link_type *links_buf_;
+  const label_unit_type *labels_;
+  label_unit_type *labels_buf_;
+  const id_type *parents_;
+  const id_type *leaves_;
+  std::size_t num_leaves_;
+  id_type *parents_buf_;
+  bool has_tails_;
+  Details::MappedFile file_;
+  int flags_;
+  std::size_t num_keys_;
+  std::size_t num_threads_;
+  uchar_type remap_[256];
+
+  // Disallows copy and assignment.
+  DoubleArrayImpl(const DoubleArrayImpl &);
+  DoubleArrayImpl &operator=(const DoubleArrayImpl &);
+
+  // build_from_dawg() builds a dictionary from a finished DAWG for
+  // <DoubleArrayStreamBuilder>.
+  template <typename Dictionary>
+  friend class DoubleArrayStreamBuilder;
+  void build_from_dawg(const Details::DawgBuilder &dawg,
+      std::size_t num_keys, int flags);
+
+  // is_valid_root() tests the first 256 units of an array of `size' units
+  // before the array is opened.
+  static inline bool is_valid_root(const unit_type *units, std::size_t size);
+  // is_valid_header() tests whether a header matches this type and a file of
+  // `size' bytes has all the units.
+  inline bool is_valid_header(const Details::FileHeader &header,
+      std::size_t size) const;
+
+  template <class U>
+  inline void exact_match_search_lanes(const key_type * const *keys,
+      const std::size_t *lengths, std::size_t num_keys, U *results,
+      std::size_t node_pos) const;
+
+  // tail_exact_match_search() and tail_prefix_search() are the searches for
+  // dictionaries with tails.
+  template <class U>
+  inline U tail_exact_match_search(const key_type *key, std::size_t length,
+      std::size_t node_pos) const;
+  template <class F>
+  inline std::size_t tail_prefix_search(const key_type *key, F callback,
+      std::size_t length, std::size_t node_pos) const;
+};
+
+// <DoubleArray> is the typical instance of <DoubleArrayImpl>. It uses <int>
+// as the type of values and it is suitable for most cases.
+typedef DoubleArrayImpl<void, void, int, void> DoubleArray;
+
+// <LargeDoubleArray> uses 8-byte units. Its dictionaries are twice as large as
+// those of <DoubleArray> but can have far more units, because the offsets of
+// 4-byte units are limited to 29 bits. The search code is shared. Note that
+// build() with values goes through a DAWG of at most 2^30 units, and it
+// throws a <Darts::Exception> if the DAWG exceeds the limit.
+typedef DoubleArrayImpl<void, void, int, LargeUnits> LargeDoubleArray;
+
+// <DoubleArrayStreamBuilder> builds a dictionary from keys which are added
+// one at a time, so the keys need not be kept in arrays for build(). Each
+// key is inserted into a DAWG as soon as it is added, and only the units of
+// the DAWG are kept until finish() converts them into a dictionary. The
+// result is the same as build() with values.
+//   Darts::DoubleArrayStreamBuilder<Darts::DoubleArray> builder;
+//   builder.begin();
+//   while (...) {
+//     builder.add(key, length, value);
+//   }
+//   builder.finish(&dic);
+template <typename Dictionary>
+class DoubleArrayStreamBuilder {
+ public:
+  typedef typename Dictionary::key_type key_type;
+  typedef typename Dictionary::value_type value_type;
+
+  DoubleArrayStreamBuilder() : dawg_builder_(NULL), num_keys_(0) {}
+  ~DoubleArrayStreamBuilder() {
+    clear();
+  }
+
+  // begin() discards the keys added so far and starts a new dictionary.
+  void begin();
+  // add() adds a key-value pair. The keys must be added in key order, and
+  // if `length' is 0, `key' is handled as a zero-terminated string. The key
+  // must not be empty and the value must not be negative, or add() throws a
+  // <Darts::Exception>. A duplicate key is ignored as well as in build().
+  void add(const key_type *key, std::size_t length, value_type value);
+  // finish() builds a dictionary from the keys added since begin() and
+  // replaces `dic' with it. `flags' can be 0 or <Darts::BUILD_LABEL_INDEX>,
+  // because the other <Darts::BuildFlags> require a trie. finish() returns 0
+  // or throws a <Darts::Exception> as well as build(). The next add() starts
+  // a new dictionary.
+  int finish(Dictionary *dic, int flags = 0);
+
+  // num_keys() returns the number of keys added since begin(), including
+  // duplicate keys.
+  std::size_t num_keys() const {
+    return num_keys_;
+  }
+
+  // clear() frees memory allocated to the keys added so far.
+  void clear();
+
+ private:
+  Details::DawgBuilder *dawg_builder_;
+  std::size_t num_keys_;
+
+  // Disallows copy and assignment.
+  DoubleArrayStreamBuilder(const DoubleArrayStreamBuilder &);
+  DoubleArrayStreamBuilder &operator=(const DoubleArrayStreamBuilder &);
+};
+
+// The interface section ends here. For using Darts-clone, there is no need
+// to read the remaining section, which gives the implementation of
+// Darts-clone.
+
+//
+// Member functions of DoubleArrayImpl (except build()).
+//
+
+template <typename A, typename B, typename T, typename C>
+int DoubleArrayImpl<A, B, T, C>::open(const char *file_name,
+    const char *mode, std::size_t offset, std::size_t size) {
+#ifdef _MSC_VER
+  std::FILE *file;
+  if (::fopen_s(&file, file_name, mode) != 0) {
+    return -1;
+  }
+#else
+  std::FILE *file = std::fopen(file_name, mode);
+  if (file == NULL) {
+    return -1;
+  }
+#endif
+
+  if (size == 0) {
+    if (std::fseek(file, 0, SEEK_END) != 0) {
+      std::fclose(file);
+      return -1;
+    }
+    size = std::ftell(file) - offset;
+  }
+
+  if (std::fseek(file, offset, SEEK_SET) != 0) {
+    std::fclose(file);
+    return -1;
+  }
+
+  Details::FileHeader header;
+  bool has_header = false;
+  if (size >= Details::FileHeader::SIZE) {
+    Details::uchar_type bytes[Details::FileHeader::MAX_SIZE];
+    if (std::fread(bytes, 1, Details::FileHeader::SIZE, file) !=
+        Details::FileHeader::SIZE) {
+      std::fclose(file);
+      return -1;
+    }
+    has_header = Details::FileHeader::has_magic(bytes);
+    if (has_header && (!header.read(bytes) || !is_valid_header(header, size))) {
+      std::fclose(file);
+      return -1;
+    }
+    if (header.has_remap_table() &&
+        (std::fread(bytes + Details::FileHeader::SIZE, 1, 256, file) != 256 ||
+         !header.read_remap_table(bytes + Details::FileHeader::SIZE))) {
+      std::fclose(file);
+      return -1;
+    }
+    if (std::fseek(file, offset + (has_header ? header.header_size() : 0),
+        SEEK_SET) != 0) {
+      std::fclose(file);
+      return -1;
+    }
+    if (has_header) {
+      size = unit_size() * header.num_units();
+    }
+  }
+
+  size /= unit_size();
+  if (size < 256 || (size & 0xFF) != 0) {
+    std::fclose(file);
+    return -1;
+  }
+
+  unit_type units[256];
+  if (std::fread(units, unit_size(), 256, file) != 256) {
+    std::fclose(file);
+    return -1;
+  }
+
+  if (!is_valid_root(units, size)) {
+    std::fclose(file);
+    return -1;
+  }
+
+  unit_type *buf;
+  try {
+    buf = new unit_type[size];
+    for (id_type i = 0; i < 256; ++i) {
+      buf[i] = units[i];
+    }
+  } catch (const std::bad_alloc &) {
+    std::fclose(file);
+    DARTS_THROW("failed to open double-array: std::bad_alloc");
+  }
+
+  if (size > 256) {
+    if (std::fread(buf + 256, unit_size(), size - 256, file) != size - 256) {
+      std::fclose(file);
+      delete[] buf;
+      return -1;
+    }
+  }
+  std::fclose(file);
+
+  if (has_header &&
+      header.compute_checksum(buf, unit_size() * size) != header.checksum()) {
+    delete[] buf;
+    return -1;
+  }
+
+  clear();
+
+  size_ = size;
+  array_ = buf;
+  buf_ = buf;
+  has_tails_ = buf[0].has_leaf();
+  flags_ = has_header ? header.flags() : (has_tails_ ? BUILD_TAIL : 0);
+  num_keys_ = has_header ? header.num_keys() : 0;
+  if (has_header) {
+    set_remap_table(header.remap_table());
+  }
+  return 0;
+}
+
+template <typename A, typename B, typename T, typename C>
+int DoubleArrayImpl<A, B, T, C>::openMapped(const char *file_name,
+    std::size_t offset, std::size_t size) {
+  Details::MappedFile file;
+  if (!file.open(file_name, offset, size) ||
+      file.size() < unit_size() * 256) {
+    return -1;
+  }
+  size = file.size();
+
+  const Details::uchar_type *bytes = file.data();
+  Details::FileHeader header;
+  const bool has_header = Details::FileHeader::has_magic(bytes);
+  if (has_header) {
+    if (!header.read(bytes) || !is_valid_header(header, size) ||
+        (header.has_remap_table() &&
+         !header.read_remap_table(bytes + Details::FileHeader::SIZE))) {
+      return -1;
+    }
+    bytes += header.header_size();
+    size = unit_size() * header.num_units();
+  }
+
+  size /= unit_size();
+  const unit_type *units = reinterpret_cast<const unit_type *>(bytes);
+  if (!is_valid_array(units, size) || (has_header &&
+      header.compute_checksum(units, unit_size() * size) !=
+      header.checksum())) {
+    return -1;
+  }
+
+  clear();
+
+  size_ = size;
+  array_ = units;
+  file_.swap(&file);
+  has_tails_ = units[0].has_leaf();
+  flags_ = has_header ? header.flags() : (has_tails_ ? BUILD_TAIL : 0);
+  num_keys_ = has_header ? header.num_keys() : 0;
+  if (has_header) {
+    set_remap_table(header.remap_table());
+  }
+  return 0;
+}
+
+template <typename A, typename B, typename T, typename C>
+inline bool DoubleArrayImpl<A, B, T, C>::is_valid_root(const unit_type *units,
+    std::size_t size) {
+  // The root has a leaf iff the dictionary has tails.
+  if (units[0].label() != '\0' ||
+      units[0].offset() == 0 || units[0].offset() >= 512) {
+    return false;
+  }
+  for (id_type i = 1; i < 256; ++i) {
+    if (units[i].label() <= 0xFF && units[i].offset() >= size) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <typename A, typename B, typename T, typename C>
+inline bool DoubleArrayImpl<A, B, T, C>::is_valid_header(
+    const Details::FileHeader &header, std::size_t size) const {
+  return header.unit_size() == unit_size() && header.header_size() <= size &&
+      header.num_units() <= (size - header.header_size()) / unit_size();
+}
+
+template <typename A, typename B, typename T, typename C>
+int DoubleArrayImpl<A, B, T, C>::save(const char *file_name,
+    const char *mode, std::size_t offset, int flags) const {
+  if (size() == 0) {
+    return -1;
+  }
+
+#ifdef _MSC_VER
+  std::FILE *file;
+  if (::fopen_s(&file, file_name, mode) != 0) {
+    return -1;
+  }
+#else
+  std::FILE *file = std::fopen(file_name, mode);
+  if (file == NULL) {
+    return -1;
+  }
+#endif
+
+  if (std::fseek(file, offset, SEEK_SET) != 0) {
+    std::fclose(file);
+    return -1;
+  }
+
+  if ((flags & SAVE_HEADER) != 0) {
+    Details::FileHeader header;
+    header.set_dictionary(*this);
+
+    Details::uchar_type bytes[Details::FileHeader::MAX_SIZE];
+    header.write(bytes);
+    if (std::fwrite(bytes, 1, header.header_size(), file) !=
+        header.header_size()) {
+      std::fclose(file);
+      return -1;
+    }
+  }
+
+  if (std::fwrite(array_, unit_size(), size(), file) != size()) {
+    std::fclose(file);
+    return -1;
+  }
+  std::fclose(file);
+  return 0;
+}
+
+template <typename A, typename B, typename T, typename C>
+template <typename U>
+inline U DoubleArrayImpl<A, B, T, C>::exactMatchSearch(const key_type *key,
+    std::size_t length, std::size_t node_pos) const {
+  if (has_tails_) {
+    return tail_exact_match_search<U>(key, length, node_pos);
+  }
+
+  U result;
+  set_result(&result, static_cast<value_type>(-1), 0);
+
+  unit_type unit = array_[node_pos];
+  if (length != 0) {
+    for (std::size_t i = 0; i < length; ++i) {
+      node_pos ^= unit.offset() ^ remap(key[i]);
+      unit = array_[node_pos];
+      if (unit.label() != remap(key[i])) {
+        return result;
+      }
+    }
+  } else {
+    for ( ; key[length] != '\0'; ++length) {
+      node_pos ^= unit.offset() ^ remap(key[length]);
+      unit = array_[node_pos];
+      if (unit.label() != remap(key[length])) {
+        return result;
+      }
+    }
+  }
+
+  if (!unit.has_leaf()) {
+    return result;
+  }
+  unit = array_[node_pos ^ unit.offset()];
+  set_result(&result, static_cast<value_type>(unit.value()), length);
+  return result;
+}
+
+template <typename A, typename B, typename T, typename C>
+template <typename U>
+inline void DoubleArrayImpl<A, B, T, C>::exactMatchSearchBatch(
+    const key_type * const *keys, const std::size_t *lengths,
+    std::size_t num_keys, U *results, std::size_t node_pos) const {
+  if (has_tails_) {
+    for (std::size_t i = 0; i < num_keys; ++i) {
+      results[i] = tail_exact_match_search<U>(keys[i],
+          (lengths != NULL) ? lengths[i] : 0, node_pos);
+    }
+    return;
+  }
+
+#ifdef DARTS_HAS_AVX2_KERNEL
+  // Groups of short keys go to the AVX2 kernel, and the others are searched
+  // by exact_match_search_lanes(). The kernel handles only 4-byte units.
+  static const std::size_t NUM_KEYS = Details::X8_NUM_KEYS;
+  const bool has_small_units =
+      sizeof(unit_type) == sizeof(Details::DoubleArrayUnit);
+  std::size_t key_id = 0;
+  for ( ; has_small_units && key_id + NUM_KEYS <= num_keys;
+      key_id += NUM_KEYS) {
+    Details::value_type values[NUM_KEYS];
+    std::size_t result_lengths[NUM_KEYS];
+    if (Details::exact_match_search_x8(
+        reinterpret_cast<const Details::DoubleArrayUnit *>(array_), remap_,
+        keys + key_id, (lengths != NULL) ? (lengths + key_id) : NULL,
+        static_cast<Details::id_type>(node_pos), values, result_lengths)) {
+      for (std::size_t i = 0; i < NUM_KEYS; ++i) {
+        set_result(&results[key_id + i],
+            static_cast<value_type>(values[i]), result_lengths[i]);
+      }
+    } else {
+      exact_match_search_lanes(keys + key_id,
+          (lengths != NULL) ? (lengths + key_id) : NULL, NUM_KEYS,
+          results + key_id, node_pos);
+    }
+  }
+  exact_match_search_lanes(keys + key_id,
+      (lengths != NULL) ? (lengths + key_id) : NULL, num_keys - key_id,
+      results + key_id, node_pos);
+#else  // DARTS_HAS_AVX2_KERNEL
+  exact_match_search_lanes(keys, lengths, num_keys, results, node_pos);
+#endif  // DARTS_HAS_AVX2_KERNEL
+}
+
+template <typename A, typename B, typename T, typename C>
+template <typename U>
+inline void DoubleArrayImpl<A, B, T, C>::exact_match_search_lanes(
+    const key_type * const *keys, const std::size_t *lengths,
+    std::size_t num_keys, U *results, std::size_t node_pos) const {
+  // Each lane keeps a key in progress. `id' is the position of the unit to be
+  // read in the next round, and the unit has already been prefetched. `label'
+  // is the label which the unit must have, or <LEAF_LABEL> if the unit is the
+  // leaf unit of the key.
+  struct Lane {
+    const key_type *key;
+    std::size_t length;
+    std::size_t key_pos;
+    std::size_t key_id;
+    id_type id;
+    id_type label;
+  };
+  static const id_type LEAF_LABEL = ~0U;
+
+  Lane lanes[BATCH_SIZE];
+  std::size_t num_lanes = 0;
+  std::size_t next_key_id = 0;
+
+  const unit_type root = array_[node_pos];
+  while (num_lanes > 0 || next_key_id < num_keys) {
+    // Empty lanes are filled with new keys. The first transition of each key
+    // is done here because the unit at `node_pos' is likely to be in cache.
+    while (num_lanes < BATCH_SIZE && next_key_id < num_keys) {
+      Lane &lane = lanes[num_lanes];
+      lane.key = keys[next_key_id];
+      lane.length = (lengths != NULL) ? lengths[next_key_id] : 0;
+      if (lane.length == 0) {
+        while (lane.key[lane.length] != '\0') {
+          ++lane.length;
+        }
+      }
+      lane.key_id = next_key_id++;
+      if (lane.length != 0) {
+        lane.label = remap(lane.key[0]);
+        lane.id = static_cast<id_type>(node_pos) ^ root.offset() ^ lane.label;
+        lane.key_pos = 1;
+      } else if (root.has_leaf()) {
+        lane.label = LEAF_LABEL;
+        lane.id = static_cast<id_type>(node_pos) ^ root.offset();
+        lane.key_pos = 0;
+      } else {
+        set_result(&results[lane.key_id], static_cast<value_type>(-1), 0);
+        continue;
+      }
+      DARTS_PREFETCH(&array_[lane.id]);
+      ++num_lanes;
+    }
+
+    // Most steps move to a child unit, and a step moves to the leaf unit when
+    // the key ends. The two cases are merged because the leaf unit is the
+    // child labeled '\0'. This removes unpredictable branches from the loop.
+    for (std::size_t i = 0; i < num_lanes; ) {
+      Lane &lane = lanes[i];
+      const unit_type unit = array_[lane.id];
+      const bool has_next = lane.key_pos < lane.length;
+      if (lane.label == LEAF_LABEL || unit.label() != lane.label ||
+          (!has_next && !unit.has_leaf())) {
+        if (lane.label == LEAF_LABEL) {
+          set_result(&results[lane.key_id],
+              static_cast<value_type>(unit.value()), lane.key_pos);
+        } else {
+          set_result(&results[lane.key_id], static_cast<value_type>(-1), 0);
+        }
+        lane = lanes[--num_lanes];
+        continue;
+      }
+
+      // If the key has ended, the last character is read but masked to '\0'
+      // so that the next unit is the leaf unit.
+      const id_type label = remap(lane.key[lane.key_pos - !has_next]) &
+          (0U - has_next);
+      lane.id ^= unit.offset() ^ label;
+      lane.label = has_next ? label : LEAF_LABEL;
+      lane.key_pos += has_next;
+      DARTS_PREFETCH(&array_[lane.id]);
+      ++i;
+    }
+  }
+}
+
+template <typename A, typename B, typename T, typename C>
+template <typename U>
+inline std::size_t DoubleArrayImpl<A, B, T, C>::commonPrefixSearch(
+    const key_type *key, U *results, std::size_t max_num_results,
+    std::size_t length, std::size_t node_pos) const {
+  if (has_tails_) {
+    return tail_prefix_search(key,
+        ResultCollector<U>(this, results, max_num_results), length, node_pos);
+  }
+
+  std::size_t num_results = 0;
+
+  unit_type unit = array_[node_pos];
+  node_pos ^= unit.offset();
+  if (length != 0) {
+    for (std::size_t i = 0; i < length; ++i) {
+      node_pos ^= remap(key[i]);
+      unit = array_[node_pos];
+      if (unit.label() != remap(key[i])) {
+        return num_results;
+      }
+
+      node_pos ^= unit.offset();
+      if (unit.has_leaf()) {
+        if (num_results < max_num_results) {
+          set_result(&results[num_results], static_cast<value_type>(
+              array_[node_pos].value()), i + 1);
+        }
+        ++num_results;
+      }
+    }
+  } else {
+    for ( ; key[length] != '\0'; ++length) {
+      node_pos ^= remap(key[length]);
+      unit = array_[node_pos];
+      if (unit.label() != remap(key[length])) {
+        return num_results;
+      }
+
+      node_pos ^= unit.offset();
+      if (unit.has_leaf()) {
+        if (num_results < max_num_results) {
+          set_result(&results[num_results], static_cast<value_type>(
+              array_[node_pos].value()), length + 1);
+        }
+        ++num_results;
+      }
+    }
+  }
+
+  return num_results;
+}
+
+template <typename A, typename B, typename T, typename C>
+template <typename F>
+inline std::size_t DoubleArrayImpl<A, B, T, C>::commonPrefixSearch(
+    const key_type *key, F callback, std::size_t length,
+    std::size_t node_pos) const {
+  if (has_tails_) {
+    return tail_prefix_search(key, callback, length, node_pos);
+  }
+
+  std::size_t num_results = 0;
+
+  unit_type unit = array_[node_pos];
+  node_pos ^= unit.offset();
+  if (length != 0) {
+    for (std::size_t i = 0; i < length; ++i) {
+      node_pos ^= remap(key[i]);
+      unit = array_[node_pos];
+      if (unit.label() != remap(key[i])) {
+        return num_results;
+      }
+
+      node_pos ^= unit.offset();
+      if (unit.has_leaf()) {
+        ++num_results;
+        if (!callback(static_cast<value_type>(array_[node_pos].value()),
+            i + 1)) {
+          return num_results;
+        }
+      }
+    }
+  } else {
+    for ( ; key[length] != '\0'; ++length) {
+      node_pos ^= remap(key[length]);
+      unit = array_[node_pos];
+      if (unit.label() != remap(key[length])) {
+        return num_results;
+      }
+
+      node_pos ^= unit.offset();
+      if (unit.has_leaf()) {
+        ++num_results;
+        if (!callback(static_cast<value_type>(array_[node_pos].value()),
+            length + 1)) {
+          return num_results;
+        }
+      }
+    }
+  }
+
+  return num_results;
+}
+
+template <typename A, typename B, typename T, typename C>
+template <typename U>
+inline U DoubleArrayImpl<A, B, T, C>::longestPrefixSearch(const key_type *key,
+    std::size_t length, std::size_t node_pos) const {
+  U result;
+  set_result(&result, static_cast<value_type>(-1), 0);
+  if (has_tails_) {
+    tail_prefix_search(key, LongestCollector<U>(this, &result), length,
+        node_pos);
+    return result;
+  }
+
+  std::size_t leaf_pos = 0;
+  std::size_t leaf_length = 0;
+
+  unit_type unit = array_[node_pos];
+  node_pos ^= unit.offset();
+  if (length != 0) {
+    for (std::size_t i = 0; i < length; ++i) {
+      node_pos ^= remap(key[i]);
+      unit = array_[node_pos];
+      if (unit.label() != remap(key[i])) {
+        break;
+      }
+
+      node_pos ^= unit.offset();
+      if (unit.has_leaf()) {
+        leaf_pos = node_pos;
+        leaf_length = i + 1;
+      }
+    }
+  } else {
+    for ( ; key[length] != '\0'; ++length) {
+      node_pos ^= remap(key[length]);
+      unit = array_[node_pos];
+      if (unit.label() != remap(key[length])) {
+        break;
+      }
+
+      node_pos ^= unit.offset();
+      if (unit.has_leaf()) {
+        leaf_pos = node_pos;
+        leaf_length = length + 1;
+      }
+    }
+  }
+
+  if (leaf_length != 0) {
+    set_result(&result, static_cast<value_type>(array_[leaf_pos].value()),
+        leaf_length);
+  }
+  return result;
+}
+
+template <typename A, typename B, typename T, typename C>
+template <typename U>
+inline U DoubleArrayImpl<A, B, T, C>::tail_exact_match_search(
+    const key_type *key, std::size_t length, std::size_t node_pos) const {
+  U result;
+  set_result(&result, static_cast<value_type>(-1), 0);
+
+  // The walk stops at the end of the key or at a unit without the next
+  // transition, and then the rest of the key must be the tail of the unit.
+  unit_type unit = array_[node_pos];
+  std::size_t key_pos = 0;
+  for ( ; has_char(key, length, key_pos); ++key_pos) {
+    const std::size_t child_pos =
+        node_pos ^ unit.offset() ^ remap(key[key_pos]);
+    const unit_type child = array_[child_pos];
+    if (child.label() != remap(key[key_pos])) {
+      break;
+    }
+    node_pos = child_pos;
+    unit = child;
+  }
+  if (!unit.has_leaf()) {
+    return result;
+  }
+
+  const Details::id_type *tail = this->tail(node_pos ^ unit.offset());
+  const uchar_type *rest = reinterpret_cast<const uchar_type *>(tail + 1);
+  for ( ; *rest != '\0'; ++rest, ++key_pos) {
+    if (!has_char(key, length, key_pos) || remap(key[key_pos]) != *rest) {
+      return result;
+    }
+  }
+  if (has_char(key, length, key_pos)) {
+    return result;
+  }
+  set_result(&result, static_cast<value_type>(
+      static_cast<Details::value_type>(tail[0])), key_pos);
+  return result;
+}
+
+template <typename A, typename B, typename T, typename C>
+template <typename F>
+inline std::size_t DoubleArrayImpl<A, B, T, C>::tail_prefix_search(
+    const key_type *key, F callback, std::size_t length,
+    std::size_t node_pos) const {
+  std::size_t num_results = 0;
+
+  unit_type unit = array_[node_pos];
+  for (std::size_t key_pos = 0; has_char(key, length, key_pos); ) {
+    node_pos ^= unit.offset() ^ remap(key[key_pos]);
+    unit = array_[node_pos];
+    if (unit.label() != remap(key[key_pos])) {
+      break;
+    }
+    ++key_pos;
+
+    if (unit.has_leaf()) {
+      const Details::id_type *tail = this->tail(node_pos ^ unit.offset());
+      const uchar_type *rest = reinterpret_cast<const uchar_type *>(tail + 1);
+      std::size_t i = 0;
+      while (rest[i] != '\0' && has_char(key, length, key_pos + i) &&
+          remap(key[key_pos + i]) == rest[i]) {
+        ++i;
+      }
+      if (rest[i] == '\0') {
+        ++num_results;
+        if (!callback(static_cast<value_type>(
+            static_cast<Details::value_type>(tail[0])), key_pos + i)) {
+          return num_results;
+        }
+      }
+      // A unit with a non-empty tail has no children.
+      if (rest[0] != '\0') {
+        break;
+      }
+    }
+  }
+  return num_results;
+}
+
+template <typename A, typename B, typename T, typename C>
+inline typename DoubleArrayImpl<A, B, T, C>::value_type
+DoubleArrayImpl<A, B, T, C>::traverse(const key_type *key,
+    std::size_t &node_pos, std::size_t &key_pos, std::size_t length) const {
+  if (has_tails_) {
+    DARTS_THROW("failed to traverse double-array: tails are not supported");
+  }
+  id_type id = static_cast<id_type>(node_pos);
+  unit_type unit = array_[id];
+
+  if (length != 0) {
+    for ( ; key_pos < length; ++key_pos) {
+      id ^= unit.offset() ^ remap(key[key_pos]);
+      unit = array_[id];
+      if (unit.label() != remap(key[key_pos])) {
+        return static_cast<value_type>(-2);
+      }
+      node_pos = id;
+    }
+  } else {
+    for ( ; key[key_pos] != '\0'; ++key_pos) {
+      id ^= unit.offset() ^ remap(key[key_pos]);
+      unit = array_[id];
+      if (unit.label() != remap(key[key_pos])) {
+        return static_cast<value_type>(-2);
+      }
+      node_pos = id;
+    }
+  }
+
+  if (!unit.has_leaf()) {
+    return static_cast<value_type>(-1);
+  }
+  unit = array_[id ^ unit.offset()];
+  return static_cast<value_type>(unit.value());
+}
+
+template <typename A, typename B, typename T, typename C>
+template <typename F>
+inline std::size_t DoubleArrayImpl<A, B, T, C>::scan(const key_type *text,
+    std::size_t length, F callback) const {
+  if (has_tails_) {
+    DARTS_THROW("failed to scan text: tails are not supported");
+  } else if (links_ == NULL) {
+    DARTS_THROW("failed to scan text: no links");
+  }
+  std::size_t num_results = 0;
+
+  id_type id = 0;
+  for (std::size_t i = 0; (length != 0) ? (i < length) : (text[i] != '\0');
+      ++i) {
+    const uchar_type label = remap(text[i]);
+    for ( ; ; ) {
+      id_type child_id = id ^ array_[id].offset() ^ label;
+      if (array_[child_id].label() == label) {
+        id = child_id;
+        break;
+      } else if (id == 0) {
+        break;
+      }
+      id = links_[id].failure();
+    }
+
+    id_type output_id = array_[id].has_leaf() ? id : links_[id].output();
+    while (output_id != 0) {
+      id_type leaf_id = output_id ^ array_[output_id].offset();
+      std::size_t key_length = links_[leaf_id].length();
+      ++num_results;
+      if (!callback(static_cast<value_type>(array_[leaf_id].value()),
+          i + 1 - key_length, key_length)) {
+        return num_results;
+      }
+      output_id = links_[output_id].output();
+    }
+  }
+  return num_results;
+}
+
+template <typename A, typename B, typename T, typename C>
+template <typename F>
+inline std::size_t DoubleArrayImpl<A, B, T, C>::fuzzySearch(
+    const key_type *key, std::size_t max_distance, F callback,
+    std::size_t length, std::size_t node_pos) const {
+  if (has_tails_) {
+    DARTS_THROW("failed to search double-array: tails are not supported");
+  }
+  if (length == 0) {
+    while (key[length] != '\0') {
+      ++length;
+    }
+  }
+  const std::size_t row_size = length + 1;
+
+  // The i-th entries of `ids', `next_labels' and `rows' belong to the unit at
+  // depth i on the current path, and `path' keeps the labels on the path.
+  // A next label of 0 means that the unit has not been visited yet, and a
+  // next label larger than 0xFF means that no child is left.
+  Details::AutoPool<id_type> ids;
+  Details::AutoPool<id_type> next_labels;
+  Details::AutoPool<std::size_t> rows;
+  Details::AutoPool<key_type> path;
+
+  ids.append(static_cast<id_type>(node_pos));
+  next_labels.append(0);
+  rows.resize(row_size);
+  for (std::size_t i = 0; i < row_size; ++i) {
+    rows[i] = i;
+  }
+  path.append('\0');
+
+  std::size_t num_results = 0;
+  while (!ids.empty()) {
+    const std::size_t depth = ids.size() - 1;
+    const id_type id = ids[depth];
+    const unit_type unit = array_[id];
+    const std::size_t row_begin = depth * row_size;
+    id_type label = next_labels[depth];
+
+    if (label == 0) {
+      if (unit.has_leaf() && rows[row_begin + length] <= max_distance) {
+        ++num_results;
+        if (!callback(static_cast<value_type>(
+            array_[id ^ unit.offset()].value()), &path[0], depth,
+            rows[row_begin + length])) {
+          return num_results;
+        }
+      }
+
+      std::size_t min_distance = rows[row_begin];
+      for (std::size_t i = 1; i < row_size; ++i) {
+        if (rows[row_begin + i] < min_distance) {
+          min_distance = rows[row_begin + i];
+        }
+      }
+      if (min_distance > max_distance) {
+        label = 0x100;
+      } else if (labels_ != NULL) {
+        label = unit.has_leaf() ?
+            labels_[id ^ unit.offset()].sibling() : labels_[id].child();
+        if (label == '\0') {
+          label = 0x100;
+        }
+      } else {
+        label = 1;
+      }
+    }
+
+    if (labels_ == NULL) {
+      while (label <= 0xFF &&
+          array_[id ^ unit.offset() ^ label].label() != label) {
+        ++label;
+      }
+    }
+    if (label > 0xFF) {
+      ids.pop_back();
+      next_labels.pop_back();
+      rows.resize(row_begin);
+      path.pop_back();
+      if (!path.empty()) {
+        path[path.size() - 1] = '\0';
+      }
+      continue;
+    }
+
+    const id_type child_id = id ^ unit.offset() ^ label;
+    if (labels_ != NULL) {
+      const uchar_type sibling = labels_[child_id].sibling();
+      next_labels[depth] = (sibling != '\0') ? sibling : 0x100;
+    } else {
+      next_labels[depth] = label + 1;
+    }
+
+    rows.resize(row_begin + (row_size * 2));
+    const std::size_t child_row_begin = row_begin + row_size;
+    rows[child_row_begin] = depth + 1;
+    for (std::size_t i = 1; i < row_size; ++i) {
+      std::size_t distance = rows[row_begin + i - 1] +
+          ((remap(key[i - 1]) == label) ? 0 : 1);
+      if (rows[row_begin + i] + 1 < distance) {
+        distance = rows[row_begin + i] + 1;
+      }
+      if (rows[child_row_begin + i - 1] + 1 < distance) {
+        distance = rows[child_row_begin + i - 1] + 1;
+      }
+      rows[child_row_begin + i] = distance;
+    }
+
+    path[depth] = static_cast<key_type>(label);
+    path.append('\0');
+    ids.append(child_id);
+    next_labels.append(0);
+  }
+  return num_results;
+}
+
+template <typename A, typename B, typename T, typename C>
+template <typename F>
+inline std::size_t DoubleArrayImpl<A, B, T, C>::patternSearch(
+    Pattern *pattern, F callback, std::size_t node_pos) const {
+  if (has_tails_) {
+    DARTS_THROW("failed to search double-array: tails are not supported");
+  }
+  if (!pattern->is_valid()) {
+    return 0;
+  }
+
+  // The atoms accept characters of the pattern, so the states are mapped to
+  // labels through the remap table.
+  Details::id_type label_states[256] = { 0 };
+  for (std::size_t i = 0; i < 256; ++i) {
+    label_states[remap_[i]] |= pattern->match_states_[i];
+  }
+
+  // The i-th entries of the stacks belong to the unit at depth i on the
+  // current path, and the labels work as well as in fuzzySearch().
+  Details::AutoPool<std::size_t> &ids = pattern->ids_;
+  Details::AutoPool<Details::id_type> &next_labels = pattern->labels_;
+  Details::AutoPool<Details::id_type> &states = pattern->states_;
+  Details::AutoPool<key_type> &path = pattern->key_;
+  ids.resize(0);
+  next_labels.resize(0);
+  states.resize(0);
+  path.resize(0);
+
+  ids.append(static_cast<id_type>(node_pos));
+  next_labels.append(0);
+  states.append(pattern->start_state());
+  path.append('\0');
+
+  const Details::id_type accept_state = pattern->accept_state();
+  std::size_t num_results = 0;
+  while (!ids.empty()) {
+    const std::size_t depth = ids.size() - 1;
+    const id_type id = static_cast<id_type>(ids[depth]);
+    const unit_type unit = array_[id];
+    const Details::id_type state = states[depth];
+    Details::id_type label = next_labels[depth];
+
+    if (label == 0) {
+      if ((state & accept_state) != 0 && unit.has_leaf()) {
+        ++num_results;
+        if (!callback(static_cast<value_type>(
+            array_[id ^ unit.offset()].value()), &path[0], depth)) {
+          return num_results;
+        }
+      }
+
+      if (labels_ != NULL) {
+        label = unit.has_leaf() ?
+            labels_[id ^ unit.offset()].sibling() : labels_[id].child();
+        if (label == '\0') {
+          label = 0x100;
+        }
+      } else {
+        label = 1;
+      }
+    }
+
+    // Labels rejected by the automaton are skipped without reading units.
+    if (labels_ != NULL) {
+      while (label <= 0xFF &&
+          (state & label_states[label]) == 0) {
+        const uchar_type sibling =
+            labels_[id ^ unit.offset() ^ label].sibling();
+        label = (sibling != '\0') ? sibling : 0x100;
+      }
+    } else {
+      while (label <= 0xFF &&
+          ((state & label_states[label]) == 0 ||
+          array_[id ^ unit.offset() ^ label].label() != label)) {
+        ++label;
+      }
+    }
+    if (label > 0xFF) {
+      ids.pop_back();
+      next_labels.pop_back();
+      states.pop_back();
+      path.pop_back();
+      if (!path.empty()) {
+        path[path.size() - 1] = '\0';
+      }
+      continue;
+    }
+
+    const id_type child_id = id ^ unit.offset() ^ label;
+    if (labels_ != NULL) {
+      const uchar_type sibling = labels_[child_id].sibling();
+      next_labels[depth] = (sibling != '\0') ? sibling : 0x100;
+    } else {
+      next_labels[depth] = label + 1;
+    }
+
+    path[depth] = static_cast<key_type>(label);
+    path.append('\0');
+    ids.append(child_id);
+    next_labels.append(0);
+    states.append(pattern->transit(state, label_states[label]));
+  }
+  return num_results;
+}
+
+template <typename A, typename B, typename T, typename C>
+inline std::size_t DoubleArrayImpl<A, B, T, C>::restoreKey(
+    std::size_t key_id, key_type *key, std::size_t size) const {
+  if (has_tails_) {
+    DARTS_THROW("failed to restore key: tails are not supported");
+  } else if (parents_ == NULL) {
+    DARTS_THROW("failed to restore key: no parents");
+  }
+  if (key_id >= num_leaves_) {
+    if (size > 0) {
+      key[0] = '\0';
+    }
+    return 0;
+  }
+
+  // The labels are found from the end of the key, so the length is counted
+  // before they are stored.
+  const id_type leaf_id = leaves_[key_id];
+  std::size_t length = 0;
+  for (id_type id = parents_[leaf_id]; id != 0; id = parents_[id]) {
+    ++length;
+  }
+  if (length >= size) {
+    return length;
+  }
+
+  key[length] = '\0';
+  std::size_t key_pos = length;
+  for (id_type id = parents_[leaf_id]; id != 0; id = parents_[id]) {
+    key[--key_pos] = static_cast<key_type>(array_[id].label());
+  }
+  return length;
+}
+
+template <typename A, typename B, typename T, typename C>
+inline void DoubleArrayImpl<A, B, T, C>::PredictiveIterator::start(
+    const DoubleArrayImpl *dic, const key_type *key, std::size_t length,
+    std::size_t node_pos) {
+  dic_ = dic;
+  key_.resize(0);
+  stack_.resize(0);
+  value_ = static_cast<value_type>(-1);
+
+  id_type id = static_cast<id_type>(node_pos);
+  for (std::size_t i = 0; (length != 0) ? (i < length) : (key[i] != '\0');
+      ++i) {
+    const uchar_type label = dic_->remap(key[i]);
+    id ^= dic_->array_[id].offset() ^ label;
+    if (dic_->array_[id].label() != label) {
+      key_.resize(0);
+      return;
+    }
+    key_.append(static_cast<key_type>(label));
+  }
+  key_.append('\0');
+  push(id);
+}
+
+template <typename A, typename B, typename T, typename C>
+inline void DoubleArrayImpl<A, B, T, C>::PredictiveIterator::push(
+    std::size_t id) {
+  Frame frame;
+  frame.id = id;
+  frame.label = (dic_->labels_ != NULL) ? dic_->labels_[id].child() : 0;
+  stack_.append(frame);
+}
+
+template <typename A, typename B, typename T, typename C>
+inline bool DoubleArrayImpl<A, B, T, C>::PredictiveIterator::next() {
+  while (!stack_.empty()) {
+    Frame &frame = stack_[stack_.size() - 1];
+    id_type label = frame.label;
+    if (label > 0xFF) {
+      stack_.pop_back();
+      if (!stack_.empty()) {
+        key_.pop_back();
+        key_[key_.size() - 1] = '\0';
+      }
+      continue;
+    }
+
+    const unit_type unit = dic_->array_[frame.id];
+    if (dic_->labels_ != NULL) {
+      if (label == '\0' && !unit.has_leaf()) {
+        frame.label = 0x100;
+        continue;
+      }
+      uchar_type sibling = dic_->labels_[frame.id ^ unit.offset() ^
+          label].sibling();
+      frame.label = (sibling != '\0') ? sibling : 0x100;
+    } else {
+      // A leaf unit is tested by has_leaf() because its label() is invalid.
+      if (label == '\0' && !unit.has_leaf()) {
+        label = 1;
+      }
+      while (label != '\0' && label <= 0xFF &&
+          dic_->array_[frame.id ^ unit.offset() ^ label].label() != label) {
+        ++label;
+      }
+      frame.label = label + 1;
+      if (label > 0xFF) {
+        continue;
+      }
+    }
+
+    const id_type child_id = frame.id ^ unit.offset() ^ label;
+    if (label == '\0') {
+      value_ = static_cast<value_type>(dic_->array_[child_id].value());
+      return true;
+    }
+    key_[key_.size() - 1] = static_cast<key_type>(label);
+    key_.append('\0');
+    push(child_id);
+  }
+  return false;
+}
+
+namespace Details {
+
+//
+// Succinct bit vector.
+//
+
+class BitVector {
+ public:
+  BitVector() : units_(), ranks_(), num_ones_(0), size_(0) {}
+  ~BitVector() {
+    clear();
+  }
+
+  bool operator[](std::size_t id) const {
+    return (units_[id / UNIT_SIZE] >> (id % UNIT_SIZE) & 1) == 1;
+  }
+
+  id_type rank(std::size_t id) const {
+    std::size_t unit_id = id / UNIT_SIZE;
+    return ranks_[unit_id] + pop_count(units_[unit_id]
+        & (~0U >> (UNIT_SIZE - (id % UNIT_SIZE) - 1)));
+  }
+
+  void set(std::size_t id, bool bit) {
+    if (bit) {
+      units_[id / UNIT_SIZE] |= 1U << (id % UNIT_SIZE);
+    } else {
+      units_[id / UNIT_SIZE] &= ~(1U << (id % UNIT_SIZE));
+    }
+  }
+
+  bool empty() const {
+    return units_.empty();
+  }
+  std::size_t num_ones() const {
+    return num_ones_;
+  }
+  std::size_t size() const {
+    return size_;
+  }
+
+  void append() {
+    if ((size_ % UNIT_SIZE) == 0) {
+      units_.append(0);
+    }
+    ++size_;
+  }
+  void build();
+
+  void clear() {
+    units_.clear();
+    ranks_.clear();
+  }
+
+ private:
+  enum { UNIT_SIZE = sizeof(id_type) * 8 };
+
+  AutoPool<id_type> units_;
+  AutoArray<id_type> ranks_;
+  std::size_t num_ones_;
+  std::size_t size_;
+
+  // Disallows copy and assignment.
+  BitVector(const BitVector &);
+  BitVector &operator=(const BitVector &);
+
+  static id_type pop_count(id_type unit) {
+    unit = ((unit & 0xAAAAAAAA) >> 1) + (unit & 0x55555555);
+    unit = ((unit & 0xCCCCCCCC) >> 2) + (unit & 0x33333333);
+    unit = ((unit >> 4) + unit) & 0x0F0F0F0F;
+    unit += unit >> 8;
+    unit += unit >> 16;
+    return unit & 0xFF;
+  }
+};
+
+inline void BitVector::build() {
+  try {
+    ranks_.reset(new id_type[units_.size()]);
+  } catch (const std::bad_alloc &) {
+    DARTS_THROW("failed to build rank index: std::bad_alloc");
+  }
+
+  num_ones_ = 0;
+  for (std::size_t i = 0; i < units_.size(); ++i) {
+    ranks_[i] = num_ones_;
+    num_ones_ += pop_count(units_[i]);
+  }
+}
+
+//
+// Keyset.
+//
+
+template <typename T>
+class Keyset {
+ public:
+  Keyset(std::size_t num_keys, const char_type * const *keys,
+      const std::size_t *lengths, const T *values,
+      const uchar_type *remap_table = NULL) :
+      num_keys_(num_keys), keys_(keys), lengths_(lengths), values_(values),
+      remap_table_(remap_table) {}
+
+  std::size_t num_keys() const {
+    return num_keys_;
+  }
+  const char_type *keys(std::size_t id) const {
+    return keys_[id];
+  }
+  uchar_type keys(std::size_t key_id, std::size_t char_id) const {
+    if (has_lengths() && char_id >= lengths_[key_id])
+      return '\0';
+    if (has_remap_table()) {
+      return remap_table_[static_cast<uchar_type>(keys_[key_id][char_id])];
+    }
+    return keys_[key_id][char_id];
+  }
+
+  // If a remap table is given, keys(key_id, char_id) returns remapped labels
+  // but keys(id) still returns the original key.
+  bool has_remap_table() const {
+    return remap_table_ != NULL;
+  }
+
+  bool has_lengths() const {
+    return lengths_ != NULL;
+  }
+  std::size_t lengths(std::size_t id) const {
+    if (has_lengths()) {
+      return lengths_[id];
+    }
+    std::size_t length = 0;
+    while (keys_[id][length] != '\0') {
+      ++length;
+    }
+    return length;
+  }
+
+  bool has_values() const {
+    return values_ != NULL;
+  }
+  const value_type values(std::size_t id) const {
+    if (has_values()) {
+      return static_cast<value_type>(values_[id]);
+    }
+    return static_cast<value_type>(id);
+  }
+
+ private:
+  std::size_t num_keys_;
+  const char_type * const * keys_;
+  const std::size_t *lengths_;
+  const T *values_;
+  const uchar_type *remap_table_;
+
+  // Disallows copy and assignment.
+  Keyset(const Keyset &);
+  Keyset &operator=(const Keyset &);
+};
+
+//
+// Node of Directed Acyclic Word Graph (DAWG).
+//
+
+class DawgNode {
+ public:
+  DawgNode() : child_(0), sibling_(0), label_('\0'),
+    is_state_(false), has_sibling_(false) {}
+
+  void set_child(id_type child) {
+    child_ = child;
+  }
+  void set_sibling(id_type sibling) {
+    sibling_ = sibling;
+  }
+  void set_value(value_type value) {
+    child_ = value;
+  }
+  void set_label(uchar_type label) {
+    label_ = label;
+  }
+  void set_is_state(bool is_state) {
+    is_state_ = is_state;
+  }
+  void set_has_sibling(bool has_sibling) {
+    has_sibling_ = has_sibling;
+  }
+
+  id_type child() const {
+    return child_;
+  }
+  id_type sibling() const {
+    return sibling_;
+  }
+  value_type value() const {
+    return static_cast<value_type>(child_);
+  }
+  uchar_type label() const {
+    return label_;
+  }
+  bool is_state() const {
+    return is_state_;
+  }
+  bool has_sibling() const {
+    return has_sibling_;
+  }
+
+  id_type unit() const {
+    if (label_ == '\0') {
+      return (child_ << 1) | (has_sibling_ ? 1 : 0);
+    }
+    return (child_ << 2) | (is_state_ ? 2 : 0) | (has_sibling_ ? 1 : 0);
+  }
+
+ private:
+  id_type child_;
+  id_type sibling_;
+  uchar_type label_;
+  bool is_state_;
+  bool has_sibling_;
+
+  // Copyable.
+};
+
+//
+// Fixed unit of Directed Acyclic Word Graph (DAWG).
+//
+
+class DawgUnit {
+ public:
+  explicit DawgUnit(id_type unit = 0) : unit_(unit) {}
+  DawgUnit(const DawgUnit &unit) : unit_(unit.unit_) {}
+
+  DawgUnit &operator=(id_type unit) {
+    unit_ = unit;
+    return *this;
+  }
+
+  id_type unit() const {
+    return unit_;
+  }
+
+  id_type child() const {
+    return unit_ >> 2;
+  }
+  bool has_sibling() const {
+    return (unit_ & 1) == 1;
+  }
+  value_type value() const {
+    return static_cast<value_type>(unit_ >> 1);
+  }
+  bool is_state() const {
+    return (unit_ & 2) == 2;
+  }
+
+ private:
+  id_type unit_;
+
+  // Copyable.
+};
+
+//
+// Directed Acyclic Word Graph (DAWG) builder.
+//
+
+class DawgBuilder {
+ public:
+  // A unit keeps the ID of its child in 30 bits, so a DAWG has at most
+  // <MAX_SIZE> units.
+  enum { MAX_SIZE = 1 << 30 };
+
+  DawgBuilder() : nodes_(), units_(), labels_(), is_intersections_(),
+    table_(), node_stack_(), recycle_bin_(), num_states_(0),
+    max_size_(MAX_SIZE) {}
+  ~DawgBuilder() {
+    clear();
+  }
+
+  id_type root() const {
+    return 0;
+  }
+
+  id_type child(id_type id) const {
+    return units_[id].child();
+  }
+  id_type sibling(id_type id) const {
+    return units_[id].has_sibling() ? (id + 1) : 0;
+  }
+  int value(id_type id) const {
+    return units_[id].value();
+  }
+
+  bool is_leaf(id_type id) const {
+    return label(id) == '\0';
+  }
+  uchar_type label(id_type id) const {
+    return labels_[id];
+  }
+
+  bool is_intersection(id_type id) const {
+    return is_intersections_[id];
+  }
+  id_type intersection_id(id_type id) const {
+    return is_intersections_.rank(id) - 1;
+  }
+
+  std::size_t num_intersections() const {
+    return is_intersections_.num_ones();
+  }
+
+  std::size_t size() const {
+    return units_.size();
+  }
+
+  // set_max_size() lowers the maximum number of units, so that the limit can
+  // be tested without a huge DAWG. A DAWG which reaches the maximum throws a
+  // <Darts::Exception>.
+  void set_max_size(std::size_t max_size) {
+    max_size_ = (max_size < static_cast<std::size_t>(MAX_SIZE)) ?
+        max_size : static_cast<std::size_t>(MAX_SIZE);
+  }
+
+  void init();
+  void finish();
+
+  void insert(const char *key, std::size_t length, value_type value);
+
+  void clear();
+
+ private:
+  enum { INITIAL_TABLE_SIZE = 1 << 10 };
+
+  AutoPool<DawgNode> nodes_;
+  AutoPool<DawgUnit> units_;
+  AutoPool<uchar_type> labels_;
+  BitVector is_intersections_;
+  AutoPool<id_type> table_;
+  AutoStack<id_type> node_stack_;
+  AutoStack<id_type> recycle_bin_;
+  std::size_t num_states_;
+  std::size_t max_size_;
+
+  // Disallows copy and assignment.
+  DawgBuilder(const DawgBuilder &);
+  DawgBuilder &operator=(const DawgBuilder &);
+
+  void flush(id_type id);
+
+  void expand_table();
+
+  id_type find_unit(id_type id, id_type *hash_id) const;
+  id_type find_node(id_type node_id, id_type *hash_id) const;
+
+  bool are_equal(id_type node_id, id_type unit_id) const;
+
+  id_type hash_unit(id_type id) const;
+  id_type hash_node(id_type id) const;
+
+  id_type append_node();
+  id_type append_unit();
+
+  void free_node(id_type id) {
+    recycle_bin_.push(id);
+  }
+
+  static id_type hash(id_type key) {
+    key = ~key + (key << 15);  // key = (key << 15) - key - 1;
+    key = key ^ (key >> 12);
+    key = key + (key << 2);
+    key = key ^ (key >> 4);
+    key = key * 2057;  // key = (key + (key << 3)) + (key << 11);
+    key = key ^ (key >> 16);
+    return key;
+  }
+};
+
+inline void DawgBuilder::init() {
+  table_.resize(INITIAL_TABLE_SIZE, 0);
+
+  append_node();
+  append_unit();
+
+  num_states_ = 1;
+
+  nodes_[0].set_label(0xFF);
+  node_stack_.push(0);
+}
+
+inline void DawgBuilder::finish() {
+  flush(0);
+
+  units_[0] = nodes_[0].unit();
+  labels_[0] = nodes_[0].label();
+
+  nodes_.clear();
+  table_.clear();
+  node_stack_.clear();
+  recycle_bin_.clear();
+
+  is_intersections_.build();
+}
+
+inline void DawgBuilder::insert(const char *key, std::size_t length,
+    value_type value) {
+  if (value < 0) {
+    DARTS_THROW("failed to insert key: negative value");
+  } else if (length == 0) {
+    DARTS_THROW("failed to insert key: zero-length key");
+  }
+
+  id_type id = 0;
+  std::size_t key_pos = 0;
+
+  for ( ; key_pos <= length; ++key_pos) {
+    id_type child_id = nodes_[id].child();
+    if (child_id == 0) {
+      break;
+    }
+
+    uchar_type key_label = static_cast<uchar_type>(key[key_pos]);
+    if (key_pos < length && key_label == '\0') {
+      DARTS_THROW("failed to insert key: invalid null character");
+    }
+
+    uchar_type unit_label = nodes_[child_id].label();
+    if (key_label < unit_label) {
+      DARTS_THROW("failed to insert key: wrong key order");
+    } else if (key_label > unit_label) {
+      nodes_[child_id].set_has_sibling(true);
+      flush(child_id);
+      break;
+    }
+    id = child_id;
+  }
+
+  if (key_pos > length) {
+    return;
+  }
+
+  for ( ; key_pos <= length; ++key_pos) {
+    uchar_type key_label = static_cast<uchar_type>(
+        (key_pos < length) ? key[key_pos] : '\0');
+    id_type child_id = append_node();
+
+    if (nodes_[id].child() == 0) {
+      nodes_[child_id].set_is_state(true);
+    }
+    nodes_[child_id].set_sibling(nodes_[id].child());
+    nodes_[child_id].set_label(key_label);
+    nodes_[id].set_child(child_id);
+    node_stack_.push(child_id);
+
+    id = child_id;
+  }
+  nodes_[id].set_value(value);
+}
+
+inline void DawgBuilder::clear() {
+  nodes_.clear();
+  units_.clear();
+  labels_.clear();
+  is_intersections_.clear();
+  table_.clear();
+  node_stack_.clear();
+  recycle_bin_.clear();
+  num_states_ = 0;
+}
+
+inline void DawgBuilder::flush(id_type id) {
+  while (node_stack_.top() != id) {
+    id_type node_id = node_stack_.top();
+    node_stack_.pop();
+
+    if (num_states_ >= table_.size() - (table_.size() >> 2)) {
+      expand_table();
+    }
+
+    id_type num_siblings = 0;
+    for (id_type i = node_id; i != 0; i = nodes_[i].sibling()) {
+      ++num_siblings;
+    }
+
+    id_type hash_id;
+    id_type match_id = find_node(node_id, &hash_id);
+    if (match_id != 0) {
+      is_intersections_.set(match_id, true);
+    } else {
+      id_type unit_id = 0;
+      for (id_type i = 0; i < num_siblings; ++i) {
+        unit_id = append_unit();
+      }
+      for (id_type i = node_id; i != 0; i = nodes_[i].sibling()) {
+        units_[unit_id] = nodes_[i].unit();
+        labels_[unit_id] = nodes_[i].label();
+        --unit_id;
+      }
+      match_id = unit_id + 1;
+      table_[hash_id] = match_id;
+      ++num_states_;
+    }
+
+    for (id_type i = node_id, next; i != 0; i = next) {
+      next = nodes_[i].sibling();
+      free_node(i);
+    }
 
-  bool empty() const {
-    return pool_.empty();
-  }
-  std::size_t size() const {
-    return pool_.size();
+    nodes_[node_stack_.top()].set_child(match_id);
   }
+  node_stack_.pop();
+}
 
-  void push(const T &value) {
-    pool_.push_back(value);
-  }
-  void pop() {
-    pool_.pop_back();
-  }
+inline void DawgBuilder::expand_table() {
+  std::size_t table_size = table_.size() << 1;
+  table_.clear();
+  table_.resize(table_size, 0);
 
-  void clear() {
-    pool_.clear();
+  for (std::size_t i = 1; i < units_.size(); ++i) {
+    id_type id = static_cast<id_type>(i);
+    if (labels_[id] == '\0' || units_[id].is_state()) {
+      id_type hash_id;
+      find_unit(id, &hash_id);
+      table_[hash_id] = id;
+    }
   }
+}
 
- private:
-  AutoPool<T> pool_;
+inline id_type DawgBuilder::find_unit(id_type id, id_type *hash_id) const {
+  *hash_id = hash_unit(id) % table_.size();
+  for ( ; ; *hash_id = (*hash_id + 1) % table_.size()) {
+    id_type unit_id = table_[*hash_id];
+    if (unit_id == 0) {
+      break;
+    }
 
-  // Disallows copy and assignment.
-  AutoStack(const AutoStack &);
-  AutoStack &operator=(const AutoStack &);
-};
+    // There must not be the same unit.
+  }
+  return 0;
+}
 
-//
-// Succinct bit vector.
-//
+inline id_type DawgBuilder::find_node(id_type node_id,
+    id_type *hash_id) const {
+  *hash_id = hash_node(node_id) % table_.size();
+  for ( ; ; *hash_id = (*hash_id + 1) % table_.size()) {
+    id_type unit_id = table_[*hash_id];
+    if (unit_id == 0) {
+      break;
+    }
 
-class BitVector {
- public:
-  BitVector() : units_(), ranks_(), num_ones_(0), size_(0) {}
-  ~BitVector() {
-    clear();
+    if (are_equal(node_id, unit_id)) {
+      return unit_id;
+    }
   }
+  return 0;
+}
 
-  bool operator[](std::size_t id) const {
-    return (units_[id / UNIT_SIZE] >> (id % UNIT_SIZE) & 1) == 1;
+inline bool DawgBuilder::are_equal(id_type node_id, id_type unit_id) const {
+  for (id_type i = nodes_[node_id].sibling(); i != 0;
+      i = nodes_[i].sibling()) {
+    if (units_[unit_id].has_sibling() == false) {
+      return false;
+    }
+    ++unit_id;
   }
-
-  id_type rank(std::size_t id) const {
-    std::size_t unit_id = id / UNIT_SIZE;
-    return ranks_[unit_id] + pop_count(units_[unit_id]
-        & (~0U >> (UNIT_SIZE - (id % UNIT_SIZE) - 1)));
+  if (units_[unit_id].has_sibling() == true) {
+    return false;
   }
 
-  void set(std::size_t id, bool bit) {
-    if (bit) {
-      units_[id / UNIT_SIZE] |= 1U << (id % UNIT_SIZE);
-    } else {
-      units_[id / UNIT_SIZE] &= ~(1U << (id % UNIT_SIZE));
+  for (id_type i = node_id; i != 0; i = nodes_[i].sibling(), --unit_id) {
+    if (nodes_[i].unit() != units_[unit_id].unit() ||
+        nodes_[i].label() != labels_[unit_id]) {
+      return false;
     }
   }
+  return true;
+}
 
-  bool empty() const {
-    return units_.empty();
-  }
-  std::size_t num_ones() const {
-    return num_ones_;
-  }
-  std::size_t size() const {
-    return size_;
-  }
+inline id_type DawgBuilder::hash_unit(id_type id) const {
+  id_type hash_value = 0;
+  for ( ; id != 0; ++id) {
+    id_type unit = units_[id].unit();
+    uchar_type label = labels_[id];
+    hash_value ^= hash((label << 24) ^ unit);
 
-  void append() {
-    if ((size_ % UNIT_SIZE) == 0) {
-      units_.append(0);
+    if (units_[id].has_sibling() == false) {
+      break;
     }
-    ++size_;
   }
-  void build();
+  return hash_value;
+}
 
-  void clear() {
-    units_.clear();
-    ranks_.clear();
+inline id_type DawgBuilder::hash_node(id_type id) const {
+  id_type hash_value = 0;
+  for ( ; id != 0; id = nodes_[id].sibling()) {
+    id_type unit = nodes_[id].unit();
+    uchar_type label = nodes_[id].label();
+    hash_value ^= hash((label << 24) ^ unit);
   }
+  return hash_value;
+}
 
- private:
-  enum { UNIT_SIZE = sizeof(id_type) * 8 };
-
-  AutoPool<id_type> units_;
-  AutoArray<id_type> ranks_;
-  std::size_t num_ones_;
-  std::size_t size_;
-
-  // Disallows copy and assignment.
-  BitVector(const BitVector &);
-  BitVector &operator=(const BitVector &);
-
-  static id_type pop_count(id_type unit) {
-    unit = ((unit & 0xAAAAAAAA) >> 1) + (unit & 0x55555555);
-    unit = ((unit & 0xCCCCCCCC) >> 2) + (unit & 0x33333333);
-    unit = ((unit >> 4) + unit) & 0x0F0F0F0F;
-    unit += unit >> 8;
-    unit += unit >> 16;
-    return unit & 0xFF;
+inline id_type DawgBuilder::append_unit() {
+  if (is_intersections_.size() >= max_size_) {
+    DARTS_THROW("failed to build DAWG: too many units");
   }
-};
+  is_intersections_.append();
+  units_.append();
+  labels_.append();
 
-inline void BitVector::build() {
-  try {
-    ranks_.reset(new id_type[units_.size()]);
-  } catch (const std::bad_alloc &) {
-    DARTS_THROW("failed to build rank index: std::bad_alloc");
-  }
+  return static_cast<id_type>(is_intersections_.size() - 1);
+}
 
-  num_ones_ = 0;
-  for (std::size_t i = 0; i < units_.size(); ++i) {
-    ranks_[i] = num_ones_;
-    num_ones_ += pop_count(units_[i]);
+inline id_type DawgBuilder::append_node() {
+  id_type id;
+  if (recycle_bin_.empty()) {
+    id = static_cast<id_type>(nodes_.size());
+    nodes_.append();
+  } else {
+    id = recycle_bin_.top();
+    nodes_[id] = DawgNode();
+    recycle_bin_.pop();
   }
+  return id;
 }
 
 //
-// Keyset.
+// Unit of double-array builder.
 //
 
-template <typename T>
-class Keyset {
+class DoubleArrayBuilderUnit {
  public:
-  Keyset(std::size_t num_keys, const char_type * const *keys,
-      const std::size_t *lengths, const T *values) :
-      num_keys_(num_keys), keys_(keys), lengths_(lengths), values_(values) {}
+  DoubleArrayBuilderUnit() : unit_(0) {}
 
-  std::size_t num_keys() const {
-    return num_keys_;
-  }
-  const char_type *keys(std::size_t id) const {
-    return keys_[id];
+  void set_has_leaf(bool has_leaf) {
+    if (has_leaf) {
+      unit_ |= 1U << 8;
+    } else {
+      unit_ &= ~(1U << 8);
+    }
   }
-  uchar_type keys(std::size_t key_id, std::size_t char_id) const {
-    if (has_lengths() && char_id >= lengths_[key_id])
-      return '\0';
-    return keys_[key_id][char_id];
+  void set_value(value_type value) {
+    unit_ = value | (1U << 31);
   }
-
-  bool has_lengths() const {
-    return lengths_ != NULL;
+  void set_label(uchar_type label) {
+    unit_ = (unit_ & ~0xFFU) | label;
   }
-  std::size_t lengths(std::size_t id) const {
-    if (has_lengths()) {
-      return lengths_[id];
+  void set_offset(id_type offset) {
+    if (offset >= 1U << 29) {
+      DARTS_THROW("failed to modify unit: too large offset");
     }
-    std::size_t length = 0;
-    while (keys_[id][length] != '\0') {
-      ++length;
+    unit_ &= (1U << 31) | (1U << 8) | 0xFF;
+    if (offset < 1U << 21) {
+      unit_ |= (offset << 10);
+    } else {
+      unit_ |= (offset << 2) | (1U << 9);
     }
-    return length;
   }
 
-  bool has_values() const {
-    return values_ != NULL;
+ private:
+  id_type unit_;
+
+  // Copyable.
+};
+
+// <DoubleArrayLargeBuilderUnit> is the builder unit of <DoubleArrayLargeUnit>.
+class DoubleArrayLargeBuilderUnit {
+ public:
+  DoubleArrayLargeBuilderUnit() : unit_(0), offset_(0) {}
+
+  void set_has_leaf(bool has_leaf) {
+    if (has_leaf) {
+      unit_ |= 1U << 8;
+    } else {
+      unit_ &= ~(1U << 8);
+    }
   }
-  const value_type values(std::size_t id) const {
-    if (has_values()) {
-      return static_cast<value_type>(values_[id]);
+  void set_value(value_type value) {
+    unit_ = value | (1U << 31);
+    offset_ = 0;
+  }
+  void set_label(uchar_type label) {
+    unit_ = (unit_ & ~0xFFU) | label;
+  }
+  void set_offset(std::size_t offset) {
+    const std::size_t upper_offset = (offset >> 16) >> 16;
+    if (upper_offset >= 1U << 22) {
+      DARTS_THROW("failed to modify unit: too large offset");
     }
-    return static_cast<value_type>(id);
+    unit_ &= (1U << 31) | (1U << 8) | 0xFF;
+    unit_ |= static_cast<id_type>(upper_offset) << 9;
+    offset_ = static_cast<id_type>(offset);
   }
 
  private:
-  std::size_t num_keys_;
-  const char_type * const * keys_;
-  const std::size_t *lengths_;
-  const T *values_;
+  id_type unit_;
+  id_type offset_;
 
-  // Disallows copy and assignment.
-  Keyset(const Keyset &);
-  Keyset &operator=(const Keyset &);
+  // Copyable.
 };
 
 //
-// Node of Directed Acyclic Word Graph (DAWG).
+// Extra block of double-array builder.
 //
 
-class DawgNode {
+// <DoubleArrayBuilderExtraBlock> keeps the flags of a block of units being
+// arranged as bitmaps. A unit is fixed once it is reserved, and it is used
+// once it becomes the child base of a unit. The flag of unit `id' is bit
+// (id % 32) of word (id % 256 / 32), so a child base `offset' and its child
+// `offset ^ label' are in the same block, and the bits of the children of
+// all the bases in a block are obtained by permuting the words and bits of
+// the block with `label'. find_child() uses this to test all the bases in a
+// block at once.
+class DoubleArrayBuilderExtraBlock {
  public:
-  DawgNode() : child_(0), sibling_(0), label_('\0'),
-    is_state_(false), has_sibling_(false) {}
+  enum { NUM_WORDS = 8 };
+  enum { NUM_UNITS = NUM_WORDS * 32 };
 
-  void set_child(id_type child) {
-    child_ = child;
-  }
-  void set_sibling(id_type sibling) {
-    sibling_ = sibling;
-  }
-  void set_value(value_type value) {
-    child_ = value;
-  }
-  void set_label(uchar_type label) {
-    label_ = label;
-  }
-  void set_is_state(bool is_state) {
-    is_state_ = is_state;
-  }
-  void set_has_sibling(bool has_sibling) {
-    has_sibling_ = has_sibling;
+  DoubleArrayBuilderExtraBlock() : num_unfixed_(NUM_UNITS) {
+    clear();
   }
 
-  id_type child() const {
-    return child_;
-  }
-  id_type sibling() const {
-    return sibling_;
+  void set_is_fixed(std::size_t id) {
+    if (!is_fixed(id)) {
+      fixed_[(id / 32) % NUM_WORDS] |= 1U << (id % 32);
+      --num_unfixed_;
+    }
   }
-  value_type value() const {
-    return static_cast<value_type>(child_);
+  void set_is_used(std::size_t id) {
+    used_[(id / 32) % NUM_WORDS] |= 1U << (id % 32);
   }
-  uchar_type label() const {
-    return label_;
+
+  bool is_fixed(std::size_t id) const {
+    return ((fixed_[(id / 32) % NUM_WORDS] >> (id % 32)) & 1) != 0;
   }
-  bool is_state() const {
-    return is_state_;
+  bool is_used(std::size_t id) const {
+    return ((used_[(id / 32) % NUM_WORDS] >> (id % 32)) & 1) != 0;
   }
-  bool has_sibling() const {
-    return has_sibling_;
+  // is_full() returns true if all the units in this block are fixed.
+  bool is_full() const {
+    return num_unfixed_ == 0;
   }
 
-  id_type unit() const {
-    if (label_ == '\0') {
-      return (child_ << 1) | (has_sibling_ ? 1 : 0);
+  // find_child() returns the lowest child `id % 256' in this block which is
+  // not fixed and whose base `id ^ labels[0]' is not used, while the
+  // children `id ^ labels[0] ^ labels[i]' are not fixed either. It returns
+  // <NUM_UNITS> if there is no such child. The unfixed children are tested
+  // one by one at first because one of them often fits, and the bitmaps are
+  // permuted only after a few tests fail.
+  inline std::size_t find_child(const uchar_type *labels,
+      std::size_t num_labels) const;
+
+  void clear() {
+    for (std::size_t i = 0; i < NUM_WORDS; ++i) {
+      fixed_[i] = 0;
+      used_[i] = 0;
     }
-    return (child_ << 2) | (is_state_ ? 2 : 0) | (has_sibling_ ? 1 : 0);
+    num_unfixed_ = NUM_UNITS;
   }
 
  private:
-  id_type child_;
-  id_type sibling_;
-  uchar_type label_;
-  bool is_state_;
-  bool has_sibling_;
+  id_type fixed_[NUM_WORDS];
+  id_type used_[NUM_WORDS];
+  std::size_t num_unfixed_;
 
   // Copyable.
-};
-
-//
-// Fixed unit of Directed Acyclic Word Graph (DAWG).
-//
 
-class DawgUnit {
- public:
-  explicit DawgUnit(id_type unit = 0) : unit_(unit) {}
-  DawgUnit(const DawgUnit &unit) : unit_(unit.unit_) {}
+  inline std::size_t find_child_in_bitmaps(const uchar_type *labels,
+      std::size_t num_labels) const;
+  static inline std::size_t lowest_bit(id_type bits);
+  // permute() sets bit i of `bits' to bit (i ^ label) of `flags'.
+  static inline void permute(const id_type *flags, uchar_type label,
+      id_type *bits);
+};
 
-  DawgUnit &operator=(id_type unit) {
-    unit_ = unit;
-    return *this;
+inline std::size_t DoubleArrayBuilderExtraBlock::find_child(
+    const uchar_type *labels, std::size_t num_labels) const {
+  // find_child_in_bitmaps() takes over after about <NUM_WORDS> tests.
+  std::size_t num_tests = NUM_WORDS;
+  for (std::size_t w = 0; w < NUM_WORDS; ++w) {
+    for (id_type unfixed = ~fixed_[w]; unfixed != 0; unfixed &= unfixed - 1) {
+      const std::size_t child = (w * 32) + lowest_bit(unfixed);
+      if (is_used(child ^ labels[0])) {
+        if (--num_tests == 0) {
+          return find_child_in_bitmaps(labels, num_labels);
+        }
+        continue;
+      }
+      std::size_t i = 1;
+      while (i < num_labels && !is_fixed(child ^ labels[0] ^ labels[i])) {
+        ++i;
+      }
+      if (i == num_labels) {
+        return child;
+      }
+      if (num_tests <= i) {
+        return find_child_in_bitmaps(labels, num_labels);
+      }
+      num_tests -= i;
+    }
   }
+  return NUM_UNITS;
+}
 
-  id_type unit() const {
-    return unit_;
+inline std::size_t DoubleArrayBuilderExtraBlock::find_child_in_bitmaps(
+    const uchar_type *labels, std::size_t num_labels) const {
+  id_type bits[NUM_WORDS];
+  id_type flags[NUM_WORDS];
+  permute(used_, labels[0], flags);
+  for (std::size_t i = 0; i < NUM_WORDS; ++i) {
+    bits[i] = ~fixed_[i] & ~flags[i];
+  }
+  for (std::size_t j = 1; j < num_labels; ++j) {
+    permute(fixed_, static_cast<uchar_type>(labels[0] ^ labels[j]), flags);
+    id_type any_bits = 0;
+    for (std::size_t i = 0; i < NUM_WORDS; ++i) {
+      bits[i] &= ~flags[i];
+      any_bits |= bits[i];
+    }
+    if (any_bits == 0) {
+      return NUM_UNITS;
+    }
   }
 
-  id_type child() const {
-    return unit_ >> 2;
-  }
-  bool has_sibling() const {
-    return (unit_ & 1) == 1;
-  }
-  value_type value() const {
-    return static_cast<value_type>(unit_ >> 1);
-  }
-  bool is_state() const {
-    return (unit_ & 2) == 2;
+  for (std::size_t i = 0; i < NUM_WORDS; ++i) {
+    if (bits[i] != 0) {
+      return (i * 32) + lowest_bit(bits[i]);
+    }
   }
+  return NUM_UNITS;
+}
 
- private:
-  id_type unit_;
+// lowest_bit() returns the position of the lowest 1 of `bits' by using a de
+// Bruijn sequence.
+inline std::size_t DoubleArrayBuilderExtraBlock::lowest_bit(id_type bits) {
+  static const unsigned char TABLE[32] = {
+    0, 1, 28, 2, 29, 14, 24, 3, 30, 22, 20, 15, 25, 17, 4, 8,
+    31, 27, 13, 23, 21, 19, 16, 7, 26, 12, 18, 6, 11, 5, 10, 9
+  };
+  return TABLE[static_cast<id_type>((bits & (~bits + 1)) * 0x077CB531U) >> 27];
+}
 
-  // Copyable.
-};
+// The bits are swapped in groups of 1, 2, 4, 8 and 16 bits for the lower 5
+// bits of `label', and the words are swapped for the upper 3 bits.
+inline void DoubleArrayBuilderExtraBlock::permute(const id_type *flags,
+    uchar_type label, id_type *bits) {
+#ifdef DARTS_HAS_AVX2_KERNEL
+  const __m256i indices = _mm256_xor_si256(
+      _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(label >> 5));
+  __m256i words = _mm256_permutevar8x32_epi32(_mm256_loadu_si256(
+      reinterpret_cast<const __m256i *>(flags)), indices);
+  if ((label & 1) != 0) {
+    const __m256i mask = _mm256_set1_epi32(0x55555555);
+    words = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(words, mask), 1),
+        _mm256_and_si256(_mm256_srli_epi32(words, 1), mask));
+  }
+  if ((label & 2) != 0) {
+    const __m256i mask = _mm256_set1_epi32(0x33333333);
+    words = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(words, mask), 2),
+        _mm256_and_si256(_mm256_srli_epi32(words, 2), mask));
+  }
+  if ((label & 4) != 0) {
+    const __m256i mask = _mm256_set1_epi32(0x0F0F0F0F);
+    words = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(words, mask), 4),
+        _mm256_and_si256(_mm256_srli_epi32(words, 4), mask));
+  }
+  if ((label & 8) != 0) {
+    const __m256i mask = _mm256_set1_epi32(0x00FF00FF);
+    words = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(words, mask), 8),
+        _mm256_and_si256(_mm256_srli_epi32(words, 8), mask));
+  }
+  if ((label & 16) != 0) {
+    words = _mm256_or_si256(_mm256_slli_epi32(words, 16),
+        _mm256_srli_epi32(words, 16));
+  }
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(bits), words);
+#else  // DARTS_HAS_AVX2_KERNEL
+  for (std::size_t i = 0; i < NUM_WORDS; ++i) {
+    id_type word = flags[i ^ (label >> 5)];
+    if ((label & 1) != 0) {
+      word = ((word & 0x55555555U) << 1) | ((word >> 1) & 0x55555555U);
+    }
+    if ((label & 2) != 0) {
+      word = ((word & 0x33333333U) << 2) | ((word >> 2) & 0x33333333U);
+    }
+    if ((label & 4) != 0) {
+      word = ((word & 0x0F0F0F0FU) << 4) | ((word >> 4) & 0x0F0F0F0FU);
+    }
+    if ((label & 8) != 0) {
+      word = ((word & 0x00FF00FFU) << 8) | ((word >> 8) & 0x00FF00FFU);
+    }
+    if ((label & 16) != 0) {
+      word = (word << 16) | (word >> 16);
+    }
+    bits[i] = word;
+  }
+#endif  // DARTS_HAS_AVX2_KERNEL
+}
 
 //
-// Directed Acyclic Word Graph (DAWG) builder.
+// DAWG -> double-array converter.
 //
 
-class DawgBuilder {
+template <typename Policy>
+class DoubleArrayBuilder {
  public:
-  DawgBuilder() : nodes_(), units_(), labels_(), is_intersections_(),
-    table_(), node_stack_(), recycle_bin_(), num_states_(0) {}
-  ~DawgBuilder() {
+  typedef typename Policy::id_type id_type;
+
+  explicit DoubleArrayBuilder(progress_func_type progress_func)
+      : progress_func_(progress_func), flags_(0), units_(), extras_(),
+        labels_(), table_(), label_units_(), parents_(), leaves_(),
+        tail_(), tail_leaves_(), extras_head_(0) {}
+  ~DoubleArrayBuilder() {
     clear();
   }
 
-  id_type root() const {
-    return 0;
-  }
+  template <typename T>
+  void build(const Keyset<T> &keyset, int flags = 0,
+      std::size_t num_threads = 1);
+  void build(const DawgBuilder &dawg, int flags = 0);
+  void relocate(const typename Policy::unit_type *units,
+      std::size_t num_units, const std::size_t *counts, int flags = 0);
+  template <typename T, typename Reader>
+  bool build_file(Reader *reader, std::size_t memory_limit, std::FILE *file,
+      std::size_t offset, std::size_t *num_keys_ptr,
+      std::size_t *num_units_ptr);
+  void copy(std::size_t *size_ptr,
+      typename Policy::unit_type **buf_ptr) const;
+  void copy_labels(DoubleArrayLabelUnit **buf_ptr) const;
+  void copy_parents(std::size_t *num_leaves_ptr, id_type **buf_ptr) const;
 
-  id_type child(id_type id) const {
-    return units_[id].child();
-  }
-  id_type sibling(id_type id) const {
-    return units_[id].has_sibling() ? (id + 1) : 0;
-  }
-  int value(id_type id) const {
-    return units_[id].value();
-  }
+  void clear();
 
-  bool is_leaf(id_type id) const {
-    return label(id) == '\0';
-  }
-  uchar_type label(id_type id) const {
-    return labels_[id];
+ private:
+  enum { BLOCK_SIZE = 256 };
+  enum { NUM_EXTRA_BLOCKS = 16 };
+
+  enum { LOWER_MASK = 0xFF };
+
+  // A unit visited by at least 1/<HOT_RATIO> of the queries is hot.
+  enum { HOT_RATIO = 4096 };
+
+  // build_from_keyset_parallel() splits the keys into about <NUM_CHUNKS>
+  // chunks of <MIN_CHUNK_KEYS> to <MAX_CHUNK_KEYS> keys. A relative offset of
+  // <SmallUnitPolicy> whose lower bits are not 0 must not cross a boundary of
+  // <WINDOW_SIZE> units, so a chunk is placed within a window.
+  enum { NUM_CHUNKS = 1024 };
+  enum { MIN_CHUNK_KEYS = 1 << 10 };
+  enum { MAX_CHUNK_KEYS = 1 << 15 };
+  enum { WINDOW_SIZE = 1 << 21 };
+
+  typedef typename Policy::builder_unit_type unit_type;
+  typedef DoubleArrayBuilderExtraBlock extra_type;
+
+  // A <RelocationFrame> is a unit whose children are to be arranged by
+  // relocate(). `src_id' and `dest_id' are the positions of the unit in the
+  // source array and in the new array, and the frames are popped in order of
+  // `count' and then in reverse order of `rank'.
+  struct RelocationFrame {
+    std::size_t count;
+    std::size_t rank;
+    id_type src_id;
+    id_type dest_id;
+
+    bool operator<(const RelocationFrame &rhs) const {
+      return (count != rhs.count) ? (count < rhs.count) : (rank < rhs.rank);
+    }
+  };
+
+  // A <KeysetChunk> is a range of keys which share a prefix of `depth'
+  // labels. The chunk has the subtrees of the children of the unit of the
+  // prefix, whose child base in the array is `offset'.
+  struct KeysetChunk {
+    std::size_t begin;
+    std::size_t end;
+    std::size_t depth;
+    id_type offset;
+  };
+  // A <ChunkRoot> is a unit of the array whose children have been arranged in
+  // a chunk. `offset' is the child base in the chunk.
+  struct ChunkRoot {
+    id_type id;
+    id_type offset;
+    uchar_type first_label;
+  };
+  // A <UnitRange> is a range of unused units left by append_chunk().
+  struct UnitRange {
+    std::size_t begin;
+    std::size_t end;
+  };
+  // The 1st pass of build_file() follows the path of the last key with a
+  // stack of <FileFrame>s. A frame gathers the memory cost of the subtree of
+  // a unit and the <FileChild>ren closed below it. A unit whose cost exceeds
+  // `chunk_cost' is arranged in memory, and it adds <FileEntry>s to the
+  // keyset of such units: its own key, if any, and a key for each root of
+  // the chunks made of its small children. `position' is the position of
+  // the entry in the keys, and `chunk_begin' and `chunk_end' are the range
+  // of keys of the chunk of a root, or 0 for an own key.
+  struct FileFrame {
+    std::size_t begin;
+    std::size_t cost;
+    std::size_t num_children;
+    std::size_t num_entries;
+    value_type value;
+  };
+  struct FileChild {
+    std::size_t begin;
+    std::size_t end;
+    std::size_t cost;
+    uchar_type label;
+    bool is_top;
+  };
+  struct FileEntry {
+    std::size_t position;
+    std::size_t key;
+    std::size_t length;
+    value_type value;
+    std::size_t chunk_begin;
+    std::size_t chunk_end;
+  };
+  struct FileSplit {
+    FileSplit() : chunk_cost(0), num_keys(0), key(), frames(), children(),
+        entries(), descendants(), chars() {}
+
+    std::size_t chunk_cost;
+    std::size_t num_keys;
+    AutoPool<char_type> key;
+    AutoPool<FileFrame> frames;
+    AutoPool<FileChild> children;
+    AutoPool<FileEntry> entries;
+    AutoPool<FileEntry> descendants;
+    AutoPool<char_type> chars;
+  };
+#ifdef DARTS_HAS_THREADS
+  // <ChunkQueue> hands chunks to worker threads and the built chunks back to
+  // the thread which appends them. `builders' and `roots' have the results
+  // of chunks, and the other fields are guarded by `mutex'.
+  template <typename T>
+  struct ChunkQueue {
+    const Keyset<T> *keyset;
+    const KeysetChunk *chunks;
+    std::size_t num_chunks;
+    int flags;
+    DoubleArrayBuilder **builders;
+    AutoPool<ChunkRoot> *roots;
+    std::size_t next_chunk;
+    bool is_stopped;
+    const char *error;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+  };
+#endif  // DARTS_HAS_THREADS
+
+  progress_func_type progress_func_;
+  int flags_;
+  AutoPool<unit_type> units_;
+  AutoArray<extra_type> extras_;
+  AutoPool<uchar_type> labels_;
+  AutoArray<id_type> table_;
+  AutoPool<DoubleArrayLabelUnit> label_units_;
+  AutoPool<id_type> parents_;
+  AutoPool<id_type> leaves_;
+  AutoPool<uchar_type> tail_;
+  AutoPool<id_type> tail_leaves_;
+  // extras_head_ is the first block which has unfixed units.
+  id_type extras_head_;
+
+  // Disallows copy and assignment.
+  DoubleArrayBuilder(const DoubleArrayBuilder &);
+  DoubleArrayBuilder &operator=(const DoubleArrayBuilder &);
+
+  std::size_t num_blocks() const {
+    return units_.size() / BLOCK_SIZE;
   }
 
-  bool is_intersection(id_type id) const {
-    return is_intersections_[id];
+  const extra_type &extras(id_type id) const {
+    return extras_[(id / BLOCK_SIZE) % NUM_EXTRA_BLOCKS];
   }
-  id_type intersection_id(id_type id) const {
-    return is_intersections_.rank(id) - 1;
+  extra_type &extras(id_type id) {
+    return extras_[(id / BLOCK_SIZE) % NUM_EXTRA_BLOCKS];
   }
-
-  std::size_t num_intersections() const {
-    return is_intersections_.num_ones();
+  bool is_fixed(id_type id) const {
+    return extras(id).is_fixed(id);
   }
-
-  std::size_t size() const {
-    return units_.size();
+  bool is_used(id_type id) const {
+    return extras(id).is_used(id);
+  }
+  void set_is_used(id_type id) {
+    extras(id).set_is_used(id);
   }
 
-  void init();
-  void finish();
+  template <typename T>
+  void build_dawg(const Keyset<T> &keyset, DawgBuilder *dawg_builder);
+  void build_from_dawg(const DawgBuilder &dawg);
+  void build_from_dawg(const DawgBuilder &dawg,
+      id_type dawg_id, id_type dic_id);
+  id_type arrange_from_dawg(const DawgBuilder &dawg,
+      id_type dawg_id, id_type dic_id);
 
-  void insert(const char *key, std::size_t length, value_type value);
+  template <typename T>
+  void build_from_keyset(const Keyset<T> &keyset);
+  template <typename T>
+  void build_from_keyset(const Keyset<T> &keyset, std::size_t begin,
+      std::size_t end, std::size_t depth, id_type dic_id);
+  template <typename T>
+  void build_children(const Keyset<T> &keyset, std::size_t begin,
+      std::size_t end, std::size_t depth, id_type offset);
+  template <typename T>
+  id_type arrange_from_keyset(const Keyset<T> &keyset, std::size_t begin,
+      std::size_t end, std::size_t depth, id_type dic_id);
+  template <typename T>
+  value_type collect_labels(const Keyset<T> &keyset, std::size_t begin,
+      std::size_t end, std::size_t depth);
 
-  void clear();
+#ifdef DARTS_HAS_THREADS
+  template <typename T>
+  void build_from_keyset_parallel(const Keyset<T> &keyset,
+      std::size_t num_threads);
+  template <typename T>
+  void build_top(const Keyset<T> &keyset, std::size_t begin,
+      std::size_t end, std::size_t depth, id_type dic_id,
+      std::size_t chunk_keys, AutoPool<KeysetChunk> *chunks);
+  template <typename T>
+  static void *build_chunks(void *queue);
+  template <typename T>
+  static std::size_t start_chunk_queue(ChunkQueue<T> *queue,
+      pthread_t *threads, std::size_t num_threads);
+  template <typename T>
+  static const char *wait_chunk(ChunkQueue<T> *queue, std::size_t chunk_id);
+  template <typename T>
+  static void stop_chunk_queue(ChunkQueue<T> *queue, pthread_t *threads,
+      std::size_t num_threads);
+#endif  // DARTS_HAS_THREADS
+  static std::size_t chunk_size(std::size_t num_keys);
+  template <typename T>
+  void build_chunk(const Keyset<T> &keyset, const KeysetChunk &chunk,
+      int flags, AutoPool<ChunkRoot> *roots);
+  id_type find_chunk_offset(id_type lower_bits) const;
+  void append_chunk(const DoubleArrayBuilder &chunk,
+      const AutoPool<ChunkRoot> &roots, AutoPool<UnitRange> *ranges);
+  void link_chunk(const AutoPool<ChunkRoot> &roots, std::size_t base);
+  unit_type moved_unit(std::size_t id, std::size_t base) const;
+  static unit_type unused_unit(std::size_t id);
+  static std::size_t place_chunk(std::size_t num_units, std::size_t *size,
+      AutoPool<UnitRange> *ranges);
+
+  template <typename T, typename Reader>
+  static void split_file(Reader *reader, FileSplit *split);
+  static void close_file_frame(FileSplit *split);
+  static void append_file_entry(FileSplit *split, std::size_t position,
+      std::size_t depth, const FileChild *child, value_type value,
+      std::size_t chunk_begin, std::size_t chunk_end);
+  template <typename T, typename Reader>
+  static bool read_file_key(Reader *reader, const AutoPool<char_type> &last_key,
+      bool is_first, const char_type **key, std::size_t *length,
+      std::size_t *lcp, value_type *value);
+  static std::size_t file_key_cost(std::size_t num_labels);
+  template <typename T>
+  void arrange_top(const Keyset<T> &keyset, std::size_t begin,
+      std::size_t end, std::size_t depth, id_type dic_id,
+      AutoPool<KeysetChunk> *chunks);
+  static bool write_units(std::FILE *file, std::size_t offset,
+      std::size_t id, const unit_type *units, std::size_t num_units);
+  static bool write_unused_units(std::FILE *file, std::size_t offset,
+      std::size_t begin, std::size_t end);
 
- private:
-  enum { INITIAL_TABLE_SIZE = 1 << 10 };
+  template <typename T>
+  bool has_single_key(const Keyset<T> &keyset, std::size_t begin,
+      std::size_t end, std::size_t depth) const;
+  template <typename T>
+  void arrange_tail(const Keyset<T> &keyset, std::size_t begin,
+      std::size_t end, std::size_t depth, id_type dic_id);
+  void begin_tail(id_type leaf_id, value_type value);
+  void end_tail();
+  void fix_tail();
 
-  AutoPool<DawgNode> nodes_;
-  AutoPool<DawgUnit> units_;
-  AutoPool<uchar_type> labels_;
-  BitVector is_intersections_;
-  AutoPool<id_type> table_;
-  AutoStack<id_type> node_stack_;
-  AutoStack<id_type> recycle_bin_;
-  std::size_t num_states_;
+  void set_label_units(id_type id, id_type offset);
 
-  // Disallows copy and assignment.
-  DawgBuilder(const DawgBuilder &);
-  DawgBuilder &operator=(const DawgBuilder &);
+  void relocate_unit(const typename Policy::unit_type *units,
+      const std::size_t *counts, const AutoPool<uchar_type> &src_labels,
+      const RelocationFrame &frame, bool is_hot,
+      AutoPool<RelocationFrame> *children);
+  static void push_frame(AutoPool<RelocationFrame> *heap,
+      const RelocationFrame &frame);
+  static RelocationFrame pop_frame(AutoPool<RelocationFrame> *heap);
 
-  void flush(id_type id);
+  id_type find_valid_offset(id_type id) const;
+  id_type find_nearby_offset(id_type id, uchar_type label) const;
+  bool is_valid_offset(id_type id, id_type offset) const;
 
-  void expand_table();
+  void reserve_id(id_type id);
+  void expand_units();
 
-  id_type find_unit(id_type id, id_type *hash_id) const;
-  id_type find_node(id_type node_id, id_type *hash_id) const;
+  void fix_all_blocks();
+  void fix_block(id_type block_id);
+};
 
-  bool are_equal(id_type node_id, id_type unit_id) const;
+template <typename Policy>
+template <typename T>
+void DoubleArrayBuilder<Policy>::build(const Keyset<T> &keyset, int flags,
+    std::size_t num_threads) {
+  flags_ = flags;
+  if ((flags & BUILD_TAIL) != 0 &&
+      (flags & (BUILD_LINKS | BUILD_PARENTS)) != 0) {
+    DARTS_THROW("failed to build double-array: "
+        "BUILD_TAIL cannot be combined with BUILD_LINKS or BUILD_PARENTS");
+  }
+  if (keyset.has_values() &&
+      (flags & (BUILD_TRIE | BUILD_LINKS | BUILD_PARENTS | BUILD_TAIL)) == 0) {
+    Details::DawgBuilder dawg_builder;
+    build_dawg(keyset, &dawg_builder);
+    build_from_dawg(dawg_builder);
+    dawg_builder.clear();
+#ifdef DARTS_HAS_THREADS
+  } else if (num_threads > 1 && (flags & (BUILD_PARENTS | BUILD_TAIL)) == 0 &&
+      keyset.num_keys() >= MIN_CHUNK_KEYS * 16) {
+    build_from_keyset_parallel(keyset, num_threads);
+#endif  // DARTS_HAS_THREADS
+  } else {
+    build_from_keyset(keyset);
+  }
+  (void)num_threads;
+}
 
-  id_type hash_unit(id_type id) const;
-  id_type hash_node(id_type id) const;
+// build() with a DAWG arranges the units of a DAWG finished outside the
+// builder, as well as build() with values does.
+template <typename Policy>
+void DoubleArrayBuilder<Policy>::build(const DawgBuilder &dawg, int flags) {
+  flags_ = flags;
+  build_from_dawg(dawg);
+}
 
-  id_type append_node();
-  id_type append_unit();
+// relocate() builds a new array from the units of an existing dictionary,
+// where counts[i] is the number of queries which have visited the i-th unit.
+// Hot units, which have been visited by at least 1/<HOT_RATIO> of the queries,
+// are arranged first in order of their counts, and the hottest child of a hot
+// unit is placed in the cache line of the unit if possible. The other units
+// are arranged in depth-first order as well as build() does, so that a cold
+// subtree stays compact. A unit shared in a DAWG stays shared as well as in
+// build_from_dawg().
+template <typename Policy>
+void DoubleArrayBuilder<Policy>::relocate(
+    const typename Policy::unit_type *units, std::size_t num_units,
+    const std::size_t *counts, int flags) {
+  flags_ = flags;
+  units_.reserve(num_units);
 
-  void free_node(id_type id) {
-    recycle_bin_.push(id);
+  extras_.reset(new extra_type[NUM_EXTRA_BLOCKS]);
+  table_.reset(new id_type[num_units]);
+  for (std::size_t i = 0; i < num_units; ++i) {
+    table_[i] = 0;
   }
 
-  static id_type hash(id_type key) {
-    key = ~key + (key << 15);  // key = (key << 15) - key - 1;
-    key = key ^ (key >> 12);
-    key = key + (key << 2);
-    key = key ^ (key >> 4);
-    key = key * 2057;  // key = (key + (key << 3)) + (key << 11);
-    key = key ^ (key >> 16);
-    return key;
+  // Only the labels which appear in the source array are tested in finding
+  // the children of a unit.
+  bool has_label[256] = { false };
+  for (std::size_t i = 0; i < num_units; ++i) {
+    if (units[i].label() <= 0xFF) {
+      has_label[units[i].label()] = true;
+    }
+  }
+  AutoPool<uchar_type> src_labels;
+  for (std::size_t label = 1; label < 256; ++label) {
+    if (has_label[label]) {
+      src_labels.append(static_cast<uchar_type>(label));
+    }
   }
-};
 
-inline void DawgBuilder::init() {
-  table_.resize(INITIAL_TABLE_SIZE, 0);
+  reserve_id(0);
+  set_is_used(0);
+  units_[0].set_offset(1);
+  units_[0].set_label('\0');
 
-  append_node();
-  append_unit();
+  const std::size_t min_hot_count = (counts[0] / HOT_RATIO != 0) ?
+      (counts[0] / HOT_RATIO) : 1;
+  AutoPool<RelocationFrame> heap;
+  AutoPool<RelocationFrame> stack;
+  AutoPool<RelocationFrame> children;
+  std::size_t num_frames = 0;
+
+  RelocationFrame root = { counts[0], num_frames++, 0, 0 };
+  push_frame(&heap, root);
+  while (!heap.empty()) {
+    const RelocationFrame frame = pop_frame(&heap);
+    if (frame.count >= min_hot_count) {
+      relocate_unit(units, counts, src_labels, frame, true, &children);
+      for (std::size_t i = 0; i < children.size(); ++i) {
+        children[i].rank = num_frames++;
+        push_frame(&heap, children[i]);
+      }
+      continue;
+    }
 
-  num_states_ = 1;
+    stack.append(frame);
+    while (!stack.empty()) {
+      const RelocationFrame cold_frame = stack[stack.size() - 1];
+      stack.resize(stack.size() - 1);
+      relocate_unit(units, counts, src_labels, cold_frame, false, &children);
+      for (std::size_t i = children.size(); i > 0; --i) {
+        stack.append(children[i - 1]);
+      }
+    }
+  }
 
-  nodes_[0].set_label(0xFF);
-  node_stack_.push(0);
+  fix_all_blocks();
+
+  extras_.clear();
+  labels_.clear();
+  table_.clear();
 }
 
-inline void DawgBuilder::finish() {
-  flush(0);
+// relocate_unit() arranges the children of a unit and returns the frames of
+// the children which are not leaves.
+template <typename Policy>
+void DoubleArrayBuilder<Policy>::relocate_unit(
+    const typename Policy::unit_type *units, const std::size_t *counts,
+    const AutoPool<uchar_type> &src_labels, const RelocationFrame &frame,
+    bool is_hot, AutoPool<RelocationFrame> *children) {
+  children->resize(0);
 
-  units_[0] = nodes_[0].unit();
-  labels_[0] = nodes_[0].label();
+  const typename Policy::unit_type unit = units[frame.src_id];
+  const std::size_t src_offset = frame.src_id ^ unit.offset();
 
-  nodes_.clear();
-  table_.clear();
-  node_stack_.clear();
-  recycle_bin_.clear();
+  labels_.resize(0);
+  if (unit.has_leaf()) {
+    labels_.append('\0');
+  }
+  std::size_t max_count = 0;
+  uchar_type hot_label = '\0';
+  for (std::size_t i = 0; i < src_labels.size(); ++i) {
+    const uchar_type label = src_labels[i];
+    const std::size_t src_child_id = src_offset ^ label;
+    if (units[src_child_id].label() == label) {
+      labels_.append(label);
+      if (counts[src_child_id] > max_count) {
+        max_count = counts[src_child_id];
+        hot_label = label;
+      }
+    }
+  }
+  if (labels_.empty()) {
+    return;
+  }
 
-  is_intersections_.build();
-}
+  id_type offset = table_[src_offset];
+  if (offset != 0 && Policy::is_valid_offset(offset ^ frame.dest_id)) {
+    units_[frame.dest_id].set_has_leaf(unit.has_leaf());
+    units_[frame.dest_id].set_offset(offset ^ frame.dest_id);
+    if (!label_units_.empty()) {
+      label_units_[frame.dest_id].set_child(labels_[0]);
+    }
+    return;
+  }
 
-inline void DawgBuilder::insert(const char *key, std::size_t length,
-    value_type value) {
-  if (value < 0) {
-    DARTS_THROW("failed to insert key: negative value");
-  } else if (length == 0) {
-    DARTS_THROW("failed to insert key: zero-length key");
+  offset = (is_hot && hot_label != '\0') ?
+      find_nearby_offset(frame.dest_id, hot_label) : 0;
+  if (offset == 0) {
+    offset = find_valid_offset(frame.dest_id);
   }
+  units_[frame.dest_id].set_offset(frame.dest_id ^ offset);
+  table_[src_offset] = offset;
 
-  id_type id = 0;
-  std::size_t key_pos = 0;
+  for (std::size_t i = 0; i < labels_.size(); ++i) {
+    id_type dest_child_id = offset ^ labels_[i];
+    reserve_id(dest_child_id);
+    if (labels_[i] == '\0') {
+      units_[frame.dest_id].set_has_leaf(true);
+      units_[dest_child_id].set_value(units[src_offset].value());
+    } else {
+      units_[dest_child_id].set_label(labels_[i]);
+      RelocationFrame child = { counts[src_offset ^ labels_[i]], 0,
+          static_cast<id_type>(src_offset ^ labels_[i]), dest_child_id };
+      children->append(child);
+    }
+  }
+  set_is_used(offset);
+  set_label_units(frame.dest_id, offset);
+}
 
-  for ( ; key_pos <= length; ++key_pos) {
-    id_type child_id = nodes_[id].child();
-    if (child_id == 0) {
+// push_frame() and pop_frame() keep `heap' as a binary heap.
+template <typename Policy>
+void DoubleArrayBuilder<Policy>::push_frame(AutoPool<RelocationFrame> *heap,
+    const RelocationFrame &frame) {
+  heap->append(frame);
+  for (std::size_t i = heap->size() - 1; i > 0; ) {
+    const std::size_t parent = (i - 1) / 2;
+    if (!((*heap)[parent] < (*heap)[i])) {
       break;
     }
+    const RelocationFrame temp = (*heap)[parent];
+    (*heap)[parent] = (*heap)[i];
+    (*heap)[i] = temp;
+    i = parent;
+  }
+}
 
-    uchar_type key_label = static_cast<uchar_type>(key[key_pos]);
-    if (key_pos < length && key_label == '\0') {
-      DARTS_THROW("failed to insert key: invalid null character");
+template <typename Policy>
+typename DoubleArrayBuilder<Policy>::RelocationFrame
+DoubleArrayBuilder<Policy>::pop_frame(AutoPool<RelocationFrame> *heap) {
+  const RelocationFrame top = (*heap)[0];
+  (*heap)[0] = (*heap)[heap->size() - 1];
+  heap->resize(heap->size() - 1);
+  for (std::size_t i = 0; i * 2 + 1 < heap->size(); ) {
+    std::size_t child = i * 2 + 1;
+    if (child + 1 < heap->size() && (*heap)[child] < (*heap)[child + 1]) {
+      ++child;
     }
-
-    uchar_type unit_label = nodes_[child_id].label();
-    if (key_label < unit_label) {
-      DARTS_THROW("failed to insert key: wrong key order");
-    } else if (key_label > unit_label) {
-      nodes_[child_id].set_has_sibling(true);
-      flush(child_id);
+    if (!((*heap)[i] < (*heap)[child])) {
       break;
     }
-    id = child_id;
+    const RelocationFrame temp = (*heap)[i];
+    (*heap)[i] = (*heap)[child];
+    (*heap)[child] = temp;
+    i = child;
   }
+  return top;
+}
 
-  if (key_pos > length) {
-    return;
+// copy() appends the tail to the units, and the size is rounded up to a
+// multiple of <BLOCK_SIZE> units so that open() accepts the array.
+template <typename Policy>
+inline void DoubleArrayBuilder<Policy>::copy(std::size_t *size_ptr,
+    typename Policy::unit_type **buf_ptr) const {
+  std::size_t size = units_.size();
+  if (!tail_.empty()) {
+    size += (tail_.size() + sizeof(unit_type) - 1) / sizeof(unit_type);
+    size = (size + BLOCK_SIZE - 1) & ~static_cast<std::size_t>(BLOCK_SIZE - 1);
   }
+  if (size_ptr != NULL) {
+    *size_ptr = size;
+  }
+  if (buf_ptr != NULL) {
+    *buf_ptr = new typename Policy::unit_type[size];
+    unit_type *units = reinterpret_cast<unit_type *>(*buf_ptr);
+    for (std::size_t i = 0; i < units_.size(); ++i) {
+      units[i] = units_[i];
+    }
+    uchar_type *tail = reinterpret_cast<uchar_type *>(units + units_.size());
+    for (std::size_t i = 0; i < tail_.size(); ++i) {
+      tail[i] = tail_[i];
+    }
+    for (std::size_t i = units_.size() * sizeof(unit_type) + tail_.size();
+        i < size * sizeof(unit_type); ++i) {
+      reinterpret_cast<uchar_type *>(units)[i] = '\0';
+    }
+  }
+}
 
-  for ( ; key_pos <= length; ++key_pos) {
-    uchar_type key_label = static_cast<uchar_type>(
-        (key_pos < length) ? key[key_pos] : '\0');
-    id_type child_id = append_node();
-
-    if (nodes_[id].child() == 0) {
-      nodes_[child_id].set_is_state(true);
+template <typename Policy>
+inline void DoubleArrayBuilder<Policy>::copy_labels(
+    DoubleArrayLabelUnit **buf_ptr) const {
+  if (buf_ptr != NULL) {
+    *buf_ptr = NULL;
+    if (!label_units_.empty()) {
+      *buf_ptr = new DoubleArrayLabelUnit[label_units_.size()];
+      for (std::size_t i = 0; i < label_units_.size(); ++i) {
+        (*buf_ptr)[i] = label_units_[i];
+      }
     }
-    nodes_[child_id].set_sibling(nodes_[id].child());
-    nodes_[child_id].set_label(key_label);
-    nodes_[id].set_child(child_id);
-    node_stack_.push(child_id);
+  }
+}
 
-    id = child_id;
+// copy_parents() stores the parents of units followed by the leaves of keys
+// into a single array.
+template <typename Policy>
+inline void DoubleArrayBuilder<Policy>::copy_parents(
+    std::size_t *num_leaves_ptr, id_type **buf_ptr) const {
+  if (num_leaves_ptr != NULL) {
+    *num_leaves_ptr = leaves_.size();
+  }
+  if (buf_ptr != NULL) {
+    *buf_ptr = NULL;
+    if (!parents_.empty()) {
+      *buf_ptr = new id_type[parents_.size() + leaves_.size()];
+      for (std::size_t i = 0; i < parents_.size(); ++i) {
+        (*buf_ptr)[i] = parents_[i];
+      }
+      for (std::size_t i = 0; i < leaves_.size(); ++i) {
+        (*buf_ptr)[parents_.size() + i] = leaves_[i];
+      }
+    }
   }
-  nodes_[id].set_value(value);
 }
 
-inline void DawgBuilder::clear() {
-  nodes_.clear();
+template <typename Policy>
+inline void DoubleArrayBuilder<Policy>::clear() {
+  flags_ = 0;
   units_.clear();
+  extras_.clear();
   labels_.clear();
-  is_intersections_.clear();
   table_.clear();
-  node_stack_.clear();
-  recycle_bin_.clear();
-  num_states_ = 0;
+  label_units_.clear();
+  parents_.clear();
+  leaves_.clear();
+  tail_.clear();
+  tail_leaves_.clear();
+  extras_head_ = 0;
 }
 
-inline void DawgBuilder::flush(id_type id) {
-  while (node_stack_.top() != id) {
-    id_type node_id = node_stack_.top();
-    node_stack_.pop();
-
-    if (num_states_ >= table_.size() - (table_.size() >> 2)) {
-      expand_table();
+template <typename Policy>
+template <typename T>
+void DoubleArrayBuilder<Policy>::build_dawg(const Keyset<T> &keyset,
+    DawgBuilder *dawg_builder) {
+  dawg_builder->init();
+  AutoPool<char_type> key;
+  for (std::size_t i = 0; i < keyset.num_keys(); ++i) {
+    if (keyset.has_remap_table()) {
+      std::size_t length = keyset.lengths(i);
+      key.resize(length + 1);
+      for (std::size_t j = 0; j <= length; ++j) {
+        key[j] = static_cast<char_type>(keyset.keys(i, j));
+      }
+      dawg_builder->insert(&key[0], length, keyset.values(i));
+    } else {
+      dawg_builder->insert(keyset.keys(i), keyset.lengths(i),
+          keyset.values(i));
     }
-
-    id_type num_siblings = 0;
-    for (id_type i = node_id; i != 0; i = nodes_[i].sibling()) {
-      ++num_siblings;
+    if (progress_func_ != NULL) {
+      progress_func_(i + 1, keyset.num_keys() + 1);
     }
+  }
+  dawg_builder->finish();
+}
 
-    id_type hash_id;
-    id_type match_id = find_node(node_id, &hash_id);
-    if (match_id != 0) {
-      is_intersections_.set(match_id, true);
-    } else {
-      id_type unit_id = 0;
-      for (id_type i = 0; i < num_siblings; ++i) {
-        unit_id = append_unit();
-      }
-      for (id_type i = node_id; i != 0; i = nodes_[i].sibling()) {
-        units_[unit_id] = nodes_[i].unit();
-        labels_[unit_id] = nodes_[i].label();
-        --unit_id;
-      }
-      match_id = unit_id + 1;
-      table_[hash_id] = match_id;
-      ++num_states_;
-    }
+template <typename Policy>
+inline void DoubleArrayBuilder<Policy>::build_from_dawg(
+    const DawgBuilder &dawg) {
+  std::size_t num_units = 1;
+  while (num_units < dawg.size()) {
+    num_units <<= 1;
+  }
+  units_.reserve(num_units);
 
-    for (id_type i = node_id, next; i != 0; i = next) {
-      next = nodes_[i].sibling();
-      free_node(i);
-    }
+  table_.reset(new id_type[dawg.num_intersections()]);
+  for (std::size_t i = 0; i < dawg.num_intersections(); ++i) {
+    table_[i] = 0;
+  }
 
-    nodes_[node_stack_.top()].set_child(match_id);
+  extras_.reset(new extra_type[NUM_EXTRA_BLOCKS]);
+
+  reserve_id(0);
+  set_is_used(0);
+  units_[0].set_offset(1);
+  units_[0].set_label('\0');
+
+  if (dawg.child(dawg.root()) != 0) {
+    build_from_dawg(dawg, dawg.root(), 0);
   }
-  node_stack_.pop();
-}
 
-inline void DawgBuilder::expand_table() {
-  std::size_t table_size = table_.size() << 1;
+  fix_all_blocks();
+
+  extras_.clear();
+  labels_.clear();
   table_.clear();
-  table_.resize(table_size, 0);
+}
 
-  for (std::size_t i = 1; i < units_.size(); ++i) {
-    id_type id = static_cast<id_type>(i);
-    if (labels_[id] == '\0' || units_[id].is_state()) {
-      id_type hash_id;
-      find_unit(id, &hash_id);
-      table_[hash_id] = id;
+template <typename Policy>
+inline void DoubleArrayBuilder<Policy>::build_from_dawg(
+    const DawgBuilder &dawg, id_type dawg_id, id_type dic_id) {
+  id_type dawg_child_id = dawg.child(dawg_id);
+  if (dawg.is_intersection(dawg_child_id)) {
+    id_type intersection_id = dawg.intersection_id(dawg_child_id);
+    id_type offset = table_[intersection_id];
+    if (offset != 0) {
+      offset ^= dic_id;
+      if (Policy::is_valid_offset(offset)) {
+        if (dawg.is_leaf(dawg_child_id)) {
+          units_[dic_id].set_has_leaf(true);
+        }
+        units_[dic_id].set_offset(offset);
+        if (!label_units_.empty()) {
+          label_units_[dic_id].set_child(dawg.label(dawg_child_id));
+        }
+        return;
+      }
     }
   }
-}
 
-inline id_type DawgBuilder::find_unit(id_type id, id_type *hash_id) const {
-  *hash_id = hash_unit(id) % table_.size();
-  for ( ; ; *hash_id = (*hash_id + 1) % table_.size()) {
-    id_type unit_id = table_[*hash_id];
-    if (unit_id == 0) {
-      break;
+  id_type offset = arrange_from_dawg(dawg, dawg_id, dic_id);
+  if (dawg.is_intersection(dawg_child_id)) {
+    table_[dawg.intersection_id(dawg_child_id)] = offset;
+  }
+
+  do {
+    uchar_type child_label = dawg.label(dawg_child_id);
+    id_type dic_child_id = offset ^ child_label;
+    if (child_label != '\0') {
+      build_from_dawg(dawg, dawg_child_id, dic_child_id);
     }
+    dawg_child_id = dawg.sibling(dawg_child_id);
+  } while (dawg_child_id != 0);
+}
 
-    // There must not be the same unit.
+template <typename Policy>
+inline typename DoubleArrayBuilder<Policy>::id_type
+DoubleArrayBuilder<Policy>::arrange_from_dawg(const DawgBuilder &dawg,
+    id_type dawg_id, id_type dic_id) {
+  labels_.resize(0);
+
+  id_type dawg_child_id = dawg.child(dawg_id);
+  while (dawg_child_id != 0) {
+    labels_.append(dawg.label(dawg_child_id));
+    dawg_child_id = dawg.sibling(dawg_child_id);
   }
-  return 0;
-}
 
-inline id_type DawgBuilder::find_node(id_type node_id,
-    id_type *hash_id) const {
-  *hash_id = hash_node(node_id) % table_.size();
-  for ( ; ; *hash_id = (*hash_id + 1) % table_.size()) {
-    id_type unit_id = table_[*hash_id];
-    if (unit_id == 0) {
-      break;
+  id_type offset = find_valid_offset(dic_id);
+  units_[dic_id].set_offset(dic_id ^ offset);
+
+  dawg_child_id = dawg.child(dawg_id);
+  for (std::size_t i = 0; i < labels_.size(); ++i) {
+    id_type dic_child_id = offset ^ labels_[i];
+    reserve_id(dic_child_id);
+
+    if (dawg.is_leaf(dawg_child_id)) {
+      units_[dic_id].set_has_leaf(true);
+      units_[dic_child_id].set_value(dawg.value(dawg_child_id));
+    } else {
+      units_[dic_child_id].set_label(labels_[i]);
     }
 
-    if (are_equal(node_id, unit_id)) {
-      return unit_id;
-    }
+    dawg_child_id = dawg.sibling(dawg_child_id);
   }
-  return 0;
+  set_is_used(offset);
+  set_label_units(dic_id, offset);
+
+  return offset;
 }
 
-inline bool DawgBuilder::are_equal(id_type node_id, id_type unit_id) const {
-  for (id_type i = nodes_[node_id].sibling(); i != 0;
-      i = nodes_[i].sibling()) {
-    if (units_[unit_id].has_sibling() == false) {
-      return false;
-    }
-    ++unit_id;
-  }
-  if (units_[unit_id].has_sibling() == true) {
-    return false;
+template <typename Policy>
+template <typename T>
+void DoubleArrayBuilder<Policy>::build_from_keyset(const Keyset<T> &keyset) {
+  std::size_t num_units = 1;
+  while (num_units < keyset.num_keys()) {
+    num_units <<= 1;
   }
+  units_.reserve(num_units);
 
-  for (id_type i = node_id; i != 0; i = nodes_[i].sibling(), --unit_id) {
-    if (nodes_[i].unit() != units_[unit_id].unit() ||
-        nodes_[i].label() != labels_[unit_id]) {
-      return false;
-    }
+  extras_.reset(new extra_type[NUM_EXTRA_BLOCKS]);
+  if ((flags_ & BUILD_PARENTS) != 0) {
+    leaves_.resize(keyset.num_keys());
   }
-  return true;
-}
 
-inline id_type DawgBuilder::hash_unit(id_type id) const {
-  id_type hash_value = 0;
-  for ( ; id != 0; ++id) {
-    id_type unit = units_[id].unit();
-    uchar_type label = labels_[id];
-    hash_value ^= hash((label << 24) ^ unit);
+  reserve_id(0);
+  set_is_used(0);
+  units_[0].set_offset(1);
+  units_[0].set_label('\0');
 
-    if (units_[id].has_sibling() == false) {
-      break;
-    }
+  if (keyset.num_keys() > 0) {
+    build_from_keyset(keyset, 0, keyset.num_keys(), 0, 0);
   }
-  return hash_value;
+
+  fix_all_blocks();
+  fix_tail();
+
+  extras_.clear();
+  labels_.clear();
 }
 
-inline id_type DawgBuilder::hash_node(id_type id) const {
-  id_type hash_value = 0;
-  for ( ; id != 0; id = nodes_[id].sibling()) {
-    id_type unit = nodes_[id].unit();
-    uchar_type label = nodes_[id].label();
-    hash_value ^= hash((label << 24) ^ unit);
+template <typename Policy>
+template <typename T>
+void DoubleArrayBuilder<Policy>::build_from_keyset(const Keyset<T> &keyset,
+    std::size_t begin, std::size_t end, std::size_t depth, id_type dic_id) {
+  if ((flags_ & BUILD_TAIL) != 0 && has_single_key(keyset, begin, end, depth)) {
+    arrange_tail(keyset, begin, end, depth, dic_id);
+    return;
   }
-  return hash_value;
+  id_type offset = arrange_from_keyset(keyset, begin, end, depth, dic_id);
+  build_children(keyset, begin, end, depth, offset);
 }
 
-inline id_type DawgBuilder::append_unit() {
-  is_intersections_.append();
-  units_.append();
-  labels_.append();
-
-  return static_cast<id_type>(is_intersections_.size() - 1);
-}
+// build_children() builds the subtrees of the children of a unit whose child
+// base is `offset'.
+template <typename Policy>
+template <typename T>
+void DoubleArrayBuilder<Policy>::build_children(const Keyset<T> &keyset,
+    std::size_t begin, std::size_t end, std::size_t depth, id_type offset) {
+  while (begin < end) {
+    if (keyset.keys(begin, depth) != '\0') {
+      break;
+    }
+    ++begin;
+  }
+  if (begin == end) {
+    return;
+  }
 
-inline id_type DawgBuilder::append_node() {
-  id_type id;
-  if (recycle_bin_.empty()) {
-    id = static_cast<id_type>(nodes_.size());
-    nodes_.append();
-  } else {
-    id = recycle_bin_.top();
-    nodes_[id] = DawgNode();
-    recycle_bin_.pop();
+  std::size_t last_begin = begin;
+  uchar_type last_label = keyset.keys(begin, depth);
+  while (++begin < end) {
+    uchar_type label = keyset.keys(begin, depth);
+    if (label != last_label) {
+      build_from_keyset(keyset, last_begin, begin,
+          depth + 1, offset ^ last_label);
+      last_begin = begin;
+      last_label = keyset.keys(begin, depth);
+    }
   }
-  return id;
+  build_from_keyset(keyset, last_begin, end, depth + 1, offset ^ last_label);
 }
 
-//
-// Unit of double-array builder.
-//
+template <typename Policy>
+template <typename T>
+typename DoubleArrayBuilder<Policy>::id_type
+DoubleArrayBuilder<Policy>::arrange_from_keyset(const Keyset<T> &keyset,
+    std::size_t begin, std::size_t end, std::size_t depth, id_type dic_id) {
+  labels_.resize(0);
+  // The root of a dictionary with tails always has a leaf, whose value is -1
+  // unless the empty key is given. It tells the dictionary has tails.
+  if ((flags_ & BUILD_TAIL) != 0 && dic_id == 0) {
+    labels_.append('\0');
+  }
+  const value_type value = collect_labels(keyset, begin, end, depth);
 
-class DoubleArrayBuilderUnit {
- public:
-  DoubleArrayBuilderUnit() : unit_(0) {}
+  id_type offset = find_valid_offset(dic_id);
+  units_[dic_id].set_offset(dic_id ^ offset);
 
-  void set_has_leaf(bool has_leaf) {
-    if (has_leaf) {
-      unit_ |= 1U << 8;
+  for (std::size_t i = 0; i < labels_.size(); ++i) {
+    id_type dic_child_id = offset ^ labels_[i];
+    reserve_id(dic_child_id);
+    if (labels_[i] == '\0') {
+      units_[dic_id].set_has_leaf(true);
+      if ((flags_ & BUILD_TAIL) != 0) {
+        begin_tail(dic_child_id, value);
+        end_tail();
+      } else {
+        units_[dic_child_id].set_value(value);
+      }
     } else {
-      unit_ &= ~(1U << 8);
+      units_[dic_child_id].set_label(labels_[i]);
     }
-  }
-  void set_value(value_type value) {
-    unit_ = value | (1U << 31);
-  }
-  void set_label(uchar_type label) {
-    unit_ = (unit_ & ~0xFFU) | label;
-  }
-  void set_offset(id_type offset) {
-    if (offset >= 1U << 29) {
-      DARTS_THROW("failed to modify unit: too large offset");
+    if (!parents_.empty()) {
+      parents_[dic_child_id] = dic_id;
     }
-    unit_ &= (1U << 31) | (1U << 8) | 0xFF;
-    if (offset < 1U << 21) {
-      unit_ |= (offset << 10);
-    } else {
-      unit_ |= (offset << 2) | (1U << 9);
+  }
+  // Keys ending here come first in the range and share the same leaf.
+  if (!leaves_.empty()) {
+    for (std::size_t i = begin;
+        i < end && keyset.keys(i, depth) == '\0'; ++i) {
+      leaves_[i] = offset;
     }
   }
+  set_is_used(offset);
+  set_label_units(dic_id, offset);
 
- private:
-  id_type unit_;
-
-  // Copyable.
-};
+  return offset;
+}
 
-//
-// Extra unit of double-array builder.
-//
+// collect_labels() appends the distinct labels of the keys in a range at
+// `depth' to `labels_' and returns the value of the keys which end there, or
+// -1 if there is no such key.
+template <typename Policy>
+template <typename T>
+value_type DoubleArrayBuilder<Policy>::collect_labels(const Keyset<T> &keyset,
+    std::size_t begin, std::size_t end, std::size_t depth) {
+  value_type value = -1;
+  for (std::size_t i = begin; i < end; ++i) {
+    uchar_type label = keyset.keys(i, depth);
+    if (label == '\0') {
+      if (keyset.has_lengths() && depth < keyset.lengths(i)) {
+        DARTS_THROW("failed to build double-array: "
+            "invalid null character");
+      } else if (keyset.values(i) < 0) {
+        DARTS_THROW("failed to build double-array: negative value");
+      }
 
-class DoubleArrayBuilderExtraUnit {
- public:
-  DoubleArrayBuilderExtraUnit() : prev_(0), next_(0),
-      is_fixed_(false), is_used_(false) {}
+      if (value == -1) {
+        value = keyset.values(i);
+      }
+      if (progress_func_ != NULL) {
+        progress_func_(i + 1, keyset.num_keys() + 1);
+      }
+    }
 
-  void set_prev(id_type prev) {
-    prev_ = prev;
-  }
-  void set_next(id_type next) {
-    next_ = next;
-  }
-  void set_is_fixed(bool is_fixed) {
-    is_fixed_ = is_fixed;
-  }
-  void set_is_used(bool is_used) {
-    is_used_ = is_used;
+    if (labels_.empty()) {
+      labels_.append(label);
+    } else if (label != labels_[labels_.size() - 1]) {
+      if (label < labels_[labels_.size() - 1]) {
+        DARTS_THROW("failed to build double-array: wrong key order");
+      }
+      labels_.append(label);
+    }
   }
+  return value;
+}
 
-  id_type prev() const {
-    return prev_;
-  }
-  id_type next() const {
-    return next_;
-  }
-  bool is_fixed() const {
-    return is_fixed_;
-  }
-  bool is_used() const {
-    return is_used_;
+#ifdef DARTS_HAS_THREADS
+// build_from_keyset_parallel() arranges the units near the root on the
+// calling thread and leaves the subtrees below them to worker threads in
+// chunks. Each chunk is arranged in its own array, and the arrays are
+// appended to the array in order of keys as soon as they are ready. The
+// result does not depend on the number of threads.
+template <typename Policy>
+template <typename T>
+void DoubleArrayBuilder<Policy>::build_from_keyset_parallel(
+    const Keyset<T> &keyset, std::size_t num_threads) {
+  std::size_t num_units = 1;
+  while (num_units < keyset.num_keys()) {
+    num_units <<= 1;
   }
+  units_.reserve(num_units);
 
- private:
-  id_type prev_;
-  id_type next_;
-  bool is_fixed_;
-  bool is_used_;
+  extras_.reset(new extra_type[NUM_EXTRA_BLOCKS]);
 
-  // Copyable.
-};
+  reserve_id(0);
+  set_is_used(0);
+  units_[0].set_offset(1);
+  units_[0].set_label('\0');
 
-//
-// DAWG -> double-array converter.
-//
+  AutoPool<KeysetChunk> chunks;
+  build_top(keyset, 0, keyset.num_keys(), 0, 0,
+      chunk_size(keyset.num_keys()), &chunks);
 
-class DoubleArrayBuilder {
- public:
-  explicit DoubleArrayBuilder(progress_func_type progress_func)
-      : progress_func_(progress_func), units_(), extras_(), labels_(),
-        table_(), extras_head_(0) {}
-  ~DoubleArrayBuilder() {
-    clear();
+  fix_all_blocks();
+  extras_.clear();
+  labels_.clear();
+  if (chunks.empty()) {
+    return;
   }
 
-  template <typename T>
-  void build(const Keyset<T> &keyset);
-  void copy(std::size_t *size_ptr, DoubleArrayUnit **buf_ptr) const;
-
-  void clear();
-
- private:
-  enum { BLOCK_SIZE = 256 };
-  enum { NUM_EXTRA_BLOCKS = 16 };
-  enum { NUM_EXTRAS = BLOCK_SIZE * NUM_EXTRA_BLOCKS };
+  const std::size_t num_chunks = chunks.size();
+  AutoArray<DoubleArrayBuilder *> builders;
+  AutoArray<AutoPool<ChunkRoot> > roots;
+  AutoArray<pthread_t> threads;
+  try {
+    builders.reset(new DoubleArrayBuilder *[num_chunks]);
+    roots.reset(new AutoPool<ChunkRoot>[num_chunks]);
+    threads.reset(new pthread_t[num_threads]);
+  } catch (const std::bad_alloc &) {
+    DARTS_THROW("failed to build double-array: std::bad_alloc");
+  }
+  for (std::size_t i = 0; i < num_chunks; ++i) {
+    builders[i] = NULL;
+  }
 
-  enum { UPPER_MASK = 0xFF << 21 };
-  enum { LOWER_MASK = 0xFF };
+  ChunkQueue<T> queue;
+  queue.keyset = &keyset;
+  queue.chunks = &chunks[0];
+  queue.num_chunks = num_chunks;
+  queue.flags = flags_;
+  queue.builders = &builders[0];
+  queue.roots = &roots[0];
+  const std::size_t num_started =
+      start_chunk_queue(&queue, &threads[0], num_threads);
 
-  typedef DoubleArrayBuilderUnit unit_type;
-  typedef DoubleArrayBuilderExtraUnit extra_type;
+  const char *error = NULL;
+  try {
+    AutoPool<UnitRange> ranges;
+    for (std::size_t i = 0; i < num_chunks; ++i) {
+      error = wait_chunk(&queue, i);
+      if (error != NULL) {
+        break;
+      }
 
-  progress_func_type progress_func_;
-  AutoPool<unit_type> units_;
-  AutoArray<extra_type> extras_;
-  AutoPool<uchar_type> labels_;
-  AutoArray<id_type> table_;
-  id_type extras_head_;
+      append_chunk(*builders[i], roots[i], &ranges);
+      delete builders[i];
+      builders[i] = NULL;
+      roots[i].clear();
+      if (progress_func_ != NULL) {
+        progress_func_(chunks[i].end, keyset.num_keys() + 1);
+      }
+    }
+  } catch (...) {
+    stop_chunk_queue(&queue, &threads[0], num_started);
+    for (std::size_t i = 0; i < num_chunks; ++i) {
+      delete builders[i];
+    }
+    throw;
+  }
+  stop_chunk_queue(&queue, &threads[0], num_started);
+  for (std::size_t i = 0; i < num_chunks; ++i) {
+    delete builders[i];
+  }
+  if (error != NULL) {
+    throw Exception(error);
+  }
+}
 
-  // Disallows copy and assignment.
-  DoubleArrayBuilder(const DoubleArrayBuilder &);
-  DoubleArrayBuilder &operator=(const DoubleArrayBuilder &);
+// build_top() works as well as build_from_keyset() but stops at the units
+// whose subtrees have at most `chunk_keys' keys. The subtrees of consecutive
+// siblings are packed into a chunk of at most `chunk_keys' keys.
+template <typename Policy>
+template <typename T>
+void DoubleArrayBuilder<Policy>::build_top(const Keyset<T> &keyset,
+    std::size_t begin, std::size_t end, std::size_t depth, id_type dic_id,
+    std::size_t chunk_keys, AutoPool<KeysetChunk> *chunks) {
+  id_type offset = arrange_from_keyset(keyset, begin, end, depth, dic_id);
 
-  std::size_t num_blocks() const {
-    return units_.size() / BLOCK_SIZE;
+  while (begin < end && keyset.keys(begin, depth) == '\0') {
+    ++begin;
   }
 
-  const extra_type &extras(id_type id) const {
-    return extras_[id % NUM_EXTRAS];
+  KeysetChunk chunk = { begin, begin, depth, offset };
+  while (begin < end) {
+    const uchar_type label = keyset.keys(begin, depth);
+    std::size_t child_end = begin + 1;
+    while (child_end < end && keyset.keys(child_end, depth) == label) {
+      ++child_end;
+    }
+
+    if (chunk.end != chunk.begin &&
+        (child_end - chunk.begin > chunk_keys ||
+         child_end - begin > chunk_keys)) {
+      chunks->append(chunk);
+      chunk.begin = begin;
+    }
+    if (child_end - begin > chunk_keys) {
+      build_top(keyset, begin, child_end, depth + 1, offset ^ label,
+          chunk_keys, chunks);
+      chunk.begin = child_end;
+    }
+    chunk.end = child_end;
+    begin = child_end;
   }
-  extra_type &extras(id_type id) {
-    return extras_[id % NUM_EXTRAS];
+  if (chunk.end != chunk.begin) {
+    chunks->append(chunk);
   }
+}
 
-  template <typename T>
-  void build_dawg(const Keyset<T> &keyset, DawgBuilder *dawg_builder);
-  void build_from_dawg(const DawgBuilder &dawg);
-  void build_from_dawg(const DawgBuilder &dawg,
-      id_type dawg_id, id_type dic_id);
-  id_type arrange_from_dawg(const DawgBuilder &dawg,
-      id_type dawg_id, id_type dic_id);
 
-  template <typename T>
-  void build_from_keyset(const Keyset<T> &keyset);
-  template <typename T>
-  void build_from_keyset(const Keyset<T> &keyset, std::size_t begin,
-      std::size_t end, std::size_t depth, id_type dic_id);
-  template <typename T>
-  id_type arrange_from_keyset(const Keyset<T> &keyset, std::size_t begin,
-      std::size_t end, std::size_t depth, id_type dic_id);
+// build_chunks() is the body of a worker thread. It builds chunks until the
+// queue becomes empty or stopped.
+template <typename Policy>
+template <typename T>
+void *DoubleArrayBuilder<Policy>::build_chunks(void *queue_ptr) {
+  ChunkQueue<T> *queue = static_cast<ChunkQueue<T> *>(queue_ptr);
+  for ( ; ; ) {
+    ::pthread_mutex_lock(&queue->mutex);
+    if (queue->is_stopped || queue->next_chunk == queue->num_chunks) {
+      ::pthread_mutex_unlock(&queue->mutex);
+      return NULL;
+    }
+    const std::size_t chunk_id = queue->next_chunk++;
+    ::pthread_mutex_unlock(&queue->mutex);
+
+    DoubleArrayBuilder *builder = NULL;
+    const char *error = NULL;
+    try {
+      builder = new DoubleArrayBuilder(NULL);
+      builder->build_chunk(*queue->keyset, queue->chunks[chunk_id],
+          queue->flags, &queue->roots[chunk_id]);
+    } catch (const Exception &ex) {
+      error = ex.what();
+    } catch (const std::bad_alloc &) {
+      error = __FILE__ ":" DARTS_LINE_STR ": exception: "
+          "failed to build double-array: std::bad_alloc";
+    }
+    if (error != NULL) {
+      delete builder;
+      builder = NULL;
+    }
 
-  id_type find_valid_offset(id_type id) const;
-  bool is_valid_offset(id_type id, id_type offset) const;
+    ::pthread_mutex_lock(&queue->mutex);
+    if (error != NULL) {
+      if (queue->error == NULL) {
+        queue->error = error;
+      }
+      queue->is_stopped = true;
+    }
+    queue->builders[chunk_id] = builder;
+    ::pthread_cond_broadcast(&queue->cond);
+    ::pthread_mutex_unlock(&queue->mutex);
+  }
+}
 
-  void reserve_id(id_type id);
-  void expand_units();
+// start_chunk_queue() starts at most `num_threads' workers and returns the
+// number of them. If no thread can be started, the calling thread builds
+// all the chunks before returning 0.
+template <typename Policy>
+template <typename T>
+std::size_t DoubleArrayBuilder<Policy>::start_chunk_queue(
+    ChunkQueue<T> *queue, pthread_t *threads, std::size_t num_threads) {
+  queue->next_chunk = 0;
+  queue->is_stopped = false;
+  queue->error = NULL;
+  ::pthread_mutex_init(&queue->mutex, NULL);
+  ::pthread_cond_init(&queue->cond, NULL);
+
+  if (num_threads > queue->num_chunks) {
+    num_threads = queue->num_chunks;
+  }
+  std::size_t num_started = 0;
+  while (num_started < num_threads && ::pthread_create(&threads[num_started],
+      NULL, &DoubleArrayBuilder::template build_chunks<T>, queue) == 0) {
+    ++num_started;
+  }
+  if (num_started == 0) {
+    build_chunks<T>(queue);
+  }
+  return num_started;
+}
 
-  void fix_all_blocks();
-  void fix_block(id_type block_id);
-};
+// wait_chunk() waits until a chunk is built and returns NULL, or returns an
+// error message if a worker has failed.
+template <typename Policy>
+template <typename T>
+const char *DoubleArrayBuilder<Policy>::wait_chunk(ChunkQueue<T> *queue,
+    std::size_t chunk_id) {
+  ::pthread_mutex_lock(&queue->mutex);
+  while (queue->builders[chunk_id] == NULL && queue->error == NULL) {
+    ::pthread_cond_wait(&queue->cond, &queue->mutex);
+  }
+  const char *error = queue->error;
+  ::pthread_mutex_unlock(&queue->mutex);
+  return error;
+}
 
+// stop_chunk_queue() stops the workers and waits for them.
+template <typename Policy>
 template <typename T>
-void DoubleArrayBuilder::build(const Keyset<T> &keyset) {
-  if (keyset.has_values()) {
-    Details::DawgBuilder dawg_builder;
-    build_dawg(keyset, &dawg_builder);
-    build_from_dawg(dawg_builder);
-    dawg_builder.clear();
-  } else {
-    build_from_keyset(keyset);
-  }
+void DoubleArrayBuilder<Policy>::stop_chunk_queue(ChunkQueue<T> *queue,
+    pthread_t *threads, std::size_t num_threads) {
+  ::pthread_mutex_lock(&queue->mutex);
+  queue->is_stopped = true;
+  ::pthread_mutex_unlock(&queue->mutex);
+  for (std::size_t i = 0; i < num_threads; ++i) {
+    ::pthread_join(threads[i], NULL);
+  }
+  ::pthread_cond_destroy(&queue->cond);
+  ::pthread_mutex_destroy(&queue->mutex);
+}
+#endif  // DARTS_HAS_THREADS
+
+// chunk_size() returns the maximum number of keys in a chunk. It does not
+// depend on the number of threads so that the result does not either.
+template <typename Policy>
+inline std::size_t DoubleArrayBuilder<Policy>::chunk_size(
+    std::size_t num_keys) {
+  std::size_t chunk_keys = num_keys / NUM_CHUNKS;
+  if (chunk_keys < static_cast<std::size_t>(MIN_CHUNK_KEYS)) {
+    chunk_keys = static_cast<std::size_t>(MIN_CHUNK_KEYS);
+  } else if (chunk_keys > static_cast<std::size_t>(MAX_CHUNK_KEYS)) {
+    chunk_keys = static_cast<std::size_t>(MAX_CHUNK_KEYS);
+  }
+  return chunk_keys;
 }
 
-inline void DoubleArrayBuilder::copy(std::size_t *size_ptr,
-    DoubleArrayUnit **buf_ptr) const {
-  if (size_ptr != NULL) {
-    *size_ptr = units_.size();
-  }
-  if (buf_ptr != NULL) {
-    *buf_ptr = new DoubleArrayUnit[units_.size()];
-    unit_type *units = reinterpret_cast<unit_type *>(*buf_ptr);
-    for (std::size_t i = 0; i < units_.size(); ++i) {
-      units[i] = units_[i];
+// build_chunk() arranges the subtrees of a chunk in this builder, which
+// starts with no units. The children of each root are placed at a child
+// base whose lower bits are those of the root, so that the root and the
+// base can be far apart once the chunk is appended.
+template <typename Policy>
+template <typename T>
+void DoubleArrayBuilder<Policy>::build_chunk(const Keyset<T> &keyset,
+    const KeysetChunk &chunk, int flags, AutoPool<ChunkRoot> *roots) {
+  flags_ = flags;
+  extras_.reset(new extra_type[NUM_EXTRA_BLOCKS]);
+
+  for (std::size_t begin = chunk.begin; begin < chunk.end; ) {
+    const uchar_type label = keyset.keys(begin, chunk.depth);
+    std::size_t end = begin + 1;
+    while (end < chunk.end && keyset.keys(end, chunk.depth) == label) {
+      ++end;
+    }
+
+    ChunkRoot root;
+    root.id = chunk.offset ^ label;
+    labels_.resize(0);
+    const value_type value = collect_labels(keyset, begin, end,
+        chunk.depth + 1);
+    root.offset = find_chunk_offset(root.id & LOWER_MASK);
+    root.first_label = labels_[0];
+    for (std::size_t i = 0; i < labels_.size(); ++i) {
+      const id_type child_id = root.offset ^ labels_[i];
+      reserve_id(child_id);
+      if (labels_[i] == '\0') {
+        units_[child_id].set_value(value);
+      } else {
+        units_[child_id].set_label(labels_[i]);
+      }
+      if (!label_units_.empty()) {
+        label_units_[child_id].set_sibling(
+            (i + 1 < labels_.size()) ? labels_[i + 1] : '\0');
+      }
     }
+    set_is_used(root.offset);
+    roots->append(root);
+
+    build_children(keyset, begin, end, chunk.depth + 1, root.offset);
+    begin = end;
   }
-}
 
-inline void DoubleArrayBuilder::clear() {
-  units_.clear();
+  fix_all_blocks();
+
   extras_.clear();
   labels_.clear();
-  table_.clear();
-  extras_head_ = 0;
 }
 
-template <typename T>
-void DoubleArrayBuilder::build_dawg(const Keyset<T> &keyset,
-    DawgBuilder *dawg_builder) {
-  dawg_builder->init();
-  for (std::size_t i = 0; i < keyset.num_keys(); ++i) {
-    dawg_builder->insert(keyset.keys(i), keyset.lengths(i), keyset.values(i));
-    if (progress_func_ != NULL) {
-      progress_func_(i + 1, keyset.num_keys() + 1);
+// find_chunk_offset() returns a child base for a root of a chunk, whose
+// lower bits must be `lower_bits'. Only 1 base per block has those bits.
+template <typename Policy>
+inline typename DoubleArrayBuilder<Policy>::id_type
+DoubleArrayBuilder<Policy>::find_chunk_offset(id_type lower_bits) const {
+  const std::size_t begin = (num_blocks() > NUM_EXTRA_BLOCKS) ?
+      (num_blocks() - NUM_EXTRA_BLOCKS) : 0;
+  for (std::size_t block_id = begin; block_id < num_blocks(); ++block_id) {
+    const id_type offset =
+        static_cast<id_type>(block_id * BLOCK_SIZE) | lower_bits;
+    bool is_valid = !is_used(offset);
+    for (std::size_t i = 0; is_valid && i < labels_.size(); ++i) {
+      is_valid = !is_fixed(offset ^ labels_[i]);
+    }
+    if (is_valid) {
+      return offset;
     }
   }
-  dawg_builder->finish();
+  return static_cast<id_type>(units_.size()) | lower_bits;
 }
 
-inline void DoubleArrayBuilder::build_from_dawg(const DawgBuilder &dawg) {
-  std::size_t num_units = 1;
-  while (num_units < dawg.size()) {
-    num_units <<= 1;
+// append_chunk() copies the units of a chunk to the end of the array or to
+// a range left unused by a previous chunk.
+template <typename Policy>
+void DoubleArrayBuilder<Policy>::append_chunk(const DoubleArrayBuilder &chunk,
+    const AutoPool<ChunkRoot> &roots, AutoPool<UnitRange> *ranges) {
+  const std::size_t num_units = chunk.units_.size();
+  const std::size_t num_used_units = units_.size();
+  std::size_t size = num_used_units;
+  const std::size_t base = place_chunk(num_units, &size, ranges);
+
+  units_.resize(size);
+  if (!label_units_.empty()) {
+    label_units_.resize(size);
+  }
+  for (std::size_t id = num_used_units; id < base; ++id) {
+    units_[id] = unused_unit(id);
+  }
+  for (std::size_t i = 0; i < num_units; ++i) {
+    units_[base + i] = chunk.moved_unit(i, base);
+    if (!label_units_.empty()) {
+      label_units_[base + i] = chunk.label_units_[i];
+    }
   }
-  units_.reserve(num_units);
+  link_chunk(roots, base);
+}
 
-  table_.reset(new id_type[dawg.num_intersections()]);
-  for (std::size_t i = 0; i < dawg.num_intersections(); ++i) {
-    table_[i] = 0;
+// link_chunk() points the roots of a chunk placed at `base' to their
+// children.
+template <typename Policy>
+void DoubleArrayBuilder<Policy>::link_chunk(const AutoPool<ChunkRoot> &roots,
+    std::size_t base) {
+  for (std::size_t i = 0; i < roots.size(); ++i) {
+    const ChunkRoot &root = roots[i];
+    units_[root.id].set_offset(static_cast<id_type>(
+        root.id ^ (base + root.offset)));
+    units_[root.id].set_has_leaf(root.first_label == '\0');
+    if (!label_units_.empty()) {
+      label_units_[root.id].set_child(root.first_label);
+    }
+  }
+}
+
+// moved_unit() returns the unit at `id' as it is moved to `base + id'. The
+// relative offset is rewritten because it depends on the position.
+template <typename Policy>
+inline typename DoubleArrayBuilder<Policy>::unit_type
+DoubleArrayBuilder<Policy>::moved_unit(std::size_t id,
+    std::size_t base) const {
+  typedef typename Policy::unit_type dic_unit_type;
+
+  const dic_unit_type &unit =
+      reinterpret_cast<const dic_unit_type &>(units_[id]);
+  unit_type moved = units_[id];
+  if (unit.label() <= 0xFF && unit.offset() != 0) {
+    moved.set_offset(static_cast<id_type>(
+        (base + id) ^ (base + (id ^ unit.offset()))));
+  }
+  return moved;
+}
+
+// unused_unit() returns a unit for `id' which is left unused between chunks.
+// Its label never matches because no unit has its child base in the block.
+template <typename Policy>
+inline typename DoubleArrayBuilder<Policy>::unit_type
+DoubleArrayBuilder<Policy>::unused_unit(std::size_t id) {
+  unit_type unit;
+  unit.set_label(static_cast<uchar_type>(id & 0xFF));
+  return unit;
+}
+
+// place_chunk() returns the position of a chunk of `num_units' units in an
+// array of `*size' units, and updates `*size' if the chunk is appended. With
+// <SmallUnitPolicy>, a chunk which fits in a window must not cross a boundary
+// of windows, and a larger chunk must start at a boundary. Units skipped for
+// this reason are kept in `ranges' and used by later chunks.
+template <typename Policy>
+std::size_t DoubleArrayBuilder<Policy>::place_chunk(std::size_t num_units,
+    std::size_t *size, AutoPool<UnitRange> *ranges) {
+  const bool has_windows = !Policy::is_valid_offset(WINDOW_SIZE | 1);
+  const std::size_t window_mask = static_cast<std::size_t>(WINDOW_SIZE) - 1;
+
+  if (has_windows && num_units <= WINDOW_SIZE) {
+    for (std::size_t i = 0; i < ranges->size(); ++i) {
+      const UnitRange range = (*ranges)[i];
+      std::size_t base = range.begin;
+      if ((base & window_mask) + num_units > WINDOW_SIZE) {
+        base = (base + window_mask) & ~window_mask;
+      }
+      if (base + num_units > range.end) {
+        continue;
+      }
+
+      (*ranges)[i] = (*ranges)[ranges->size() - 1];
+      ranges->resize(ranges->size() - 1);
+      if (range.begin != base) {
+        UnitRange left = { range.begin, base };
+        ranges->append(left);
+      }
+      if (base + num_units != range.end) {
+        UnitRange right = { base + num_units, range.end };
+        ranges->append(right);
+      }
+      return base;
+    }
+  }
+
+  std::size_t base = *size;
+  if (has_windows && (base & window_mask) != 0 &&
+      (num_units > WINDOW_SIZE ||
+       (base & window_mask) + num_units > WINDOW_SIZE)) {
+    UnitRange range = { base, (base + window_mask) & ~window_mask };
+    ranges->append(range);
+    base = range.end;
+  }
+  *size = base + num_units;
+  return base;
+}
+
+// build_file() arranges the units near the root in memory and then the
+// chunks below them one by one, and writes the units to `file' at `offset'.
+// The units near the root are written first to keep the file contiguous,
+// and they are written again after the roots of the chunks are linked. It
+// returns false iff the file cannot be written.
+template <typename Policy>
+template <typename T, typename Reader>
+bool DoubleArrayBuilder<Policy>::build_file(Reader *reader,
+    std::size_t memory_limit, std::FILE *file, std::size_t offset,
+    std::size_t *num_keys_ptr, std::size_t *num_units_ptr) {
+  flags_ = BUILD_TRIE;
+
+  // A chunk takes at least the extras of its builder, so a smaller chunk
+  // only wastes units.
+  FileSplit split;
+  split.chunk_cost = memory_limit / 4;
+  if (split.chunk_cost < sizeof(unit_type) * BLOCK_SIZE * NUM_EXTRA_BLOCKS) {
+    split.chunk_cost = sizeof(unit_type) * BLOCK_SIZE * NUM_EXTRA_BLOCKS;
+  }
+  split_file<T>(reader, &split);
+
+  // The entries are in order of positions, so the chunks are numbered in
+  // order of keys. Each root of a chunk has -1 - (chunk ID) as its value.
+  AutoPool<KeysetChunk> chunks;
+  const std::size_t num_entries = split.entries.size();
+  AutoArray<const char_type *> keys;
+  AutoArray<std::size_t> lengths;
+  AutoArray<value_type> values;
+  try {
+    keys.reset(new const char_type *[num_entries]);
+    lengths.reset(new std::size_t[num_entries]);
+    values.reset(new value_type[num_entries]);
+  } catch (const std::bad_alloc &) {
+    DARTS_THROW("failed to build double-array: std::bad_alloc");
+  }
+  for (std::size_t i = 0; i < num_entries; ++i) {
+    const FileEntry &entry = split.entries[i];
+    keys[i] = &split.chars[entry.key];
+    lengths[i] = entry.length;
+    values[i] = entry.value;
+    if (entry.chunk_end != 0) {
+      if (chunks.empty() ||
+          chunks[chunks.size() - 1].begin != entry.chunk_begin) {
+        const KeysetChunk chunk =
+            { entry.chunk_begin, entry.chunk_end, entry.length - 1, 0 };
+        chunks.append(chunk);
+      }
+      values[i] = static_cast<value_type>(-1) -
+          static_cast<value_type>(chunks.size() - 1);
+    }
   }
 
-  extras_.reset(new extra_type[NUM_EXTRAS]);
+  // The keys of the units near the root are not the keys given by `reader',
+  // so they are not reported to `progress_func_'.
+  const progress_func_type progress_func = progress_func_;
+  progress_func_ = NULL;
+  extras_.reset(new extra_type[NUM_EXTRA_BLOCKS]);
 
   reserve_id(0);
-  extras(0).set_is_used(true);
+  set_is_used(0);
   units_[0].set_offset(1);
   units_[0].set_label('\0');
 
-  if (dawg.child(dawg.root()) != 0) {
-    build_from_dawg(dawg, dawg.root(), 0);
+  if (num_entries > 0) {
+    Keyset<value_type> keyset(num_entries, &keys[0], &lengths[0],
+        &values[0]);
+    arrange_top(keyset, 0, num_entries, 0, 0, &chunks);
   }
 
   fix_all_blocks();
-
   extras_.clear();
   labels_.clear();
-  table_.clear();
-}
+  progress_func_ = progress_func;
+
+  keys.clear();
+  lengths.clear();
+  values.clear();
+  split.entries.clear();
+  split.chars.clear();
+  split.key.clear();
+  if (!write_units(file, offset, 0, &units_[0], units_.size())) {
+    return false;
+  }
 
-inline void DoubleArrayBuilder::build_from_dawg(const DawgBuilder &dawg,
-    id_type dawg_id, id_type dic_id) {
-  id_type dawg_child_id = dawg.child(dawg_id);
-  if (dawg.is_intersection(dawg_child_id)) {
-    id_type intersection_id = dawg.intersection_id(dawg_child_id);
-    id_type offset = table_[intersection_id];
-    if (offset != 0) {
-      offset ^= dic_id;
-      if (!(offset & UPPER_MASK) || !(offset & LOWER_MASK)) {
-        if (dawg.is_leaf(dawg_child_id)) {
-          units_[dic_id].set_has_leaf(true);
-        }
-        units_[dic_id].set_offset(offset);
-        return;
+  // The 2nd pass reads the keys again, and each chunk is built from its keys
+  // without the common prefix.
+  reader->rewind();
+  AutoPool<char_type> chunk_chars;
+  AutoPool<std::size_t> chunk_starts;
+  AutoPool<const char_type *> chunk_keys;
+  AutoPool<std::size_t> chunk_lengths;
+  AutoPool<value_type> chunk_values;
+  AutoPool<UnitRange> ranges;
+  std::size_t size = units_.size();
+  std::size_t key_id = 0;
+  for (std::size_t i = 0; i < chunks.size(); ++i) {
+    const KeysetChunk &chunk = chunks[i];
+    chunk_chars.resize(0);
+    chunk_starts.resize(0);
+    chunk_lengths.resize(0);
+    chunk_values.resize(0);
+    for ( ; key_id < chunk.end; ++key_id) {
+      const char_type *key;
+      std::size_t length, lcp;
+      value_type value;
+      if (!read_file_key<T>(reader, split.key, key_id == 0,
+          &key, &length, &lcp, &value)) {
+        DARTS_THROW("failed to build double-array: keys changed");
+      }
+      split.key.resize(lcp);
+      for (std::size_t j = lcp; j < length; ++j) {
+        split.key.append(key[j]);
+      }
+      if (key_id < chunk.begin) {
+        continue;
+      }
+
+      chunk_starts.append(chunk_chars.size());
+      chunk_lengths.append(length - chunk.depth);
+      chunk_values.append(value);
+      for (std::size_t j = chunk.depth; j < length; ++j) {
+        chunk_chars.append(key[j]);
       }
     }
+    chunk_chars.append('\0');
+    chunk_keys.resize(chunk_starts.size());
+    for (std::size_t j = 0; j < chunk_starts.size(); ++j) {
+      chunk_keys[j] = &chunk_chars[chunk_starts[j]];
+    }
+
+    Keyset<value_type> keyset(chunk_keys.size(), &chunk_keys[0],
+        &chunk_lengths[0], &chunk_values[0]);
+    const KeysetChunk local_chunk = { 0, keyset.num_keys(), 0, chunk.offset };
+    DoubleArrayBuilder builder(NULL);
+    AutoPool<ChunkRoot> roots;
+    builder.build_chunk(keyset, local_chunk, flags_, &roots);
+
+    const std::size_t num_units = builder.units_.size();
+    const std::size_t num_used_units = size;
+    const std::size_t base = place_chunk(num_units, &size, &ranges);
+    for (std::size_t j = 0; j < num_units; ++j) {
+      builder.units_[j] = builder.moved_unit(j, base);
+    }
+    if (!write_unused_units(file, offset, num_used_units, base) ||
+        !write_units(file, offset, base, &builder.units_[0], num_units)) {
+      return false;
+    }
+    link_chunk(roots, base);
+
+    if (progress_func_ != NULL) {
+      progress_func_(chunk.end, split.num_keys + 1);
+    }
   }
 
-  id_type offset = arrange_from_dawg(dawg, dawg_id, dic_id);
-  if (dawg.is_intersection(dawg_child_id)) {
-    table_[dawg.intersection_id(dawg_child_id)] = offset;
+  if (!write_units(file, offset, 0, &units_[0], units_.size())) {
+    return false;
   }
+  *num_keys_ptr = split.num_keys;
+  *num_units_ptr = size;
+  return true;
+}
 
-  do {
-    uchar_type child_label = dawg.label(dawg_child_id);
-    id_type dic_child_id = offset ^ child_label;
-    if (child_label != '\0') {
-      build_from_dawg(dawg, dawg_child_id, dic_child_id);
+// split_file() is the 1st pass of build_file(). It reads the keys and
+// leaves the entries of the units to be arranged in memory in order of
+// positions.
+template <typename Policy>
+template <typename T, typename Reader>
+void DoubleArrayBuilder<Policy>::split_file(Reader *reader,
+    FileSplit *split) {
+  split->num_keys = 0;
+  split->chars.append('\0');
+  const FileFrame root = { 0, 0, 0, 0, -1 };
+  split->frames.append(root);
+
+  const char_type *key;
+  std::size_t length, lcp;
+  value_type value;
+  while (read_file_key<T>(reader, split->key, split->num_keys == 0,
+      &key, &length, &lcp, &value)) {
+    while (split->frames.size() > lcp + 1) {
+      close_file_frame(split);
     }
-    dawg_child_id = dawg.sibling(dawg_child_id);
-  } while (dawg_child_id != 0);
+    while (split->frames.size() <= length) {
+      const FileFrame frame = { split->num_keys, 0, split->children.size(),
+          split->entries.size(), -1 };
+      split->frames.append(frame);
+    }
+    split->frames[length].value = value;
+    split->frames[length].cost += file_key_cost(length - lcp);
+
+    split->key.resize(lcp);
+    for (std::size_t i = lcp; i < length; ++i) {
+      split->key.append(key[i]);
+    }
+    ++split->num_keys;
+  }
+
+  while (!split->frames.empty()) {
+    close_file_frame(split);
+  }
 }
 
-inline id_type DoubleArrayBuilder::arrange_from_dawg(const DawgBuilder &dawg,
-    id_type dawg_id, id_type dic_id) {
-  labels_.resize(0);
+// close_file_frame() closes the last frame. If its unit is arranged in
+// memory, the small children are packed into chunks as well as build_top()
+// does, and their entries are merged with the entries left by the larger
+// children.
+template <typename Policy>
+void DoubleArrayBuilder<Policy>::close_file_frame(FileSplit *split) {
+  const FileFrame frame = split->frames[split->frames.size() - 1];
+  split->frames.pop_back();
+  const std::size_t depth = split->frames.size();
+  const bool is_top = (depth == 0) || (frame.cost > split->chunk_cost);
+
+  if (is_top) {
+    AutoPool<FileEntry> &descendants = split->descendants;
+    descendants.resize(0);
+    for (std::size_t i = frame.num_entries; i < split->entries.size(); ++i) {
+      descendants.append(split->entries[i]);
+    }
+    split->entries.resize(frame.num_entries);
 
-  id_type dawg_child_id = dawg.child(dawg_id);
-  while (dawg_child_id != 0) {
-    labels_.append(dawg.label(dawg_child_id));
-    dawg_child_id = dawg.sibling(dawg_child_id);
+    if (frame.value >= 0) {
+      append_file_entry(split, frame.begin, depth, NULL, frame.value, 0, 0);
+    }
+
+    std::size_t next = 0;
+    std::size_t first = frame.num_children;
+    std::size_t cost = 0;
+    for (std::size_t i = frame.num_children; ; ++i) {
+      const bool is_end = (i == split->children.size());
+      if (first < i && (is_end || split->children[i].is_top ||
+          cost + split->children[i].cost > split->chunk_cost)) {
+        const std::size_t chunk_begin = split->children[first].begin;
+        const std::size_t chunk_end = split->children[i - 1].end;
+        for (std::size_t j = first; j < i; ++j) {
+          append_file_entry(split, split->children[j].begin, depth,
+              &split->children[j], -1, chunk_begin, chunk_end);
+        }
+        first = i;
+        cost = 0;
+      }
+      if (is_end) {
+        break;
+      }
+
+      const FileChild &child = split->children[i];
+      if (child.is_top) {
+        while (next < descendants.size() &&
+            descendants[next].position < child.end) {
+          split->entries.append(descendants[next++]);
+        }
+        first = i + 1;
+      } else {
+        cost += child.cost;
+      }
+    }
   }
 
-  id_type offset = find_valid_offset(dic_id);
-  units_[dic_id].set_offset(dic_id ^ offset);
+  split->children.resize(frame.num_children);
+  if (depth > 0) {
+    const FileChild child = { frame.begin, split->num_keys, frame.cost,
+        static_cast<uchar_type>(split->key[depth - 1]), is_top };
+    split->children.append(child);
+    split->frames[depth - 1].cost += frame.cost;
+  }
+}
 
-  dawg_child_id = dawg.child(dawg_id);
-  for (std::size_t i = 0; i < labels_.size(); ++i) {
-    id_type dic_child_id = offset ^ labels_[i];
-    reserve_id(dic_child_id);
+// append_file_entry() appends an entry whose key is the first `depth' labels
+// of the last key, followed by the label of `child' for a root of a chunk.
+template <typename Policy>
+void DoubleArrayBuilder<Policy>::append_file_entry(FileSplit *split,
+    std::size_t position, std::size_t depth, const FileChild *child,
+    value_type value, std::size_t chunk_begin, std::size_t chunk_end) {
+  FileEntry entry;
+  entry.position = position;
+  entry.key = split->chars.size();
+  entry.length = depth;
+  entry.value = value;
+  entry.chunk_begin = chunk_begin;
+  entry.chunk_end = chunk_end;
+  for (std::size_t i = 0; i < depth; ++i) {
+    split->chars.append(split->key[i]);
+  }
+  if (child != NULL) {
+    split->chars.append(static_cast<char_type>(child->label));
+    ++entry.length;
+  }
+  split->entries.append(entry);
+}
 
-    if (dawg.is_leaf(dawg_child_id)) {
-      units_[dic_id].set_has_leaf(true);
-      units_[dic_child_id].set_value(dawg.value(dawg_child_id));
-    } else {
-      units_[dic_child_id].set_label(labels_[i]);
+// read_file_key() reads the next key which differs from `last_key' and sets
+// `lcp' to the length of their common prefix. Duplicate keys are skipped as
+// well as in build().
+template <typename Policy>
+template <typename T, typename Reader>
+bool DoubleArrayBuilder<Policy>::read_file_key(Reader *reader,
+    const AutoPool<char_type> &last_key, bool is_first,
+    const char_type **key, std::size_t *length, std::size_t *lcp,
+    value_type *value) {
+  T key_value;
+  for ( ; ; ) {
+    if (!reader->read(key, length, &key_value)) {
+      return false;
     }
 
-    dawg_child_id = dawg.sibling(dawg_child_id);
+    std::size_t i = 0;
+    while (i < *length && i < last_key.size() && (*key)[i] == last_key[i]) {
+      ++i;
+    }
+    if (!is_first && i == *length && i == last_key.size()) {
+      continue;
+    }
+    if (i < last_key.size() && (i == *length ||
+        static_cast<uchar_type>((*key)[i]) <
+        static_cast<uchar_type>(last_key[i]))) {
+      DARTS_THROW("failed to build double-array: wrong key order");
+    }
+    for (std::size_t j = i; j < *length; ++j) {
+      if ((*key)[j] == '\0') {
+        DARTS_THROW("failed to build double-array: invalid null character");
+      }
+    }
+
+    *value = static_cast<value_type>(key_value);
+    if (*value < 0) {
+      DARTS_THROW("failed to build double-array: negative value");
+    }
+    *lcp = i;
+    return true;
   }
-  extras(offset).set_is_used(true);
+}
 
-  return offset;
+// file_key_cost() estimates the bytes taken by a key while its chunk is
+// built, where `num_labels' is the number of labels which do not share units
+// with the previous key: the key with its pointer, length and value, and 2
+// units per new unit because the array of units grows by doubling.
+template <typename Policy>
+inline std::size_t DoubleArrayBuilder<Policy>::file_key_cost(
+    std::size_t num_labels) {
+  return sizeof(const char_type *) + sizeof(std::size_t) +
+      sizeof(value_type) +
+      (num_labels + 1) * (sizeof(char_type) + 2 * sizeof(unit_type));
 }
 
+// arrange_top() works as well as build_top() but stops at the entries of
+// the roots of chunks, and sets the child base of their parent to the chunk.
+template <typename Policy>
 template <typename T>
-void DoubleArrayBuilder::build_from_keyset(const Keyset<T> &keyset) {
-  std::size_t num_units = 1;
-  while (num_units < keyset.num_keys()) {
-    num_units <<= 1;
+void DoubleArrayBuilder<Policy>::arrange_top(const Keyset<T> &keyset,
+    std::size_t begin, std::size_t end, std::size_t depth, id_type dic_id,
+    AutoPool<KeysetChunk> *chunks) {
+  const id_type offset =
+      arrange_from_keyset(keyset, begin, end, depth, dic_id);
+
+  while (begin < end && keyset.keys(begin, depth) == '\0') {
+    ++begin;
   }
-  units_.reserve(num_units);
+  while (begin < end) {
+    const uchar_type label = keyset.keys(begin, depth);
+    std::size_t child_end = begin + 1;
+    while (child_end < end && keyset.keys(child_end, depth) == label) {
+      ++child_end;
+    }
 
-  extras_.reset(new extra_type[NUM_EXTRAS]);
+    const value_type value = keyset.values(begin);
+    if (child_end - begin == 1 && value < 0 &&
+        keyset.lengths(begin) == depth + 1) {
+      (*chunks)[static_cast<std::size_t>(-1 - value)].offset = offset;
+    } else {
+      arrange_top(keyset, begin, child_end, depth + 1, offset ^ label,
+          chunks);
+    }
+    begin = child_end;
+  }
+}
 
-  reserve_id(0);
-  extras(0).set_is_used(true);
-  units_[0].set_offset(1);
-  units_[0].set_label('\0');
+template <typename Policy>
+inline bool DoubleArrayBuilder<Policy>::write_units(std::FILE *file,
+    std::size_t offset, std::size_t id, const unit_type *units,
+    std::size_t num_units) {
+  return seek_file(file, offset + sizeof(unit_type) * id) &&
+      std::fwrite(units, sizeof(unit_type), num_units, file) == num_units;
+}
 
-  if (keyset.num_keys() > 0) {
-    build_from_keyset(keyset, 0, keyset.num_keys(), 0, 0);
+// write_unused_units() fills the units in [begin, end) of a file with unused
+// units as well as append_chunk() does.
+template <typename Policy>
+bool DoubleArrayBuilder<Policy>::write_unused_units(std::FILE *file,
+    std::size_t offset, std::size_t begin, std::size_t end) {
+  if (begin >= end) {
+    return true;
   }
+  if (!seek_file(file, offset + sizeof(unit_type) * begin)) {
+    return false;
+  }
+  for (std::size_t id = begin; id < end; ++id) {
+    const unit_type unit = unused_unit(id);
+    if (std::fwrite(&unit, sizeof(unit_type), 1, file) != 1) {
+      return false;
+    }
+  }
+  return true;
+}
 
-  fix_all_blocks();
-
-  extras_.clear();
-  labels_.clear();
+// has_single_key() tests whether the keys in a range are the same, that is,
+// whether the range is a single path to a leaf.
+template <typename Policy>
+template <typename T>
+inline bool DoubleArrayBuilder<Policy>::has_single_key(
+    const Keyset<T> &keyset, std::size_t begin, std::size_t end,
+    std::size_t depth) const {
+  for (std::size_t i = depth; ; ++i) {
+    const uchar_type label = keyset.keys(begin, i);
+    if (label != keyset.keys(end - 1, i)) {
+      return false;
+    } else if (label == '\0') {
+      return true;
+    }
+  }
 }
 
+// arrange_tail() gives a leaf to the unit of a single key and stores the
+// rest of the key in the tail.
+template <typename Policy>
 template <typename T>
-void DoubleArrayBuilder::build_from_keyset(const Keyset<T> &keyset,
+void DoubleArrayBuilder<Policy>::arrange_tail(const Keyset<T> &keyset,
     std::size_t begin, std::size_t end, std::size_t depth, id_type dic_id) {
-  id_type offset = arrange_from_keyset(keyset, begin, end, depth, dic_id);
-
-  while (begin < end) {
-    if (keyset.keys(begin, depth) != '\0') {
-      break;
-    }
-    ++begin;
+  std::size_t length = depth;
+  while (keyset.keys(begin, length) != '\0') {
+    ++length;
   }
-  if (begin == end) {
-    return;
+  if (keyset.has_lengths() && length < keyset.lengths(begin)) {
+    DARTS_THROW("failed to build double-array: invalid null character");
+  } else if (keyset.values(begin) < 0) {
+    DARTS_THROW("failed to build double-array: negative value");
+  }
+  if (progress_func_ != NULL) {
+    progress_func_(end, keyset.num_keys() + 1);
   }
 
-  std::size_t last_begin = begin;
-  uchar_type last_label = keyset.keys(begin, depth);
-  while (++begin < end) {
-    uchar_type label = keyset.keys(begin, depth);
-    if (label != last_label) {
-      build_from_keyset(keyset, last_begin, begin,
-          depth + 1, offset ^ last_label);
-      last_begin = begin;
-      last_label = keyset.keys(begin, depth);
-    }
+  labels_.resize(0);
+  labels_.append('\0');
+  id_type offset = find_valid_offset(dic_id);
+  units_[dic_id].set_offset(dic_id ^ offset);
+  units_[dic_id].set_has_leaf(true);
+  reserve_id(offset);
+
+  begin_tail(offset, keyset.values(begin));
+  for (std::size_t i = depth; i < length; ++i) {
+    tail_.append(keyset.keys(begin, i));
   }
-  build_from_keyset(keyset, last_begin, end, depth + 1, offset ^ last_label);
+  end_tail();
+
+  set_is_used(offset);
+  set_label_units(dic_id, offset);
 }
 
-template <typename T>
-id_type DoubleArrayBuilder::arrange_from_keyset(const Keyset<T> &keyset,
-    std::size_t begin, std::size_t end, std::size_t depth, id_type dic_id) {
-  labels_.resize(0);
+// A tail consists of the value of a key and the rest of the key, which is
+// terminated by '\0' and padded to a multiple of 4 bytes. The value of its
+// leaf is set by fix_tail() because it is the position of the tail in 4-byte
+// words from the beginning of the units.
+template <typename Policy>
+inline void DoubleArrayBuilder<Policy>::begin_tail(id_type leaf_id,
+    value_type value) {
+  tail_leaves_.append(leaf_id);
 
-  value_type value = -1;
-  for (std::size_t i = begin; i < end; ++i) {
-    uchar_type label = keyset.keys(i, depth);
-    if (label == '\0') {
-      if (keyset.has_lengths() && depth < keyset.lengths(i)) {
-        DARTS_THROW("failed to build double-array: "
-            "invalid null character");
-      } else if (keyset.values(i) < 0) {
-        DARTS_THROW("failed to build double-array: negative value");
-      }
+  const Details::id_type tail_value = static_cast<Details::id_type>(value);
+  for (std::size_t i = 0; i < sizeof(tail_value); ++i) {
+    tail_.append(reinterpret_cast<const uchar_type *>(&tail_value)[i]);
+  }
+}
 
-      if (value == -1) {
-        value = keyset.values(i);
-      }
-      if (progress_func_ != NULL) {
-        progress_func_(i + 1, keyset.num_keys() + 1);
-      }
-    }
+template <typename Policy>
+inline void DoubleArrayBuilder<Policy>::end_tail() {
+  do {
+    tail_.append('\0');
+  } while ((tail_.size() % 4) != 0);
+}
 
-    if (labels_.empty()) {
-      labels_.append(label);
-    } else if (label != labels_[labels_.size() - 1]) {
-      if (label < labels_[labels_.size() - 1]) {
-        DARTS_THROW("failed to build double-array: wrong key order");
-      }
-      labels_.append(label);
+template <typename Policy>
+inline void DoubleArrayBuilder<Policy>::fix_tail() {
+  if (tail_leaves_.empty()) {
+    return;
+  }
+
+  const std::size_t base = units_.size() * sizeof(unit_type) / 4;
+  if (base + tail_.size() / 4 > 0x7FFFFFFF) {
+    DARTS_THROW("failed to build double-array: too large tail");
+  }
+  std::size_t pos = 0;
+  for (std::size_t i = 0; i < tail_leaves_.size(); ++i) {
+    units_[tail_leaves_[i]].set_value(static_cast<value_type>(base + pos / 4));
+    pos += 4;
+    while (tail_[pos] != '\0') {
+      ++pos;
     }
+    pos = (pos + 4) & ~static_cast<std::size_t>(3);
   }
+  tail_leaves_.clear();
+}
 
-  id_type offset = find_valid_offset(dic_id);
-  units_[dic_id].set_offset(dic_id ^ offset);
+template <typename Policy>
+inline void DoubleArrayBuilder<Policy>::set_label_units(id_type id,
+    id_type offset) {
+  if (label_units_.empty()) {
+    return;
+  }
 
+  label_units_[id].set_child(labels_[0]);
   for (std::size_t i = 0; i < labels_.size(); ++i) {
-    id_type dic_child_id = offset ^ labels_[i];
-    reserve_id(dic_child_id);
-    if (labels_[i] == '\0') {
-      units_[dic_id].set_has_leaf(true);
-      units_[dic_child_id].set_value(value);
+    label_units_[offset ^ labels_[i]].set_sibling(
+        (i + 1 < labels_.size()) ? labels_[i + 1] : '\0');
+  }
+}
+
+template <typename Policy>
+inline typename DoubleArrayBuilder<Policy>::id_type
+DoubleArrayBuilder<Policy>::find_valid_offset(id_type id) const {
+  // The blocks being arranged are scanned in order, and the lowest unfixed
+  // child of each block is tested first, so the offset is the same as that
+  // found by testing the unfixed units one by one. If the upper bits of the
+  // relative offset to a block are not valid, the lower bits must be the
+  // same as `id', and there is only one offset to test.
+  id_type begin = (num_blocks() > NUM_EXTRA_BLOCKS) ?
+      (num_blocks() - NUM_EXTRA_BLOCKS) : 0;
+  if (begin < extras_head_) {
+    begin = extras_head_;
+  }
+  for (id_type block_id = begin; block_id < num_blocks(); ++block_id) {
+    const id_type block_base = block_id * BLOCK_SIZE;
+    if (extras(block_base).is_full()) {
+      continue;
+    } else if (Policy::is_valid_offset((id ^ block_base) | LOWER_MASK)) {
+      const std::size_t child = extras(block_base).find_child(&labels_[0],
+          labels_.size());
+      if (child != BLOCK_SIZE) {
+        return (block_base | static_cast<id_type>(child)) ^ labels_[0];
+      }
     } else {
-      units_[dic_child_id].set_label(labels_[i]);
+      const id_type offset = block_base | (id & LOWER_MASK);
+      if (!is_fixed(offset ^ labels_[0]) && is_valid_offset(id, offset)) {
+        return offset;
+      }
     }
   }
-  extras(offset).set_is_used(true);
 
-  return offset;
+  return units_.size() | (id & LOWER_MASK);
 }
 
-inline id_type DoubleArrayBuilder::find_valid_offset(id_type id) const {
-  if (extras_head_ >= units_.size()) {
-    return units_.size() | (id & LOWER_MASK);
+// find_nearby_offset() returns an offset which places the child labeled
+// `label' in the same cache line of 16 units as `id', or 0 if there is no
+// such offset in the blocks being arranged.
+template <typename Policy>
+inline typename DoubleArrayBuilder<Policy>::id_type
+DoubleArrayBuilder<Policy>::find_nearby_offset(id_type id,
+    uchar_type label) const {
+  const std::size_t begin = (num_blocks() > NUM_EXTRA_BLOCKS) ?
+      ((num_blocks() - NUM_EXTRA_BLOCKS) * BLOCK_SIZE) : 0;
+  if (id < begin) {
+    return 0;
   }
 
-  id_type unfixed_id = extras_head_;
-  do {
-    id_type offset = unfixed_id ^ labels_[0];
-    if (is_valid_offset(id, offset)) {
+  for (id_type i = 0; i < 16; ++i) {
+    const id_type child_id = (id & ~static_cast<id_type>(15)) | i;
+    const id_type offset = child_id ^ label;
+    if (!is_fixed(child_id) &&
+        !is_fixed(offset ^ labels_[0]) &&
+        is_valid_offset(id, offset)) {
       return offset;
     }
-    unfixed_id = extras(unfixed_id).next();
-  } while (unfixed_id != extras_head_);
-
-  return units_.size() | (id & LOWER_MASK);
+  }
+  return 0;
 }
 
-inline bool DoubleArrayBuilder::is_valid_offset(id_type id,
+template <typename Policy>
+inline bool DoubleArrayBuilder<Policy>::is_valid_offset(id_type id,
     id_type offset) const {
-  if (extras(offset).is_used()) {
+  if (is_used(offset)) {
     return false;
   }
 
   id_type rel_offset = id ^ offset;
-  if ((rel_offset & LOWER_MASK) && (rel_offset & UPPER_MASK)) {
+  if (!Policy::is_valid_offset(rel_offset)) {
     return false;
   }
 
   for (std::size_t i = 1; i < labels_.size(); ++i) {
-    if (extras(offset ^ labels_[i]).is_fixed()) {
+    if (is_fixed(offset ^ labels_[i])) {
       return false;
     }
   }
@@ -1806,23 +6114,23 @@ inline bool DoubleArrayBuilder::is_valid_offset(id_type id,
   return true;
 }
 
-inline void DoubleArrayBuilder::reserve_id(id_type id) {
+template <typename Policy>
+inline void DoubleArrayBuilder<Policy>::reserve_id(id_type id) {
   if (id >= units_.size()) {
     expand_units();
   }
+  extras(id).set_is_fixed(id);
 
-  if (id == extras_head_) {
-    extras_head_ = extras(id).next();
-    if (extras_head_ == id) {
-      extras_head_ = units_.size();
+  if (id / BLOCK_SIZE == extras_head_) {
+    while (extras_head_ < num_blocks() &&
+        extras(extras_head_ * BLOCK_SIZE).is_full()) {
+      ++extras_head_;
     }
   }
-  extras(extras(id).prev()).set_next(extras(id).next());
-  extras(extras(id).next()).set_prev(extras(id).prev());
-  extras(id).set_is_fixed(true);
 }
 
-inline void DoubleArrayBuilder::expand_units() {
+template <typename Policy>
+inline void DoubleArrayBuilder<Policy>::expand_units() {
   id_type src_num_units = units_.size();
   id_type src_num_blocks = num_blocks();
 
@@ -1834,30 +6142,20 @@ inline void DoubleArrayBuilder::expand_units() {
   }
 
   units_.resize(dest_num_units);
-
-  if (dest_num_blocks > NUM_EXTRA_BLOCKS) {
-    for (std::size_t id = src_num_units; id < dest_num_units; ++id) {
-      extras(id).set_is_used(false);
-      extras(id).set_is_fixed(false);
-    }
+  if ((flags_ & BUILD_LABEL_INDEX) != 0) {
+    label_units_.resize(dest_num_units);
   }
-
-  for (id_type i = src_num_units + 1; i < dest_num_units; ++i) {
-    extras(i - 1).set_next(i);
-    extras(i).set_prev(i - 1);
+  if ((flags_ & BUILD_PARENTS) != 0) {
+    parents_.resize(dest_num_units, 0);
   }
 
-  extras(src_num_units).set_prev(dest_num_units - 1);
-  extras(dest_num_units - 1).set_next(src_num_units);
-
-  extras(src_num_units).set_prev(extras(extras_head_).prev());
-  extras(dest_num_units - 1).set_next(extras_head_);
-
-  extras(extras(extras_head_).prev()).set_next(src_num_units);
-  extras(extras_head_).set_prev(dest_num_units - 1);
+  if (dest_num_blocks > NUM_EXTRA_BLOCKS) {
+    extras(src_num_units).clear();
+  }
 }
 
-inline void DoubleArrayBuilder::fix_all_blocks() {
+template <typename Policy>
+inline void DoubleArrayBuilder<Policy>::fix_all_blocks() {
   id_type begin = 0;
   if (num_blocks() > NUM_EXTRA_BLOCKS) {
     begin = num_blocks() - NUM_EXTRA_BLOCKS;
@@ -1869,63 +6167,600 @@ inline void DoubleArrayBuilder::fix_all_blocks() {
   }
 }
 
-inline void DoubleArrayBuilder::fix_block(id_type block_id) {
+template <typename Policy>
+inline void DoubleArrayBuilder<Policy>::fix_block(id_type block_id) {
   id_type begin = block_id * BLOCK_SIZE;
   id_type end = begin + BLOCK_SIZE;
 
   id_type unused_offset = 0;
   for (id_type offset = begin; offset != end; ++offset) {
-    if (!extras(offset).is_used()) {
+    if (!is_used(offset)) {
       unused_offset = offset;
       break;
     }
   }
 
   for (id_type id = begin; id != end; ++id) {
-    if (!extras(id).is_fixed()) {
+    if (!is_fixed(id)) {
       reserve_id(id);
       units_[id].set_label(static_cast<uchar_type>(id ^ unused_offset));
     }
   }
 }
 
+//
+// Aho-Corasick link builder.
+//
+
+template <typename Policy>
+class DoubleArrayLinkBuilder {
+ public:
+  typedef typename Policy::id_type id_type;
+  typedef typename Policy::unit_type unit_type;
+  typedef DoubleArrayLink<id_type> link_type;
+
+  DoubleArrayLinkBuilder() : units_(NULL), num_units_(0), links_(),
+      labels_(), queue_() {}
+  ~DoubleArrayLinkBuilder() {
+    clear();
+  }
+
+  // The 1st build() tests only the labels which appear in the keys, and the
+  // 2nd build() tests the labels marked in `is_used_labels'. build() throws a
+  // <Darts::Exception> if a unit is reached from 2 parents, that is, if the
+  // units are not a trie.
+  template <typename T>
+  void build(const unit_type *units, std::size_t num_units,
+      const Keyset<T> &keyset);
+  void build(const unit_type *units, std::size_t num_units,
+      const bool *is_used_labels);
+  void copy(link_type **buf_ptr) const;
+
+  void clear();
+
+ private:
+  const unit_type *units_;
+  std::size_t num_units_;
+  AutoArray<link_type> links_;
+  AutoPool<uchar_type> labels_;
+  AutoPool<id_type> queue_;
+
+  // Disallows copy and assignment.
+  DoubleArrayLinkBuilder(const DoubleArrayLinkBuilder &);
+  DoubleArrayLinkBuilder &operator=(const DoubleArrayLinkBuilder &);
+
+  // child() returns the child of `id' labeled `label', or 0 if there is no
+  // such child. Note that the root never becomes a child.
+  id_type child(id_type id, uchar_type label) const {
+    id_type child_id = id ^ units_[id].offset() ^ label;
+    return (units_[child_id].label() == label) ? child_id : 0;
+  }
+};
+
+template <typename Policy>
+template <typename T>
+void DoubleArrayLinkBuilder<Policy>::build(const unit_type *units,
+    std::size_t num_units, const Keyset<T> &keyset) {
+  bool is_used_labels[256] = { false };
+  for (std::size_t i = 0; i < keyset.num_keys(); ++i) {
+    std::size_t length = keyset.lengths(i);
+    for (std::size_t j = 0; j < length; ++j) {
+      is_used_labels[keyset.keys(i, j)] = true;
+    }
+  }
+  build(units, num_units, is_used_labels);
+}
+
+template <typename Policy>
+void DoubleArrayLinkBuilder<Policy>::build(const unit_type *units,
+    std::size_t num_units, const bool *is_used_labels) {
+  units_ = units;
+  num_units_ = num_units;
+
+  // A unit which has been queued has a failure link or is a child of the
+  // root, so `is_queued' finds a unit reached from 2 parents.
+  AutoArray<bool> is_queued;
+  try {
+    links_.reset(new link_type[num_units]);
+    is_queued.reset(new bool[num_units]);
+  } catch (const std::bad_alloc &) {
+    DARTS_THROW("failed to build links: std::bad_alloc");
+  }
+  for (std::size_t i = 0; i < num_units; ++i) {
+    is_queued[i] = false;
+  }
+
+  // Children are found by testing labels, and only the used labels are
+  // tested.
+  for (id_type label = 1; label < 256; ++label) {
+    if (is_used_labels[label]) {
+      labels_.append(static_cast<uchar_type>(label));
+    }
+  }
+
+  // Units are visited in breadth-first order so that the links of shallower
+  // units are ready before they are followed.
+  queue_.append(0);
+  std::size_t level_end = queue_.size();
+  id_type depth = 0;
+  for (std::size_t i = 0; i < queue_.size(); ++i) {
+    if (i == level_end) {
+      level_end = queue_.size();
+      ++depth;
+    }
+
+    id_type id = queue_[i];
+    for (std::size_t j = 0; j < labels_.size(); ++j) {
+      uchar_type label = labels_[j];
+      id_type child_id = child(id, label);
+      if (child_id == 0) {
+        continue;
+      } else if (is_queued[child_id]) {
+        labels_.clear();
+        queue_.clear();
+        DARTS_THROW("failed to build links: not a trie");
+      }
+      is_queued[child_id] = true;
+
+      id_type failure_id = 0;
+      if (id != 0) {
+        failure_id = links_[id].failure();
+        for ( ; ; ) {
+          id_type next_id = child(failure_id, label);
+          if (next_id != 0) {
+            failure_id = next_id;
+            break;
+          } else if (failure_id == 0) {
+            break;
+          }
+          failure_id = links_[failure_id].failure();
+        }
+      }
+      links_[child_id].set_failure(failure_id);
+      if (failure_id != 0) {
+        links_[child_id].set_output(units_[failure_id].has_leaf() ?
+            failure_id : links_[failure_id].output());
+      }
+
+      if (units_[child_id].has_leaf()) {
+        links_[child_id ^ units_[child_id].offset()].set_length(depth + 1);
+      }
+      queue_.append(child_id);
+    }
+  }
+
+  labels_.clear();
+  queue_.clear();
+}
+
+template <typename Policy>
+inline void DoubleArrayLinkBuilder<Policy>::copy(link_type **buf_ptr) const {
+  if (buf_ptr != NULL) {
+    *buf_ptr = new link_type[num_units_];
+    for (std::size_t i = 0; i < num_units_; ++i) {
+      (*buf_ptr)[i] = links_[i];
+    }
+  }
+}
+
+template <typename Policy>
+inline void DoubleArrayLinkBuilder<Policy>::clear() {
+  units_ = NULL;
+  num_units_ = 0;
+  links_.clear();
+  labels_.clear();
+  queue_.clear();
+}
+
 }  // namespace Details
 
 //
 // Member function build() of DoubleArrayImpl.
 //
 
+template <typename A, typename B, typename T, typename C>
+void DoubleArrayImpl<A, B, T, C>::build_from_dawg(
+    const Details::DawgBuilder &dawg, std::size_t num_keys, int flags) {
+  Details::DoubleArrayBuilder<policy_type> builder(NULL);
+  builder.build(dawg, flags);
+
+  std::size_t size = 0;
+  unit_type *buf = NULL;
+  builder.copy(&size, &buf);
+  label_unit_type *labels = NULL;
+  try {
+    builder.copy_labels(&labels);
+  } catch (...) {
+    delete[] buf;
+    throw;
+  }
+  builder.clear();
+
+  clear();
+
+  size_ = size;
+  array_ = buf;
+  buf_ = buf;
+  labels_ = labels;
+  labels_buf_ = labels;
+  flags_ = flags;
+  num_keys_ = num_keys;
+  set_remap_table(NULL);
+}
+
+template <typename A, typename B, typename T, typename C>
+int DoubleArrayImpl<A, B, T, C>::relocate(std::size_t num_queries,
+    const key_type * const *queries, const std::size_t *lengths) {
+  if (size_ == 0) {
+    DARTS_THROW("failed to relocate double-array: unknown size");
+  } else if (links_ != NULL || parents_ != NULL || has_tails_) {
+    DARTS_THROW("failed to relocate double-array: unsupported dictionary");
+  }
+  // The root of an empty dictionary has an offset which is not reserved.
+  if (array_[0].offset() == 1 && !array_[0].has_leaf()) {
+    return 0;
+  }
+
+  Details::AutoArray<std::size_t> counts;
+  try {
+    counts.reset(new std::size_t[size_]);
+  } catch (const std::bad_alloc &) {
+    DARTS_THROW("failed to relocate double-array: std::bad_alloc");
+  }
+  for (std::size_t i = 0; i < size_; ++i) {
+    counts[i] = 0;
+  }
+  for (std::size_t i = 0; i < num_queries; ++i) {
+    const key_type *query = queries[i];
+    const std::size_t length = (lengths != NULL) ? lengths[i] : 0;
+    id_type id = 0;
+    unit_type unit = array_[id];
+    ++counts[id];
+    for (std::size_t j = 0; has_char(query, length, j); ++j) {
+      id ^= unit.offset() ^ remap(query[j]);
+      unit = array_[id];
+      if (unit.label() != remap(query[j])) {
+        break;
+      }
+      ++counts[id];
+    }
+  }
+
+  Details::DoubleArrayBuilder<policy_type> builder(NULL);
+  builder.relocate(array_, size_, &counts[0],
+      (labels_ != NULL) ? BUILD_LABEL_INDEX : 0);
+  counts.clear();
+
+  std::size_t size = 0;
+  unit_type *buf = NULL;
+  builder.copy(&size, &buf);
+  label_unit_type *labels = NULL;
+  try {
+    builder.copy_labels(&labels);
+  } catch (...) {
+    delete[] buf;
+    throw;
+  }
+  builder.clear();
+
+  const int flags = flags_;
+  const std::size_t num_keys = num_keys_;
+  clear();
+
+  size_ = size;
+  array_ = buf;
+  buf_ = buf;
+  labels_ = labels;
+  labels_buf_ = labels;
+  flags_ = flags;
+  num_keys_ = num_keys;
+  return 0;
+}
+
 template <typename A, typename B, typename T, typename C>
 int DoubleArrayImpl<A, B, T, C>::build(std::size_t num_keys,
     const key_type * const *keys, const std::size_t *lengths,
-    const value_type *values, Details::progress_func_type progress_func) {
-  Details::Keyset<value_type> keyset(num_keys, keys, lengths, values);
+    const value_type *values, Details::progress_func_type progress_func,
+    int flags, const unsigned char *remap_table) {
+  if (remap_table != NULL && !Details::is_valid_remap_table(remap_table)) {
+    DARTS_THROW("failed to build double-array: invalid remap table");
+  }
+  Details::Keyset<value_type> keyset(num_keys, keys, lengths, values,
+      remap_table);
 
-  Details::DoubleArrayBuilder builder(progress_func);
-  builder.build(keyset);
+  Details::DoubleArrayBuilder<policy_type> builder(progress_func);
+  builder.build(keyset, flags, num_threads_);
 
   std::size_t size = 0;
   unit_type *buf = NULL;
   builder.copy(&size, &buf);
+  label_unit_type *labels = NULL;
+  std::size_t num_leaves = 0;
+  id_type *parents = NULL;
+  try {
+    builder.copy_labels(&labels);
+    builder.copy_parents(&num_leaves, &parents);
+  } catch (...) {
+    delete[] buf;
+    delete[] labels;
+    throw;
+  }
+  builder.clear();
+
+  link_type *links = NULL;
+  if ((flags & BUILD_LINKS) != 0) {
+    try {
+      Details::DoubleArrayLinkBuilder<policy_type> link_builder;
+      link_builder.build(buf, size, keyset);
+      link_builder.copy(&links);
+    } catch (...) {
+      delete[] buf;
+      delete[] labels;
+      delete[] parents;
+      throw;
+    }
+  }
 
   clear();
 
   size_ = size;
   array_ = buf;
   buf_ = buf;
+  links_ = links;
+  links_buf_ = links;
+  labels_ = labels;
+  labels_buf_ = labels;
+  parents_ = parents;
+  leaves_ = (parents != NULL) ? (parents + size) : NULL;
+  num_leaves_ = num_leaves;
+  parents_buf_ = parents;
+  has_tails_ = (flags & BUILD_TAIL) != 0;
+  flags_ = flags;
+  num_keys_ = num_keys;
+  set_remap_table(remap_table);
+
+  if (progress_func != NULL) {
+    progress_func(num_keys + 1, num_keys + 1);
+  }
+
+  return 0;
+}
+
+template <typename A, typename B, typename T, typename C>
+int DoubleArrayImpl<A, B, T, C>::buildLinks() {
+  if (size_ == 0) {
+    DARTS_THROW("failed to build links: unknown size");
+  } else if (has_tails_) {
+    DARTS_THROW("failed to build links: tails are not supported");
+  }
+
+  bool is_used_labels[256];
+  for (std::size_t i = 0; i < 256; ++i) {
+    is_used_labels[i] = true;
+  }
+  link_type *links = NULL;
+  {
+    Details::DoubleArrayLinkBuilder<policy_type> link_builder;
+    link_builder.build(array_, size_, is_used_labels);
+    link_builder.copy(&links);
+  }
+
+  if (links_buf_ != NULL) {
+    delete[] links_buf_;
+  }
+  links_ = links;
+  links_buf_ = links;
+  return 0;
+}
+
+template <typename A, typename B, typename T, typename C>
+int DoubleArrayImpl<A, B, T, C>::buildParents() {
+  if (size_ == 0) {
+    DARTS_THROW("failed to build parents: unknown size");
+  } else if (has_tails_) {
+    DARTS_THROW("failed to build parents: tails are not supported");
+  }
+
+  Details::AutoArray<id_type> parents;
+  Details::AutoArray<bool> is_visited;
+  Details::AutoPool<id_type> leaves;
+  Details::AutoPool<id_type> stack;
+  try {
+    parents.reset(new id_type[size_]);
+    is_visited.reset(new bool[size_]);
+  } catch (const std::bad_alloc &) {
+    DARTS_THROW("failed to build parents: std::bad_alloc");
+  }
+  for (std::size_t i = 0; i < size_; ++i) {
+    parents[i] = 0;
+    is_visited[i] = false;
+  }
+
+  // The children are pushed in descending order of labels, so that units are
+  // popped in key order and a key which ends at a unit comes first.
+  stack.append(0);
+  while (!stack.empty()) {
+    const id_type id = stack[stack.size() - 1];
+    stack.resize(stack.size() - 1);
+    const unit_type unit = array_[id];
+    if (unit.has_leaf()) {
+      parents[id ^ unit.offset()] = id;
+      leaves.append(id ^ unit.offset());
+    }
+    for (id_type label = 255; label > 0; --label) {
+      const id_type child_id = id ^ unit.offset() ^ label;
+      if (array_[child_id].label() != label) {
+        continue;
+      } else if (is_visited[child_id]) {
+        DARTS_THROW("failed to build parents: not a trie");
+      }
+      is_visited[child_id] = true;
+      parents[child_id] = id;
+      stack.append(child_id);
+    }
+  }
+
+  id_type *buf;
+  try {
+    buf = new id_type[size_ + leaves.size()];
+  } catch (const std::bad_alloc &) {
+    DARTS_THROW("failed to build parents: std::bad_alloc");
+  }
+  for (std::size_t i = 0; i < size_; ++i) {
+    buf[i] = parents[i];
+  }
+  for (std::size_t i = 0; i < leaves.size(); ++i) {
+    buf[size_ + i] = leaves[i];
+  }
+
+  if (parents_buf_ != NULL) {
+    delete[] parents_buf_;
+  }
+  parents_ = buf;
+  leaves_ = buf + size_;
+  num_leaves_ = leaves.size();
+  parents_buf_ = buf;
+  return 0;
+}
+
+template <typename A, typename B, typename T, typename C>
+template <typename Reader>
+int DoubleArrayImpl<A, B, T, C>::buildFile(Reader *reader,
+    const char *file_name, std::size_t memory_limit,
+    Details::progress_func_type progress_func, int flags) const {
+#ifdef _MSC_VER
+  std::FILE *file;
+  if (::fopen_s(&file, file_name, "wb+") != 0) {
+    return -1;
+  }
+#else
+  std::FILE *file = std::fopen(file_name, "wb+");
+  if (file == NULL) {
+    return -1;
+  }
+#endif
+
+  // The header is written after the units because it has their checksum.
+  const std::size_t header_size =
+      ((flags & SAVE_HEADER) != 0) ? Details::FileHeader::SIZE : 0;
+  Details::uchar_type bytes[Details::FileHeader::SIZE];
+  for (std::size_t i = 0; i < header_size; ++i) {
+    bytes[i] = '\0';
+  }
+  if (std::fwrite(bytes, 1, header_size, file) != header_size) {
+    std::fclose(file);
+    return -1;
+  }
+
+  std::size_t num_keys = 0;
+  std::size_t num_units = 0;
+  bool is_written;
+  try {
+    Details::DoubleArrayBuilder<policy_type> builder(progress_func);
+    is_written = builder.template build_file<value_type>(reader,
+        memory_limit, file, header_size, &num_keys, &num_units);
+  } catch (...) {
+    std::fclose(file);
+    throw;
+  }
+
+  if (is_written && header_size != 0) {
+    Details::id_type checksum = 0;
+    is_written = std::fflush(file) == 0 &&
+        Details::seek_file(file, header_size);
+    for (std::size_t i = 0; is_written && i < num_units; ) {
+      unit_type buf[1024];
+      const std::size_t n = (num_units - i < 1024) ? (num_units - i) : 1024;
+      is_written = std::fread(buf, unit_size(), n, file) == n;
+      checksum = Details::crc32c(checksum, buf, unit_size() * n);
+      i += n;
+    }
+
+    Details::FileHeader header;
+    header.set_unit_size(unit_size());
+    header.set_flags(BUILD_TRIE);
+    header.set_num_keys(num_keys);
+    header.set_num_units(num_units);
+    header.set_checksum(checksum);
+    header.write(bytes);
+    is_written = is_written && Details::seek_file(file, 0) &&
+        std::fwrite(bytes, 1, header_size, file) == header_size;
+  }
 
+  if (std::fclose(file) != 0 || !is_written) {
+    return -1;
+  }
   if (progress_func != NULL) {
     progress_func(num_keys + 1, num_keys + 1);
   }
+  return 0;
+}
+
+//
+// Member functions of DoubleArrayStreamBuilder.
+//
+
+template <typename Dictionary>
+void DoubleArrayStreamBuilder<Dictionary>::begin() {
+  clear();
+  try {
+    dawg_builder_ = new Details::DawgBuilder;
+  } catch (const std::bad_alloc &) {
+    DARTS_THROW("failed to build double-array: std::bad_alloc");
+  }
+  dawg_builder_->init();
+}
+
+template <typename Dictionary>
+void DoubleArrayStreamBuilder<Dictionary>::add(const key_type *key,
+    std::size_t length, value_type value) {
+  if (dawg_builder_ == NULL) {
+    begin();
+  }
+  if (length == 0) {
+    while (key[length] != '\0') {
+      ++length;
+    }
+  }
+  dawg_builder_->insert(key, length, static_cast<Details::value_type>(value));
+  ++num_keys_;
+}
+
+template <typename Dictionary>
+int DoubleArrayStreamBuilder<Dictionary>::finish(Dictionary *dic,
+    int flags) {
+  if ((flags & ~BUILD_LABEL_INDEX) != 0) {
+    DARTS_THROW("failed to build double-array: unsupported flags");
+  } else if (dawg_builder_ == NULL) {
+    begin();
+  }
 
+  dawg_builder_->finish();
+  const std::size_t num_keys = num_keys_;
+  try {
+    dic->build_from_dawg(*dawg_builder_, num_keys, flags);
+  } catch (...) {
+    clear();
+    throw;
+  }
+  clear();
   return 0;
 }
 
+template <typename Dictionary>
+void DoubleArrayStreamBuilder<Dictionary>::clear() {
+  delete dawg_builder_;
+  dawg_builder_ = NULL;
+  num_keys_ = 0;
+}
+
 }  // namespace Darts
 
-#undef DARTS_INT_TO_STR
-#undef DARTS_LINE_TO_STR
-#undef DARTS_LINE_STR
-#undef DARTS_THROW
+#undef DARTS_PREFETCH
+#undef DARTS_HAS_AVX2_KERNEL
+#undef DARTS_HAS_MMAP
+#undef DARTS_HAS_THREADS
+#undef DARTS_HAS_SSE42_CRC32C
+#undef DARTS_HAS_ARM_CRC32C
 
 #endif  // DARTS_H_
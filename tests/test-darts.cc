@@ -1,13 +1,29 @@
 #include <darts.h>
+#include <darts-bundle.h>
+#include <darts-compressed.h>
+#include <darts-lattice.h>
+#include <darts-payload.h>
+#include <darts-record.h>
 
+#include <algorithm>
 #include <cassert>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
 #include <iostream>
 #include <set>
+#include <sstream>
 #include <string>
 #include <vector>
 
+// The AVX2 build has its own file so that both builds can run in parallel.
+#if defined(DARTS_USE_AVX2) && defined(__AVX2__)
+const char DIC_FILE_NAME[] = "test-darts-avx2.dic";
+#else  // defined(DARTS_USE_AVX2) && defined(__AVX2__)
+const char DIC_FILE_NAME[] = "test-darts.dic";
+#endif  // defined(DARTS_USE_AVX2) && defined(__AVX2__)
+
 void generate_valid_keys(std::size_t num_keys,
     std::set<std::string> *valid_keys) {
   std::vector<char> key;
@@ -74,9 +90,53 @@ void test_dic(const T &dic, const std::vector<const char *> &keys,
     assert(result.value == -1);
   }
 
+  std::vector<typename T::value_type> batch_values(keys.size());
+  std::vector<typename T::result_pair_type> batch_results(keys.size());
+
+  dic.exactMatchSearchBatch(&keys[0], NULL, keys.size(), &batch_values[0]);
+  dic.exactMatchSearchBatch(&keys[0], &lengths[0], keys.size(),
+      &batch_results[0]);
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    assert(batch_values[i] == values[i]);
+    assert(batch_results[i].value == values[i]);
+    assert(batch_results[i].length == lengths[i]);
+  }
+
+  std::vector<const char *> invalid_key_ptrs;
+  for (std::set<std::string>::const_iterator it = invalid_keys.begin();
+      it != invalid_keys.end(); ++it) {
+    invalid_key_ptrs.push_back(it->c_str());
+  }
+  batch_values.resize(invalid_key_ptrs.size());
+  dic.exactMatchSearchBatch(&invalid_key_ptrs[0], NULL,
+      invalid_key_ptrs.size(), &batch_values[0]);
+  for (std::size_t i = 0; i < invalid_key_ptrs.size(); ++i) {
+    assert(batch_values[i] == -1);
+  }
+
   std::cerr << "ok" << std::endl;
 }
 
+template <typename T>
+class ResultCollector {
+ public:
+  ResultCollector(std::vector<typename T::result_pair_type> &results,
+      std::size_t max_num_results)
+      : results_(results), max_num_results_(max_num_results) {}
+
+  bool operator()(typename T::value_type value, std::size_t length) {
+    typename T::result_pair_type result;
+    result.value = value;
+    result.length = length;
+    results_.push_back(result);
+    return results_.size() < max_num_results_;
+  }
+
+ private:
+  std::vector<typename T::result_pair_type> &results_;
+  std::size_t max_num_results_;
+};
+
 template <typename T>
 void test_common_prefix_search(const T &dic,
     const std::vector<const char *> &keys,
@@ -105,6 +165,33 @@ void test_common_prefix_search(const T &dic,
       assert(results[j].value == results_with_length[j].value);
       assert(results[j].length == results_with_length[j].length);
     }
+
+    std::vector<typename T::result_pair_type> collected_results;
+    assert(dic.commonPrefixSearch(keys[i], ResultCollector<T>(
+        collected_results, MAX_NUM_RESULTS), lengths[i]) == num_results);
+    assert(collected_results.size() == num_results);
+    for (std::size_t j = 0; j < num_results; ++j) {
+      assert(results[j].value == collected_results[j].value);
+      assert(results[j].length == collected_results[j].length);
+    }
+
+    collected_results.clear();
+    assert(dic.commonPrefixSearch(keys[i],
+        ResultCollector<T>(collected_results, 1)) == 1);
+    assert(collected_results.size() == 1);
+    assert(results[0].value == collected_results[0].value);
+    assert(results[0].length == collected_results[0].length);
+  }
+
+  typename T::result_pair_type longest_result;
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    dic.longestPrefixSearch(keys[i], longest_result);
+    assert(longest_result.value == values[i]);
+    assert(longest_result.length == lengths[i]);
+
+    dic.longestPrefixSearch(keys[i], longest_result, lengths[i]);
+    assert(longest_result.value == values[i]);
+    assert(longest_result.length == lengths[i]);
   }
 
   for (std::set<std::string>::const_iterator it = invalid_keys.begin();
@@ -127,6 +214,15 @@ void test_common_prefix_search(const T &dic,
       assert(results[j].value == results_with_length[j].value);
       assert(results[j].length == results_with_length[j].length);
     }
+
+    dic.longestPrefixSearch(it->c_str(), longest_result, it->length());
+    if (num_results > 0) {
+      assert(longest_result.value == results[num_results - 1].value);
+      assert(longest_result.length == results[num_results - 1].length);
+    } else {
+      assert(longest_result.value == -1);
+      assert(longest_result.length == 0);
+    }
   }
 
   std::cerr << "ok" << std::endl;
@@ -168,6 +264,953 @@ void test_traverse(const T &dic,
   std::cerr << "ok" << std::endl;
 }
 
+template <typename T>
+class OccurrenceCollector {
+ public:
+  explicit OccurrenceCollector(std::vector<std::size_t> &occurrences)
+      : occurrences_(occurrences) {}
+
+  bool operator()(typename T::value_type value, std::size_t begin,
+      std::size_t length) {
+    occurrences_.push_back(static_cast<std::size_t>(value));
+    occurrences_.push_back(begin);
+    occurrences_.push_back(length);
+    return true;
+  }
+
+ private:
+  std::vector<std::size_t> &occurrences_;
+};
+
+template <typename T>
+void test_scan(const T &dic, const std::vector<const char *> &keys) {
+  static const std::size_t NUM_TEXTS = 1 << 10;
+  static const std::size_t MAX_NUM_RESULTS = 16;
+  typename T::result_pair_type results[MAX_NUM_RESULTS];
+
+  for (std::size_t i = 0; i < NUM_TEXTS; ++i) {
+    std::string text;
+    while (text.length() < 64) {
+      if (std::rand() % 2 == 0) {
+        text += keys[std::rand() % keys.size()];
+      } else {
+        text += static_cast<char>('A' + (std::rand() % 26));
+      }
+    }
+
+    // The expected occurrences are sorted by their end positions, and longer
+    // ones come first at the same end position.
+    std::vector<std::size_t> expected_occurrences;
+    for (std::size_t end = 1; end <= text.length(); ++end) {
+      for (std::size_t begin = 0; begin < end; ++begin) {
+        std::size_t num_results = dic.commonPrefixSearch(
+            text.c_str() + begin, results, MAX_NUM_RESULTS, end - begin);
+        assert(num_results <= MAX_NUM_RESULTS);
+        if (num_results > 0 && results[num_results - 1].length == end - begin) {
+          expected_occurrences.push_back(
+              static_cast<std::size_t>(results[num_results - 1].value));
+          expected_occurrences.push_back(begin);
+          expected_occurrences.push_back(end - begin);
+        }
+      }
+    }
+
+    std::vector<std::size_t> occurrences;
+    std::size_t num_occurrences = dic.scan(text.c_str(), text.length(),
+        OccurrenceCollector<T>(occurrences));
+    assert(num_occurrences * 3 == occurrences.size());
+    assert(occurrences == expected_occurrences);
+
+    occurrences.clear();
+    dic.scan(text.c_str(), 0, OccurrenceCollector<T>(occurrences));
+    assert(occurrences == expected_occurrences);
+  }
+
+  std::cerr << "ok" << std::endl;
+}
+
+template <typename T>
+void test_predictive_search(const T &dic,
+    const std::vector<const char *> &keys,
+    const std::vector<std::size_t> &lengths,
+    const std::vector<typename T::value_type> &values) {
+  static const std::size_t NUM_PREFIXES = 1 << 10;
+
+  typename T::PredictiveIterator iterator;
+  for (std::size_t i = 0; i < NUM_PREFIXES; ++i) {
+    std::size_t key_id = std::rand() % keys.size();
+    std::string prefix(keys[key_id], 1 + (std::rand() % lengths[key_id]));
+    if (i % 8 == 0) {
+      prefix += '@';
+    }
+
+    // The keys are sorted, so the expected keys are contiguous.
+    std::size_t begin = 0;
+    std::size_t end = keys.size();
+    while (begin < end) {
+      std::size_t middle = begin + ((end - begin) / 2);
+      if (std::string(keys[middle]) < prefix) {
+        begin = middle + 1;
+      } else {
+        end = middle;
+      }
+    }
+
+    dic.predictiveSearch(prefix.c_str(), &iterator, prefix.length());
+    std::size_t id = begin;
+    while (iterator.next()) {
+      assert(id < keys.size());
+      assert(iterator.length() == lengths[id]);
+      assert(std::string(iterator.key()) == keys[id]);
+      assert(iterator.value() == values[id]);
+      ++id;
+    }
+    assert(id == keys.size() ||
+        std::string(keys[id]).compare(0, prefix.length(), prefix) != 0);
+
+    std::size_t node_pos = 0;
+    std::size_t key_pos = 0;
+    if (dic.traverse(prefix.c_str(), node_pos, key_pos,
+        prefix.length()) == -2) {
+      continue;
+    }
+    dic.predictiveSearch("", &iterator, 0, node_pos);
+    for (std::size_t j = begin; j < id; ++j) {
+      assert(iterator.next());
+      assert(std::string(iterator.key()) == keys[j] + prefix.length());
+    }
+    assert(!iterator.next());
+  }
+
+  std::cerr << "ok" << std::endl;
+}
+
+template <typename T>
+class FuzzyCollector {
+ public:
+  explicit FuzzyCollector(std::vector<std::string> &matches)
+      : matches_(matches) {}
+
+  bool operator()(typename T::value_type value, const char *key,
+      std::size_t length, std::size_t distance) {
+    assert(std::string(key).length() == length);
+    std::ostringstream match;
+    match << key << ' ' << value << ' ' << distance;
+    matches_.push_back(match.str());
+    return true;
+  }
+
+ private:
+  std::vector<std::string> &matches_;
+};
+
+std::size_t edit_distance(const std::string &lhs, const std::string &rhs) {
+  std::vector<std::size_t> row(rhs.length() + 1);
+  for (std::size_t j = 0; j < row.size(); ++j) {
+    row[j] = j;
+  }
+  for (std::size_t i = 1; i <= lhs.length(); ++i) {
+    std::size_t diagonal = row[0];
+    row[0] = i;
+    for (std::size_t j = 1; j < row.size(); ++j) {
+      std::size_t distance = diagonal + ((lhs[i - 1] == rhs[j - 1]) ? 0 : 1);
+      distance = std::min(distance, std::min(row[j], row[j - 1]) + 1);
+      diagonal = row[j];
+      row[j] = distance;
+    }
+  }
+  return row[rhs.length()];
+}
+
+template <typename T>
+void test_fuzzy_search(const T &dic, const std::vector<const char *> &keys,
+    const std::vector<typename T::value_type> &values) {
+  static const std::size_t NUM_QUERIES = 1 << 4;
+
+  for (std::size_t i = 0; i < NUM_QUERIES; ++i) {
+    std::string query = keys[std::rand() % keys.size()];
+    query[std::rand() % query.length()] = 'A' + (std::rand() % 26);
+    if (i % 2 == 0) {
+      query.insert(std::rand() % query.length(), 1, '@');
+    }
+    std::size_t max_distance = 1 + (i % 2);
+
+    std::vector<std::string> expected_matches;
+    for (std::size_t j = 0; j < keys.size(); ++j) {
+      std::size_t distance = edit_distance(keys[j], query);
+      if (distance <= max_distance) {
+        std::ostringstream match;
+        match << keys[j] << ' ' << values[j] << ' ' << distance;
+        expected_matches.push_back(match.str());
+      }
+    }
+
+    std::vector<std::string> matches;
+    std::size_t num_matches = dic.fuzzySearch(query.c_str(), max_distance,
+        FuzzyCollector<T>(matches));
+    assert(num_matches == matches.size());
+    assert(matches == expected_matches);
+  }
+
+  std::cerr << "ok" << std::endl;
+}
+
+template <typename T>
+class KeyCollector {
+ public:
+  explicit KeyCollector(std::vector<std::string> &matches)
+      : matches_(matches) {}
+
+  bool operator()(typename T::value_type value, const char *key,
+      std::size_t length) {
+    assert(std::string(key).length() == length);
+    std::ostringstream match;
+    match << key << ' ' << value;
+    matches_.push_back(match.str());
+    return true;
+  }
+
+ private:
+  std::vector<std::string> &matches_;
+};
+
+// A <PatternAtom> is a set of characters which occurs once, or at least
+// `min_count' times if it is repeated.
+struct PatternAtom {
+  PatternAtom(const std::string &chars_, bool is_repeated_,
+      std::size_t min_count_)
+      : chars(chars_), is_repeated(is_repeated_), min_count(min_count_) {}
+
+  std::string chars;
+  bool is_repeated;
+  std::size_t min_count;
+};
+
+bool match_pattern(const std::vector<PatternAtom> &atoms, std::size_t atom_id,
+    const char *key) {
+  if (atom_id == atoms.size()) {
+    return *key == '\0';
+  }
+  const PatternAtom &atom = atoms[atom_id];
+  for (std::size_t i = 0; ; ++i) {
+    if (i >= atom.min_count && match_pattern(atoms, atom_id + 1, key + i)) {
+      return true;
+    }
+    if (key[i] == '\0' || atom.chars.find(key[i]) == std::string::npos ||
+        (!atom.is_repeated && i >= atom.min_count)) {
+      return false;
+    }
+  }
+}
+
+template <typename T>
+void test_pattern_search(const T &dic, const std::vector<const char *> &keys,
+    const std::vector<typename T::value_type> &values) {
+  static const std::size_t NUM_PATTERNS = 1 << 4;
+
+  Darts::Pattern pattern;
+  assert(pattern.compile("[A-Z") != 0);
+  assert(pattern.compile("+A") != 0);
+  assert(pattern.compile("A\\") != 0);
+  std::vector<std::string> matches;
+  assert(dic.patternSearch(&pattern, KeyCollector<T>(matches)) == 0);
+
+  std::string all_chars;
+  for (char c = 'A'; c <= 'Z'; ++c) {
+    all_chars += c;
+  }
+
+  for (std::size_t i = 0; i < NUM_PATTERNS; ++i) {
+    const std::string key = keys[std::rand() % keys.size()];
+    std::string text;
+    std::vector<PatternAtom> atoms;
+    for (std::size_t j = 0; j < key.length(); ++j) {
+      PatternAtom atom(std::string(1, key[j]), false, 1);
+      switch (std::rand() % 6) {
+        case 0: {
+          text += '?';
+          atom.chars = all_chars;
+          break;
+        }
+        case 1: {
+          text += (key[j] <= 'M') ? "[A-M]" : "[!A-M]";
+          atom.chars = (key[j] <= 'M') ? all_chars.substr(0, 13) :
+              all_chars.substr(13);
+          break;
+        }
+        case 2: {
+          text += '*';
+          atom.chars = all_chars;
+          atom.is_repeated = true;
+          atom.min_count = 0;
+          break;
+        }
+        default: {
+          text += key[j];
+          break;
+        }
+      }
+      if (!atom.is_repeated && std::rand() % 4 == 0) {
+        text += '+';
+        atom.is_repeated = true;
+      }
+      atoms.push_back(atom);
+    }
+    assert(pattern.compile(text.c_str()) == 0);
+
+    std::vector<std::string> expected_matches;
+    for (std::size_t j = 0; j < keys.size(); ++j) {
+      if (match_pattern(atoms, 0, keys[j])) {
+        std::ostringstream match;
+        match << keys[j] << ' ' << values[j];
+        expected_matches.push_back(match.str());
+      }
+    }
+    assert(!expected_matches.empty());
+
+    matches.clear();
+    std::size_t num_matches = dic.patternSearch(&pattern,
+        KeyCollector<T>(matches));
+    assert(num_matches == matches.size());
+    assert(matches == expected_matches);
+  }
+
+  std::cerr << "ok" << std::endl;
+}
+
+template <typename T>
+void test_restore_key(const T &dic, const std::vector<const char *> &keys,
+    const std::vector<std::size_t> &lengths) {
+  std::vector<char> key;
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    key.assign(lengths[i] + 1, '@');
+    assert(dic.restoreKey(i, &key[0], lengths[i]) == lengths[i]);
+    assert(key[0] == '@');
+    assert(dic.restoreKey(i, &key[0], key.size()) == lengths[i]);
+    assert(std::string(&key[0]) == keys[i]);
+  }
+
+  key.assign(1, '@');
+  assert(dic.restoreKey(keys.size(), &key[0], key.size()) == 0);
+  assert(key[0] == '\0');
+
+  std::cerr << "ok" << std::endl;
+}
+
+template <typename T>
+void test_remap_table(const T &dic, const std::vector<const char *> &keys,
+    const std::vector<std::size_t> &lengths,
+    const std::vector<typename T::value_type> &values) {
+  typename T::value_type value;
+  typename T::result_pair_type result;
+
+  std::vector<typename T::result_pair_type> results(keys.size());
+  std::vector<const char *> lower_keys(keys.size());
+  std::vector<std::string> lower_key_strings(keys.size());
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    lower_key_strings[i] = keys[i];
+    for (std::size_t j = 0; j < lengths[i]; ++j) {
+      lower_key_strings[i][j] = static_cast<char>(
+          lower_key_strings[i][j] - 'A' + 'a');
+    }
+    lower_keys[i] = lower_key_strings[i].c_str();
+  }
+  dic.exactMatchSearchBatch(&lower_keys[0], NULL, lower_keys.size(),
+      &results[0]);
+
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    const char *lower_key = lower_keys[i];
+    dic.exactMatchSearch(lower_key, value);
+    assert(value == values[i]);
+    dic.exactMatchSearch(lower_key, result, lengths[i]);
+    assert(result.value == values[i]);
+    assert(result.length == lengths[i]);
+    assert(results[i].value == values[i]);
+
+    result = dic.template longestPrefixSearch<typename T::result_pair_type>(
+        lower_key);
+    assert(result.value == values[i]);
+
+    std::size_t node_pos = 0;
+    std::size_t key_pos = 0;
+    assert(dic.traverse(lower_key, node_pos, key_pos) == values[i]);
+  }
+
+  // Patterns are remapped as well as queries, and the keys found by searches
+  // consist of labels, that is, of remapped characters.
+  typename T::PredictiveIterator iterator;
+  Darts::Pattern pattern;
+  for (std::size_t i = 0; i < keys.size(); i += 1 << 8) {
+    dic.predictiveSearch(lower_keys[i], &iterator);
+    assert(iterator.next());
+    assert(std::strcmp(iterator.key(), keys[i]) == 0);
+
+    assert(pattern.compile(lower_keys[i]) == 0);
+    std::vector<std::string> matches;
+    assert(dic.patternSearch(&pattern, KeyCollector<T>(matches)) == 1);
+    std::ostringstream match;
+    match << keys[i] << ' ' << values[i];
+    assert(matches[0] == match.str());
+  }
+
+  std::cerr << "ok" << std::endl;
+}
+
+template <typename T>
+void test_lattice() {
+  const char *keys[] = { "a", "ab", "abc", "bc", "c" };
+  const typename T::value_type values[] = { 5, 3, 20, 5, 6 };
+  T dic;
+  dic.build(5, keys, NULL, values);
+
+  Darts::Lattice<T> lattice;
+  lattice.set_unknown_cost(100);
+  for (int i = 0; i < 2; ++i) {
+    // "ab" + "c" costs 9 and beats "a" + "bc" (10) and "abc" (20).
+    assert(lattice.segment(dic, "abcd") == 3);
+    assert(lattice.word(0).begin == 0 && lattice.word(0).length == 2);
+    assert(lattice.word(0).value == 3);
+    assert(lattice.word(1).begin == 2 && lattice.word(1).length == 1);
+    assert(lattice.word(2).begin == 3 && lattice.word(2).length == 1);
+    assert(lattice.word(2).value == -1);
+    assert(lattice.cost() == 109);
+    assert(lattice.num_nodes() == 6);
+  }
+
+  // An unknown word spans a whole UTF-8 character.
+  assert(lattice.segment(dic, "a\xE3\x81\x82" "c") == 3);
+  assert(lattice.word(1).length == 3);
+  assert(lattice.word(1).value == -1);
+  lattice.set_utf8(false);
+  assert(lattice.segment(dic, "a\xE3\x81\x82" "c") == 5);
+
+  lattice.set_unknown_mode(Darts::Lattice<T>::UNKNOWN_NONE);
+  assert(lattice.segment(dic, "abcd") == 0);
+  assert(lattice.num_words() == 0);
+  assert(lattice.segment(dic, "abcabc", 3) == 2);
+
+  lattice.set_unknown_mode(Darts::Lattice<T>::UNKNOWN_ALWAYS);
+  lattice.set_unknown_cost(1);
+  assert(lattice.segment(dic, "abc") == 3);
+  assert(lattice.cost() == 3);
+
+  std::cerr << "ok" << std::endl;
+}
+
+struct TestPayload {
+  double score;
+  long id;
+};
+
+class PayloadCounter {
+ public:
+  explicit PayloadCounter(std::size_t *count) : count_(count) {}
+
+  bool operator()(const TestPayload &payload, std::size_t length) {
+    assert(payload.score == -0.5 * static_cast<double>(-payload.id));
+    assert(length > 0);
+    ++*count_;
+    return true;
+  }
+
+ private:
+  std::size_t *count_;
+};
+
+template <typename T>
+void test_payloads(const std::set<std::string> &valid_keys,
+    const std::set<std::string> &invalid_keys) {
+  static const long NUM_PAYLOADS = 97;
+
+  std::vector<const char *> keys;
+  std::vector<TestPayload> payloads;
+  for (std::set<std::string>::const_iterator it = valid_keys.begin();
+      it != valid_keys.end(); ++it) {
+    TestPayload payload;
+    payload.id = -static_cast<long>(keys.size() % NUM_PAYLOADS);
+    payload.score = -0.5 * static_cast<double>(-payload.id);
+    keys.push_back(it->c_str());
+    payloads.push_back(payload);
+  }
+
+  Darts::PayloadDoubleArray<TestPayload, T> dic;
+  dic.build(keys.size(), &keys[0], NULL, &payloads[0]);
+  assert(dic.num_payloads() == static_cast<std::size_t>(NUM_PAYLOADS));
+
+  Darts::PayloadDoubleArray<TestPayload, T> dic_copy;
+  assert(dic.save(DIC_FILE_NAME) == 0);
+  assert(dic_copy.open(DIC_FILE_NAME) == 0);
+  assert(dic_copy.num_payloads() == dic.num_payloads());
+  assert(dic_copy.dictionary().size() == dic.dictionary().size());
+
+  Darts::PayloadDoubleArray<int, T> dic_other;
+  assert(dic_other.open(DIC_FILE_NAME) != 0);
+
+  // The units section can be opened alone.
+  T dic_units;
+  assert(dic_units.open(DIC_FILE_NAME) == 0);
+  assert(dic_units.size() == dic.dictionary().size());
+
+  // A broken payload is rejected by the checksum, and a header with too many
+  // payloads is rejected before they are allocated.
+  const long payloads_offset = static_cast<long>(64 +
+      dic.dictionary().total_size());
+  Darts::PayloadDoubleArray<TestPayload, T> dic_broken;
+  std::FILE *file = std::fopen(DIC_FILE_NAME, "r+b");
+  assert(file != NULL);
+  assert(std::fseek(file, payloads_offset + 64, SEEK_SET) == 0);
+  assert(std::fputc(0x7F, file) != EOF);
+  std::fclose(file);
+  assert(dic_broken.open(DIC_FILE_NAME) != 0);
+  file = std::fopen(DIC_FILE_NAME, "r+b");
+  assert(file != NULL);
+  assert(std::fseek(file, payloads_offset + 39, SEEK_SET) == 0);
+  assert(std::fputc(0x7F, file) != EOF);
+  std::fclose(file);
+  assert(dic_other.open(DIC_FILE_NAME) != 0);
+  assert(dic_broken.open(DIC_FILE_NAME) != 0);
+
+  // The remap table is restored by open().
+  unsigned char remap_table[256];
+  for (std::size_t i = 0; i < 256; ++i) {
+    remap_table[i] = static_cast<unsigned char>(
+        (i >= 'a' && i <= 'z') ? (i - 'a' + 'A') : i);
+  }
+  Darts::PayloadDoubleArray<TestPayload, T> dic_remap;
+  dic_remap.build(keys.size(), &keys[0], NULL, &payloads[0], NULL, 0,
+      remap_table);
+  assert(dic_remap.save(DIC_FILE_NAME) == 0);
+  assert(dic_broken.open(DIC_FILE_NAME) == 0);
+  for (std::size_t i = 0; i < keys.size(); i += 1 << 8) {
+    std::string lower_key = keys[i];
+    for (std::size_t j = 0; j < lower_key.length(); ++j) {
+      lower_key[j] = static_cast<char>(lower_key[j] - 'A' + 'a');
+    }
+    const TestPayload *payload =
+        dic_broken.exactMatchSearch(lower_key.c_str());
+    assert(payload != NULL);
+    assert(payload->id == payloads[i].id);
+  }
+
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    const TestPayload *payload = dic_copy.exactMatchSearch(keys[i]);
+    assert(payload != NULL);
+    assert(payload->id == payloads[i].id);
+    assert(payload->score == payloads[i].score);
+
+    std::size_t count = 0;
+    std::size_t num_results = dic_copy.commonPrefixSearch(keys[i],
+        PayloadCounter(&count));
+    assert(num_results == count && count > 0);
+    assert(num_results == dic_copy.dictionary().commonPrefixSearch(
+        keys[i], static_cast<typename T::result_type *>(NULL), 0));
+  }
+
+  for (std::set<std::string>::const_iterator it = invalid_keys.begin();
+      it != invalid_keys.end(); ++it) {
+    assert(dic_copy.exactMatchSearch(it->c_str()) == NULL);
+  }
+
+  std::cerr << "ok" << std::endl;
+}
+
+// The records of test_records() consist of a repeated letter.
+template <typename T>
+class RecordCounter {
+ public:
+  explicit RecordCounter(std::size_t *count) : count_(count) {}
+
+  bool operator()(
+      const typename Darts::RecordDoubleArray<T>::record_type &record,
+      std::size_t length) {
+    assert(record.data != NULL);
+    assert(record.length == 0 ||
+        std::string(record.length, record.data[0]) ==
+        std::string(record.data, record.length));
+    assert(length > 0);
+    ++*count_;
+    return true;
+  }
+
+ private:
+  std::size_t *count_;
+};
+
+template <typename T>
+void test_records(const std::set<std::string> &valid_keys,
+    const std::set<std::string> &invalid_keys) {
+  // Records of 128 bytes or more have 2-byte length prefixes.
+  static const std::size_t NUM_RECORDS = 211;
+
+  std::vector<std::string> distinct_records;
+  for (std::size_t i = 0; i < NUM_RECORDS; ++i) {
+    distinct_records.push_back(std::string(i, 'a' + (i % 26)));
+  }
+  std::vector<const char *> keys;
+  std::vector<const char *> records;
+  std::vector<std::size_t> record_lengths;
+  for (std::set<std::string>::const_iterator it = valid_keys.begin();
+      it != valid_keys.end(); ++it) {
+    const std::string &record = distinct_records[keys.size() % NUM_RECORDS];
+    keys.push_back(it->c_str());
+    records.push_back(record.c_str());
+    record_lengths.push_back(record.length());
+  }
+
+  Darts::RecordDoubleArray<T> dic;
+  dic.build(keys.size(), &keys[0], NULL, &records[0], &record_lengths[0]);
+  assert(dic.num_records() == NUM_RECORDS);
+
+  Darts::RecordDoubleArray<T> dic_copy;
+  assert(dic.save(DIC_FILE_NAME) == 0);
+  for (int mapped = 0; mapped < 2; ++mapped) {
+    if (mapped == 0) {
+      assert(dic_copy.open(DIC_FILE_NAME) == 0);
+    } else {
+      assert(dic_copy.openMapped(DIC_FILE_NAME) == 0);
+    }
+    assert(dic_copy.num_records() == dic.num_records());
+    assert(dic_copy.arena_size() == dic.arena_size());
+    assert(dic_copy.dictionary().num_keys() == keys.size());
+
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+      const typename Darts::RecordDoubleArray<T>::record_type record =
+          dic_copy.exactMatchSearch(keys[i]);
+      assert(record.data != NULL);
+      assert(record.length == record_lengths[i]);
+      assert(std::memcmp(record.data, records[i], record.length) == 0);
+
+      std::size_t count = 0;
+      std::size_t num_results = dic_copy.commonPrefixSearch(keys[i],
+          RecordCounter<T>(&count));
+      assert(num_results == count && count > 0);
+    }
+
+    for (std::set<std::string>::const_iterator it = invalid_keys.begin();
+        it != invalid_keys.end(); ++it) {
+      assert(dic_copy.exactMatchSearch(it->c_str()).data == NULL);
+    }
+  }
+
+  assert(dic_copy.record(static_cast<typename T::value_type>(
+      NUM_RECORDS)).data == NULL);
+  assert(dic_copy.record(-1).data == NULL);
+
+  // The units of a record file can be opened alone.
+  T dic_units;
+  assert(dic_units.open(DIC_FILE_NAME) == 0);
+  assert(dic_units.size() == dic.dictionary().size());
+
+  Darts::RecordDoubleArray<Darts::LargeDoubleArray> dic_other;
+  assert(dic_other.open(DIC_FILE_NAME) != 0);
+  assert(dic_other.openMapped(DIC_FILE_NAME) != 0);
+
+  // A broken record is found by the checksum.
+  std::FILE *file = std::fopen(DIC_FILE_NAME, "r+b");
+  assert(file != NULL);
+  assert(std::fseek(file, -1, SEEK_END) == 0);
+  const int byte = std::fgetc(file);
+  assert(std::fseek(file, -1, SEEK_END) == 0);
+  assert(std::fputc(byte ^ 1, file) != EOF);
+  std::fclose(file);
+  assert(dic_copy.open(DIC_FILE_NAME) != 0);
+  assert(dic_copy.openMapped(DIC_FILE_NAME) != 0);
+
+  // The remap table is restored by open() and openMapped().
+  unsigned char remap_table[256];
+  for (std::size_t i = 0; i < 256; ++i) {
+    remap_table[i] = static_cast<unsigned char>(
+        (i >= 'a' && i <= 'z') ? (i - 'a' + 'A') : i);
+  }
+  dic.build(keys.size(), &keys[0], NULL, &records[0], &record_lengths[0],
+      NULL, 0, remap_table);
+  assert(dic.save(DIC_FILE_NAME) == 0);
+  for (int mapped = 0; mapped < 2; ++mapped) {
+    if (mapped == 0) {
+      assert(dic_copy.open(DIC_FILE_NAME) == 0);
+    } else {
+      assert(dic_copy.openMapped(DIC_FILE_NAME) == 0);
+    }
+    for (std::size_t i = 0; i < keys.size(); i += 1 << 8) {
+      std::string lower_key = keys[i];
+      for (std::size_t j = 0; j < lower_key.length(); ++j) {
+        lower_key[j] = static_cast<char>(lower_key[j] - 'A' + 'a');
+      }
+      const typename Darts::RecordDoubleArray<T>::record_type record =
+          dic_copy.exactMatchSearch(lower_key.c_str());
+      assert(record.data != NULL);
+      assert(record.length == record_lengths[i]);
+    }
+  }
+
+  std::cerr << "ok" << std::endl;
+}
+
+template <typename T>
+void test_compressed(const std::set<std::string> &valid_keys,
+    const std::set<std::string> &invalid_keys) {
+  std::vector<const char *> keys;
+  std::vector<typename T::value_type> values;
+  for (std::set<std::string>::const_iterator it = valid_keys.begin();
+      it != valid_keys.end(); ++it) {
+    keys.push_back(it->c_str());
+    values.push_back(static_cast<typename T::value_type>(std::rand() % 100));
+  }
+
+  T dic;
+  dic.build(keys.size(), &keys[0], NULL, &values[0]);
+
+  Darts::CompressedDoubleArray<T> compressed;
+  compressed.compress(dic);
+  assert(compressed.size() == dic.size());
+  assert(compressed.total_size() < dic.total_size());
+
+  Darts::CompressedDoubleArray<T> dic_copy;
+  assert(compressed.save(DIC_FILE_NAME) == 0);
+  assert(dic_copy.open(DIC_FILE_NAME) == 0);
+  assert(dic_copy.size() == compressed.size());
+  assert(dic_copy.total_size() == compressed.total_size());
+
+  // A small cache evicts blocks in most searches.
+  dic_copy.set_cache_size(4);
+
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    assert(dic_copy.template exactMatchSearch<typename T::value_type>(
+        keys[i]) == values[i]);
+
+    typename T::result_pair_type results[8], dic_results[8];
+    const std::size_t num_results =
+        dic_copy.commonPrefixSearch(keys[i], results, 8);
+    assert(num_results == dic.commonPrefixSearch(keys[i], dic_results, 8));
+    for (std::size_t j = 0; j < num_results && j < 8; ++j) {
+      assert(results[j].value == dic_results[j].value);
+      assert(results[j].length == dic_results[j].length);
+    }
+
+    std::size_t node_pos = 0, key_pos = 0;
+    assert(dic_copy.traverse(keys[i], node_pos, key_pos) == values[i]);
+  }
+
+  for (std::set<std::string>::const_iterator it = invalid_keys.begin();
+      it != invalid_keys.end(); ++it) {
+    assert(dic_copy.template exactMatchSearch<typename T::value_type>(
+        it->c_str()) == -1);
+  }
+
+  // The file has no units for open() of <DoubleArrayImpl>.
+  T dic_units;
+  assert(dic_units.open(DIC_FILE_NAME) != 0);
+
+  // Too many words are rejected without allocating them. The header is
+  // rewritten with a valid checksum of its own.
+  Darts::Details::uchar_type bytes[Darts::Details::FileHeader::SIZE];
+  Darts::Details::FileHeader header;
+  std::FILE *file = std::fopen(DIC_FILE_NAME, "r+b");
+  assert(file != NULL);
+  assert(std::fread(bytes, 1, sizeof(bytes), file) == sizeof(bytes));
+  assert(header.read(bytes));
+  header.set_num_units(header.num_units() + (std::size_t(1) << 30));
+  header.write(bytes);
+  assert(std::fseek(file, 0, SEEK_SET) == 0);
+  assert(std::fwrite(bytes, 1, sizeof(bytes), file) == sizeof(bytes));
+  std::fclose(file);
+  assert(dic_copy.open(DIC_FILE_NAME) != 0);
+
+  // A broken block is found by the checksum.
+  assert(compressed.save(DIC_FILE_NAME) == 0);
+  const long first_block = static_cast<long>(64 +
+      4 * ((compressed.size() / 64) + 1));
+  file = std::fopen(DIC_FILE_NAME, "r+b");
+  assert(file != NULL);
+  assert(std::fseek(file, first_block + 1, SEEK_SET) == 0);
+  const int byte = std::fgetc(file);
+  assert(std::fseek(file, first_block + 1, SEEK_SET) == 0);
+  assert(std::fputc(byte ^ 0x02, file) != EOF);
+  std::fclose(file);
+  assert(dic_copy.open(DIC_FILE_NAME) != 0);
+
+  // The remap table is saved in the header.
+  unsigned char remap_table[256];
+  for (std::size_t i = 0; i < 256; ++i) {
+    remap_table[i] = static_cast<unsigned char>(
+        (i >= 'a' && i <= 'z') ? (i - 'a' + 'A') : i);
+  }
+  dic.build(keys.size(), &keys[0], NULL, &values[0], NULL, 0, remap_table);
+  compressed.compress(dic);
+  assert(compressed.save(DIC_FILE_NAME) == 0);
+  assert(dic_copy.open(DIC_FILE_NAME) == 0);
+  for (std::size_t i = 0; i < keys.size(); i += 1 << 8) {
+    std::string lower_key = keys[i];
+    for (std::size_t j = 0; j < lower_key.length(); ++j) {
+      lower_key[j] = static_cast<char>(lower_key[j] - 'A' + 'a');
+    }
+    assert(dic_copy.template exactMatchSearch<typename T::value_type>(
+        lower_key.c_str()) == values[i]);
+  }
+
+  std::cerr << "ok" << std::endl;
+}
+
+template <typename T>
+void test_bundle(const std::set<std::string> &valid_keys,
+    const std::set<std::string> &invalid_keys) {
+  static const std::size_t NUM_DICS = 3;
+  static const char * const NAMES[NUM_DICS] = { "b", "c", "a" };
+
+  // The i-th dictionary has every NUM_DICS-th key from the i-th one.
+  std::vector<const char *> keys[NUM_DICS];
+  std::vector<typename T::value_type> values[NUM_DICS];
+  std::size_t key_id = 0;
+  for (std::set<std::string>::const_iterator it = valid_keys.begin();
+      it != valid_keys.end(); ++it, ++key_id) {
+    keys[key_id % NUM_DICS].push_back(it->c_str());
+    values[key_id % NUM_DICS].push_back(
+        static_cast<typename T::value_type>(key_id));
+  }
+
+  T dics[NUM_DICS];
+  Darts::BundleWriter writer;
+  for (std::size_t i = 0; i < NUM_DICS; ++i) {
+    dics[i].build(keys[i].size(), &keys[i][0], NULL, &values[i][0]);
+    writer.add(NAMES[i], dics[i]);
+  }
+  try {
+    writer.add(NAMES[0], dics[0]);
+    assert(false);
+  } catch (const std::exception &) {
+  }
+  assert(writer.size() == NUM_DICS);
+  assert(writer.save(DIC_FILE_NAME) == 0);
+
+  Darts::Bundle bundle;
+  assert(bundle.open(DIC_FILE_NAME) == 0);
+  assert(bundle.size() == NUM_DICS);
+  assert(bundle.verify() == 0);
+  assert(std::string(bundle.name(0)) == "a");
+  assert(bundle.find("c") == 2);
+  assert(bundle.find("d") == bundle.size());
+
+  for (std::size_t i = 0; i < NUM_DICS; ++i) {
+    T dic;
+    assert(bundle.attach(NAMES[i], &dic) == 0);
+    assert(dic.size() == dics[i].size());
+    for (std::size_t j = 0; j < keys[i].size(); ++j) {
+      assert(dic.template exactMatchSearch<typename T::value_type>(
+          keys[i][j]) == values[i][j]);
+    }
+    for (std::set<std::string>::const_iterator it = invalid_keys.begin();
+        it != invalid_keys.end(); ++it) {
+      assert(dic.template exactMatchSearch<typename T::value_type>(
+          it->c_str()) == -1);
+    }
+  }
+  T dic;
+  assert(bundle.attach("d", &dic) != 0);
+  if (dic.unit_size() != Darts::LargeDoubleArray().unit_size()) {
+    Darts::LargeDoubleArray large_dic;
+    assert(bundle.attach("a", &large_dic) != 0);
+  }
+
+  // A broken unit is found by verify(), and a broken index by open().
+  std::FILE *file = std::fopen(DIC_FILE_NAME, "r+b");
+  assert(file != NULL);
+  assert(std::fseek(file, -1, SEEK_END) == 0);
+  int byte = std::fgetc(file);
+  assert(std::fseek(file, -1, SEEK_END) == 0);
+  assert(std::fputc(byte ^ 1, file) != EOF);
+  std::fclose(file);
+  assert(bundle.open(DIC_FILE_NAME) == 0);
+  assert(bundle.verify() != 0);
+
+  file = std::fopen(DIC_FILE_NAME, "r+b");
+  assert(file != NULL);
+  assert(std::fseek(file, 64, SEEK_SET) == 0);
+  byte = std::fgetc(file);
+  assert(std::fseek(file, 64, SEEK_SET) == 0);
+  assert(std::fputc(byte ^ 1, file) != EOF);
+  std::fclose(file);
+  assert(bundle.open(DIC_FILE_NAME) != 0);
+
+  std::cerr << "ok" << std::endl;
+}
+
+template <typename T>
+void test_tail_searches(const T &dic, const std::vector<const char *> &keys) {
+  // The searches which walk paths below a unit reject tails.
+  std::size_t node_pos = 0;
+  std::size_t key_pos = 0;
+  try {
+    dic.traverse(keys[0], node_pos, key_pos);
+    assert(false);
+  } catch (const std::exception &) {
+  }
+  typename T::PredictiveIterator iterator;
+  try {
+    dic.predictiveSearch(keys[0], &iterator);
+    assert(false);
+  } catch (const std::exception &) {
+  }
+  std::vector<std::string> matches;
+  try {
+    dic.fuzzySearch(keys[0], 1, FuzzyCollector<T>(matches));
+    assert(false);
+  } catch (const std::exception &) {
+  }
+  Darts::Pattern pattern;
+  assert(pattern.compile("*") == 0);
+  try {
+    dic.patternSearch(&pattern, KeyCollector<T>(matches));
+    assert(false);
+  } catch (const std::exception &) {
+  }
+  std::vector<std::size_t> occurrences;
+  try {
+    dic.scan(keys[0], 0, OccurrenceCollector<T>(occurrences));
+    assert(false);
+  } catch (const std::exception &) {
+  }
+  char key[16];
+  try {
+    dic.restoreKey(0, key, sizeof(key));
+    assert(false);
+  } catch (const std::exception &) {
+  }
+  assert(matches.empty() && occurrences.empty());
+
+  std::cerr << "ok" << std::endl;
+}
+
+// <KeyReader> reads keys and values from arrays for buildFile().
+template <typename T>
+class KeyReader {
+ public:
+  KeyReader(const std::vector<const char *> &keys,
+      const std::vector<std::size_t> &lengths,
+      const std::vector<typename T::value_type> &values)
+      : keys_(keys), lengths_(lengths), values_(values), id_(0) {}
+
+  bool read(const char **key, std::size_t *length,
+      typename T::value_type *value) {
+    if (id_ == keys_.size()) {
+      return false;
+    }
+    *key = keys_[id_];
+    *length = lengths_[id_];
+    *value = values_[id_];
+    ++id_;
+    return true;
+  }
+  void rewind() {
+    id_ = 0;
+  }
+
+ private:
+  const std::vector<const char *> &keys_;
+  const std::vector<std::size_t> &lengths_;
+  const std::vector<typename T::value_type> &values_;
+  std::size_t id_;
+};
+
 template <typename T>
 void test_darts(const std::set<std::string> &valid_keys,
     const std::set<std::string> &invalid_keys) {
@@ -205,14 +1248,103 @@ void test_darts(const std::set<std::string> &valid_keys,
   dic.build(keys.size(), &keys[0], &lengths[0], &values[0]);
   test_dic(dic, keys, lengths, values, invalid_keys);
 
+  std::cerr << "build() with random values and 4 threads: ";
+  const std::size_t dawg_size = dic.size();
+  const char *serial_units = static_cast<const char *>(dic.array());
+  const std::vector<char> serial_array(serial_units,
+      serial_units + dic.total_size());
+  dic.set_num_threads(4);
+  dic.build(keys.size(), &keys[0], &lengths[0], &values[0]);
+  dic.set_num_threads(1);
+  assert(dic.size() == dawg_size);
+  assert(std::memcmp(dic.array(), &serial_array[0],
+      serial_array.size()) == 0);
+  test_dic(dic, keys, lengths, values, invalid_keys);
+
+  std::cerr << "DoubleArrayStreamBuilder: ";
+  Darts::DoubleArrayStreamBuilder<T> stream_builder;
+  stream_builder.begin();
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    stream_builder.add(keys[i], lengths[i], values[i]);
+  }
+  assert(stream_builder.num_keys() == keys.size());
+  stream_builder.finish(&dic);
+  assert(dic.size() == dawg_size);
+  assert(dic.num_keys() == keys.size());
+  test_dic(dic, keys, lengths, values, invalid_keys);
+  try {
+    stream_builder.add(keys[1], lengths[1], values[1]);
+    stream_builder.add(keys[0], lengths[0], values[0]);
+    assert(false);
+  } catch (const std::exception &) {
+  }
+
   T dic_copy;
 
   std::cerr << "save() and open(): ";
-  assert(dic.save("test-darts.dic") == 0);
-  assert(dic_copy.open("test-darts.dic") == 0);
+  assert(dic.save(DIC_FILE_NAME) == 0);
+  assert(dic_copy.open(DIC_FILE_NAME) == 0);
+  assert(dic_copy.size() == dic.size());
+  test_dic(dic_copy, keys, lengths, values, invalid_keys);
+
+  std::cerr << "openMapped(): ";
+  assert(dic_copy.openMapped(DIC_FILE_NAME) == 0);
+  assert(dic_copy.size() == dic.size());
+  test_dic(dic_copy, keys, lengths, values, invalid_keys);
+
+  std::cerr << "openMapped() with an offset: ";
+  assert(dic.save(DIC_FILE_NAME, "wb", 100) == 0);
+  assert(dic_copy.openMapped(DIC_FILE_NAME, 100) == 0);
+  assert(dic_copy.size() == dic.size());
+  assert(dic_copy.openMapped(DIC_FILE_NAME, 101) != 0);
+  test_dic(dic_copy, keys, lengths, values, invalid_keys);
+
+  std::cerr << "save() and open() with SAVE_HEADER: ";
+  assert(dic.save(DIC_FILE_NAME, "wb", 0, Darts::SAVE_HEADER) == 0);
+  assert(dic_copy.open(DIC_FILE_NAME) == 0);
   assert(dic_copy.size() == dic.size());
+  assert(dic_copy.num_keys() == keys.size());
+  test_dic(dic_copy, keys, lengths, values, invalid_keys);
+
+  std::cerr << "openMapped() with SAVE_HEADER: ";
+  assert(dic_copy.openMapped(DIC_FILE_NAME) == 0);
+  assert(dic_copy.size() == dic.size());
+  assert(dic_copy.num_keys() == keys.size());
+  test_dic(dic_copy, keys, lengths, values, invalid_keys);
+
+  std::cerr << "buildFile() with a small memory limit: ";
+  KeyReader<T> reader(keys, lengths, values);
+  assert(dic.buildFile(&reader, DIC_FILE_NAME, 1 << 16) == 0);
+  assert(dic_copy.open(DIC_FILE_NAME) == 0);
   test_dic(dic_copy, keys, lengths, values, invalid_keys);
 
+  std::cerr << "buildFile() with SAVE_HEADER: ";
+  reader.rewind();
+  assert(dic.buildFile(&reader, DIC_FILE_NAME, 1 << 30, NULL,
+      Darts::SAVE_HEADER) == 0);
+  assert(dic_copy.open(DIC_FILE_NAME) == 0);
+  assert(dic_copy.num_keys() == keys.size());
+  test_dic(dic_copy, keys, lengths, values, invalid_keys);
+
+  std::cerr << "open() with a broken file: ";
+  assert(dic_copy.open(DIC_FILE_NAME, "rb", 0,
+      dic.total_size() + 64 - dic.unit_size()) != 0);
+  assert(dic_copy.openMapped(DIC_FILE_NAME, 0,
+      dic.total_size() + 64 - dic.unit_size()) != 0);
+  if (dic.unit_size() != Darts::LargeDoubleArray().unit_size()) {
+    assert(Darts::LargeDoubleArray().open(DIC_FILE_NAME) != 0);
+  }
+  std::FILE *file = std::fopen(DIC_FILE_NAME, "r+b");
+  assert(file != NULL);
+  assert(std::fseek(file, 64 + dic.total_size() / 2, SEEK_SET) == 0);
+  const int byte = std::fgetc(file);
+  assert(std::fseek(file, 64 + dic.total_size() / 2, SEEK_SET) == 0);
+  assert(std::fputc(byte ^ 1, file) != EOF);
+  std::fclose(file);
+  assert(dic_copy.open(DIC_FILE_NAME) != 0);
+  assert(dic_copy.openMapped(DIC_FILE_NAME) != 0);
+  std::cerr << "ok" << std::endl;
+
   std::cerr << "set_array() with array(): ";
   dic_copy.set_array(dic.array());
   assert(dic_copy.size() == 0);
@@ -223,14 +1355,244 @@ void test_darts(const std::set<std::string> &valid_keys,
   assert(dic_copy.size() == dic.size());
   test_dic(dic_copy, keys, lengths, values, invalid_keys);
 
+  std::cerr << "relocate(): ";
+  dic.relocate(keys.size() / 2, &keys[keys.size() / 4]);
+  test_dic(dic, keys, lengths, values, invalid_keys);
+
   std::cerr << "commonPrefixSearch(): ";
   test_common_prefix_search(dic, keys, lengths, values, invalid_keys);
 
   std::cerr << "traverse(): ";
   test_traverse(dic, keys, lengths, values, invalid_keys);
+
+  std::cerr << "predictiveSearch(): ";
+  test_predictive_search(dic, keys, lengths, values);
+
+  std::cerr << "fuzzySearch(): ";
+  test_fuzzy_search(dic, keys, values);
+
+  std::cerr << "patternSearch(): ";
+  test_pattern_search(dic, keys, values);
+
+  std::cerr << "build() with BUILD_LABEL_INDEX: ";
+  dic.build(keys.size(), &keys[0], &lengths[0], &values[0], NULL,
+      Darts::BUILD_LABEL_INDEX);
+  test_dic(dic, keys, lengths, values, invalid_keys);
+
+  std::cerr << "relocate() with BUILD_LABEL_INDEX: ";
+  dic.relocate(keys.size(), &keys[0], &lengths[0]);
+  test_dic(dic, keys, lengths, values, invalid_keys);
+
+  std::cerr << "predictiveSearch() with BUILD_LABEL_INDEX: ";
+  test_predictive_search(dic, keys, lengths, values);
+
+  std::cerr << "fuzzySearch() with BUILD_LABEL_INDEX: ";
+  test_fuzzy_search(dic, keys, values);
+
+  std::cerr << "patternSearch() with BUILD_LABEL_INDEX: ";
+  test_pattern_search(dic, keys, values);
+
+  std::cerr << "build() with 4 threads: ";
+  dic.set_num_threads(4);
+  dic.build(keys.size(), &keys[0], &lengths[0], &values[0], NULL,
+      Darts::BUILD_TRIE | Darts::BUILD_LABEL_INDEX);
+  dic.set_num_threads(1);
+  test_dic(dic, keys, lengths, values, invalid_keys);
+
+  std::cerr << "predictiveSearch() with 4 threads: ";
+  test_predictive_search(dic, keys, lengths, values);
+
+  unsigned char remap_table[256];
+  for (std::size_t i = 0; i < 256; ++i) {
+    remap_table[i] = static_cast<unsigned char>(
+        (i >= 'a' && i <= 'z') ? (i - 'a' + 'A') : i);
+  }
+
+  std::cerr << "build() with a remap table: ";
+  dic.build(keys.size(), &keys[0], &lengths[0], &values[0], NULL, 0,
+      remap_table);
+  test_dic(dic, keys, lengths, values, invalid_keys);
+
+  std::cerr << "search with a remap table: ";
+  test_remap_table(dic, keys, lengths, values);
+
+  std::cerr << "open() with a remap table: ";
+  assert(dic.save(DIC_FILE_NAME, "wb", 0, Darts::SAVE_HEADER) == 0);
+  {
+    T dic_copy;
+    assert(dic_copy.open(DIC_FILE_NAME) == 0);
+    test_remap_table(dic_copy, keys, lengths, values);
+  }
+
+  std::cerr << "openMapped() with a remap table: ";
+  {
+    T dic_copy;
+    assert(dic_copy.openMapped(DIC_FILE_NAME) == 0);
+    test_remap_table(dic_copy, keys, lengths, values);
+
+    // The checksum covers the remap table.
+    std::FILE *file = std::fopen(DIC_FILE_NAME, "r+b");
+    assert(file != NULL);
+    assert(std::fseek(file, 64 + 'b', SEEK_SET) == 0);
+    assert(std::fputc('C', file) != EOF);
+    std::fclose(file);
+    T dic_broken;
+    assert(dic_broken.open(DIC_FILE_NAME) != 0);
+    assert(dic_broken.openMapped(DIC_FILE_NAME) != 0);
+  }
+
+  std::cerr << "Bundle with a remap table: ";
+  {
+    Darts::BundleWriter writer;
+    writer.add("remap", dic);
+    assert(writer.save(DIC_FILE_NAME) == 0);
+    Darts::Bundle bundle;
+    assert(bundle.open(DIC_FILE_NAME) == 0);
+    assert(bundle.verify() == 0);
+    T dic_copy;
+    assert(bundle.attach("remap", &dic_copy) == 0);
+    test_remap_table(dic_copy, keys, lengths, values);
+  }
+
+  remap_table['a'] = '\0';
+  try {
+    dic.build(keys.size(), &keys[0], &lengths[0], &values[0], NULL, 0,
+        remap_table);
+    assert(false);
+  } catch (const std::exception &) {
+  }
+
+  std::cerr << "build() with BUILD_PARENTS: ";
+  dic.build(keys.size(), &keys[0], &lengths[0], &values[0], NULL,
+      Darts::BUILD_PARENTS);
+  test_dic(dic, keys, lengths, values, invalid_keys);
+
+  std::cerr << "restoreKey(): ";
+  test_restore_key(dic, keys, lengths);
+
+  std::cerr << "restoreKey() after open(): ";
+  assert(dic.save(DIC_FILE_NAME) == 0);
+  assert(dic_copy.openMapped(DIC_FILE_NAME) == 0);
+  {
+    char key[16];
+    try {
+      dic_copy.restoreKey(0, key, sizeof(key));
+      assert(false);
+    } catch (const std::exception &) {
+    }
+  }
+  assert(dic_copy.buildParents() == 0);
+  test_restore_key(dic_copy, keys, lengths);
+  {
+    // The parents of a DAWG are rejected because its units are shared.
+    const std::vector<typename T::value_type> zeros(keys.size(), 0);
+    T dawg;
+    dawg.build(keys.size(), &keys[0], &lengths[0], &zeros[0]);
+    try {
+      dawg.buildParents();
+      assert(false);
+    } catch (const std::exception &) {
+    }
+  }
+
+  std::cerr << "build() with BUILD_TAIL: ";
+  dic.build(keys.size(), &keys[0], &lengths[0], &values[0], NULL,
+      Darts::BUILD_TAIL);
+  test_dic(dic, keys, lengths, values, invalid_keys);
+
+  std::cerr << "commonPrefixSearch() with BUILD_TAIL: ";
+  test_common_prefix_search(dic, keys, lengths, values, invalid_keys);
+
+  std::cerr << "open() with BUILD_TAIL: ";
+  assert(dic.save(DIC_FILE_NAME) == 0);
+  assert(dic_copy.open(DIC_FILE_NAME) == 0);
+  assert(dic_copy.size() == dic.size());
+  test_dic(dic_copy, keys, lengths, values, invalid_keys);
+
+  std::cerr << "openMapped() with BUILD_TAIL: ";
+  assert(dic_copy.openMapped(DIC_FILE_NAME) == 0);
+  test_dic(dic_copy, keys, lengths, values, invalid_keys);
+
+  std::cerr << "other searches with BUILD_TAIL: ";
+  test_tail_searches(dic_copy, keys);
+
+  std::cerr << "build() with BUILD_LINKS: ";
+  dic.build(keys.size(), &keys[0], &lengths[0], &values[0], NULL,
+      Darts::BUILD_LINKS);
+  test_dic(dic, keys, lengths, values, invalid_keys);
+
+  std::cerr << "scan(): ";
+  test_scan(dic, keys);
+
+  std::cerr << "scan() after open(): ";
+  assert(dic.save(DIC_FILE_NAME) == 0);
+  for (int mapped = 0; mapped < 2; ++mapped) {
+    if (mapped == 0) {
+      assert(dic_copy.open(DIC_FILE_NAME) == 0);
+    } else {
+      assert(dic_copy.openMapped(DIC_FILE_NAME) == 0);
+    }
+    std::vector<std::size_t> occurrences;
+    try {
+      dic_copy.scan(keys[0], 0, OccurrenceCollector<T>(occurrences));
+      assert(false);
+    } catch (const std::exception &) {
+    }
+    assert(occurrences.empty());
+
+    // buildLinks() restores the links which are not saved.
+    assert(dic_copy.buildLinks() == 0);
+    for (std::size_t i = 0; i < keys.size(); i += 1 << 8) {
+      std::vector<std::size_t> expected_occurrences;
+      dic.scan(keys[i], 0, OccurrenceCollector<T>(expected_occurrences));
+      dic_copy.scan(keys[i], 0, OccurrenceCollector<T>(occurrences));
+      assert(!occurrences.empty());
+      assert(occurrences == expected_occurrences);
+      occurrences.clear();
+    }
+  }
+  test_scan(dic_copy, keys);
+
+  // The links of a DAWG are rejected because its units are shared.
+  const std::vector<typename T::value_type> zeros(keys.size(), 0);
+  dic_copy.build(keys.size(), &keys[0], &lengths[0], &zeros[0]);
+  try {
+    dic_copy.buildLinks();
+    assert(false);
+  } catch (const std::exception &) {
+  }
+}
+
+void test_dawg_size_limit(const std::set<std::string> &valid_keys) {
+  // A DAWG which reaches its maximum size throws an exception instead of
+  // overflowing the child IDs of its units.
+  Darts::Details::DawgBuilder dawg;
+  dawg.set_max_size(1 << 10);
+  dawg.init();
+  try {
+    int value = 0;
+    for (std::set<std::string>::const_iterator it = valid_keys.begin();
+        it != valid_keys.end(); ++it) {
+      dawg.insert(it->c_str(), it->length(), value++);
+    }
+    dawg.finish();
+    assert(false);
+  } catch (const std::exception &) {
+  }
+  assert(dawg.size() <= (1 << 10));
+
+  std::cerr << "ok" << std::endl;
 }
 
 int main() {
+#if defined(DARTS_USE_AVX2) && defined(__AVX2__) && defined(__GNUC__)
+  // 77 tells the test harness that the test is skipped.
+  if (!__builtin_cpu_supports("avx2")) {
+    std::cerr << "skipped: AVX2 is not available" << std::endl;
+    return 77;
+  }
+#endif  // defined(DARTS_USE_AVX2) && defined(__AVX2__) && defined(__GNUC__)
+
   try {
     std::srand(static_cast<unsigned int>(std::time(NULL)));
 
@@ -244,12 +1606,39 @@ int main() {
     generate_invalid_keys(NUM_INVALID_KEYS, valid_keys, &invalid_keys);
 
     test_darts<Darts::DoubleArray>(valid_keys, invalid_keys);
+
+    std::cerr << "Lattice: ";
+    test_lattice<Darts::DoubleArray>();
+
+    std::cerr << "PayloadDoubleArray: ";
+    test_payloads<Darts::DoubleArray>(valid_keys, invalid_keys);
+
+    std::cerr << "RecordDoubleArray: ";
+    test_records<Darts::DoubleArray>(valid_keys, invalid_keys);
+
+    std::cerr << "CompressedDoubleArray: ";
+    test_compressed<Darts::DoubleArray>(valid_keys, invalid_keys);
+
+    std::cerr << "Bundle: ";
+    test_bundle<Darts::DoubleArray>(valid_keys, invalid_keys);
+
+    std::cerr << "DAWG size limit: ";
+    test_dawg_size_limit(valid_keys);
+
     test_darts<Darts::DoubleArrayImpl<char, unsigned char, long,
         unsigned long> >(valid_keys, invalid_keys);
+
+    if (Darts::LargeDoubleArray().unit_size() != 8) {
+      std::cerr << "error: LargeDoubleArray::unit_size() != 8" << std::endl;
+      std::exit(1);
+    }
+    test_darts<Darts::LargeDoubleArray>(valid_keys, invalid_keys);
   } catch (const std::exception &ex) {
     std::cerr << "exception: " << ex.what() << std::endl;
+    std::remove(DIC_FILE_NAME);
     throw ex;
   }
+  std::remove(DIC_FILE_NAME);
 
   return 0;
 }
@@ -35,3 +35,74 @@ then
 fi
 
 echo "Done! $darts_path"
+
+"$mkdarts_path" -b test-bundle test=test-dic
+if [ $? -ne 0 ]
+then
+  echo "Error: $mkdarts_path -b failed"
+  exit 1
+fi
+
+"$darts_path" -b test test-bundle < test-text > test-result
+if [ $? -ne 0 ]
+then
+  echo "Error: $darts_path -b failed"
+  exit 1
+fi
+
+cat correct-result | cmp test-result
+if [ $? -ne 0 ]
+then
+  echo "Error: incorrect result with a bundle"
+  exit 1
+fi
+
+echo "Done! $mkdarts_path -b"
+
+# The keys are split into chunks only if there are 16384 keys or more.
+awk 'BEGIN { for (i = 0; i < 40000; ++i) printf("key%d\n", i * 7919) }' \
+  | LC_ALL=C sort -u > test-large-lexicon
+"$mkdarts_path" -j 4 test-large-lexicon test-large-dic
+if [ $? -ne 0 ]
+then
+  echo "Error: $mkdarts_path -j failed"
+  exit 1
+fi
+
+# Every key must be found as the longest match of itself.
+num_keys=`wc -l < test-large-lexicon`
+"$darts_path" test-large-dic < test-large-lexicon \
+  | awk -v num_keys=$num_keys '{ split($NF, pair, ":") }
+      $2 == "found," && pair[2] == length($1) - 1 { ++num_found }
+      END { exit num_found != num_keys }'
+if [ $? -ne 0 ]
+then
+  echo "Error: incorrect dictionary with threads"
+  exit 1
+fi
+rm -f test-large-lexicon test-large-dic
+
+echo "Done! $mkdarts_path -j"
+
+"$mkdarts_path" -m 1 test-lexicon test-dic
+if [ $? -ne 0 ]
+then
+  echo "Error: $mkdarts_path -m failed"
+  exit 1
+fi
+
+"$darts_path" test-dic < test-text > test-result
+if [ $? -ne 0 ]
+then
+  echo "Error: $darts_path failed"
+  exit 1
+fi
+
+cat correct-result | cmp test-result
+if [ $? -ne 0 ]
+then
+  echo "Error: incorrect result out of core"
+  exit 1
+fi
+
+echo "Done! $mkdarts_path -m"
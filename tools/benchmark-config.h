@@ -11,8 +11,9 @@ class BenchmarkConfig {
  public:
   BenchmarkConfig() : command_(NULL), has_values_(false),
       benchmarks_exact_match_search_(false),
+      benchmarks_exact_match_search_batch_(false),
       benchmarks_common_prefix_search_(false), benchmarks_traverse_(false),
-      lexicon_file_name_(NULL), dic_file_name_(NULL) {}
+      relocates_(false), lexicon_file_name_(NULL), dic_file_name_(NULL) {}
 
   void parse(int argc, char **argv);
 
@@ -23,12 +24,18 @@ class BenchmarkConfig {
   bool benchmarks_exact_match_search() const {
     return benchmarks_exact_match_search_;
   }
+  bool benchmarks_exact_match_search_batch() const {
+    return benchmarks_exact_match_search_batch_;
+  }
   bool benchmarks_common_prefix_search() const {
     return benchmarks_common_prefix_search_;
   }
   bool benchmarks_traverse() const {
     return benchmarks_traverse_;
   }
+  bool relocates() const {
+    return relocates_;
+  }
 
   const char *lexicon_file_name() const {
     return lexicon_file_name_;
@@ -43,16 +50,21 @@ class BenchmarkConfig {
         "  -h  display this help\n"
         "  -t  use tab separated values\n"
         "  -E  benchmark exactMatchSearch()\n"
+        "  -B  benchmark exactMatchSearchBatch()\n"
         "  -C  benchmark commonPrefixSearch()\n"
-        "  -T  benchmark traverse()\n" << std::endl;
+        "  -T  benchmark traverse()\n"
+        "  -R  relocate() with the lexicon as queries and benchmark again\n"
+        << std::endl;
   }
 
  private:
   const char *command_;
   bool has_values_;
   bool benchmarks_exact_match_search_;
+  bool benchmarks_exact_match_search_batch_;
   bool benchmarks_common_prefix_search_;
   bool benchmarks_traverse_;
+  bool relocates_;
   const char *lexicon_file_name_;
   const char *dic_file_name_;
 
@@ -81,10 +93,14 @@ inline void BenchmarkConfig::parse(int argc, char **argv) {
       has_values_ = true;
     } else if (std::strcmp(argv[i], "-E") == 0) {
       benchmarks_exact_match_search_ = true;
+    } else if (std::strcmp(argv[i], "-B") == 0) {
+      benchmarks_exact_match_search_batch_ = true;
     } else if (std::strcmp(argv[i], "-C") == 0) {
       benchmarks_common_prefix_search_ = true;
     } else if (std::strcmp(argv[i], "-T") == 0) {
       benchmarks_traverse_ = true;
+    } else if (std::strcmp(argv[i], "-R") == 0) {
+      relocates_ = true;
     } else {
       std::cerr << "error: invalid option: " << argv[i] << std::endl;
       show_usage();
@@ -100,8 +116,10 @@ inline void BenchmarkConfig::parse(int argc, char **argv) {
   }
 
   if (!benchmarks_exact_match_search_ &&
+      !benchmarks_exact_match_search_batch_ &&
       !benchmarks_common_prefix_search_ && !benchmarks_traverse_) {
     benchmarks_exact_match_search_ = true;
+    benchmarks_exact_match_search_batch_ = true;
     benchmarks_common_prefix_search_ = true;
     benchmarks_traverse_ = true;
   }
@@ -1,11 +1,14 @@
 #include <darts.h>
 
+#include <algorithm>
 #include <cstdio>
 #include <fstream>
 #include <iostream>
+#include <vector>
 
 #include "./benchmark-config.h"
 #include "./lexicon.h"
+#include "./mersenne-twister.h"
 #include "./timer.h"
 
 namespace {
@@ -58,6 +61,31 @@ void benchmark_exact_match_search(const Darts::DoubleArray &dic,
   std::fflush(stdout);
 }
 
+void benchmark_exact_match_search_batch(const Darts::DoubleArray &dic,
+    const Darts::Lexicon &lexicon) {
+  std::vector<Darts::DoubleArray::value_type> values(lexicon.size());
+
+  Darts::Timer timer;
+
+  std::size_t num_tries = 0;
+  do {
+    dic.exactMatchSearchBatch(lexicon.keys(), NULL, lexicon.size(),
+        &values[0]);
+    for (std::size_t i = 0; i < lexicon.size(); ++i) {
+      if (values[i] == -1) {
+        std::cerr << "error: failed to find key: "
+            << lexicon[i] << std::endl;
+        std::exit(1);
+      }
+    }
+    ++num_tries;
+  } while (timer.elapsed() < 1.0);
+
+  std::printf(" %8.1fns", 1e+9 * timer.elapsed()
+      / (lexicon.size() * num_tries));
+  std::fflush(stdout);
+}
+
 void benchmark_common_prefix_search(const Darts::DoubleArray &dic,
     const Darts::Lexicon &lexicon) {
   Darts::Timer timer;
@@ -117,6 +145,104 @@ void benchmark_traverse(const Darts::DoubleArray &dic,
   std::fflush(stdout);
 }
 
+// make_skewed_queries() draws keys from `lexicon' so that the i-th key is
+// drawn with a probability proportional to 1 / (i + 1).
+void make_skewed_queries(const Darts::Lexicon &lexicon,
+    std::size_t num_queries, std::vector<const char *> *queries) {
+  std::vector<double> weights(lexicon.size());
+  double total = 0.0;
+  for (std::size_t i = 0; i < lexicon.size(); ++i) {
+    total += 1.0 / (i + 1);
+    weights[i] = total;
+  }
+
+  Darts::MersenneTwister mt;
+  queries->resize(num_queries);
+  for (std::size_t i = 0; i < num_queries; ++i) {
+    const double x = total * mt(1U << 30) / (1U << 30);
+    std::size_t id = std::upper_bound(weights.begin(), weights.end(), x) -
+        weights.begin();
+    (*queries)[i] = lexicon[(id < lexicon.size()) ? id : (id - 1)];
+  }
+}
+
+double benchmark_skewed_queries(const Darts::DoubleArray &dic,
+    const std::vector<const char *> &queries) {
+  Darts::Timer timer;
+
+  std::size_t num_tries = 0;
+  do {
+    for (std::size_t i = 0; i < queries.size(); ++i) {
+      if (dic.exactMatchSearch<Darts::DoubleArray::value_type>(
+          queries[i]) == -1) {
+        std::cerr << "error: failed to find key: "
+            << queries[i] << std::endl;
+        std::exit(1);
+      }
+    }
+    ++num_tries;
+  } while (timer.elapsed() < 1.0);
+
+  return 1e+9 * timer.elapsed() / (queries.size() * num_tries);
+}
+
+// count_cache_lines() returns the average number of distinct 64-byte lines
+// of units visited by exactMatchSearch(), which is the number of cache misses
+// per lookup if the cache is cold.
+double count_cache_lines(const Darts::DoubleArray &dic,
+    const std::vector<const char *> &queries) {
+  std::size_t num_lines = 0;
+  std::vector<std::size_t> lines;
+  for (std::size_t i = 0; i < queries.size(); ++i) {
+    const char *key = queries[i];
+
+    std::size_t id = 0;
+    lines.assign(1, 0);
+    for (std::size_t j = 0; key[j] != '\0'; ++j) {
+      std::size_t key_pos = j;
+      dic.traverse(key, id, key_pos, j + 1);
+      lines.push_back(id * dic.unit_size() / 64);
+    }
+    std::sort(lines.begin(), lines.end());
+    num_lines += std::unique(lines.begin(), lines.end()) - lines.begin();
+  }
+  return 1.0 * num_lines / queries.size();
+}
+
+// benchmark_relocate() relocates `dic' with skewed queries and compares the
+// search time and the cache lines per lookup before and after relocate().
+void benchmark_relocate(const Darts::Lexicon &randomized_lexicon,
+    Darts::DoubleArray *dic) {
+  std::vector<const char *> queries;
+  make_skewed_queries(randomized_lexicon, randomized_lexicon.size(),
+      &queries);
+
+  const double time_before = benchmark_skewed_queries(*dic, queries);
+  const double lines_before = count_cache_lines(*dic, queries);
+
+  Darts::Timer timer;
+  dic->relocate(queries.size(), &queries[0]);
+  std::printf("relocate() with %u skewed queries: %.0fns per query\n",
+      static_cast<unsigned int>(queries.size()),
+      1e+9 * timer.elapsed() / queries.size());
+
+  std::printf(" %21s %9s %9s\n", "", "before", "after");
+  std::printf(" %21s %7.1fns %7.1fns\n", "exactMatchSearch",
+      time_before, benchmark_skewed_queries(*dic, queries));
+  std::printf(" %21s %9.2f %9.2f\n", "cache lines / lookup",
+      lines_before, count_cache_lines(*dic, queries));
+}
+
+// print_separator() prints a separator line whose segments match the columns
+// of the table.
+void print_separator(const Darts::BenchmarkConfig &config) {
+  std::printf("+--------+--------+-----------------+");
+  if (config.benchmarks_exact_match_search_batch()) {
+    std::printf("---------------------+");
+  }
+  std::printf("-------------------+-----------------+\n");
+}
+
 void benchmark_lexicon(const Darts::BenchmarkConfig &config,
     const Darts::Lexicon &lexicon, Darts::DoubleArray *dic) {
   Darts::Timer timer;
@@ -127,13 +253,15 @@ void benchmark_lexicon(const Darts::BenchmarkConfig &config,
     std::exit(1);
   }
 
-  std::printf("+--------+--------+-----------------+-------------------+"
-      "-----------------+\n");
+  print_separator(config);
 
   std::printf(" %8s %8s", "size", "build");
   if (config.benchmarks_exact_match_search()) {
     std::printf(" %17s", "exactMatchSearch");
   }
+  if (config.benchmarks_exact_match_search_batch()) {
+    std::printf(" %21s", "exactMatchSearchBatch");
+  }
   if (config.benchmarks_common_prefix_search()) {
     std::printf(" %19s", "commonPrefixSearch");
   }
@@ -146,6 +274,9 @@ void benchmark_lexicon(const Darts::BenchmarkConfig &config,
   if (config.benchmarks_exact_match_search()) {
     std::printf(" %8s %8s", "sorted", "random");
   }
+  if (config.benchmarks_exact_match_search_batch()) {
+    std::printf(" %10s %10s", "sorted", "random");
+  }
   if (config.benchmarks_common_prefix_search()) {
     std::printf(" %9s %9s", "sorted", "random");
   }
@@ -154,8 +285,7 @@ void benchmark_lexicon(const Darts::BenchmarkConfig &config,
   }
   std::printf("\n");
 
-  std::printf("+--------+--------+-----------------+-------------------+"
-      "-----------------+\n");
+  print_separator(config);
 
   Darts::Lexicon randomized_lexicon(lexicon);
   randomized_lexicon.randomize();
@@ -167,6 +297,11 @@ void benchmark_lexicon(const Darts::BenchmarkConfig &config,
   benchmark_exact_match_search(*dic, lexicon);
   benchmark_exact_match_search(*dic, randomized_lexicon);
 
+  if (config.benchmarks_exact_match_search_batch()) {
+    benchmark_exact_match_search_batch(*dic, lexicon);
+    benchmark_exact_match_search_batch(*dic, randomized_lexicon);
+  }
+
   benchmark_common_prefix_search(*dic, lexicon);
   benchmark_common_prefix_search(*dic, randomized_lexicon);
 
@@ -174,8 +309,11 @@ void benchmark_lexicon(const Darts::BenchmarkConfig &config,
   benchmark_traverse(*dic, randomized_lexicon);
 
   std::printf("\n");
-  std::printf("+--------+--------+-----------------+-------------------+"
-      "-----------------+\n");
+  print_separator(config);
+
+  if (config.relocates()) {
+    benchmark_relocate(randomized_lexicon, dic);
+  }
 }
 
 }  // namespace
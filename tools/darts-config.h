@@ -9,7 +9,7 @@ namespace Darts {
 
 class DartsConfig {
  public:
-  DartsConfig() : command_(NULL), has_values_(false),
+  DartsConfig() : command_(NULL), has_values_(false), dic_name_(NULL),
       dic_file_name_(NULL), lexicon_file_name_(NULL) {}
 
   void parse(int argc, char **argv);
@@ -17,6 +17,11 @@ class DartsConfig {
   bool has_values() const {
     return has_values_;
   }
+  // dic_name() returns the name given by -b, or NULL if the dictionary file
+  // is not a bundle.
+  const char *dic_name() const {
+    return dic_name_;
+  }
   const char *dic_file_name() const {
     return dic_file_name_;
   }
@@ -27,6 +32,7 @@ class DartsConfig {
   void show_usage() const {
     std::cerr << "\nUsage: " << command_
         << " [Options...] [Dictionary] [Lexicon]\n\n"
+        "  -b  search the dictionary of a given name in a bundle\n"
         "  -h  display this help\n"
         "  -t  drop tab separated values\n" << std::endl;
   }
@@ -34,6 +40,7 @@ class DartsConfig {
  private:
   const char *command_;
   bool has_values_;
+  const char *dic_name_;
   const char *dic_file_name_;
   const char *lexicon_file_name_;
 
@@ -55,6 +62,13 @@ inline void DartsConfig::parse(int argc, char **argv) {
         show_usage();
         std::exit(1);
       }
+    } else if (std::strcmp(argv[i], "-b") == 0) {
+      if (++i == argc) {
+        std::cerr << "error: -b requires a name" << std::endl;
+        show_usage();
+        std::exit(1);
+      }
+      dic_name_ = argv[i];
     } else if (std::strcmp(argv[i], "-h") == 0) {
       show_usage();
       std::exit(0);
@@ -70,6 +84,11 @@ inline void DartsConfig::parse(int argc, char **argv) {
   if (dic_file_name_ == NULL) {
     dic_file_name_ = "-";
   }
+  if (dic_name_ != NULL && std::strcmp(dic_file_name_, "-") == 0) {
+    std::cerr << "error: -b requires a bundle file" << std::endl;
+    show_usage();
+    std::exit(1);
+  }
   if (lexicon_file_name_ == NULL) {
     lexicon_file_name_ = "-";
   }
@@ -1,4 +1,5 @@
 #include <darts.h>
+#include <darts-bundle.h>
 
 #include <cstring>
 #include <fstream>
@@ -45,8 +46,20 @@ int main(int argc, char **argv) {
     Darts::DartsConfig config;
     config.parse(argc, argv);
 
+    Darts::Bundle bundle;
     Darts::DoubleArray dic;
-    if (dic.open(config.dic_file_name()) != 0) {
+    if (config.dic_name() != NULL) {
+      if (bundle.open(config.dic_file_name()) != 0) {
+        std::cerr << "error: failed to open bundle file: "
+            << config.dic_file_name() << std::endl;
+        std::exit(1);
+      }
+      if (bundle.attach(config.dic_name(), &dic) != 0) {
+        std::cerr << "error: failed to find dictionary: "
+            << config.dic_name() << std::endl;
+        std::exit(1);
+      }
+    } else if (dic.openMapped(config.dic_file_name()) != 0) {
       std::cerr << "error: failed to open dictionary file: "
           << config.dic_file_name() << std::endl;
       std::exit(1);
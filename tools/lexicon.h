@@ -5,8 +5,10 @@
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
+#include <fstream>
 #include <iostream>
 #include <limits>
+#include <string>
 #include <vector>
 
 #include "./mersenne-twister.h"
@@ -64,6 +66,9 @@ class Lexicon {
   }
 
   void split();
+  // parse_value() parses the value of a tab separated line, or exits with an
+  // error message.
+  static int parse_value(const char *str);
 
   void clear();
 
@@ -139,28 +144,32 @@ inline void Lexicon::split() {
 
     total_ -= ptr - tab;
     *tab++ = '\0';
-    if (*tab == '\0') {
-      std::cerr << "error: failed to split keys: no value" << std::endl;
-      std::exit(1);
-    }
+    values_[i] = parse_value(tab);
+  }
+}
 
-    char *value_end;
-    long value = std::strtol(tab, &value_end, 10);
-    if (*value_end != '\0') {
-      std::cerr << "error: failed to split keys: invalid characters: \""
-          << tab << "\" (" << value << ')' << std::endl;
-      std::exit(1);
-    } else if (value < 0) {
-      std::cerr << "error: failed to split keys: negative value: \""
-          << tab << "\" (" << value << ')' << std::endl;
-      std::exit(1);
-    } else if (value > std::numeric_limits<int>::max()) {
-      std::cerr << "error: failed to split keys: too large value: \""
-          << tab << "\" (" << value << ')' << std::endl;
-      std::exit(1);
-    }
-    values_[i] = static_cast<int>(value);
+inline int Lexicon::parse_value(const char *str) {
+  if (*str == '\0') {
+    std::cerr << "error: failed to split keys: no value" << std::endl;
+    std::exit(1);
+  }
+
+  char *value_end;
+  long value = std::strtol(str, &value_end, 10);
+  if (*value_end != '\0') {
+    std::cerr << "error: failed to split keys: invalid characters: \""
+        << str << "\" (" << value << ')' << std::endl;
+    std::exit(1);
+  } else if (value < 0) {
+    std::cerr << "error: failed to split keys: negative value: \""
+        << str << "\" (" << value << ')' << std::endl;
+    std::exit(1);
+  } else if (value > std::numeric_limits<int>::max()) {
+    std::cerr << "error: failed to split keys: too large value: \""
+        << str << "\" (" << value << ')' << std::endl;
+    std::exit(1);
   }
+  return static_cast<int>(value);
 }
 
 inline void Lexicon::clear() {
@@ -176,6 +185,64 @@ inline void Lexicon::clear() {
   total_ = 0;
 }
 
+// <LexiconReader> reads a lexicon file line by line for buildFile() of
+// <DoubleArrayImpl>, so that the lexicon need not fit in memory. Empty lines
+// are skipped, and keys and values are split as well as split() of <Lexicon>.
+// Without values, each key has its index in the lexicon as its value.
+class LexiconReader {
+ public:
+  LexiconReader(const char *file_name, bool has_values)
+      : file_(file_name, std::ios::binary), line_(),
+        has_values_(has_values), num_keys_(0) {}
+
+  bool is_open() const {
+    return file_.is_open();
+  }
+
+  bool read(const char **key, std::size_t *length, int *value);
+  void rewind() {
+    file_.clear();
+    file_.seekg(0, std::ios::beg);
+    num_keys_ = 0;
+  }
+
+ private:
+  std::ifstream file_;
+  std::string line_;
+  bool has_values_;
+  int num_keys_;
+
+  // Disallows copy and assignment.
+  LexiconReader(const LexiconReader &);
+  LexiconReader &operator=(const LexiconReader &);
+};
+
+inline bool LexiconReader::read(const char **key, std::size_t *length,
+    int *value) {
+  do {
+    if (!std::getline(file_, line_)) {
+      return false;
+    }
+    if (!line_.empty() && line_[line_.length() - 1] == '\r') {
+      line_.erase(line_.length() - 1);
+    }
+  } while (line_.empty());
+
+  *key = line_.c_str();
+  *length = line_.length();
+  *value = num_keys_++;
+  if (has_values_) {
+    const std::string::size_type tab = line_.find_last_of('\t');
+    if (tab != std::string::npos) {
+      *length = tab;
+      *value = Lexicon::parse_value(line_.c_str() + tab + 1);
+    } else {
+      *value = 0;
+    }
+  }
+  return true;
+}
+
 }  // namespace Darts
 
 #endif  // DARTS_LEXICON_H_
@@ -4,13 +4,17 @@
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <vector>
 
 namespace Darts {
 
 class MkdartsConfig {
  public:
   MkdartsConfig() : command_(NULL), is_sorted_(true), has_values_(false),
-      lexicon_file_name_(NULL), dic_file_name_(NULL) {}
+      has_header_(false), is_bundle_(false), num_threads_(1),
+      memory_limit_(0),
+      lexicon_file_name_(NULL),
+      dic_file_name_(NULL), bundle_file_name_(NULL), dic_specs_() {}
 
   void parse(int argc, char **argv);
 
@@ -20,17 +24,44 @@ class MkdartsConfig {
   bool has_values() const {
     return has_values_;
   }
+  bool has_header() const {
+    return has_header_;
+  }
+  bool is_bundle() const {
+    return is_bundle_;
+  }
+  std::size_t num_threads() const {
+    return num_threads_;
+  }
+  // memory_limit() returns the memory limit in bytes for building a
+  // dictionary out of core, or 0 if the lexicon is read into memory.
+  std::size_t memory_limit() const {
+    return memory_limit_;
+  }
   const char *lexicon_file_name() const {
     return lexicon_file_name_;
   }
   const char *dic_file_name() const {
     return dic_file_name_;
   }
+  // In the bundle mode, each dictionary is given as "Name=File" or "File". In
+  // the latter case, the name is the file name without directories.
+  const char *bundle_file_name() const {
+    return bundle_file_name_;
+  }
+  const std::vector<const char *> &dic_specs() const {
+    return dic_specs_;
+  }
 
   void show_usage() const {
     std::cerr << "\nUsage: " << command_
-        << " [Options...] [Lexicon] [Dictionary]\n\n"
+        << " [Options...] [Lexicon] [Dictionary]\n"
+        "       " << command_ << " -b Bundle [Name=]Dictionary...\n\n"
+        "  -b  pack dictionaries into a bundle\n"
         "  -h  display this help\n"
+        "  -H  write a header with a checksum\n"
+        "  -j  build with a given number of threads\n"
+        "  -m  build out of core within a given number of megabytes\n"
         "  -s  sort lexicon before insertion\n"
         "  -t  use tab separated values\n" << std::endl;
   }
@@ -39,8 +70,14 @@ class MkdartsConfig {
   const char *command_;
   bool is_sorted_;
   bool has_values_;
+  bool has_header_;
+  bool is_bundle_;
+  std::size_t num_threads_;
+  std::size_t memory_limit_;
   const char *lexicon_file_name_;
   const char *dic_file_name_;
+  const char *bundle_file_name_;
+  std::vector<const char *> dic_specs_;
 
   // Disallows copy and assignment.
   MkdartsConfig(const MkdartsConfig &);
@@ -49,20 +86,37 @@ class MkdartsConfig {
 
 inline void MkdartsConfig::parse(int argc, char **argv) {
   command_ = argv[0];
+  std::vector<const char *> args;
   for (int i = 1; i < argc; ++i) {
     if (argv[i][0] != '-') {
-      if (lexicon_file_name_ == NULL) {
-        lexicon_file_name_ = argv[i];
-      } else if (dic_file_name_ == NULL) {
-        dic_file_name_ = argv[i];
-      } else {
-        std::cerr << "error: too many arguments" << std::endl;
-        show_usage();
-        std::exit(1);
-      }
+      args.push_back(argv[i]);
+    } else if (std::strcmp(argv[i], "-b") == 0) {
+      is_bundle_ = true;
     } else if (std::strcmp(argv[i], "-h") == 0) {
       show_usage();
       std::exit(0);
+    } else if (std::strcmp(argv[i], "-H") == 0) {
+      has_header_ = true;
+    } else if (std::strcmp(argv[i], "-j") == 0) {
+      char *end = NULL;
+      if (++i < argc) {
+        num_threads_ = std::strtoul(argv[i], &end, 10);
+      }
+      if (end == NULL || *end != '\0' || num_threads_ == 0) {
+        std::cerr << "error: -j requires a positive number" << std::endl;
+        show_usage();
+        std::exit(1);
+      }
+    } else if (std::strcmp(argv[i], "-m") == 0) {
+      char *end = NULL;
+      if (++i < argc) {
+        memory_limit_ = std::strtoul(argv[i], &end, 10) << 20;
+      }
+      if (end == NULL || *end != '\0' || memory_limit_ == 0) {
+        std::cerr << "error: -m requires a positive number" << std::endl;
+        show_usage();
+        std::exit(1);
+      }
     } else if (std::strcmp(argv[i], "-s") == 0) {
       is_sorted_ = false;
     } else if (std::strcmp(argv[i], "-t") == 0) {
@@ -74,11 +128,41 @@ inline void MkdartsConfig::parse(int argc, char **argv) {
     }
   }
 
-  if (lexicon_file_name_ == NULL) {
-    lexicon_file_name_ = "-";
+  if (is_bundle_) {
+    if (args.size() < 2) {
+      std::cerr << "error: -b requires a bundle and dictionaries" << std::endl;
+      show_usage();
+      std::exit(1);
+    }
+    bundle_file_name_ = args[0];
+    dic_specs_.assign(args.begin() + 1, args.end());
+    return;
+  }
+
+  if (args.size() > 2) {
+    std::cerr << "error: too many arguments" << std::endl;
+    show_usage();
+    std::exit(1);
+  }
+  lexicon_file_name_ = (args.size() > 0) ? args[0] : "-";
+  dic_file_name_ = (args.size() > 1) ? args[1] : "-";
+  if (has_header_ && std::strcmp(dic_file_name_, "-") == 0) {
+    std::cerr << "error: -H requires a dictionary file" << std::endl;
+    show_usage();
+    std::exit(1);
   }
-  if (dic_file_name_ == NULL) {
-    dic_file_name_ = "-";
+  if (memory_limit_ != 0) {
+    if (std::strcmp(lexicon_file_name_, "-") == 0 ||
+        std::strcmp(dic_file_name_, "-") == 0) {
+      std::cerr << "error: -m requires a lexicon file and a dictionary file"
+          << std::endl;
+      show_usage();
+      std::exit(1);
+    } else if (!is_sorted_) {
+      std::cerr << "error: -m cannot sort lexicon" << std::endl;
+      show_usage();
+      std::exit(1);
+    }
   }
 }
 
@@ -1,9 +1,12 @@
 #include <darts.h>
+#include <darts-bundle.h>
 
 #include <cstdio>
 #include <cstring>
 #include <fstream>
 #include <iostream>
+#include <string>
+#include <vector>
 
 #include "./lexicon.h"
 #include "./mkdarts-config.h"
@@ -35,6 +38,70 @@ int progress_bar(std::size_t current, std::size_t total) {
   return 1;
 }
 
+// make_bundle() packs the dictionaries given by "Name=File" or "File" into a
+// bundle.
+void make_bundle(const Darts::MkdartsConfig &config) {
+  const std::vector<const char *> &specs = config.dic_specs();
+  std::vector<std::string> names(specs.size());
+  std::vector<Darts::DoubleArray *> dics(specs.size(), NULL);
+  Darts::BundleWriter writer;
+  for (std::size_t i = 0; i < specs.size(); ++i) {
+    std::string spec(specs[i]);
+    std::string file_name = spec;
+    std::string::size_type pos = spec.find('=');
+    if (pos != std::string::npos) {
+      names[i] = spec.substr(0, pos);
+      file_name = spec.substr(pos + 1);
+    } else {
+      pos = spec.find_last_of('/');
+      names[i] = (pos != std::string::npos) ? spec.substr(pos + 1) : spec;
+    }
+
+    dics[i] = new Darts::DoubleArray;
+    if (dics[i]->open(file_name.c_str()) != 0) {
+      std::cerr << "error: failed to open dictionary file: "
+          << file_name << std::endl;
+      std::exit(1);
+    }
+    writer.add(names[i].c_str(), *dics[i]);
+    std::cerr << names[i] << ": " << dics[i]->total_size() << std::endl;
+  }
+
+  if (writer.save(config.bundle_file_name()) != 0) {
+    std::cerr << "error: failed to write bundle file: "
+        << config.bundle_file_name() << std::endl;
+    std::exit(1);
+  }
+  std::cerr << "dictionaries: " << writer.size() << std::endl;
+
+  for (std::size_t i = 0; i < dics.size(); ++i) {
+    delete dics[i];
+  }
+}
+
+// make_file() builds a dictionary file from a lexicon file which is read
+// twice instead of being kept in memory.
+void make_file(const Darts::MkdartsConfig &config) {
+  Darts::LexiconReader reader(config.lexicon_file_name(), config.has_values());
+  if (!reader.is_open()) {
+    std::cerr << "error: failed to open lexicon file: "
+        << config.lexicon_file_name() << std::endl;
+    std::exit(1);
+  }
+
+  Darts::DoubleArray dic;
+  if (dic.buildFile(&reader, config.dic_file_name(), config.memory_limit(),
+      progress_bar, config.has_header() ? Darts::SAVE_HEADER : 0) != 0 ||
+      dic.openMapped(config.dic_file_name()) != 0) {
+    std::cerr << "error: failed to write dictionary file: "
+        << config.dic_file_name() << std::endl;
+    std::exit(1);
+  }
+
+  std::cerr << "size: " << dic.size() << std::endl;
+  std::cerr << "total_size: " << dic.total_size() << std::endl;
+}
+
 }  // namespace
 
 int main(int argc, char **argv) {
@@ -42,6 +109,16 @@ int main(int argc, char **argv) {
     Darts::MkdartsConfig config;
     config.parse(argc, argv);
 
+    if (config.is_bundle()) {
+      make_bundle(config);
+      return 0;
+    }
+
+    if (config.memory_limit() != 0) {
+      make_file(config);
+      return 0;
+    }
+
     Darts::Lexicon lexicon;
     if (std::strcmp(config.lexicon_file_name(), "-") != 0) {
       std::ifstream file(config.lexicon_file_name());
@@ -69,6 +146,7 @@ int main(int argc, char **argv) {
     std::cerr << "total: " << lexicon.total() << std::endl;
 
     Darts::DoubleArray dic;
+    dic.set_num_threads(config.num_threads());
     if (dic.build(lexicon.size(), lexicon.keys(), NULL,
         lexicon.values(), progress_bar) != 0) {
       std::cerr << "error: failed to build dictionary" << std::endl;
@@ -83,7 +161,8 @@ int main(int argc, char **argv) {
         std::exit(1);
       }
       file.close();
-      dic.save(config.dic_file_name());
+      dic.save(config.dic_file_name(), "wb", 0,
+          config.has_header() ? Darts::SAVE_HEADER : 0);
     } else {
       std::cout.write(static_cast<const char *>(dic.array()),
           dic.total_size());